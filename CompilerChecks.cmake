@@ -86,3 +86,25 @@ endif()
 
 set(DEFAULT_CXX_COMPILE_FLAGS ${SUPPORTED_CXX_COMPILER_FLAGS} CACHE INTERNAL "Default CXX Compiler Flags" FORCE)
 set(DEFAULT_LINK_FLAGS ${SUPPORTED_LINKER_FLAGS} CACHE INTERNAL "Default Linker Flags" FORCE)
+
+if (OPTION_TARGET_CLONES)
+    # function multiversioning needs compiler support and ifunc support of the target (ELF)
+    include(CheckCXXSourceCompiles)
+    check_cxx_source_compiles("
+        __attribute__((target_clones(\"arch=x86-64-v4\", \"arch=x86-64-v3\", \"default\")))
+        int multiversioned(int x) { return x + 1; }
+        int main(int argc, char **) { return multiversioned(argc) == 2 ? 0 : 1; }"
+        HAVE_TARGET_CLONES)
+endif()
+
+if (OPTION_NEON)
+    # the vectorized code paths are written against the SSE2 vector layer, helperneon.h implements it with NEON
+    include(CheckCXXSourceCompiles)
+    check_cxx_source_compiles("
+        #if !defined(__aarch64__) || !defined(__ARM_NEON)
+        #error no AArch64 NEON
+        #endif
+        #include <arm_neon.h>
+        int main(int argc, char **) { return static_cast<int>(vaddvq_f32(vdupq_n_f32(argc))) == 4 ? 0 : 1; }"
+        HAVE_NEON)
+endif()
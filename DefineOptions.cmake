@@ -2,3 +2,11 @@ option(OPTION_OMP "Build with OpenMP support" ON)
 option(VERBOSE "Build in verbose mode" OFF)
 option(PICKY_DEVELOPER "Build with picky developer flags" OFF)
 option(BUILD_SHARED_LIBS "Build shared libraries" ON)
+option(BUILD_BENCHMARK "Build the rtprocess_bench benchmark executable" OFF)
+option(OPTION_TARGET_CLONES "Build the hot routines for several x86-64 ISA levels and select the best one at runtime" ON)
+if (CMAKE_SYSTEM_PROCESSOR MATCHES "^(aarch64|arm64|ARM64)$")
+    set(NEON_DEFAULT ON)
+else()
+    set(NEON_DEFAULT OFF)
+endif()
+option(OPTION_NEON "Use NEON for the vectorized code paths on AArch64" ${NEON_DEFAULT})
@@ -0,0 +1,615 @@
+/*
+ * This file is part of librtprocess.
+ *
+ * librtprocess is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * librtprocess is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with librtprocess.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Benchmark for all public entry points of librtprocess.
+// Runs every routine on synthetic Bayer and X-Trans mosaics for a set of image sizes, thread counts and chunk sizes
+// and writes the results as JSON (median and 95th percentile runtime, megapixels per second, peak resident memory).
+//
+// usage: rtprocess_bench [--sizes 12,24,45,100] [--threads 1,2,4,...] [--chunks 1,2,4] [--repeat 5]
+//                        [--only name,name,...] [--output file.json] [--list]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "librtprocess.h"
+
+namespace
+{
+
+const unsigned bayer[2][2] = {{0, 1}, {1, 2}};
+const unsigned bayer4[2][2] = {{0, 1}, {3, 2}};
+const unsigned xtrans[6][6] = {
+    {1, 1, 0, 1, 1, 2},
+    {1, 1, 2, 1, 1, 0},
+    {2, 0, 1, 0, 2, 1},
+    {1, 1, 2, 1, 1, 0},
+    {1, 1, 0, 1, 1, 2},
+    {0, 2, 1, 2, 0, 1}
+};
+const float rgb_cam[3][4] = {
+    {1.6f, -0.4f, -0.2f, 0.f},
+    {-0.2f, 1.5f, -0.3f, 0.f},
+    {0.05f, -0.5f, 1.45f, 0.f}
+};
+const float clipLevel = 60000.f;
+
+template<typename T>
+class PlaneOf
+{
+public:
+    PlaneOf(int w, int h) : data(static_cast<std::size_t>(w) * h), rows(h)
+    {
+        for (int i = 0; i < h; ++i) {
+            rows[i] = data.data() + static_cast<std::size_t>(i) * w;
+        }
+    }
+
+    T **ptr()
+    {
+        return rows.data();
+    }
+
+private:
+    std::vector<T> data;
+    std::vector<T*> rows;
+};
+
+using Plane = PlaneOf<float>;
+// raw data as delivered by the raw decoders
+using Plane16 = PlaneOf<uint16_t>;
+
+// deterministic pseudo random noise, independent of the thread which computes the pixel
+inline float noise(unsigned x, unsigned y)
+{
+    unsigned h = x * 374761393u + y * 668265263u;
+    h = (h ^ (h >> 13)) * 1274126177u;
+    return ((h ^ (h >> 16)) & 0xffff) / 65535.f;
+}
+
+// smooth gradients, hard edges and fine detail, so the edge directed algorithms take all their code paths
+inline float scene(int x, int y)
+{
+    const float smooth = 0.5f + 0.3f * std::sin(x * 0.013f) * std::cos(y * 0.017f);
+    const float edges = ((x / 97 + y / 61) & 1) ? 0.25f : 0.f;
+    const float detail = 0.1f * std::sin((x + y) * 0.9f);
+    return std::max(0.f, smooth + edges + detail + 0.05f * noise(x, y));
+}
+
+template<typename Pattern>
+void fillMosaic(Plane &raw, int w, int h, Pattern colour)
+{
+    float **rows = raw.ptr();
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for (int y = 0; y < h; ++y) {
+        for (int x = 0; x < w; ++x) {
+            const unsigned c = colour(x, y);
+            const float mul = c == 0 ? 0.55f : c == 2 ? 0.45f : 1.f;
+            rows[y][x] = std::min(65535.f, 45000.f * mul * scene(x, y));
+        }
+    }
+}
+
+// rgb image with partly clipped highlights for HLRecovery_inpaint
+void fillHighlights(Plane &r, Plane &g, Plane &b, int w, int h)
+{
+    float **red = r.ptr();
+    float **green = g.ptr();
+    float **blue = b.ptr();
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for (int y = 0; y < h; ++y) {
+        for (int x = 0; x < w; ++x) {
+            const float v = 55000.f * scene(x, y);
+            red[y][x] = std::min(clipLevel, v * 0.9f);
+            green[y][x] = std::min(clipLevel, v * 1.1f);
+            blue[y][x] = std::min(clipLevel, v * 0.7f);
+        }
+    }
+}
+
+// peak resident set size of the process in bytes
+std::size_t peakRss()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.PeakWorkingSetSize;
+    }
+    return 0;
+#elif defined(__linux__)
+    FILE *status = fopen("/proc/self/status", "r");
+    if (status) {
+        char line[256];
+        std::size_t kB = 0;
+        while (fgets(line, sizeof(line), status)) {
+            if (sscanf(line, "VmHWM: %zu kB", &kB) == 1) {
+                break;
+            }
+        }
+        fclose(status);
+        return kB * 1024;
+    }
+    return 0;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return static_cast<std::size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+// on Linux the peak can be reset to the current rss, which gives a peak per benchmark instead of per process
+void resetPeakRss()
+{
+#ifdef __linux__
+    FILE *clearRefs = fopen("/proc/self/clear_refs", "w");
+    if (clearRefs) {
+        fputs("5", clearRefs);
+        fclose(clearRefs);
+    }
+#endif
+}
+
+std::vector<double> parseList(const char *arg)
+{
+    std::vector<double> values;
+    const char *pos = arg;
+    while (*pos) {
+        char *end;
+        const double value = strtod(pos, &end);
+        if (end == pos) {
+            break;
+        }
+        values.push_back(value);
+        pos = *end == ',' ? end + 1 : end;
+    }
+    return values;
+}
+
+std::vector<std::string> parseNames(const char *arg)
+{
+    std::vector<std::string> names;
+    std::string current;
+    for (const char *pos = arg; ; ++pos) {
+        if (*pos == ',' || *pos == '\0') {
+            if (!current.empty()) {
+                names.push_back(current);
+            }
+            current.clear();
+            if (*pos == '\0') {
+                break;
+            }
+        } else {
+            current += *pos;
+        }
+    }
+    return names;
+}
+
+struct Images {
+    int width;
+    int height;
+    Plane bayerRaw;
+    Plane16 bayerRaw16;
+    Plane xtransRaw;
+    Plane red;
+    Plane green;
+    Plane blue;
+
+    Images(int w, int h) : width(w), height(h), bayerRaw(w, h), bayerRaw16(w, h), xtransRaw(w, h), red(w, h), green(w, h), blue(w, h)
+    {
+        fillMosaic(bayerRaw, w, h, [](int x, int y) { return bayer[y & 1][x & 1]; });
+        // the float mosaic rounded to integers, for the uint16_t entry points
+        float **raw = bayerRaw.ptr();
+        uint16_t **raw16 = bayerRaw16.ptr();
+        for (int y = 0; y < h; ++y) {
+            for (int x = 0; x < w; ++x) {
+                raw16[y][x] = raw[y][x] + 0.5f;
+                raw[y][x] = raw16[y][x];
+            }
+        }
+        fillMosaic(xtransRaw, w, h, [](int x, int y) { return xtrans[y % 6][x % 6]; });
+    }
+};
+
+struct Benchmark {
+    const char *name;
+    bool usesChunkSize;
+    // called before every timed run, not included in the timing
+    std::function<void(Images&)> prepare;
+    std::function<rpError(Images&, rpContext&, std::size_t)> run;
+};
+
+const std::function<bool(double)> noProgress = [](double) { return false; };
+
+// the strip benchmarks process the image in strips of this height
+constexpr int stripRows = 512;
+// the batch entries treat bands of burstRows rows as separate small frames
+constexpr int burstRows = 128;
+
+// the CA model of the bench mosaic for the entries which apply one, detected once per image size
+rpCAModel caModel;
+
+void detectCAModel(Images &im)
+{
+    if (caModel.width != im.width || caModel.height != im.height) {
+        rpContext context;
+        CA_detect(context, 0, 0, im.width, im.height, im.bayerRaw.ptr(), bayer, noProgress, caModel, 65535.f, 2, 4);
+    }
+}
+
+std::vector<Benchmark> benchmarks()
+{
+    const std::function<void(Images&)> none = [](Images&) {};
+    std::vector<Benchmark> list;
+
+    list.push_back({"bayerborder", false, none, [](Images &im, rpContext&, std::size_t) {
+        return bayerborder_demosaic(im.width, im.height, 4, im.bayerRaw.ptr(), im.red.ptr(), im.green.ptr(), im.blue.ptr(), bayer);
+    }});
+    list.push_back({"xtransborder", false, none, [](Images &im, rpContext&, std::size_t) {
+        xtransborder_demosaic(im.width, im.height, 6, im.xtransRaw.ptr(), im.red.ptr(), im.green.ptr(), im.blue.ptr(), xtrans);
+        return RP_NO_ERROR;
+    }});
+    list.push_back({"ahd", false, none, [](Images &im, rpContext&, std::size_t) {
+        return ahd_demosaic(im.width, im.height, im.bayerRaw.ptr(), im.red.ptr(), im.green.ptr(), im.blue.ptr(), bayer, rgb_cam, noProgress);
+    }});
+    list.push_back({"ahd_context", false, none, [](Images &im, rpContext &context, std::size_t) {
+        return ahd_demosaic(context, im.width, im.height, im.bayerRaw.ptr(), im.red.ptr(), im.green.ptr(), im.blue.ptr(), bayer, rgb_cam, noProgress);
+    }});
+    list.push_back({"amaze", true, none, [](Images &im, rpContext&, std::size_t chunkSize) {
+        return amaze_demosaic(im.width, im.height, 0, 0, im.width, im.height, im.bayerRaw.ptr(), im.red.ptr(), im.green.ptr(), im.blue.ptr(), bayer, noProgress, 1.0, 0, 65535.f, 65535.f, chunkSize);
+    }});
+    list.push_back({"amaze_context", true, none, [](Images &im, rpContext &context, std::size_t chunkSize) {
+        return amaze_demosaic(context, im.width, im.height, 0, 0, im.width, im.height, im.bayerRaw.ptr(), im.red.ptr(), im.green.ptr(), im.blue.ptr(), bayer, noProgress, 1.0, 0, 65535.f, 65535.f, chunkSize);
+    }});
+    list.push_back({"amaze_u16", true, none, [](Images &im, rpContext &context, std::size_t chunkSize) {
+        return amaze_demosaic(context, im.width, im.height, 0, 0, im.width, im.height, im.bayerRaw16.ptr(), im.red.ptr(), im.green.ptr(), im.blue.ptr(), bayer, noProgress, 1.0, 0, 65535.f, 65535.f, chunkSize);
+    }});
+    list.push_back({"amaze_strip", true, none, [](Images &im, rpContext &context, std::size_t chunkSize) {
+        rpError rc = RP_NO_ERROR;
+        for (int top = 0; top < im.height && !rc; top += stripRows) {
+            rc = amaze_demosaic_strip(context, im.width, im.height, top, stripRows, im.bayerRaw.ptr(), im.red.ptr(), im.green.ptr(), im.blue.ptr(), bayer, noProgress, 1.0, 0, 65535.f, 65535.f, chunkSize);
+        }
+        return rc;
+    }});
+    list.push_back({"bayerfast", false, none, [](Images &im, rpContext&, std::size_t) {
+        return bayerfast_demosaic(im.width, im.height, im.bayerRaw.ptr(), im.red.ptr(), im.green.ptr(), im.blue.ptr(), bayer, noProgress, 1.0);
+    }});
+    list.push_back({"bayerfast_context", false, none, [](Images &im, rpContext &context, std::size_t) {
+        return bayerfast_demosaic(context, im.width, im.height, im.bayerRaw.ptr(), im.red.ptr(), im.green.ptr(), im.blue.ptr(), bayer, noProgress, 1.0);
+    }});
+    list.push_back({"dcb", false, none, [](Images &im, rpContext&, std::size_t) {
+        return dcb_demosaic(im.width, im.height, im.bayerRaw.ptr(), im.red.ptr(), im.green.ptr(), im.blue.ptr(), bayer, noProgress, 2, true);
+    }});
+    list.push_back({"hphd", false, none, [](Images &im, rpContext&, std::size_t) {
+        return hphd_demosaic(im.width, im.height, im.bayerRaw.ptr(), im.red.ptr(), im.green.ptr(), im.blue.ptr(), bayer, noProgress);
+    }});
+    list.push_back({"rcd", true, none, [](Images &im, rpContext&, std::size_t chunkSize) {
+        return rcd_demosaic(im.width, im.height, im.bayerRaw.ptr(), im.red.ptr(), im.green.ptr(), im.blue.ptr(), bayer, noProgress, chunkSize);
+    }});
+    list.push_back({"rcd_context", true, none, [](Images &im, rpContext &context, std::size_t chunkSize) {
+        return rcd_demosaic(context, im.width, im.height, im.bayerRaw.ptr(), im.red.ptr(), im.green.ptr(), im.blue.ptr(), bayer, noProgress, chunkSize);
+    }});
+    list.push_back({"rcd_u16", true, none, [](Images &im, rpContext &context, std::size_t chunkSize) {
+        return rcd_demosaic(context, im.width, im.height, im.bayerRaw16.ptr(), im.red.ptr(), im.green.ptr(), im.blue.ptr(), bayer, noProgress, chunkSize);
+    }});
+    list.push_back({"rcd_strip", true, none, [](Images &im, rpContext &context, std::size_t chunkSize) {
+        rpError rc = RP_NO_ERROR;
+        for (int top = 0; top < im.height && !rc; top += stripRows) {
+            rc = rcd_demosaic_strip(context, im.width, im.height, top, stripRows, im.bayerRaw.ptr(), im.red.ptr(), im.green.ptr(), im.blue.ptr(), bayer, noProgress, chunkSize);
+        }
+        return rc;
+    }});
+    list.push_back({"rcd_frames", true, none, [](Images &im, rpContext &context, std::size_t chunkSize) {
+        rpError rc = RP_NO_ERROR;
+        for (int top = 0; top < im.height && !rc; top += burstRows) {
+            const int rows = std::min(burstRows, im.height - top);
+            rc = rcd_demosaic(context, im.width, rows, im.bayerRaw.ptr() + top, im.red.ptr() + top, im.green.ptr() + top, im.blue.ptr() + top, bayer, noProgress, chunkSize);
+        }
+        return rc;
+    }});
+    list.push_back({"rcd_batch", true, none, [](Images &im, rpContext &context, std::size_t chunkSize) {
+        std::vector<rpBayerFrame> frames;
+        for (int top = 0; top < im.height; top += burstRows) {
+            const int rows = std::min(burstRows, im.height - top);
+            frames.push_back({im.width, rows, im.bayerRaw.ptr() + top, nullptr, rpOutput(im.red.ptr() + top, im.green.ptr() + top, im.blue.ptr() + top), {{bayer[0][0], bayer[0][1]}, {bayer[1][0], bayer[1][1]}}});
+        }
+        return rcd_demosaic_batch(context, frames.data(), frames.size(), noProgress, chunkSize);
+    }});
+    list.push_back({"markesteijn1", true, none, [](Images &im, rpContext&, std::size_t chunkSize) {
+        return markesteijn_demosaic(im.width, im.height, im.xtransRaw.ptr(), im.red.ptr(), im.green.ptr(), im.blue.ptr(), xtrans, rgb_cam, noProgress, 1, false, chunkSize);
+    }});
+    list.push_back({"markesteijn3", true, none, [](Images &im, rpContext&, std::size_t chunkSize) {
+        return markesteijn_demosaic(im.width, im.height, im.xtransRaw.ptr(), im.red.ptr(), im.green.ptr(), im.blue.ptr(), xtrans, rgb_cam, noProgress, 3, true, chunkSize);
+    }});
+    list.push_back({"markesteijn3_context", true, none, [](Images &im, rpContext &context, std::size_t chunkSize) {
+        return markesteijn_demosaic(context, im.width, im.height, im.xtransRaw.ptr(), im.red.ptr(), im.green.ptr(), im.blue.ptr(), xtrans, rgb_cam, noProgress, 3, true, chunkSize);
+    }});
+    list.push_back({"xtransfast", false, none, [](Images &im, rpContext&, std::size_t) {
+        return xtransfast_demosaic(im.width, im.height, im.xtransRaw.ptr(), im.red.ptr(), im.green.ptr(), im.blue.ptr(), xtrans, noProgress);
+    }});
+    list.push_back({"vng4", false, none, [](Images &im, rpContext&, std::size_t) {
+        return vng4_demosaic(im.width, im.height, im.bayerRaw.ptr(), im.red.ptr(), im.green.ptr(), im.blue.ptr(), bayer4, noProgress);
+    }});
+    list.push_back({"vng4_half", false, none, [](Images &im, rpContext &context, std::size_t) {
+        context.setHalfBuffers(true);
+        const rpError rc = vng4_demosaic(context, im.width, im.height, im.bayerRaw.ptr(), im.red.ptr(), im.green.ptr(), im.blue.ptr(), bayer4, noProgress);
+        context.setHalfBuffers(false);
+        return rc;
+    }});
+    list.push_back({"igv", false, none, [](Images &im, rpContext&, std::size_t) {
+        return igv_demosaic(im.width, im.height, im.bayerRaw.ptr(), im.red.ptr(), im.green.ptr(), im.blue.ptr(), bayer, noProgress);
+    }});
+    list.push_back({"lmmse", false, none, [](Images &im, rpContext&, std::size_t) {
+        return lmmse_demosaic(im.width, im.height, im.bayerRaw.ptr(), im.red.ptr(), im.green.ptr(), im.blue.ptr(), bayer, noProgress, 2);
+    }});
+    list.push_back({"CA_correct", true, none, [](Images &im, rpContext&, std::size_t chunkSize) {
+        double fitParams[2][2][16] = {};
+        return CA_correct(0, 0, im.width, im.height, true, 2, 0.0, 0.0, true, im.bayerRaw.ptr(), im.red.ptr(), bayer, noProgress, fitParams, false, 65535.f, 65535.f, chunkSize);
+    }});
+    list.push_back({"CA_correct_half", true, none, [](Images &im, rpContext &context, std::size_t chunkSize) {
+        double fitParams[2][2][16] = {};
+        context.setHalfBuffers(true);
+        const rpError rc = CA_correct(context, 0, 0, im.width, im.height, true, 2, 0.0, 0.0, true, im.bayerRaw.ptr(), im.red.ptr(), bayer, noProgress, fitParams, false, 65535.f, 65535.f, chunkSize);
+        context.setHalfBuffers(false);
+        return rc;
+    }});
+    list.push_back({"CA_correct_tiled", true, none, [](Images &im, rpContext &context, std::size_t chunkSize) {
+        double fitParams[2][2][16] = {};
+        return CA_correct_tiled(context, im.width, im.height, true, 2, 0.0, 0.0, true, im.bayerRaw.ptr(), im.red.ptr(), bayer, noProgress, fitParams, false, 65535.f, 65535.f, chunkSize);
+    }});
+    list.push_back({"CA_correct_auto", true, none, [](Images &im, rpContext &context, std::size_t chunkSize) {
+        rpCAStats stats;
+        return CA_correct_auto(context, 0, 0, im.width, im.height, 2, 0.05, true, im.bayerRaw.ptr(), im.red.ptr(), bayer, noProgress, stats, 65535.f, 65535.f, chunkSize);
+    }});
+    list.push_back({"CA_detect", true, none, [](Images &im, rpContext &context, std::size_t chunkSize) {
+        rpCAModel model;
+        return CA_detect(context, 0, 0, im.width, im.height, im.bayerRaw.ptr(), bayer, noProgress, model, 65535.f, chunkSize);
+    }});
+    list.push_back({"CA_detect_step2", true, none, [](Images &im, rpContext &context, std::size_t chunkSize) {
+        rpCAModel model;
+        return CA_detect(context, 0, 0, im.width, im.height, im.bayerRaw.ptr(), bayer, noProgress, model, 65535.f, chunkSize, 2);
+    }});
+    list.push_back({"CA_detect_step2_order6", true, none, [](Images &im, rpContext &context, std::size_t chunkSize) {
+        rpCAModel model;
+        return CA_detect(context, 0, 0, im.width, im.height, im.bayerRaw.ptr(), bayer, noProgress, model, 65535.f, chunkSize, 2, RP_CA_POLYNOMIAL, 6);
+    }});
+    list.push_back({"CA_correct_xtrans", true, none, [](Images &im, rpContext &context, std::size_t chunkSize) {
+        rpCAModel model;
+        return CA_correct_xtrans(context, im.width, im.height, 2, im.xtransRaw.ptr(), im.red.ptr(), xtrans, noProgress, model, false, 65535.f, 65535.f, chunkSize);
+    }});
+    // CA correction followed by amaze through a corrected raw image and fused
+    list.push_back({"CA_apply_amaze", true, detectCAModel, [](Images &im, rpContext &context, std::size_t chunkSize) {
+        Plane corrected(im.width, im.height);
+        const rpError rc = CA_apply(context, 0, 0, im.width, im.height, caModel, false, im.bayerRaw.ptr(), corrected.ptr(), bayer, noProgress, 65535.f, 65535.f, chunkSize);
+        return rc ? rc : amaze_demosaic(context, im.width, im.height, 0, 0, im.width, im.height, corrected.ptr(), im.red.ptr(), im.green.ptr(), im.blue.ptr(), bayer, noProgress, 1.0, 0, 65535.f, 65535.f, chunkSize);
+    }});
+    list.push_back({"CA_amaze", true, detectCAModel, [](Images &im, rpContext &context, std::size_t chunkSize) {
+        return CA_amaze_demosaic(context, im.width, im.height, caModel, im.bayerRaw.ptr(), im.red.ptr(), im.green.ptr(), im.blue.ptr(), bayer, noProgress, 1.0, 0, 65535.f, 65535.f, chunkSize);
+    }});
+    // HLRecovery_inpaint works in place, so the input is regenerated before every run
+    list.push_back({"HLRecovery_inpaint", false, [](Images &im) {
+        fillHighlights(im.red, im.green, im.blue, im.width, im.height);
+    }, [](Images &im, rpContext&, std::size_t) {
+        const float chmax[3] = {clipLevel, clipLevel, clipLevel};
+        const float clmax[3] = {clipLevel, clipLevel, clipLevel};
+        return HLRecovery_inpaint(im.width, im.height, im.red.ptr(), im.green.ptr(), im.blue.ptr(), chmax, clmax, noProgress);
+    }});
+    list.push_back({"HLRecovery_inpaint_sparse", false, [](Images &im) {
+        fillHighlights(im.red, im.green, im.blue, im.width, im.height);
+    }, [](Images &im, rpContext &context, std::size_t) {
+        const float chmax[3] = {clipLevel, clipLevel, clipLevel};
+        const float clmax[3] = {clipLevel, clipLevel, clipLevel};
+        return HLRecovery_inpaint(context, im.width, im.height, im.red.ptr(), im.green.ptr(), im.blue.ptr(), chmax, clmax, noProgress, true);
+    }});
+    list.push_back({"HLRecovery_inpaint_pyramid", false, [](Images &im) {
+        fillHighlights(im.red, im.green, im.blue, im.width, im.height);
+    }, [](Images &im, rpContext &context, std::size_t) {
+        const float chmax[3] = {clipLevel, clipLevel, clipLevel};
+        const float clmax[3] = {clipLevel, clipLevel, clipLevel};
+        return HLRecovery_inpaint(context, im.width, im.height, im.red.ptr(), im.green.ptr(), im.blue.ptr(), chmax, clmax, noProgress, false, RP_HL_PYRAMID);
+    }});
+    list.push_back({"HLRecovery_inpaint_tiled", false, [](Images &im) {
+        fillHighlights(im.red, im.green, im.blue, im.width, im.height);
+    }, [](Images &im, rpContext &context, std::size_t) {
+        const float chmax[3] = {clipLevel, clipLevel, clipLevel};
+        const float clmax[3] = {clipLevel, clipLevel, clipLevel};
+        return HLRecovery_inpaint_tiled(context, im.width, im.height, im.red.ptr(), im.green.ptr(), im.blue.ptr(), chmax, clmax, noProgress);
+    }});
+
+    return list;
+}
+
+double percentile(std::vector<double> values, double p)
+{
+    std::sort(values.begin(), values.end());
+    const double pos = p * (values.size() - 1);
+    const std::size_t lower = static_cast<std::size_t>(pos);
+    const std::size_t upper = std::min(lower + 1, values.size() - 1);
+    return values[lower] + (pos - lower) * (values[upper] - values[lower]);
+}
+
+void usage()
+{
+    fprintf(stderr,
+            "usage: rtprocess_bench [options]\n"
+            "  --sizes LIST     image sizes in megapixels (default 12,24,45,100)\n"
+            "  --threads LIST   thread counts (default powers of two up to the number of cores, and the number of cores)\n"
+            "  --chunks LIST    chunk sizes for the routines which take one (default 1,2,4)\n"
+            "  --repeat N       timed runs per configuration, after one warm up run (default 5)\n"
+            "  --only LIST      run only the named benchmarks\n"
+            "  --output FILE    write the JSON to FILE instead of stdout\n"
+            "  --list           print the benchmark names and exit\n");
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<double> sizes = {12, 24, 45, 100};
+    std::vector<double> chunks = {1, 2, 4};
+    std::vector<double> threads;
+    std::vector<std::string> only;
+    int repeat = 5;
+    const char *outputName = nullptr;
+
+#ifdef _OPENMP
+    const int maxThreads = omp_get_max_threads();
+#else
+    const int maxThreads = 1;
+#endif
+
+    for (int i = 1; i < argc; ++i) {
+        const bool hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "--sizes") && hasValue) {
+            sizes = parseList(argv[++i]);
+        } else if (!strcmp(argv[i], "--threads") && hasValue) {
+            threads = parseList(argv[++i]);
+        } else if (!strcmp(argv[i], "--chunks") && hasValue) {
+            chunks = parseList(argv[++i]);
+        } else if (!strcmp(argv[i], "--repeat") && hasValue) {
+            repeat = std::max(1, atoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--only") && hasValue) {
+            only = parseNames(argv[++i]);
+        } else if (!strcmp(argv[i], "--output") && hasValue) {
+            outputName = argv[++i];
+        } else if (!strcmp(argv[i], "--list")) {
+            for (const auto &benchmark : benchmarks()) {
+                printf("%s\n", benchmark.name);
+            }
+            return 0;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    if (threads.empty()) {
+        for (int n = 1; n < maxThreads; n *= 2) {
+            threads.push_back(n);
+        }
+        threads.push_back(maxThreads);
+    }
+
+    FILE *out = outputName ? fopen(outputName, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "could not open %s\n", outputName);
+        return 1;
+    }
+
+    const std::vector<Benchmark> list = benchmarks();
+
+    fprintf(out, "{\n  \"max_threads\": %d,\n  \"repeat\": %d,\n  \"results\": [", maxThreads, repeat);
+    bool first = true;
+
+    for (double megaPixels : sizes) {
+        // 3:2 aspect ratio, dimensions are multiples of 6 so both mosaics tile the image completely
+        const int width = static_cast<int>(std::sqrt(megaPixels * 1.0e6 * 1.5) / 6.0) * 6;
+        const int height = static_cast<int>(megaPixels * 1.0e6 / width / 6.0) * 6;
+        if (width < 36 || height < 36) {
+            fprintf(stderr, "skipping size %g MP, image too small\n", megaPixels);
+            continue;
+        }
+        fprintf(stderr, "generating %dx%d input\n", width, height);
+        Images images(width, height);
+        const double pixels = static_cast<double>(width) * height;
+
+        for (const auto &benchmark : list) {
+            if (!only.empty() && std::find(only.begin(), only.end(), benchmark.name) == only.end()) {
+                continue;
+            }
+            const std::vector<double> chunkSizes = benchmark.usesChunkSize ? chunks : std::vector<double>(1, 0.0);
+            for (double threadCount : threads) {
+#ifdef _OPENMP
+                omp_set_num_threads(std::max(1, static_cast<int>(threadCount)));
+#endif
+                for (double chunk : chunkSizes) {
+                    const std::size_t chunkSize = std::max<std::size_t>(1, static_cast<std::size_t>(chunk));
+                    fprintf(stderr, "%s %g MP, %d threads", benchmark.name, megaPixels, static_cast<int>(threadCount));
+                    if (benchmark.usesChunkSize) {
+                        fprintf(stderr, ", chunk size %zu", chunkSize);
+                    }
+                    fprintf(stderr, "\n");
+
+                    // constructed after setting the thread count, so it gets one arena per thread
+                    rpContext context;
+                    std::vector<double> seconds;
+                    rpError error = RP_NO_ERROR;
+                    resetPeakRss();
+                    for (int run = 0; run <= repeat && error == RP_NO_ERROR; ++run) {
+                        benchmark.prepare(images);
+                        const auto start = std::chrono::steady_clock::now();
+                        error = benchmark.run(images, context, chunkSize);
+                        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                        if (run > 0) { // first run is warm up
+                            seconds.push_back(elapsed.count());
+                        }
+                    }
+
+                    fprintf(out, "%s\n    {\"name\": \"%s\", \"megapixels\": %g, \"width\": %d, \"height\": %d, \"threads\": %d, ",
+                            first ? "" : ",", benchmark.name, megaPixels, width, height, static_cast<int>(threadCount));
+                    first = false;
+                    if (benchmark.usesChunkSize) {
+                        fprintf(out, "\"chunk_size\": %zu, ", chunkSize);
+                    } else {
+                        fprintf(out, "\"chunk_size\": null, ");
+                    }
+                    if (error != RP_NO_ERROR || seconds.empty()) {
+                        fprintf(out, "\"error\": %d}", static_cast<int>(error));
+                        continue;
+                    }
+                    const double median = percentile(seconds, 0.5);
+                    fprintf(out, "\"median_s\": %.6f, \"p95_s\": %.6f, \"min_s\": %.6f, \"mp_per_s\": %.3f, \"peak_rss_mb\": %.1f}",
+                            median, percentile(seconds, 0.95), *std::min_element(seconds.begin(), seconds.end()),
+                            pixels / 1.0e6 / median, peakRss() / (1024.0 * 1024.0));
+                    fflush(out);
+                }
+            }
+        }
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
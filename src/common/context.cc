@@ -0,0 +1,119 @@
+/*
+ * This file is part of librtprocess.
+ *
+ * librtprocess is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * librtprocess is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with librtprocess.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cstdint>
+#include <cstdlib>
+
+#include "librtprocess.h"
+#include "scratch.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace
+{
+
+char *alignTo64(char *ptr)
+{
+    return ptr ? (char*)((uintptr_t(ptr) + uintptr_t(63)) / 64 * 64) : nullptr;
+}
+
+}
+
+struct rpContext::Arena {
+    char *memory; // as returned by calloc
+    char *data;   // memory aligned to 64 bytes
+    std::size_t size;
+};
+
+rpContext::rpContext() :
+    useHalfBuffers(false),
+#ifdef _OPENMP
+    numArenas(omp_get_max_threads())
+#else
+    numArenas(1)
+#endif
+{
+    // threads beyond numArenas (e.g. after omp_set_num_threads() was raised) fall back to local buffers
+    arenas = new Arena[numArenas]();
+}
+
+rpContext::~rpContext()
+{
+    release();
+    delete[] arenas;
+}
+
+void rpContext::release()
+{
+    for (int i = 0; i < numArenas; ++i) {
+        free(arenas[i].memory);
+        arenas[i] = Arena();
+    }
+}
+
+std::size_t rpContext::size() const
+{
+    std::size_t sum = 0;
+    for (int i = 0; i < numArenas; ++i) {
+        sum += arenas[i].size;
+    }
+    return sum;
+}
+
+void rpContext::setHalfBuffers(bool enable)
+{
+    useHalfBuffers = enable;
+}
+
+bool rpContext::halfBuffers() const
+{
+    return useHalfBuffers;
+}
+
+namespace librtprocess
+{
+
+ScratchBuffer::ScratchBuffer(rpContext *context, std::size_t size) : buffer(nullptr), owned(nullptr)
+{
+#ifdef _OPENMP
+    const int thread = omp_get_thread_num();
+#else
+    const int thread = 0;
+#endif
+
+    if (context && thread < context->numArenas) {
+        // each thread only touches its own arena, so no locking is needed here
+        rpContext::Arena &arena = context->arenas[thread];
+        if (arena.size < size) {
+            free(arena.memory);
+            arena.memory = (char*) calloc(size + 63, 1);
+            arena.data = alignTo64(arena.memory);
+            arena.size = arena.memory ? size : 0;
+        }
+        buffer = arena.data;
+    } else {
+        owned = (char*) calloc(size + 63, 1);
+        buffer = alignTo64(owned);
+    }
+}
+
+ScratchBuffer::~ScratchBuffer()
+{
+    free(owned);
+}
+
+}
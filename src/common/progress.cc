@@ -0,0 +1,54 @@
+/*
+ * This file is part of librtprocess.
+ *
+ * librtprocess is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * librtprocess is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with librtprocess.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+
+#include "progress.h"
+
+namespace librtprocess
+{
+
+Progress::Progress(const std::function<bool(double)> &callback, std::size_t numItems, double beginValue, double endValue) :
+    setProgCancel(callback),
+    items(std::max<std::size_t>(numItems, 1)),
+    step(std::max<std::size_t>(numItems / 100, 1)),
+    begin(beginValue),
+    range(endValue - beginValue),
+    counter(0),
+    nextReport(step),
+    reporting(false),
+    cancel(false)
+{
+}
+
+void Progress::done(std::size_t count)
+{
+    const std::size_t finished = counter.fetch_add(count, std::memory_order_relaxed) + count;
+    if (finished < nextReport.load(std::memory_order_relaxed) || cancelled() || reporting.exchange(true, std::memory_order_acquire)) {
+        // not yet due, cancelled or another thread is reporting
+        return;
+    }
+    // checked again, the reporting thread may have moved nextReport past finished in the meantime
+    if (finished >= nextReport.load(std::memory_order_relaxed)) {
+        nextReport.store(finished + step, std::memory_order_relaxed);
+        if (setProgCancel(begin + range * std::min(static_cast<double>(finished) / items, 1.0))) {
+            cancel.store(true, std::memory_order_relaxed);
+        }
+    }
+    reporting.store(false, std::memory_order_release);
+}
+
+}
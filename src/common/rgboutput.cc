@@ -0,0 +1,84 @@
+/*
+ * This file is part of librtprocess.
+ *
+ * librtprocess is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * librtprocess is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with librtprocess.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cstdint>
+#include <cstring>
+
+#include "float16.h"
+#include "librtprocess.h"
+#include "opthelper.h"
+#include "rgboutput.h"
+#include "rt_math.h"
+
+namespace librtprocess
+{
+
+TARGET_CLONES
+void writeOutputRow(const rpOutput &output, int row, int col, int count, const float *r, const float *g, const float *b)
+{
+    const float scale = output.scale;
+
+    switch (output.layout) {
+        case RP_OUTPUT_PLANAR_FLOAT:
+            memcpy(output.red[row] + col, r, count * sizeof(float));
+            memcpy(output.green[row] + col, g, count * sizeof(float));
+            memcpy(output.blue[row] + col, b, count * sizeof(float));
+            break;
+
+        case RP_OUTPUT_RGB_FLOAT: {
+            float *dst = static_cast<float*>(output.rows[row]) + 3 * col;
+            for (int i = 0; i < count; ++i) {
+                dst[3 * i] = scale * r[i];
+                dst[3 * i + 1] = scale * g[i];
+                dst[3 * i + 2] = scale * b[i];
+            }
+            break;
+        }
+
+        case RP_OUTPUT_RGBA_HALF: {
+            uint16_t *dst = static_cast<uint16_t*>(output.rows[row]) + 4 * col;
+            constexpr uint16_t one = 0x3c00;
+            if (runtimeF16C()) {
+                for (int i = 0; i < count; ++i) {
+                    dst[4 * i] = floatToHalfF16C(scale * r[i]);
+                    dst[4 * i + 1] = floatToHalfF16C(scale * g[i]);
+                    dst[4 * i + 2] = floatToHalfF16C(scale * b[i]);
+                    dst[4 * i + 3] = one;
+                }
+            } else {
+                for (int i = 0; i < count; ++i) {
+                    dst[4 * i] = floatToHalf(scale * r[i]);
+                    dst[4 * i + 1] = floatToHalf(scale * g[i]);
+                    dst[4 * i + 2] = floatToHalf(scale * b[i]);
+                    dst[4 * i + 3] = one;
+                }
+            }
+            break;
+        }
+
+        case RP_OUTPUT_RGB_UINT16: {
+            uint16_t *dst = static_cast<uint16_t*>(output.rows[row]) + 3 * col;
+            for (int i = 0; i < count; ++i) {
+                dst[3 * i] = LIM(scale * r[i], 0.f, 65535.f) + 0.5f;
+                dst[3 * i + 1] = LIM(scale * g[i], 0.f, 65535.f) + 0.5f;
+                dst[3 * i + 2] = LIM(scale * b[i], 0.f, 65535.f) + 0.5f;
+            }
+            break;
+        }
+    }
+}
+
+}
@@ -0,0 +1,98 @@
+/*
+ * This file is part of librtprocess.
+ *
+ * librtprocess is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * librtprocess is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with librtprocess.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cstring>
+
+#include "librtprocess.h"
+#include "stagetimer.h"
+
+namespace
+{
+
+// stages are identified by name
+void addTime(std::vector<librtprocess::StageTime> &list, const librtprocess::StageTime &time)
+{
+    for (auto &entry : list) {
+        if (entry.stage == time.stage || !strcmp(entry.stage, time.stage)) {
+            entry.seconds += time.seconds;
+            entry.begin = std::min(entry.begin, time.begin);
+            return;
+        }
+    }
+    list.push_back(time);
+}
+
+}
+
+void rpContext::setStageCallback(const rpStageCallback &callback)
+{
+    stageCallback = callback;
+}
+
+namespace librtprocess
+{
+
+StageTimer::StageTimer(const rpContext *context, const char *routineName) :
+    callback(context && context->stageCallback ? &context->stageCallback : nullptr),
+    routine(routineName)
+{
+    if (callback) {
+        startTime = std::chrono::steady_clock::now();
+    }
+}
+
+StageTimer::~StageTimer()
+{
+    if (callback) {
+        const std::chrono::duration<double, std::milli> total = std::chrono::steady_clock::now() - startTime;
+        std::stable_sort(stages.begin(), stages.end(), [](const StageTime &a, const StageTime &b) { return a.begin < b.begin; });
+        for (const auto &stage : stages) {
+            (*callback)(routine, stage.stage, stage.seconds * 1000.0);
+        }
+        (*callback)(routine, "total", total.count());
+    }
+}
+
+void StageTimer::add(const std::vector<StageTime> &times)
+{
+#ifdef _OPENMP
+    #pragma omp critical (stagetimer)
+#endif
+    {
+        for (const auto &time : times) {
+            addTime(stages, time);
+        }
+    }
+}
+
+void StageClock::lap(const char *stage)
+{
+    if (timer.enabled()) {
+        const auto now = std::chrono::steady_clock::now();
+        addTime(times, {stage, std::chrono::duration<double>(now - last).count(), last});
+        last = now;
+    }
+}
+
+StageClock::~StageClock()
+{
+    if (!times.empty()) {
+        timer.add(times);
+    }
+}
+
+}
@@ -31,15 +31,23 @@
 #include "opthelper.h"
 #include "rt_math.h"
 #include "median.h"
+#include "progress.h"
+#include "scratch.h"
+#include "stagetimer.h"
 #include "StopWatch.h"
 
 #define TS 144
 
 using namespace librtprocess;
 
-rpError ahd_demosaic(int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const float rgb_cam[3][4], const std::function<bool(double)> &setProgCancel)
+namespace
+{
+
+template<typename T>
+rpError ahd_demosaic_impl(rpContext *context, int width, int height, const T * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const float rgb_cam[3][4], const std::function<bool(double)> &setProgCancel)
 {
     BENCHFUN
+    StageTimer timer(context, "ahd");
 
     if (!validateBayerCfa(3, cfarray)) {
         return RP_WRONG_CFA;
@@ -59,8 +67,7 @@ rpError ahd_demosaic(int width, int height, const float * const *rawData, float
 
     constexpr float d65_white[3] = { 0.950456, 1, 1.088754 };
 
-    double progress = 0.0;
-    setProgCancel(progress);
+    setProgCancel(0.0);
 
     for (int i = 0; i < 65536; i++) {
         const double r = i / 65535.0;
@@ -77,12 +84,16 @@ rpError ahd_demosaic(int width, int height, const float * const *rawData, float
 
     rc = bayerborder_demosaic(width, height, 5, rawData, red, green, blue, cfarray);
 
+    const int numTileRows = std::max((height - 7 + TS - 7) / (TS - 6), 0);
+    const int numTileCols = std::max((width - 7 + TS - 7) / (TS - 6), 0);
+    Progress progress(setProgCancel, numTileRows * numTileCols);
+
 #ifdef _OPENMP
 #pragma omp parallel
 #endif
 {
-    int progresscounter = 0;
-    float *buffer = new (std::nothrow) float[13 * TS * TS]; /* 1053 kB per core */
+    const ScratchBuffer scratch(context, 13 * TS * TS * sizeof(float)); /* 1053 kB per core */
+    float *buffer = (float*) scratch.data();
 #ifdef _OPENMP
     #pragma omp critical
 #endif
@@ -98,25 +109,32 @@ rpError ahd_demosaic(int width, int height, const float * const *rawData, float
         auto rgb  = (float(*)[TS][TS][3]) buffer;
         auto lab  = (float(*)[TS][TS][3])(buffer + 6 * TS * TS);
         auto homo = (uint16_t(*)[TS][TS])(buffer + 12 * TS * TS);
+        StageClock clock(timer);
 
 #ifdef _OPENMP
         #pragma omp for collapse(2) schedule(dynamic) nowait
 #endif
         for (int top = 2; top < height - 5; top += TS - 6) {
             for (int left = 2; left < width - 5; left += TS - 6) {
+                if (progress.cancelled()) {
+                    continue;
+                }
+                clock.start();
                 //  Interpolate green horizontally and vertically:
                 for (int row = top; row < top + TS && row < height - 2; row++) {
             for (int col = left + (fc(cfarray, row, left) & 1); col < std::min(left + TS, width - 2); col += 2) {
                         auto pix = &rawData[row][col];
                         float val0 = 0.25f * ((pix[-1] + pix[0] + pix[1]) * 2
                                       - pix[-2] - pix[2]) ;
-                        rgb[0][row - top][col - left][1] = median(val0, pix[-1], pix[1]);
+                        rgb[0][row - top][col - left][1] = median(val0, static_cast<float>(pix[-1]), static_cast<float>(pix[1]));
                         float val1 = 0.25f * ((pix[-width] + pix[0] + pix[width]) * 2
                                       - pix[-2 * width] - pix[2 * width]) ;
-                        rgb[1][row - top][col - left][1] = median(val1, pix[-width], pix[width]);
+                        rgb[1][row - top][col - left][1] = median(val1, static_cast<float>(pix[-width]), static_cast<float>(pix[width]));
                     }
                 }
 
+                clock.lap("green interpolation");
+
                 //  Interpolate red and blue, and convert to CIELab:
                 for (int d = 0; d < 2; d++)
                     for (int row = top + 1; row < top + TS - 1 && row < height - 3; row++) {
@@ -156,6 +174,8 @@ rpError ahd_demosaic(int width, int height, const float * const *rawData, float
                         }
                     }
 
+                clock.lap("red and blue interpolation");
+
                 //  Build homogeneity maps from the CIELab images:
 
                 for (int row = top + 2; row < top + TS - 2 && row < height - 4; row++) {
@@ -187,6 +207,8 @@ rpError ahd_demosaic(int width, int height, const float * const *rawData, float
                     }
                 }
 
+                clock.lap("homogeneity maps");
+
                 //  Combine the most homogeneous pixels for the final result:
                 for (int row = top + 3; row < top + TS - 3 && row < height - 5; row++) {
                     int tr = row - top;
@@ -211,30 +233,42 @@ rpError ahd_demosaic(int width, int height, const float * const *rawData, float
                         }
                     }
                 }
-
-
-                progresscounter++;
-                if(progresscounter % 32 == 0) {
-#ifdef _OPENMP
-                    #pragma omp critical (ahdprogress)
-#endif
-                    {
-                        progress += 32.0 * SQR(TS - 6) / (height * width);
-                        progress = std::min(progress, 1.0);
-                        setProgCancel(progress);
-                    }
-                }
-
+                clock.lap("output");
+                progress.done();
             }
         }
     }
-    delete [] buffer;
 }
 
+    if (!rc && progress.cancelled()) {
+        return RP_CANCELLED;
+    }
     setProgCancel(1.0);
 
     return rc;
 }
+
+}
+
+rpError ahd_demosaic(int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const float rgb_cam[3][4], const std::function<bool(double)> &setProgCancel)
+{
+    return ahd_demosaic_impl(nullptr, width, height, rawData, red, green, blue, cfarray, rgb_cam, setProgCancel);
+}
+
+rpError ahd_demosaic(rpContext &context, int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const float rgb_cam[3][4], const std::function<bool(double)> &setProgCancel)
+{
+    return ahd_demosaic_impl(&context, width, height, rawData, red, green, blue, cfarray, rgb_cam, setProgCancel);
+}
+
+rpError ahd_demosaic(int width, int height, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const float rgb_cam[3][4], const std::function<bool(double)> &setProgCancel)
+{
+    return ahd_demosaic_impl(nullptr, width, height, rawData, red, green, blue, cfarray, rgb_cam, setProgCancel);
+}
+
+rpError ahd_demosaic(rpContext &context, int width, int height, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const float rgb_cam[3][4], const std::function<bool(double)> &setProgCancel)
+{
+    return ahd_demosaic_impl(&context, width, height, rawData, red, green, blue, cfarray, rgb_cam, setProgCancel);
+}
 #undef TS
 
 
@@ -33,15 +33,35 @@
 
 #include "bayerhelper.h"
 #include "librtprocess.h"
+#include "rgboutput.h"
 #include "rt_math.h"
 #include "sleef.h"
 #include "opthelper.h"
 #include "median.h"
+#include "progress.h"
+#include "scratch.h"
+#include "stagetimer.h"
 #include "StopWatch.h"
 
 using namespace librtprocess;
 
-rpError amaze_demosaic(int raw_width, int raw_height, int winx, int winy, int winw, int winh, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double initGain, int border, float inputScale, float outputScale, std::size_t chunkSize, bool measure)
+namespace
+{
+
+// this allows to pass AMAZETS to the code. On some machines larger AMAZETS is faster
+// If AMAZETS is undefined it will be set to 160, which is the fastest on modern x86/64 machines
+#ifndef AMAZETS
+#define AMAZETS 160
+#endif
+// Tile size; the image is processed in square tiles to lower memory requirements and facilitate multi-threading
+// We assure that Tile size is a multiple of 32 in the range [96;992]
+constexpr int ts = (AMAZETS & 992) < 96 ? 96 : (AMAZETS & 992);
+constexpr int tsh = ts / 2; // half of Tile size
+
+// computes the rows [stripTop, stripBottom) of the window, only the tiles which contribute to these rows are processed
+template<typename T>
+TARGET_CLONES
+rpError amaze_demosaic_impl(rpContext *context, int raw_width, int raw_height, int winx, int winy, int winw, int winh, int stripTop, int stripBottom, const T * const *rawData, const rpOutput &output, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double initGain, int border, float inputScale, float outputScale, std::size_t chunkSize, bool measure)
 {
     BENCHFUN
     std::unique_ptr<StopWatch> stop;
@@ -51,28 +71,19 @@ rpError amaze_demosaic(int raw_width, int raw_height, int winx, int winy, int wi
         stop.reset(new StopWatch("amaze demosaic"));
     }
 
+    StageTimer timer(context, "amaze");
+
     if (!validateBayerCfa(3, cfarray)) {
         return RP_WRONG_CFA;
     }
     rpError rc = RP_NO_ERROR;
 
-    double progress = 0.0;
-    setProgCancel(progress);
+    setProgCancel(0.0);
 
     const int width = winw, height = winh;
     const float clip_pt = 1.0 / initGain;
     const float clip_pt8 = 0.8 / initGain;
 
-// this allows to pass AMAZETS to the code. On some machines larger AMAZETS is faster
-// If AMAZETS is undefined it will be set to 160, which is the fastest on modern x86/64 machines
-#ifndef AMAZETS
-#define AMAZETS 160
-#endif
-    // Tile size; the image is processed in square tiles to lower memory requirements and facilitate multi-threading
-    // We assure that Tile size is a multiple of 32 in the range [96;992]
-    constexpr int ts = (AMAZETS & 992) < 96 ? 96 : (AMAZETS & 992);
-    constexpr int tsh = ts / 2; // half of Tile size
- 
     //offset of R pixel within a Bayer quartet
     int ex, ey;
 
@@ -118,20 +129,31 @@ rpError amaze_demosaic(int raw_width, int raw_height, int winx, int winy, int wi
     //gaussian on quincunx grid
     constexpr float gquinc[4] = {0.169917f, 0.108947f, 0.069855f, 0.0287182f};
 
-    typedef struct {
+    struct s_hv {
         float h;
         float v;
-    } s_hv;
+    };
+
+    const bool planar = isPlanar(output);
+
+    // the tiles in rows outside of the strip are skipped and don't count
+    int numTileRows = 0;
+    for (int top = winy - 16; top < winy + height; top += ts - 32) {
+        if (top + 16 < stripBottom && min(top + ts, winy + height + 16) - 16 > stripTop) {
+            ++numTileRows;
+        }
+    }
+    const int numTileCols = (width + 16 + ts - 33) / (ts - 32);
+    Progress progress(setProgCancel, numTileRows * numTileCols);
 
 #ifdef _OPENMP
     #pragma omp parallel
 #endif
     {
-        int progresscounter = 0;
-
         constexpr int cldf = 2; // factor to multiply cache line distance. 1 = 64 bytes, 2 = 128 bytes ...
         // assign working space
-        char *buffer = (char *) calloc(14 * sizeof(float) * ts * ts + sizeof(char) * ts * tsh + 18 * cldf * 64 + 63, 1);
+        const std::size_t bufferSize = 14 * sizeof(float) * ts * ts + sizeof(char) * ts * tsh + 18 * cldf * 64;
+        const ScratchBuffer buffer(context, bufferSize);
 #ifdef _OPENMP
         #pragma omp critical
 #endif
@@ -145,7 +167,7 @@ rpError amaze_demosaic(int raw_width, int raw_height, int winx, int winy, int wi
 #endif
         if (!rc) {
             // aligned to 64 byte boundary
-            float *data = (float*)((uintptr_t(buffer) + uintptr_t(63)) / 64 * 64);
+            float *data = (float*)buffer.data();
 
             // green values
             float *rgbgreen         = data;
@@ -194,6 +216,10 @@ rpError amaze_demosaic(int raw_width, int raw_height, int winx, int winy, int wi
             unsigned char *nyquist  = (unsigned char (*)) (cfa + ts * ts + cldf * 16);            // 1
             unsigned char *nyquist2 = (unsigned char (*)) cddiffsq;
             float *nyqutest = (float(*)) (nyquist + sizeof(unsigned char) * ts * tsh + cldf * 64);                // 1
+            // one output row for the interleaved layouts, planar outputs are written in place
+            float outRow[3][ts];
+
+            StageClock clock(timer);
 
             // Main algorithm: Tile loop
             // use collapse(2) to collapse the 2 loops to one large loop, so there is better scaling
@@ -203,9 +229,15 @@ rpError amaze_demosaic(int raw_width, int raw_height, int winx, int winy, int wi
 
             for (int top = winy - 16; top < winy + height; top += ts - 32) {
                 for (int left = winx - 16; left < winx + width; left += ts - 32) {
-                    memset(&nyquist[3 * tsh], 0, sizeof(unsigned char) * (ts - 6) * tsh);
                     //location of tile bottom edge
                     int bottom = min(top + ts, winy + height + 16);
+                    if (top + 16 >= stripBottom || bottom - 16 <= stripTop || progress.cancelled()) {
+                        continue;
+                    }
+                    clock.start();
+                    // some stages read rows and columns of the working space at the tile edges which no stage writes,
+                    // clear it so that they don't see the values of the previous tile (or the previous call)
+                    memset(data, 0, bufferSize);
                     //location of tile right edge
                     int right  = min(left + ts, winx + width + 16);
                     //tile width  (=ts except for right edge of image)
@@ -227,7 +259,7 @@ rpError amaze_demosaic(int raw_width, int raw_height, int winx, int winy, int wi
                     // a 16 pixel border is added to each side of the image
 
                     // begin of tile initialization
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                     vfloat cinScalev = F2V( inputScale );
 
                     //fill upper border
@@ -237,7 +269,7 @@ rpError amaze_demosaic(int raw_width, int raw_height, int winx, int winy, int wi
 
                             for (int cc = ccmin; cc < ccmax; cc += 4) {
                                 int indx1 = rr * ts + cc;
-                                vfloat tempv = LVFU(rawData[row][cc + left]) / cinScalev;
+                                vfloat tempv = LVFRAW(rawData[row][cc + left]) / cinScalev;
                                 STVF(cfa[indx1], tempv);
                                 STVF(rgbgreen[indx1], tempv );
                             }
@@ -250,7 +282,7 @@ rpError amaze_demosaic(int raw_width, int raw_height, int winx, int winy, int wi
                         int cc = ccmin;
                         for (; cc < ccmax - 3; cc += 4) {
                             int indx1 = rr * ts + cc;
-                            vfloat tempv = LVFU(rawData[row][cc + left]) / cinScalev;
+                            vfloat tempv = LVFRAW(rawData[row][cc + left]) / cinScalev;
                             STVF(cfa[indx1], tempv );
                             STVF(rgbgreen[indx1], tempv );
                         }
@@ -267,7 +299,7 @@ rpError amaze_demosaic(int raw_width, int raw_height, int winx, int winy, int wi
                         for (int rr = 0; rr < 16; rr++)
                             for (int cc = ccmin; cc < ccmax; cc += 4) {
                                 int indx1 = (rrmax + rr) * ts + cc;
-                                vfloat tempv = LVFU(rawData[(winy + height - rr - 2)][left + cc]) / cinScalev;
+                                vfloat tempv = LVFRAW(rawData[(winy + height - rr - 2)][left + cc]) / cinScalev;
                                 STVF(cfa[indx1], tempv );
                                 STVF(rgbgreen[indx1], tempv );
                             }
@@ -358,9 +390,10 @@ rpError amaze_demosaic(int raw_width, int raw_height, int winx, int winy, int wi
                     }
 
                     // end of tile initialization
+                    clock.lap("tile initialization");
 
                     // horizontal and vertical gradients
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                     vfloat epsv = F2V( eps );
 
                     for (int rr = 2; rr < rr1 - 2; rr++) {
@@ -387,7 +420,7 @@ rpError amaze_demosaic(int raw_width, int raw_height, int winx, int winy, int wi
 #endif
 
                     //interpolate vertical and horizontal colour differences
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                     vfloat sgnv;
 
                     if( !(fc(cfarray, 4, 4) & 1) ) {
@@ -545,7 +578,7 @@ rpError amaze_demosaic(int raw_width, int raw_height, int winx, int winy, int wi
 
 
 
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                     vfloat  clip_ptv = F2V( clip_pt );
                     vfloat  sgn3v;
 
@@ -699,7 +732,7 @@ rpError amaze_demosaic(int raw_width, int raw_height, int winx, int winy, int wi
 
 
 
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                     vfloat  epssqv = F2V( epssq );
 
                     for (int rr = 6; rr < rr1 - 6; rr++) {
@@ -795,7 +828,7 @@ rpError amaze_demosaic(int raw_width, int raw_height, int winx, int winy, int wi
 
 #endif
 
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                     vfloat gaussg0 = F2V(gaussgrad[0]);
                     vfloat gaussg1 = F2V(gaussgrad[1]);
                     vfloat gaussg2 = F2V(gaussgrad[2]);
@@ -814,7 +847,7 @@ rpError amaze_demosaic(int raw_width, int raw_height, int winx, int winy, int wi
                         int cc = 6 + (fc(cfarray, rr, 2) & 1);
                         int indx = rr * ts + cc;
 
-#ifdef __SSE2__
+#ifdef RT_VECTOR
 
                         for (; cc < cc1 - 7; cc += 8, indx += 8) {
                             vfloat valv = (gausso0 * LC2VFU(cddiffsq[indx]) +
@@ -900,14 +933,14 @@ rpError amaze_demosaic(int raw_width, int raw_height, int winx, int winy, int wi
                         nyendcol = std::min(cc1 - 8, nyendcol);
                         memset(&nyquist2[4 * tsh], 0, sizeof(char) * (ts - 8) * tsh);
 
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                         vint fourvb = _mm_set1_epi8(4);
                         vint onevb = _mm_set1_epi8(1);
 
 #endif
 
                         for (int rr = nystartrow; rr < nyendrow; rr++) {
-#ifdef __SSE2__
+#ifdef RT_VECTOR
 
                             for (int indx = rr * ts; indx < rr * ts + cc1; indx += 32) {
                                 vint nyquisttemp1v = _mm_adds_epi8(_mm_load_si128((vint*)&nyquist[(indx - v2) >> 1]), _mm_loadu_si128((vint*)&nyquist[(indx - m1) >> 1]));
@@ -1023,7 +1056,7 @@ rpError amaze_demosaic(int raw_width, int raw_height, int winx, int winy, int wi
                     }
 
 
-#ifdef __SSE2__
+#ifdef RT_VECTOR
 
                     for (int rr = 6; rr < rr1 - 6; rr++) {
                         if((fc(cfarray, rr, 2) & 1) == 0) {
@@ -1070,16 +1103,17 @@ rpError amaze_demosaic(int raw_width, int raw_height, int winx, int winy, int wi
                     }
 
 #endif
+                    clock.lap("green interpolation");
 
                     // diagonal interpolation correction
 
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                     vfloat gausseven0v = F2V(gausseven[0]);
                     vfloat gausseven1v = F2V(gausseven[1]);
 #endif
 
                     for (int rr = 8; rr < rr1 - 8; rr++) {
-#ifdef __SSE2__
+#ifdef RT_VECTOR
 
                         for (int indx = rr * ts + 8 + (fc(cfarray, rr, 2) & 1), indx1 = indx >> 1; indx < rr * ts + cc1 - 8; indx += 8, indx1 += 4) {
 
@@ -1230,12 +1264,12 @@ rpError amaze_demosaic(int raw_width, int raw_height, int winx, int winy, int wi
 #endif
                     }
 
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                     vfloat zd25v = F2V(0.25f);
 #endif
 
                     for (int rr = 10; rr < rr1 - 10; rr++)
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                         for (int indx = rr * ts + 10 + (fc(cfarray, rr, 2) & 1), indx1 = indx >> 1; indx < rr * ts + cc1 - 10; indx += 8, indx1 += 4) {
 
                             //first ask if one gets more directional discrimination from nearby B/R sites
@@ -1263,7 +1297,7 @@ rpError amaze_demosaic(int raw_width, int raw_height, int winx, int winy, int wi
 #endif
 
                     for (int rr = 12; rr < rr1 - 12; rr++)
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                         for (int indx = rr * ts + 12 + (fc(cfarray, rr, 2) & 1), indx1 = indx >> 1; indx < rr * ts + cc1 - 12; indx += 8, indx1 += 4) {
                             vmask copymask = vmaskf_ge(vabsf(zd5v - LVFU(pmwt[indx1])), vabsf(zd5v - LVFU(hvwt[indx1])));
 
@@ -1400,6 +1434,7 @@ rpError amaze_demosaic(int raw_width, int raw_height, int winx, int winy, int wi
 #endif
 
                     //end of diagonal interpolation correction
+                    clock.lap("diagonal correction");
 
                     //fancy chrominance interpolation
                     //(ey,ex) is location of R site
@@ -1409,14 +1444,14 @@ rpError amaze_demosaic(int raw_width, int raw_height, int winx, int winy, int wi
                             Dgrb[0][indx1] = 0;
                         }
 
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                     vfloat oned325v = F2V( 1.325f );
                     vfloat zd175v = F2V( 0.175f );
                     vfloat zd075v = F2V( 0.075f );
 #endif
 
                     for (int rr = 14; rr < rr1 - 14; rr++)
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                         for (int cc = 14 + (fc(cfarray, rr, 2) & 1), indx = rr * ts + cc, c = 1 - fc(cfarray, rr, cc) / 2; cc < cc1 - 14; cc += 8, indx += 8) {
                             vfloat tempv = epsv + vabsf(LVFU(Dgrb[c][(indx - m1) >> 1]) - LVFU(Dgrb[c][(indx + m1) >> 1]));
                             vfloat temp2v = epsv + vabsf(LVFU(Dgrb[c][(indx + p1) >> 1]) - LVFU(Dgrb[c][(indx - p1) >> 1]));
@@ -1447,13 +1482,16 @@ rpError amaze_demosaic(int raw_width, int raw_height, int winx, int winy, int wi
 
 #endif
 
-#ifdef __SSE2__
+                    // output rows of the tile
+                    const int rrStart = std::max(16, stripTop - top);
+                    const int rrEnd = std::min(rr1 - 16, stripBottom - top);
+#ifdef RT_VECTOR
                     int offset;
                     vfloat twov = F2V(2.f);
                     vfloat coutscalev = F2V(outputScale);
                     vmask selmask;
 
-                    if((fc(cfarray, 16, 2) & 1) == 1) {
+                    if((fc(cfarray, rrStart, 2) & 1) == 1) {
                         selmask = _mm_set_epi32(0xffffffff, 0, 0xffffffff, 0);
                         offset = 1;
                     } else {
@@ -1463,11 +1501,13 @@ rpError amaze_demosaic(int raw_width, int raw_height, int winx, int winy, int wi
 
 #endif
 
-                    for (int rr = 16; rr < rr1 - 16; rr++) {
+                    for (int rr = rrStart; rr < rrEnd; rr++) {
                         int row = rr + top;
                         int col = left + 16;
                         int indx = rr * ts + 16;
-#ifdef __SSE2__
+                        float *const redRow = planar ? output.red[row] + left : outRow[0];
+                        float *const blueRow = planar ? output.blue[row] + left : outRow[2];
+#ifdef RT_VECTOR
                         offset = 1 - offset;
                         selmask = vnotm(selmask);
 
@@ -1481,48 +1521,48 @@ rpError amaze_demosaic(int raw_width, int raw_height, int winx, int winy, int wi
                             vfloat bluev1 = greenv - (temp00v * vdup(LVFU(Dgrb[1][(indx - v1) >> 1])) + (onev - vdup(LVFU(hvwt[(indx + 1 + offset) >> 1]))) * vdup(LVFU(Dgrb[1][(indx + 1 + offset) >> 1])) + (onev - vdup(LVFU(hvwt[(indx - 1 + offset) >> 1]))) * vdup(LVFU(Dgrb[1][(indx - 1 + offset) >> 1])) + temp01v * vdup(LVFU(Dgrb[1][(indx + v1) >> 1]))) * tempv;
                             vfloat redv2  = greenv - vdup(LVFU(Dgrb[0][indx >> 1]));
                             vfloat bluev2 = greenv - vdup(LVFU(Dgrb[1][indx >> 1]));
-                            STVFU(red[row][col], coutscalev * vself(selmask, redv1, redv2));
-                            STVFU(blue[row][col], coutscalev * vself(selmask, bluev1, bluev2));
+                            STVFU(redRow[col - left], coutscalev * vself(selmask, redv1, redv2));
+                            STVFU(blueRow[col - left], coutscalev * vself(selmask, bluev1, bluev2));
                         }
 
                         if(offset == 0) {
                             for (; indx < rr * ts + cc1 - 16 - (cc1 & 1); indx++, col++) {
                                 float temp =  1.f / (hvwt[(indx - v1) >> 1] + 2.f - hvwt[(indx + 1) >> 1] - hvwt[(indx - 1) >> 1] + hvwt[(indx + v1) >> 1]);
-                                red[row][col] = outputScale * (rgbgreen[indx] - ((hvwt[(indx - v1) >> 1]) * Dgrb[0][(indx - v1) >> 1] + (1.f - hvwt[(indx + 1) >> 1]) * Dgrb[0][(indx + 1) >> 1] + (1.f - hvwt[(indx - 1) >> 1]) * Dgrb[0][(indx - 1) >> 1] + (hvwt[(indx + v1) >> 1]) * Dgrb[0][(indx + v1) >> 1]) *
+                                redRow[col - left] = outputScale * (rgbgreen[indx] - ((hvwt[(indx - v1) >> 1]) * Dgrb[0][(indx - v1) >> 1] + (1.f - hvwt[(indx + 1) >> 1]) * Dgrb[0][(indx + 1) >> 1] + (1.f - hvwt[(indx - 1) >> 1]) * Dgrb[0][(indx - 1) >> 1] + (hvwt[(indx + v1) >> 1]) * Dgrb[0][(indx + v1) >> 1]) *
                                                             temp);
-                                blue[row][col] = outputScale * (rgbgreen[indx] - ((hvwt[(indx - v1) >> 1]) * Dgrb[1][(indx - v1) >> 1] + (1.f - hvwt[(indx + 1) >> 1]) * Dgrb[1][(indx + 1) >> 1] + (1.f - hvwt[(indx - 1) >> 1]) * Dgrb[1][(indx - 1) >> 1] + (hvwt[(indx + v1) >> 1]) * Dgrb[1][(indx + v1) >> 1]) *
+                                blueRow[col - left] = outputScale * (rgbgreen[indx] - ((hvwt[(indx - v1) >> 1]) * Dgrb[1][(indx - v1) >> 1] + (1.f - hvwt[(indx + 1) >> 1]) * Dgrb[1][(indx + 1) >> 1] + (1.f - hvwt[(indx - 1) >> 1]) * Dgrb[1][(indx - 1) >> 1] + (hvwt[(indx + v1) >> 1]) * Dgrb[1][(indx + v1) >> 1]) *
                                                              temp);
 
                                 indx++;
                                 col++;
-                                red[row][col] = outputScale * (rgbgreen[indx] - Dgrb[0][indx >> 1]);
-                                blue[row][col] = outputScale * (rgbgreen[indx] - Dgrb[1][indx >> 1]);
+                                redRow[col - left] = outputScale * (rgbgreen[indx] - Dgrb[0][indx >> 1]);
+                                blueRow[col - left] = outputScale * (rgbgreen[indx] - Dgrb[1][indx >> 1]);
                             }
 
                             if(cc1 & 1) { // width of tile is odd
                                 float temp =  1.f / (hvwt[(indx - v1) >> 1] + 2.f - hvwt[(indx + 1) >> 1] - hvwt[(indx - 1) >> 1] + hvwt[(indx + v1) >> 1]);
-                                red[row][col] = outputScale * (rgbgreen[indx] - ((hvwt[(indx - v1) >> 1]) * Dgrb[0][(indx - v1) >> 1] + (1.f - hvwt[(indx + 1) >> 1]) * Dgrb[0][(indx + 1) >> 1] + (1.f - hvwt[(indx - 1) >> 1]) * Dgrb[0][(indx - 1) >> 1] + (hvwt[(indx + v1) >> 1]) * Dgrb[0][(indx + v1) >> 1]) *
+                                redRow[col - left] = outputScale * (rgbgreen[indx] - ((hvwt[(indx - v1) >> 1]) * Dgrb[0][(indx - v1) >> 1] + (1.f - hvwt[(indx + 1) >> 1]) * Dgrb[0][(indx + 1) >> 1] + (1.f - hvwt[(indx - 1) >> 1]) * Dgrb[0][(indx - 1) >> 1] + (hvwt[(indx + v1) >> 1]) * Dgrb[0][(indx + v1) >> 1]) *
                                                             temp);
-                                blue[row][col] = outputScale * (rgbgreen[indx] - ((hvwt[(indx - v1) >> 1]) * Dgrb[1][(indx - v1) >> 1] + (1.f - hvwt[(indx + 1) >> 1]) * Dgrb[1][(indx + 1) >> 1] + (1.f - hvwt[(indx - 1) >> 1]) * Dgrb[1][(indx - 1) >> 1] + (hvwt[(indx + v1) >> 1]) * Dgrb[1][(indx + v1) >> 1]) *
+                                blueRow[col - left] = outputScale * (rgbgreen[indx] - ((hvwt[(indx - v1) >> 1]) * Dgrb[1][(indx - v1) >> 1] + (1.f - hvwt[(indx + 1) >> 1]) * Dgrb[1][(indx + 1) >> 1] + (1.f - hvwt[(indx - 1) >> 1]) * Dgrb[1][(indx - 1) >> 1] + (hvwt[(indx + v1) >> 1]) * Dgrb[1][(indx + v1) >> 1]) *
                                                              temp);
                             }
                         } else {
                             for (; indx < rr * ts + cc1 - 16 - (cc1 & 1); indx++, col++) {
-                                red[row][col] = outputScale * (rgbgreen[indx] - Dgrb[0][indx >> 1]);
-                                blue[row][col] = outputScale * (rgbgreen[indx] - Dgrb[1][indx >> 1]);
+                                redRow[col - left] = outputScale * (rgbgreen[indx] - Dgrb[0][indx >> 1]);
+                                blueRow[col - left] = outputScale * (rgbgreen[indx] - Dgrb[1][indx >> 1]);
 
                                 indx++;
                                 col++;
                                 float temp =  1.f / (hvwt[(indx - v1) >> 1] + 2.f - hvwt[(indx + 1) >> 1] - hvwt[(indx - 1) >> 1] + hvwt[(indx + v1) >> 1]);
-                                red[row][col] = outputScale * (rgbgreen[indx] - ((hvwt[(indx - v1) >> 1]) * Dgrb[0][(indx - v1) >> 1] + (1.f - hvwt[(indx + 1) >> 1]) * Dgrb[0][(indx + 1) >> 1] + (1.f - hvwt[(indx - 1) >> 1]) * Dgrb[0][(indx - 1) >> 1] + (hvwt[(indx + v1) >> 1]) * Dgrb[0][(indx + v1) >> 1]) *
+                                redRow[col - left] = outputScale * (rgbgreen[indx] - ((hvwt[(indx - v1) >> 1]) * Dgrb[0][(indx - v1) >> 1] + (1.f - hvwt[(indx + 1) >> 1]) * Dgrb[0][(indx + 1) >> 1] + (1.f - hvwt[(indx - 1) >> 1]) * Dgrb[0][(indx - 1) >> 1] + (hvwt[(indx + v1) >> 1]) * Dgrb[0][(indx + v1) >> 1]) *
                                                             temp);
-                                blue[row][col] = outputScale * (rgbgreen[indx] - ((hvwt[(indx - v1) >> 1]) * Dgrb[1][(indx - v1) >> 1] + (1.f - hvwt[(indx + 1) >> 1]) * Dgrb[1][(indx + 1) >> 1] + (1.f - hvwt[(indx - 1) >> 1]) * Dgrb[1][(indx - 1) >> 1] + (hvwt[(indx + v1) >> 1]) * Dgrb[1][(indx + v1) >> 1]) *
+                                blueRow[col - left] = outputScale * (rgbgreen[indx] - ((hvwt[(indx - v1) >> 1]) * Dgrb[1][(indx - v1) >> 1] + (1.f - hvwt[(indx + 1) >> 1]) * Dgrb[1][(indx + 1) >> 1] + (1.f - hvwt[(indx - 1) >> 1]) * Dgrb[1][(indx - 1) >> 1] + (hvwt[(indx + v1) >> 1]) * Dgrb[1][(indx + v1) >> 1]) *
                                                              temp);
                             }
 
                             if(cc1 & 1) { // width of tile is odd
-                                red[row][col] = outputScale * (rgbgreen[indx] - Dgrb[0][indx >> 1]);
-                                blue[row][col] = outputScale * (rgbgreen[indx] - Dgrb[1][indx >> 1]);
+                                redRow[col - left] = outputScale * (rgbgreen[indx] - Dgrb[0][indx >> 1]);
+                                blueRow[col - left] = outputScale * (rgbgreen[indx] - Dgrb[1][indx >> 1]);
                             }
                         }
 
@@ -1531,89 +1571,165 @@ rpError amaze_demosaic(int raw_width, int raw_height, int winx, int winy, int wi
                         if((fc(cfarray, rr, 2) & 1) == 1) {
                             for (; indx < rr * ts + cc1 - 16 - (cc1 & 1); indx++, col++) {
                                 float temp =  1.f / (hvwt[(indx - v1) >> 1] + 2.f - hvwt[(indx + 1) >> 1] - hvwt[(indx - 1) >> 1] + hvwt[(indx + v1) >> 1]);
-                                red[row][col] = outputScale * (rgbgreen[indx] - ((hvwt[(indx - v1) >> 1]) * Dgrb[0][(indx - v1) >> 1] + (1.f - hvwt[(indx + 1) >> 1]) * Dgrb[0][(indx + 1) >> 1] + (1.f - hvwt[(indx - 1) >> 1]) * Dgrb[0][(indx - 1) >> 1] + (hvwt[(indx + v1) >> 1]) * Dgrb[0][(indx + v1) >> 1]) *
+                                redRow[col - left] = outputScale * (rgbgreen[indx] - ((hvwt[(indx - v1) >> 1]) * Dgrb[0][(indx - v1) >> 1] + (1.f - hvwt[(indx + 1) >> 1]) * Dgrb[0][(indx + 1) >> 1] + (1.f - hvwt[(indx - 1) >> 1]) * Dgrb[0][(indx - 1) >> 1] + (hvwt[(indx + v1) >> 1]) * Dgrb[0][(indx + v1) >> 1]) *
                                                             temp);
-                                blue[row][col] = outputScale * (rgbgreen[indx] - ((hvwt[(indx - v1) >> 1]) * Dgrb[1][(indx - v1) >> 1] + (1.f - hvwt[(indx + 1) >> 1]) * Dgrb[1][(indx + 1) >> 1] + (1.f - hvwt[(indx - 1) >> 1]) * Dgrb[1][(indx - 1) >> 1] + (hvwt[(indx + v1) >> 1]) * Dgrb[1][(indx + v1) >> 1]) *
+                                blueRow[col - left] = outputScale * (rgbgreen[indx] - ((hvwt[(indx - v1) >> 1]) * Dgrb[1][(indx - v1) >> 1] + (1.f - hvwt[(indx + 1) >> 1]) * Dgrb[1][(indx + 1) >> 1] + (1.f - hvwt[(indx - 1) >> 1]) * Dgrb[1][(indx - 1) >> 1] + (hvwt[(indx + v1) >> 1]) * Dgrb[1][(indx + v1) >> 1]) *
                                                              temp);
 
                                 indx++;
                                 col++;
-                                red[row][col] = outputScale* (rgbgreen[indx] - Dgrb[0][indx >> 1]);
-                                blue[row][col] = outputScale * (rgbgreen[indx] - Dgrb[1][indx >> 1]);
+                                redRow[col - left] = outputScale* (rgbgreen[indx] - Dgrb[0][indx >> 1]);
+                                blueRow[col - left] = outputScale * (rgbgreen[indx] - Dgrb[1][indx >> 1]);
                             }
 
                             if(cc1 & 1) { // width of tile is odd
                                 float temp =  1.f / (hvwt[(indx - v1) >> 1] + 2.f - hvwt[(indx + 1) >> 1] - hvwt[(indx - 1) >> 1] + hvwt[(indx + v1) >> 1]);
-                                red[row][col] = outputScale * (rgbgreen[indx] - ((hvwt[(indx - v1) >> 1]) * Dgrb[0][(indx - v1) >> 1] + (1.f - hvwt[(indx + 1) >> 1]) * Dgrb[0][(indx + 1) >> 1] + (1.f - hvwt[(indx - 1) >> 1]) * Dgrb[0][(indx - 1) >> 1] + (hvwt[(indx + v1) >> 1]) * Dgrb[0][(indx + v1) >> 1]) *
+                                redRow[col - left] = outputScale * (rgbgreen[indx] - ((hvwt[(indx - v1) >> 1]) * Dgrb[0][(indx - v1) >> 1] + (1.f - hvwt[(indx + 1) >> 1]) * Dgrb[0][(indx + 1) >> 1] + (1.f - hvwt[(indx - 1) >> 1]) * Dgrb[0][(indx - 1) >> 1] + (hvwt[(indx + v1) >> 1]) * Dgrb[0][(indx + v1) >> 1]) *
                                                             temp);
-                                blue[row][col] = outputScale * (rgbgreen[indx] - ((hvwt[(indx - v1) >> 1]) * Dgrb[1][(indx - v1) >> 1] + (1.f - hvwt[(indx + 1) >> 1]) * Dgrb[1][(indx + 1) >> 1] + (1.f - hvwt[(indx - 1) >> 1]) * Dgrb[1][(indx - 1) >> 1] + (hvwt[(indx + v1) >> 1]) * Dgrb[1][(indx + v1) >> 1]) *
+                                blueRow[col - left] = outputScale * (rgbgreen[indx] - ((hvwt[(indx - v1) >> 1]) * Dgrb[1][(indx - v1) >> 1] + (1.f - hvwt[(indx + 1) >> 1]) * Dgrb[1][(indx + 1) >> 1] + (1.f - hvwt[(indx - 1) >> 1]) * Dgrb[1][(indx - 1) >> 1] + (hvwt[(indx + v1) >> 1]) * Dgrb[1][(indx + v1) >> 1]) *
                                                              temp);
                             }
                         } else {
                             for (; indx < rr * ts + cc1 - 16 - (cc1 & 1); indx++, col++) {
-                                red[row][col] = outputScale * (rgbgreen[indx] - Dgrb[0][indx >> 1]);
-                                blue[row][col] = outputScale * (rgbgreen[indx] - Dgrb[1][indx >> 1]);
+                                redRow[col - left] = outputScale * (rgbgreen[indx] - Dgrb[0][indx >> 1]);
+                                blueRow[col - left] = outputScale * (rgbgreen[indx] - Dgrb[1][indx >> 1]);
 
                                 indx++;
                                 col++;
                                 float temp =  1.f / (hvwt[(indx - v1) >> 1] + 2.f - hvwt[(indx + 1) >> 1] - hvwt[(indx - 1) >> 1] + hvwt[(indx + v1) >> 1]);
-                                red[row][col] = outputScale * (rgbgreen[indx] - ((hvwt[(indx - v1) >> 1]) * Dgrb[0][(indx - v1) >> 1] + (1.f - hvwt[(indx + 1) >> 1]) * Dgrb[0][(indx + 1) >> 1] + (1.f - hvwt[(indx - 1) >> 1]) * Dgrb[0][(indx - 1) >> 1] + (hvwt[(indx + v1) >> 1]) * Dgrb[0][(indx + v1) >> 1]) *
+                                redRow[col - left] = outputScale * (rgbgreen[indx] - ((hvwt[(indx - v1) >> 1]) * Dgrb[0][(indx - v1) >> 1] + (1.f - hvwt[(indx + 1) >> 1]) * Dgrb[0][(indx + 1) >> 1] + (1.f - hvwt[(indx - 1) >> 1]) * Dgrb[0][(indx - 1) >> 1] + (hvwt[(indx + v1) >> 1]) * Dgrb[0][(indx + v1) >> 1]) *
                                                             temp);
-                                blue[row][col] = outputScale * (rgbgreen[indx] - ((hvwt[(indx - v1) >> 1]) * Dgrb[1][(indx - v1) >> 1] + (1.f - hvwt[(indx + 1) >> 1]) * Dgrb[1][(indx + 1) >> 1] + (1.f - hvwt[(indx - 1) >> 1]) * Dgrb[1][(indx - 1) >> 1] + (hvwt[(indx + v1) >> 1]) * Dgrb[1][(indx + v1) >> 1]) *
+                                blueRow[col - left] = outputScale * (rgbgreen[indx] - ((hvwt[(indx - v1) >> 1]) * Dgrb[1][(indx - v1) >> 1] + (1.f - hvwt[(indx + 1) >> 1]) * Dgrb[1][(indx + 1) >> 1] + (1.f - hvwt[(indx - 1) >> 1]) * Dgrb[1][(indx - 1) >> 1] + (hvwt[(indx + v1) >> 1]) * Dgrb[1][(indx + v1) >> 1]) *
                                                              temp);
                             }
 
                             if(cc1 & 1) { // width of tile is odd
-                                red[row][col] = outputScale * (rgbgreen[indx] - Dgrb[0][indx >> 1]);
-                                blue[row][col] = outputScale * (rgbgreen[indx] - Dgrb[1][indx >> 1]);
+                                redRow[col - left] = outputScale * (rgbgreen[indx] - Dgrb[0][indx >> 1]);
+                                blueRow[col - left] = outputScale * (rgbgreen[indx] - Dgrb[1][indx >> 1]);
                             }
                         }
 
 #endif
+
+                        if (!planar) {
+                            for (int cc = 16; cc < cc1 - 16; cc++) {
+                                outRow[1][cc] = outputScale * rgbgreen[rr * ts + cc];
+                            }
+                            writeOutputRow(output, row, left + 16, cc1 - 32, outRow[0] + 16, outRow[1] + 16, outRow[2] + 16);
+                        }
                     }
 
+                    clock.lap("chroma interpolation");
+
                     // copy smoothed results back to image matrix
-                    for (int rr = 16; rr < rr1 - 16; rr++) {
-                        int row = rr + top;
+                    for (int rr = rrStart; rr < rrEnd && planar; rr++) {
+                        float *const greenRow = output.green[rr + top] + left;
                         int cc = 16;
-#ifdef __SSE2__
+#ifdef RT_VECTOR
 
                         for (; cc < cc1 - 19; cc += 4) {
-                            STVFU(green[row][cc + left], LVF(rgbgreen[rr * ts + cc]) * coutscalev);
+                            STVFU(greenRow[cc], LVF(rgbgreen[rr * ts + cc]) * coutscalev);
                         }
 
 #endif
 
                         for (; cc < cc1 - 16; cc++) {
-                            green[row][cc + left] = outputScale * rgbgreen[rr * ts + cc];
+                            greenRow[cc] = outputScale * rgbgreen[rr * ts + cc];
                         }
                     }
 
-                    progresscounter++;
-
-                    if(progresscounter % 32 == 0) {
-#ifdef _OPENMP
-                        #pragma omp critical (amazeprogress)
-#endif
-                        {
-                            progress += 32.0 * SQR(ts - 32) / (height * width);
-                            progress = std::min(progress, 1.0);
-                            setProgCancel(progress);
-                        }
-                    }
+                    clock.lap("output");
+                    progress.done();
                 }
             }  //end of main loop
         }
-        // clean up
-        if (buffer) {
-            free(buffer);
-        }
     }
+    if (rc == RP_NO_ERROR && progress.cancelled()) {
+        return RP_CANCELLED;
+    }
+
     if(border < 4 && rc == RP_NO_ERROR) {
-        rc = bayerborder_demosaic(width, height, 3, rawData, red, green, blue, cfarray);
+        StageClock clock(timer);
+        bayerborder_demosaic_rows(width, height, 3, stripTop - winy, stripBottom - winy, rawData, output, cfarray);
+        clock.lap("border");
     }
 
     setProgCancel(1.0);
 
     return rc;
 }
+
+}
+
+rpError amaze_demosaic(int raw_width, int raw_height, int winx, int winy, int winw, int winh, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double initGain, int border, float inputScale, float outputScale, std::size_t chunkSize, bool measure)
+{
+    return amaze_demosaic_impl(nullptr, raw_width, raw_height, winx, winy, winw, winh, winy, winy + winh, rawData, rpOutput(red, green, blue), cfarray, setProgCancel, initGain, border, inputScale, outputScale, chunkSize, measure);
+}
+
+rpError amaze_demosaic(rpContext &context, int raw_width, int raw_height, int winx, int winy, int winw, int winh, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double initGain, int border, float inputScale, float outputScale, std::size_t chunkSize, bool measure)
+{
+    return amaze_demosaic_impl(&context, raw_width, raw_height, winx, winy, winw, winh, winy, winy + winh, rawData, rpOutput(red, green, blue), cfarray, setProgCancel, initGain, border, inputScale, outputScale, chunkSize, measure);
+}
+
+rpError amaze_demosaic(int raw_width, int raw_height, int winx, int winy, int winw, int winh, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double initGain, int border, float inputScale, float outputScale, std::size_t chunkSize, bool measure)
+{
+    return amaze_demosaic_impl(nullptr, raw_width, raw_height, winx, winy, winw, winh, winy, winy + winh, rawData, rpOutput(red, green, blue), cfarray, setProgCancel, initGain, border, inputScale, outputScale, chunkSize, measure);
+}
+
+rpError amaze_demosaic(rpContext &context, int raw_width, int raw_height, int winx, int winy, int winw, int winh, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double initGain, int border, float inputScale, float outputScale, std::size_t chunkSize, bool measure)
+{
+    return amaze_demosaic_impl(&context, raw_width, raw_height, winx, winy, winw, winh, winy, winy + winh, rawData, rpOutput(red, green, blue), cfarray, setProgCancel, initGain, border, inputScale, outputScale, chunkSize, measure);
+}
+
+rpError amaze_demosaic(rpContext &context, int raw_width, int raw_height, int winx, int winy, int winw, int winh, const float * const *rawData, const rpOutput &output, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double initGain, int border, float inputScale, float outputScale, std::size_t chunkSize)
+{
+    return amaze_demosaic_impl(&context, raw_width, raw_height, winx, winy, winw, winh, winy, winy + winh, rawData, output, cfarray, setProgCancel, initGain, border, inputScale, outputScale, chunkSize, false);
+}
+
+rpError amaze_demosaic(rpContext &context, int raw_width, int raw_height, int winx, int winy, int winw, int winh, const uint16_t * const *rawData, const rpOutput &output, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double initGain, int border, float inputScale, float outputScale, std::size_t chunkSize)
+{
+    return amaze_demosaic_impl(&context, raw_width, raw_height, winx, winy, winw, winh, winy, winy + winh, rawData, output, cfarray, setProgCancel, initGain, border, inputScale, outputScale, chunkSize, false);
+}
+
+void amaze_demosaic_strip_input(int height, int stripTop, int stripHeight, int &rawTop, int &rawBottom)
+{
+    stripTop = std::max(stripTop, 0);
+    const int stripBottom = std::min(stripTop + stripHeight, height);
+    // the border rows need their direct neighbours
+    rawTop = std::max(stripTop - 1, 0);
+    rawBottom = std::min(stripBottom + 1, height);
+
+    for (int top = -16; top < height; top += ts - 32) {
+        const int bottom = std::min(top + ts, height + 16);
+        if (top + 16 < stripBottom && bottom - 16 > stripTop) {
+            rawTop = std::min(rawTop, std::max(top, 0));
+            rawBottom = std::max(rawBottom, std::min(bottom, height));
+        }
+    }
+}
+
+namespace
+{
+
+template<typename T>
+rpError amaze_demosaic_strip_impl(rpContext &context, int width, int height, int stripTop, int stripHeight, const T * const *rawData, const rpOutput &output, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double initGain, int border, float inputScale, float outputScale, std::size_t chunkSize)
+{
+    stripTop = std::max(stripTop, 0);
+    const int stripBottom = std::min(stripTop + stripHeight, height);
+    if (stripTop >= stripBottom) {
+        return RP_NO_ERROR;
+    }
+    return amaze_demosaic_impl(&context, width, height, 0, 0, width, height, stripTop, stripBottom, rawData, output, cfarray, setProgCancel, initGain, border, inputScale, outputScale, chunkSize, false);
+}
+
+}
+
+rpError amaze_demosaic_strip(rpContext &context, int width, int height, int stripTop, int stripHeight, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double initGain, int border, float inputScale, float outputScale, std::size_t chunkSize)
+{
+    return amaze_demosaic_strip_impl(context, width, height, stripTop, stripHeight, rawData, rpOutput(red, green, blue), cfarray, setProgCancel, initGain, border, inputScale, outputScale, chunkSize);
+}
+
+rpError amaze_demosaic_strip(rpContext &context, int width, int height, int stripTop, int stripHeight, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double initGain, int border, float inputScale, float outputScale, std::size_t chunkSize)
+{
+    return amaze_demosaic_strip_impl(context, width, height, stripTop, stripHeight, rawData, rpOutput(red, green, blue), cfarray, setProgCancel, initGain, border, inputScale, outputScale, chunkSize);
+}
@@ -26,7 +26,10 @@
 #include "bayerhelper.h"
 #include "librtprocess.h"
 #include "opthelper.h"
+#include "progress.h"
 #include "rt_math.h"
+#include "scratch.h"
+#include "stagetimer.h"
 #include "StopWatch.h"
 
 using namespace librtprocess;
@@ -34,15 +37,21 @@ using namespace librtprocess;
 #define TS 224
 
 #define INVGRAD(i) (16.0f/SQR(4.0f+i))
-#ifdef __SSE2__
+#ifdef RT_VECTOR
 #define INVGRADV(i) (c16v*_mm_rcp_ps(SQRV(fourv+i)))
 #endif
 
 
-rpError bayerfast_demosaic(int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double initGain)
+namespace
+{
+
+template<typename T>
+rpError bayerfast_demosaic_impl(rpContext *context, int width, int height, const T * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double initGain)
 {
 
     BENCHFUN
+    StageTimer timer(context, "bayerfast");
+
     if (!validateBayerCfa(3, cfarray)) {
         return RP_WRONG_CFA;
     }
@@ -57,11 +66,19 @@ rpError bayerfast_demosaic(int width, int height, const float * const *rawData,
     const int W = width;
     const float clip_pt = 4 * 65535 * initGain;
 
-    rc = bayerborder_demosaic(width, height, bord, rawData, red, green, blue, cfarray);
+    {
+        StageClock clock(timer);
+        rc = bayerborder_demosaic(width, height, bord, rawData, red, green, blue, cfarray);
+        clock.lap("border");
+    }
 
     progress += 0.1;
     setProgCancel(progress);
 
+    const int numTileRows = std::max((H - 2 * bord + 4 + TS - 5) / (TS - 4), 0);
+    const int numTileCols = std::max((W - 2 * bord + 4 + TS - 5) / (TS - 4), 0);
+    Progress tileProgress(setProgCancel, numTileRows * numTileCols, progress);
+
 #ifdef _OPENMP
     #pragma omp parallel
 #endif
@@ -69,7 +86,7 @@ rpError bayerfast_demosaic(int width, int height, const float * const *rawData,
 
 #define CLF 1
         // assign working space
-        char *buffer = (char *) calloc(3 * sizeof(float) * TS * TS + 3 * CLF * 64 + 63, 1);
+        const ScratchBuffer buffer(context, 3 * sizeof(float) * TS * TS + 3 * CLF * 64);
 #ifdef _OPENMP
     #pragma omp critical
 #endif
@@ -82,14 +99,13 @@ rpError bayerfast_demosaic(int width, int height, const float * const *rawData,
         #pragma omp barrier
 #endif
         if (!rc) {
-            char *data = (char*)((uintptr_t(buffer) + uintptr_t(63)) / 64 * 64);
+            char *data = buffer.data();
 
             float * const greentile = (float (*)) data; //pointers to array
             float * const redtile   = (float (*)) ((char*)greentile + sizeof(float) * TS * TS + CLF * 64);
             float * const bluetile  = (float (*)) ((char*)redtile + sizeof(float) * TS * TS + CLF * 64);
 
-            int progressCounter = 0;
-            const double progressInc = 16.0 * (1.0 - progress) / ((H * W) / ((TS - 4) * (TS - 4)));
+            StageClock clock(timer);
 
 #ifdef _OPENMP
             #pragma omp for nowait
@@ -97,10 +113,14 @@ rpError bayerfast_demosaic(int width, int height, const float * const *rawData,
 
             for (int top = bord - 2; top < H - bord + 2; top += TS - 4)
                 for (int left = bord - 2; left < W - bord + 2; left += TS - 4) {
+                    if (tileProgress.cancelled()) {
+                        continue;
+                    }
                     const int bottom = min(top + TS, H - bord + 2);
                     const int right  = min(left + TS, W - bord + 2);
+                    clock.start();
 
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                     const vfloat c16v = F2V(16.0f);
                     const vfloat fourv = F2V(4.0f);
                     vmask selmask;
@@ -118,18 +138,18 @@ rpError bayerfast_demosaic(int width, int height, const float * const *rawData,
                     for (int i = top, rr = 0; i < bottom; i++, rr++) {
                         int j = left;
                         int cc = 0;
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                         selmask = (vmask)_mm_andnot_ps((vfloat)selmask, (vfloat)andmask);
 
                         for (; j < right - 3; j += 4, cc += 4) {
-                            const vfloat tempv = LVFU(rawData[i][j]);
-                            const vfloat absv = vabsf(LVFU(rawData[i - 1][j]) - LVFU(rawData[i + 1][j]));
-                            const vfloat wtuv = INVGRADV(absv + vabsf(tempv - LVFU(rawData[i - 2][j])) + vabsf(LVFU(rawData[i - 1][j]) - LVFU(rawData[i - 3][j])));
-                            const vfloat wtdv = INVGRADV(absv + vabsf(tempv - LVFU(rawData[i + 2][j])) + vabsf(LVFU(rawData[i + 1][j]) - LVFU(rawData[i + 3][j])));
-                            const vfloat abs2v = vabsf(LVFU(rawData[i][j - 1]) - LVFU(rawData[i][j + 1]));
-                            const vfloat wtlv = INVGRADV(abs2v + vabsf(tempv - LVFU(rawData[i][j - 2])) + vabsf(LVFU(rawData[i][j - 1]) - LVFU(rawData[i][j - 3])));
-                            const vfloat wtrv = INVGRADV(abs2v + vabsf(tempv - LVFU(rawData[i][j + 2])) + vabsf(LVFU(rawData[i][j + 1]) - LVFU(rawData[i][j + 3])));
-                            const vfloat greenv = (wtuv * LVFU(rawData[i - 1][j]) + wtdv * LVFU(rawData[i + 1][j]) + wtlv * LVFU(rawData[i][j - 1]) + wtrv * LVFU(rawData[i][j + 1])) / (wtuv + wtdv + wtlv + wtrv);
+                            const vfloat tempv = LVFRAW(rawData[i][j]);
+                            const vfloat absv = vabsf(LVFRAW(rawData[i - 1][j]) - LVFRAW(rawData[i + 1][j]));
+                            const vfloat wtuv = INVGRADV(absv + vabsf(tempv - LVFRAW(rawData[i - 2][j])) + vabsf(LVFRAW(rawData[i - 1][j]) - LVFRAW(rawData[i - 3][j])));
+                            const vfloat wtdv = INVGRADV(absv + vabsf(tempv - LVFRAW(rawData[i + 2][j])) + vabsf(LVFRAW(rawData[i + 1][j]) - LVFRAW(rawData[i + 3][j])));
+                            const vfloat abs2v = vabsf(LVFRAW(rawData[i][j - 1]) - LVFRAW(rawData[i][j + 1]));
+                            const vfloat wtlv = INVGRADV(abs2v + vabsf(tempv - LVFRAW(rawData[i][j - 2])) + vabsf(LVFRAW(rawData[i][j - 1]) - LVFRAW(rawData[i][j - 3])));
+                            const vfloat wtrv = INVGRADV(abs2v + vabsf(tempv - LVFRAW(rawData[i][j + 2])) + vabsf(LVFRAW(rawData[i][j + 1]) - LVFRAW(rawData[i][j + 3])));
+                            const vfloat greenv = (wtuv * LVFRAW(rawData[i - 1][j]) + wtdv * LVFRAW(rawData[i + 1][j]) + wtlv * LVFRAW(rawData[i][j - 1]) + wtrv * LVFRAW(rawData[i][j + 1])) / (wtuv + wtdv + wtlv + wtrv);
                             STVF(greentile[rr * TS + cc], vself(selmask, greenv, tempv));
                             STVF(redtile[rr * TS + cc], tempv);
                             STVF(bluetile[rr * TS + cc], tempv);
@@ -142,10 +162,10 @@ rpError bayerfast_demosaic(int width, int height, const float * const *rawData,
 
                             } else {
                                 //compute directional weights using image gradients
-                                const float wtu = INVGRAD((std::fabs(rawData[i + 1][j] - rawData[i - 1][j]) + std::fabs(rawData[i][j] - rawData[i - 2][j]) + std::fabs(rawData[i - 1][j] - rawData[i - 3][j])));
-                                const float wtd = INVGRAD((std::fabs(rawData[i - 1][j] - rawData[i + 1][j]) + std::fabs(rawData[i][j] - rawData[i + 2][j]) + std::fabs(rawData[i + 1][j] - rawData[i + 3][j])));
-                                const float wtl = INVGRAD((std::fabs(rawData[i][j + 1] - rawData[i][j - 1]) + std::fabs(rawData[i][j] - rawData[i][j - 2]) + std::fabs(rawData[i][j - 1] - rawData[i][j - 3])));
-                                const float wtr = INVGRAD((std::fabs(rawData[i][j - 1] - rawData[i][j + 1]) + std::fabs(rawData[i][j] - rawData[i][j + 2]) + std::fabs(rawData[i][j + 1] - rawData[i][j + 3])));
+                                const float wtu = INVGRAD((fabsf(rawData[i + 1][j] - rawData[i - 1][j]) + fabsf(rawData[i][j] - rawData[i - 2][j]) + fabsf(rawData[i - 1][j] - rawData[i - 3][j])));
+                                const float wtd = INVGRAD((fabsf(rawData[i - 1][j] - rawData[i + 1][j]) + fabsf(rawData[i][j] - rawData[i + 2][j]) + fabsf(rawData[i + 1][j] - rawData[i + 3][j])));
+                                const float wtl = INVGRAD((fabsf(rawData[i][j + 1] - rawData[i][j - 1]) + fabsf(rawData[i][j] - rawData[i][j - 2]) + fabsf(rawData[i][j - 1] - rawData[i][j - 3])));
+                                const float wtr = INVGRAD((fabsf(rawData[i][j - 1] - rawData[i][j + 1]) + fabsf(rawData[i][j] - rawData[i][j + 2]) + fabsf(rawData[i][j + 1] - rawData[i][j + 3])));
 
                                 //store in rgb array the interpolated G value at R/B grid points using directional weighted average
                                 greentile[rr * TS + cc] = (wtu * rawData[i - 1][j] + wtd * rawData[i + 1][j] + wtl * rawData[i][j - 1] + wtr * rawData[i][j + 1]) / (wtu + wtd + wtl + wtr);
@@ -156,18 +176,18 @@ rpError bayerfast_demosaic(int width, int height, const float * const *rawData,
                         }
                     }
 
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                     const vfloat zd25v = F2V(0.25f);
                     const vfloat clip_ptv = F2V(clip_pt);
 #endif
 
                     for (int i = top + 1, rr = 1; i < bottom - 1; i++, rr++) {
                         if (fc(cfarray, i, left + (fc(cfarray, i, 2) & 1) + 1) == 0)
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                             for (int j = left + 1, cc = 1; j < right - 1; j += 4, cc += 4) {
                                 //interpolate B/R colors at R/B sites
                                 STVFU(bluetile[rr * TS + cc], LVFU(greentile[rr * TS + cc]) - zd25v * ((LVFU(greentile[(rr - 1)*TS + (cc - 1)]) + LVFU(greentile[(rr - 1)*TS + (cc + 1)]) + LVFU(greentile[(rr + 1)*TS + cc + 1]) + LVFU(greentile[(rr + 1)*TS + cc - 1])) -
-                                              vminf(LVFU(rawData[i - 1][j - 1]) + LVFU(rawData[i - 1][j + 1]) + LVFU(rawData[i + 1][j + 1]) + LVFU(rawData[i + 1][j - 1]), clip_ptv)));
+                                              vminf(LVFRAW(rawData[i - 1][j - 1]) + LVFRAW(rawData[i - 1][j + 1]) + LVFRAW(rawData[i + 1][j + 1]) + LVFRAW(rawData[i + 1][j - 1]), clip_ptv)));
                             }
 
 #else
@@ -180,11 +200,11 @@ rpError bayerfast_demosaic(int width, int height, const float * const *rawData,
 
 #endif
                         else
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                             for (int j = left + 1, cc = 1; j < right - 1; j += 4, cc += 4) {
                                 //interpolate B/R colors at R/B sites
                                 STVFU(redtile[rr * TS + cc], LVFU(greentile[rr * TS + cc]) - zd25v * ((LVFU(greentile[(rr - 1)*TS + cc - 1]) + LVFU(greentile[(rr - 1)*TS + cc + 1]) + LVFU(greentile[(rr + 1)*TS + cc + 1]) + LVFU(greentile[(rr + 1)*TS + cc - 1])) -
-                                              vminf(LVFU(rawData[i - 1][j - 1]) + LVFU(rawData[i - 1][j + 1]) + LVFU(rawData[i + 1][j + 1]) + LVFU(rawData[i + 1][j - 1]), clip_ptv)));
+                                              vminf(LVFRAW(rawData[i - 1][j - 1]) + LVFRAW(rawData[i - 1][j + 1]) + LVFRAW(rawData[i + 1][j + 1]) + LVFRAW(rawData[i + 1][j - 1]), clip_ptv)));
                             }
 
 #else
@@ -199,13 +219,15 @@ rpError bayerfast_demosaic(int width, int height, const float * const *rawData,
                     }
 
 
-#ifdef __SSE2__
+                    clock.lap("green interpolation");
+
+#ifdef RT_VECTOR
                     selmask = _mm_set_epi32(0xffffffff, 0, 0xffffffff, 0);
 #endif
 
                     // interpolate R/B using color differences
                     for (int i = top + 2, rr = 2; i < bottom - 2; i++, rr++) {
-#ifdef __SSE2__
+#ifdef RT_VECTOR
 
                         for (int cc = 2 + (fc(cfarray, i, 2) & 1), j = left + cc; j < right - 2; j += 4, cc += 4) {
                             // no need to take care about the borders of the tile. There's enough free space.
@@ -237,12 +259,12 @@ rpError bayerfast_demosaic(int width, int height, const float * const *rawData,
 
 #endif
                     }
-
+                    clock.lap("red and blue interpolation");
 
                     for (int i = top + 2, rr = 2; i < bottom - 2; i++, rr++) {
                         int j = left + 2;
                         int cc = 2;
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                         for (; j < right - 5; j += 4, cc += 4) {
                             STVFU(red[i][j], LVFU(redtile[rr * TS + cc]));
                             STVFU(green[i][j], LVFU(greentile[rr * TS + cc]));
@@ -255,25 +277,40 @@ rpError bayerfast_demosaic(int width, int height, const float * const *rawData,
                             blue[i][j] = bluetile[rr * TS + cc];
                         }
                     }
-
-                    if((++progressCounter) % 16 == 0) {
-#ifdef _OPENMP
-                        #pragma omp critical (updateprogress)
-#endif
-                        {
-                            progress += progressInc;
-                            progress = min(1.0, progress);
-                            setProgCancel(progress);
-                        }
-                    }
+                    clock.lap("output");
+                    tileProgress.done();
                 }
             }
-        free(buffer);
     } // End of parallelization
 
+    if (!rc && tileProgress.cancelled()) {
+        return RP_CANCELLED;
+    }
     setProgCancel(1.0);
     return rc;
 
 }
+
+}
+
+rpError bayerfast_demosaic(int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double initGain)
+{
+    return bayerfast_demosaic_impl(nullptr, width, height, rawData, red, green, blue, cfarray, setProgCancel, initGain);
+}
+
+rpError bayerfast_demosaic(rpContext &context, int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double initGain)
+{
+    return bayerfast_demosaic_impl(&context, width, height, rawData, red, green, blue, cfarray, setProgCancel, initGain);
+}
+
+rpError bayerfast_demosaic(int width, int height, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double initGain)
+{
+    return bayerfast_demosaic_impl(nullptr, width, height, rawData, red, green, blue, cfarray, setProgCancel, initGain);
+}
+
+rpError bayerfast_demosaic(rpContext &context, int width, int height, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double initGain)
+{
+    return bayerfast_demosaic_impl(&context, width, height, rawData, red, green, blue, cfarray, setProgCancel, initGain);
+}
 #undef TS
 #undef CLF
@@ -17,26 +17,27 @@
  *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <algorithm>
+#include <vector>
 
 #include "bayerhelper.h"
 #include "librtprocess.h"
+#include "rgboutput.h"
 #include "StopWatch.h"
 #include "xtranshelper.h"
 
 using namespace librtprocess;
 
-rpError bayerborder_demosaic(int winw, int winh, int lborders, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2])
+namespace librtprocess
 {
-    BENCHFUN
-    if (!validateBayerCfa(3, cfarray)) {
-        return RP_WRONG_CFA;
-    }
 
+template<typename T>
+void bayerborder_demosaic_rows(int winw, int winh, int lborders, int rowStart, int rowEnd, const T * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2])
+{
     int bord = lborders;
     int width = winw;
     int height = winh;
 
-    for (int i = 0; i < height; i++) {
+    for (int i = rowStart; i < rowEnd; i++) {
 
         float sum[6];
 
@@ -107,7 +108,7 @@ rpError bayerborder_demosaic(int winw, int winh, int lborders, const float * con
         }//j
     }//i
 
-    for (int i = 0; i < bord; i++) {
+    for (int i = rowStart; i < std::min(bord, rowEnd); i++) {
 
         float sum[6];
 
@@ -145,7 +146,7 @@ rpError bayerborder_demosaic(int winw, int winh, int lborders, const float * con
         }//j
     }
 
-    for (int i = height - bord; i < height; i++) {
+    for (int i = std::max(height - bord, rowStart); i < rowEnd; i++) {
 
         float sum[6];
 
@@ -182,13 +183,11 @@ rpError bayerborder_demosaic(int winw, int winh, int lborders, const float * con
             }
         }//j
     }
-
-    return RP_NO_ERROR;
 }
 
-void xtransborder_demosaic(int winw, int winh, int border, const float * const *rawData, float **red, float **green, float **blue, const unsigned xtrans[6][6])
+template<typename T>
+void xtransborder_demosaic_rows(int winw, int winh, int border, int rowStart, int rowEnd, const T * const *rawData, float **red, float **green, float **blue, const unsigned xtrans[6][6])
 {
-    BENCHFUN
     const int height = winh, width = winw;
 
     const float weight[3][3] = {
@@ -197,7 +196,7 @@ void xtransborder_demosaic(int winw, int winh, int border, const float * const *
                                 {0.25f, 0.5f, 0.25f}
                                };
 
-    for (int row = 0; row < height; row++) {
+    for (int row = rowStart; row < rowEnd; row++) {
         for (int col = 0; col < width; col++) {
             if (col == border && row >= border && row < height - border) {
                 col = width - border;
@@ -238,3 +237,97 @@ void xtransborder_demosaic(int winw, int winh, int border, const float * const *
         }
     }
 }
+
+template<typename Rows>
+void borderToOutput(int width, int height, int border, int rowStart, int rowEnd, const rpOutput &output, const Rows &borderRows)
+{
+    // the border functions write only the border pixels of row i to red[i], green[i] and blue[i], so all rows can share one buffer
+    std::vector<float> buffer(3 * width);
+    std::vector<float*> red(height, buffer.data());
+    std::vector<float*> green(height, buffer.data() + width);
+    std::vector<float*> blue(height, buffer.data() + 2 * width);
+
+    for (int row = rowStart; row < rowEnd; ++row) {
+        borderRows(row, red.data(), green.data(), blue.data());
+        if (row < border || row >= height - border) {
+            writeOutputRow(output, row, 0, width, red[row], green[row], blue[row]);
+        } else {
+            writeOutputRow(output, row, 0, border, red[row], green[row], blue[row]);
+            writeOutputRow(output, row, width - border, border, red[row] + width - border, green[row] + width - border, blue[row] + width - border);
+        }
+    }
+}
+
+template<typename T>
+void bayerborder_demosaic_rows(int winw, int winh, int lborders, int rowStart, int rowEnd, const T * const *rawData, const rpOutput &output, const unsigned cfarray[2][2])
+{
+    if (isPlanar(output)) {
+        bayerborder_demosaic_rows(winw, winh, lborders, rowStart, rowEnd, rawData, output.red, output.green, output.blue, cfarray);
+    } else {
+        borderToOutput(winw, winh, lborders, rowStart, rowEnd, output, [&](int row, float **red, float **green, float **blue) {
+            bayerborder_demosaic_rows(winw, winh, lborders, row, row + 1, rawData, red, green, blue, cfarray);
+        });
+    }
+}
+
+template<typename T>
+void xtransborder_demosaic_rows(int winw, int winh, int border, int rowStart, int rowEnd, const T * const *rawData, const rpOutput &output, const unsigned xtrans[6][6])
+{
+    if (isPlanar(output)) {
+        xtransborder_demosaic_rows(winw, winh, border, rowStart, rowEnd, rawData, output.red, output.green, output.blue, xtrans);
+    } else {
+        borderToOutput(winw, winh, border, rowStart, rowEnd, output, [&](int row, float **red, float **green, float **blue) {
+            xtransborder_demosaic_rows(winw, winh, border, row, row + 1, rawData, red, green, blue, xtrans);
+        });
+    }
+}
+
+template void bayerborder_demosaic_rows<float>(int winw, int winh, int lborders, int rowStart, int rowEnd, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2]);
+template void bayerborder_demosaic_rows<uint16_t>(int winw, int winh, int lborders, int rowStart, int rowEnd, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2]);
+template void bayerborder_demosaic_rows<float>(int winw, int winh, int lborders, int rowStart, int rowEnd, const float * const *rawData, const rpOutput &output, const unsigned cfarray[2][2]);
+template void bayerborder_demosaic_rows<uint16_t>(int winw, int winh, int lborders, int rowStart, int rowEnd, const uint16_t * const *rawData, const rpOutput &output, const unsigned cfarray[2][2]);
+template void xtransborder_demosaic_rows<float>(int winw, int winh, int border, int rowStart, int rowEnd, const float * const *rawData, const rpOutput &output, const unsigned xtrans[6][6]);
+template void xtransborder_demosaic_rows<uint16_t>(int winw, int winh, int border, int rowStart, int rowEnd, const uint16_t * const *rawData, const rpOutput &output, const unsigned xtrans[6][6]);
+
+}
+
+namespace
+{
+
+template<typename T>
+rpError bayerborder_demosaic_impl(int winw, int winh, int lborders, const T * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2])
+{
+    BENCHFUN
+    if (!validateBayerCfa(3, cfarray)) {
+        return RP_WRONG_CFA;
+    }
+
+    bayerborder_demosaic_rows(winw, winh, lborders, 0, winh, rawData, red, green, blue, cfarray);
+
+    return RP_NO_ERROR;
+}
+
+
+}
+
+rpError bayerborder_demosaic(int winw, int winh, int lborders, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2])
+{
+    return bayerborder_demosaic_impl(winw, winh, lborders, rawData, red, green, blue, cfarray);
+}
+
+rpError bayerborder_demosaic(int winw, int winh, int lborders, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2])
+{
+    return bayerborder_demosaic_impl(winw, winh, lborders, rawData, red, green, blue, cfarray);
+}
+
+void xtransborder_demosaic(int winw, int winh, int border, const float * const *rawData, float **red, float **green, float **blue, const unsigned xtrans[6][6])
+{
+    BENCHFUN
+    xtransborder_demosaic_rows(winw, winh, border, 0, winh, rawData, red, green, blue, xtrans);
+}
+
+void xtransborder_demosaic(int winw, int winh, int border, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned xtrans[6][6])
+{
+    BENCHFUN
+    xtransborder_demosaic_rows(winw, winh, border, 0, winh, rawData, red, green, blue, xtrans);
+}
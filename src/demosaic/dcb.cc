@@ -98,7 +98,8 @@ inline void dcb_initTileLimits(int W, int H, int &colMin, int &rowMin, int &colM
     }
 }
 
-void fill_raw(int W, int H, float (*cache )[3], int x0, int y0, const float * const *rawData, const unsigned cfarray[2][2])
+template<typename T>
+void fill_raw(int W, int H, float (*cache )[3], int x0, int y0, const T * const *rawData, const unsigned cfarray[2][2])
 {
     int rowMin, colMin, rowMax, colMax;
     dcb_initTileLimits(W, H, colMin, rowMin, colMax, rowMax, x0, y0, 0);
@@ -507,10 +508,9 @@ void dcb_color_full(int W, int H, float (*image)[3], int x0, int y0, float (*chr
         }
 }
 
-}
-
 // DCB demosaicing main routine
-rpError dcb_demosaic(int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, int iterations, bool dcb_enhance)
+template<typename T>
+rpError dcb_demosaic_impl(int width, int height, const T * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, int iterations, bool dcb_enhance)
 {
 BENCHFUN
     if (!validateBayerCfa(3, cfarray)) {
@@ -645,8 +645,19 @@ BENCHFUN
     return rc;
 }
 
+}
+
 #undef TILEBORDER
 #undef TILESIZE
 #undef CACHESIZE
 #undef FORCC
 
+rpError dcb_demosaic(int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, int iterations, bool dcb_enhance)
+{
+    return dcb_demosaic_impl(width, height, rawData, red, green, blue, cfarray, setProgCancel, iterations, dcb_enhance);
+}
+
+rpError dcb_demosaic(int width, int height, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, int iterations, bool dcb_enhance)
+{
+    return dcb_demosaic_impl(width, height, rawData, red, green, blue, cfarray, setProgCancel, iterations, dcb_enhance);
+}
@@ -33,7 +33,8 @@ using namespace librtprocess;
 
 namespace {
 
-rpError hphd_vertical(const float * const *rawData, float** hpmap, int col_from, int col_to, int H)
+template<typename T>
+rpError hphd_vertical(const T * const *rawData, float** hpmap, int col_from, int col_to, int H)
 {
 
     // process 'numCols' columns for better usage of L1 cpu cache (especially faster for large values of H)
@@ -48,7 +49,7 @@ rpError hphd_vertical(const float * const *rawData, float** hpmap, int col_from,
     }
 
     int k = col_from;
-#ifdef __SSE2__
+#ifdef RT_VECTOR
     const vfloat ninev = F2V(9.f);
     const vfloat epsv = F2V(0.001f);
 #endif
@@ -63,7 +64,7 @@ rpError hphd_vertical(const float * const *rawData, float** hpmap, int col_from,
         }
 
         for (int j = 4; j < H - 4; j++) {
-#ifdef __SSE2__
+#ifdef RT_VECTOR
             // faster than #pragma omp simd...
             const vfloat avgL1 = ((LVFU(temp[j - 4][0]) + LVFU(temp[j - 3][0])) + (LVFU(temp[j - 2][0]) + LVFU(temp[j - 1][0])) + (LVFU(temp[j][0]) + LVFU(temp[j + 1][0])) + (LVFU(temp[j + 2][0]) + LVFU(temp[j + 3][0])) + LVFU(temp[j + 4][0])) / ninev;
             STVFU(avg[j][0], avgL1);
@@ -119,7 +120,8 @@ rpError hphd_vertical(const float * const *rawData, float** hpmap, int col_from,
     return RP_NO_ERROR;
 }
 
-rpError hphd_horizontal(const float * const *rawData, float** hpmap, int row_from, int row_to, int W)
+template<typename T>
+rpError hphd_horizontal(const T * const *rawData, float** hpmap, int row_from, int row_to, int W)
 {
 
     float* temp = new (std::nothrow) float[W] ();
@@ -131,7 +133,7 @@ rpError hphd_horizontal(const float * const *rawData, float** hpmap, int row_fro
         rc = RP_MEMORY_ERROR;
     } else {
 
-#ifdef __SSE2__
+#ifdef RT_VECTOR
         const vfloat onev = F2V(1.f);
         const vfloat twov = F2V(2.f);
         const vfloat zd8v = F2V(0.8f);
@@ -154,7 +156,7 @@ rpError hphd_horizontal(const float * const *rawData, float** hpmap, int row_fro
             }
 
             int j = 5;
-#ifdef __SSE2__
+#ifdef RT_VECTOR
             // faster than #pragma omp simd
             for (; j < W - 8; j+=4) {
                 const vfloat avgL = LVFU(avg[j - 1]);
@@ -193,7 +195,8 @@ rpError hphd_horizontal(const float * const *rawData, float** hpmap, int row_fro
     return rc;
 }
 
-rpError hphd_RedGreenBlue(const float * const *rawData, const unsigned cfarray[2][2], const float * const *hpmap, int W, int H, float **red, float **green, float **blue)
+template<typename T>
+rpError hphd_RedGreenBlue(const T * const *rawData, const unsigned cfarray[2][2], const float * const *hpmap, int W, int H, float **red, float **green, float **blue)
 {
 
     rpError rc = RP_NO_ERROR;
@@ -321,10 +324,8 @@ rpError hphd_RedGreenBlue(const float * const *rawData, const unsigned cfarray[2
     return rc;
 }
 
-}
-
-
-rpError hphd_demosaic(int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel)
+template<typename T>
+rpError hphd_demosaic_impl(int width, int height, const T * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel)
 {
     BENCHFUN
     if (!validateBayerCfa(3, cfarray)) {
@@ -397,3 +398,14 @@ rpError hphd_demosaic(int width, int height, const float * const *rawData, float
     return rc;
 }
 
+}
+
+rpError hphd_demosaic(int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel)
+{
+    return hphd_demosaic_impl(width, height, rawData, red, green, blue, cfarray, setProgCancel);
+}
+
+rpError hphd_demosaic(int width, int height, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel)
+{
+    return hphd_demosaic_impl(width, height, rawData, red, green, blue, cfarray, setProgCancel);
+}
@@ -41,9 +41,14 @@ using namespace librtprocess;
 ***/
 // Adapted to RawTherapee by Jacques Desmis 3/2013
 // SSE version by Ingo Weyrich 5/2013
-#ifdef __SSE2__
+#ifdef RT_VECTOR
 #define CLIPV(a) LIMV(a,zerov,c65535v)
-rpError igv_demosaic(int winw, int winh, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel)
+namespace
+{
+
+template<typename T>
+TARGET_CLONES
+rpError igv_demosaic_impl(int winw, int winh, const T * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel)
 {
     BENCHFUN
     if (!validateBayerCfa(3, cfarray)) {
@@ -130,8 +135,8 @@ rpError igv_demosaic(int winw, int winh, const float * const *rawData, float **r
             int col, indx;
 
             for (col = 0, indx = row * width + col; col < width - 7; col += 8, indx += 8) {
-                temp1v = CLIPV(LVFU(rawData[row][col]));
-                temp2v = CLIPV(LVFU(rawData[row][col + 4]));
+                temp1v = CLIPV(LVFRAW(rawData[row][col]));
+                temp2v = CLIPV(LVFRAW(rawData[row][col + 4]));
                 STVFU(dest1[indx >> 1], _mm_shuffle_ps(temp1v, temp2v, _MM_SHUFFLE(2, 0, 2, 0)));
                 STVFU(dest2[indx >> 1], _mm_shuffle_ps(temp1v, temp2v, _MM_SHUFFLE(3, 1, 3, 1)));
             }
@@ -437,9 +442,15 @@ rpError igv_demosaic(int winw, int winh, const float * const *rawData, float **r
 
     return rc;
 }
+
+}
 #undef CLIPV
 #else
-rpError igv_demosaic(int winw, int winh, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel)
+namespace
+{
+
+template<typename T>
+rpError igv_demosaic_impl(int winw, int winh, const T * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel)
 {
     BENCHFUN
     if (!validateBayerCfa(3, cfarray)) {
@@ -692,5 +703,16 @@ rpError igv_demosaic(int winw, int winh, const float * const *rawData, float **r
 
     return rc;
 }
+
+}
 #endif
 
+rpError igv_demosaic(int winw, int winh, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel)
+{
+    return igv_demosaic_impl(winw, winh, rawData, red, green, blue, cfarray, setProgCancel);
+}
+
+rpError igv_demosaic(int winw, int winh, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel)
+{
+    return igv_demosaic_impl(winw, winh, rawData, red, green, blue, cfarray, setProgCancel);
+}
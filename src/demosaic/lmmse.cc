@@ -38,9 +38,10 @@ namespace {
    Adapted for RawTherapee - Jacques Desmis 04/2013
 */
 
-#ifdef __SSE2__
+#ifdef RT_VECTOR
 #define CLIPV(a) LIMV(a,ZEROV,c65535v)
 #endif
+TARGET_CLONES
 void refinement(int width, int height, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, int PassCount)
 {
 
@@ -67,7 +68,7 @@ BENCHFUN
             for (int row = 2; row < height - 2; row++) {
                 int col = 2 + (fc(cfarray, row, 2) & 1);
                 int c = fc(cfarray, row, col);
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                 vfloat dLv, dRv, dUv, dDv, v0v;
                 const vfloat onev = F2V(1.f);
                 const vfloat zd5v = F2V(0.5f);
@@ -103,7 +104,7 @@ BENCHFUN
             for (int row = 2; row < height - 2; row++) {
                 int col = 2 + (fc(cfarray, row, 3) & 1);
                 int c = fc(cfarray, row, col + 1);
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                 vfloat dLv, dRv, dUv, dDv, v0v;
                 const vfloat onev = F2V(1.f);
                 const vfloat zd5v = F2V(0.5f);
@@ -142,7 +143,7 @@ BENCHFUN
             for (int row = 2; row < height - 2; row++) {
                 int col = 2 + (fc(cfarray, row, 2) & 1);
                 int c = 2 - fc(cfarray, row, col);
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                 vfloat dLv, dRv, dUv, dDv, v0v;
                 const vfloat onev = F2V(1.f);
                 const vfloat zd5v = F2V(0.5f);
@@ -175,7 +176,7 @@ BENCHFUN
 
 }
 }
-#ifdef __SSE2__
+#ifdef RT_VECTOR
 #undef CLIPV
 #endif
 
@@ -187,7 +188,12 @@ BENCHFUN
 // Adapted to RawTherapee by Jacques Desmis 3/2013
 // Improved speed and reduced memory consumption by Ingo Weyrich 2/2015
 //TODO Tiles to reduce memory consumption
-rpError lmmse_demosaic(int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, int iterations)
+namespace
+{
+
+template<typename T>
+TARGET_CLONES
+rpError lmmse_demosaic_impl(int width, int height, const T * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, int iterations)
 {
     BENCHFUN
     if (!validateBayerCfa(3, cfarray)) {
@@ -386,7 +392,7 @@ rpError lmmse_demosaic(int width, int height, const float * const *rawData, floa
 
         for (int rr = 4; rr < rr1 - 4; rr++) {
             int cc = 4 + (fc(cfarray, rr, 4) & 1);
-#ifdef __SSE2__
+#ifdef RT_VECTOR
             vfloat p1v, p2v, p3v, p4v, p5v, p6v, p7v, p8v, p9v, muv, vxv, vnv, xhv, vhv, xvv, vvv;
             const vfloat epsv = F2V(1e-7f);
             const vfloat ninev = F2V(9.f);
@@ -612,7 +618,7 @@ rpError lmmse_demosaic(int width, int height, const float * const *rawData, floa
             for (int c = 0; c < 3; c += 2) {
                 int d = c + 3 - (c == 0 ? 0 : 1);
                 int cc = 1;
-#ifdef __SSE2__
+#ifdef RT_VECTOR
 
                 for (; cc < cc1 - 4; cc += 4) {
                     rix[d] = qix[d] + rr * cc1 + cc;
@@ -780,3 +786,14 @@ rpError lmmse_demosaic(int width, int height, const float * const *rawData, floa
     return RP_NO_ERROR;
 }
 
+}
+
+rpError lmmse_demosaic(int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, int iterations)
+{
+    return lmmse_demosaic_impl(width, height, rawData, red, green, blue, cfarray, setProgCancel, iterations);
+}
+
+rpError lmmse_demosaic(int width, int height, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, int iterations)
+{
+    return lmmse_demosaic_impl(width, height, rawData, red, green, blue, cfarray, setProgCancel, iterations);
+}
@@ -27,6 +27,10 @@
 #include "sleef.h"
 #include "rt_math.h"
 #include "opthelper.h"
+#include "progress.h"
+#include "rgboutput.h"
+#include "scratch.h"
+#include "stagetimer.h"
 #include "StopWatch.h"
 #include "xtranshelper.h"
 
@@ -62,7 +66,7 @@ void cielab (const float (*rgb)[3], float* l, float* a, float *b, const int widt
         return;
     }
 
-#ifdef __SSE2__
+#ifdef RT_VECTOR
     vfloat c116v = F2V(116.f);
     vfloat c16v = F2V(16.f);
     vfloat c500v = F2V(500.f);
@@ -74,11 +78,11 @@ void cielab (const float (*rgb)[3], float* l, float* a, float *b, const int widt
             xyz_camv[i][j] = F2V(xyz_cam[i][j]);
         }
 
-#endif // __SSE2__
+#endif // RT_VECTOR
 
     for(int i = 0; i < height; i++) {
         int j = 0;
-#ifdef __SSE2__
+#ifdef RT_VECTOR
 
         for(; j < labWidth - 3; j += 4) {
             vfloat redv, greenv, bluev;
@@ -126,7 +130,12 @@ void cielab (const float (*rgb)[3], float* l, float* a, float *b, const int widt
 */
 
 using namespace librtprocess;
-rpError markesteijn_demosaic (int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned xtrans[6][6], const float rgb_cam[3][4], const std::function<bool(double)> &setProgCancel, const int passes, const bool useCieLab, std::size_t chunkSize, bool measure)
+namespace
+{
+
+template<typename T>
+TARGET_CLONES
+rpError markesteijn_demosaic_impl(rpContext *context, int width, int height, const T * const *rawData, const rpOutput &output, const unsigned xtrans[6][6], const float rgb_cam[3][4], const std::function<bool(double)> &setProgCancel, const int passes, const bool useCieLab, std::size_t chunkSize, bool measure)
 {
     BENCHFUN
     std::unique_ptr<StopWatch> stop;
@@ -135,6 +144,8 @@ rpError markesteijn_demosaic (int width, int height, const float * const *rawDat
         std::cout << passes << "-pass Markesteijn Demosaicing " << width << "x" << height << " image with " << chunkSize << " tiles per thread" << std::endl;
         stop.reset(new StopWatch("xtrans demosaic"));
     }
+
+    StageTimer timer(context, "markesteijn");
     if (!validateXtransCfa(xtrans)) {
         return RP_WRONG_CFA;
     }
@@ -143,6 +154,7 @@ rpError markesteijn_demosaic (int width, int height, const float * const *rawDat
 
     constexpr int ts = 114;      /* Tile Size */
     constexpr int tsh = ts / 2;  /* half of Tile Size */
+    const bool planar = isPlanar(output);
 
     double progress = 0.0;
     setProgCancel(progress);
@@ -207,8 +219,9 @@ rpError markesteijn_demosaic (int width, int height, const float * const *rawDat
     progress += 0.05;
     setProgCancel(progress);
 
-
-    double progressInc = 36.0 * (1.0 - progress) / ((height * width) / ((ts - 16) * (ts - 16)));
+    const int numTileRows = std::max((height - 22 + ts - 17) / (ts - 16), 0);
+    const int numTileCols = std::max((width - 22 + ts - 17) / (ts - 16), 0);
+    Progress tileProgress(setProgCancel, numTileRows * numTileCols, progress);
     const int ndir = 4 << (passes > 1);
     cielab (nullptr, nullptr, nullptr, nullptr, 0, 0, 0, nullptr);
     struct s_minmaxgreen {
@@ -233,10 +246,10 @@ rpError markesteijn_demosaic (int width, int height, const float * const *rawDat
     #pragma omp parallel
 #endif
     {
-        int progressCounter = 0;
         float dcolor[3][6];
 
-        float *buffer = (float *) malloc ((ts * ts * (ndir * 4 + 3) + 128) * sizeof(float));
+        const ScratchBuffer scratch(context, (ts * ts * (ndir * 4 + 3) + 128) * sizeof(float));
+        float *buffer = (float*) scratch.data();
 
 #ifdef _OPENMP
         #pragma omp critical
@@ -257,6 +270,9 @@ rpError markesteijn_demosaic (int width, int height, const float * const *rawDat
             s_minmaxgreen  (*greenminmaxtile)[tsh] = (s_minmaxgreen(*)[tsh]) (lab); // we can reuse the lab-buffer because they are not used together
             uint8_t (*homosum)[ts][ts] = (uint8_t (*)[ts][ts]) (drv); // we can reuse the drv-buffer because they are not used together
             uint8_t (*homosummax)[ts] = (uint8_t (*)[ts]) homo[ndir - 1]; // we can reuse the homo-buffer because they are not used together
+            // one output row for the interleaved layouts, planar outputs are written in place
+            float outRow[3][ts];
+            StageClock clock(timer);
 
 #ifdef _OPENMP
             #pragma omp for collapse(2) schedule(dynamic, chunkSize) nowait
@@ -264,6 +280,10 @@ rpError markesteijn_demosaic (int width, int height, const float * const *rawDat
 
             for (int top = 3; top < height - 19; top += ts - 16)
                 for (int left = 3; left < width - 19; left += ts - 16) {
+                    if (tileProgress.cancelled()) {
+                        continue;
+                    }
+                    clock.start();
                     int mrow = std::min(top + ts, height - 3);
                     int mcol = std::min(left + ts, width - 3);
 
@@ -285,7 +305,7 @@ rpError markesteijn_demosaic (int width, int height, const float * const *rawDat
                             for (int col = leftstart; col < mcol; col += coloffset) {
                                 float minval = FLT_MAX;
                                 float maxval = 0.f;
-                                const float *pix = &rawData[row][col];
+                                const T *pix = &rawData[row][col];
 
                                 for(int c = 0; c < 6; c++) {
                                     float val = pix[hex[c]];
@@ -305,7 +325,7 @@ rpError markesteijn_demosaic (int width, int height, const float * const *rawDat
                             if(coloffset == 2) {
                                 minval = FLT_MAX;
                                 maxval = 0.f;
-                                const float *pix = &rawData[row][col];
+                                const T *pix = &rawData[row][col];
                                 short *hex = allhex[0][row % 3][col % 3];
 
                                 for(int c = 0; c < 6; c++) {
@@ -325,7 +345,7 @@ rpError markesteijn_demosaic (int width, int height, const float * const *rawDat
                             for (; col < mcol - 1; col += 3) {
                                 minval = FLT_MAX;
                                 maxval = 0.f;
-                                const float *pix = &rawData[row][col];
+                                const T *pix = &rawData[row][col];
 
                                 for(int c = 0; c < 6; c++) {
                                     float val = pix[hex[c]];
@@ -343,7 +363,7 @@ rpError markesteijn_demosaic (int width, int height, const float * const *rawDat
                             if(col < mcol) {
                                 minval = FLT_MAX;
                                 maxval = 0.f;
-                                const float *pix = &rawData[row][col];
+                                const T *pix = &rawData[row][col];
 
                                 for(int c = 0; c < 6; c++) {
                                     float val = pix[hex[c]];
@@ -385,7 +405,7 @@ rpError markesteijn_demosaic (int width, int height, const float * const *rawDat
                             short *hex = allhex[0][row % 3][leftstart % 3];
 
                             for (int col = leftstart; col < mcol; col += coloffset) {
-                                const float *pix = &rawData[row][col];
+                                const T *pix = &rawData[row][col];
                                 float color[4];
                                 color[0] = 0.6796875f * (pix[hex[1]] + pix[hex[0]]) -
                                            0.1796875f * (pix[2 * hex[1]] + pix[2 * hex[0]]);
@@ -406,7 +426,7 @@ rpError markesteijn_demosaic (int width, int height, const float * const *rawDat
                             hexmod[1] = allhex[0][row % 3][(leftstart + coloffset) % 3];
 
                             for (int col = leftstart, hexindex = 0; col < mcol; col += coloffset, coloffset ^= 3, hexindex ^= 1) {
-                                const float *pix = &rawData[row][col];
+                                const T *pix = &rawData[row][col];
                                 short *hex = hexmod[hexindex];
                                 float color[4];
                                 color[0] = 0.6796875f * (pix[hex[1]] + pix[hex[0]]) -
@@ -601,6 +621,7 @@ rpError markesteijn_demosaic (int width, int height, const float * const *rawDat
                     }
 
     // end of multipass part
+                    clock.lap("interpolation");
                     rgb = (float(*)[ts][ts][3]) buffer;
                     mrow -= top;
                     mcol -= left;
@@ -640,7 +661,7 @@ rpError markesteijn_demosaic (int width, int height, const float * const *rawDat
                         // camera RGB is roughly linear.
                         for (int d = 0; d < ndir; d++) {
                             float (*yuv)[ts - 8][ts - 8] = lab; // we use the lab buffer, which has the same dimensions
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                             vfloat zd2627v = F2V(0.2627f);
                             vfloat zd6780v = F2V(0.6780f);
                             vfloat zd0593v = F2V(0.0593f);
@@ -650,7 +671,7 @@ rpError markesteijn_demosaic (int width, int height, const float * const *rawDat
 
                             for (int row = 4; row < mrow - 4; row++) {
                                 int col = 4;
-#ifdef __SSE2__
+#ifdef RT_VECTOR
 
                                 for (; col < mcol - 7; col += 4) {
                                     // use ITU-R BT.2020 YPbPr, which is great, but could use
@@ -694,8 +715,10 @@ rpError markesteijn_demosaic (int width, int height, const float * const *rawDat
                         }
                     }
 
+                    clock.lap("derivatives");
+
                     /* Build homogeneity maps from the derivatives:         */
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                     vfloat eightv = F2V(8.f);
                     vfloat zerov = F2V(0.f);
                     vfloat onev = F2V(1.f);
@@ -703,7 +726,7 @@ rpError markesteijn_demosaic (int width, int height, const float * const *rawDat
 
                     for (int row = 6; row < mrow - 6; row++) {
                         int col = 6;
-#ifdef __SSE2__
+#ifdef RT_VECTOR
 
                         for (; col < mcol - 9; col += 4) {
                             vfloat tr1v = vminf(LVFU(drv[0][row - 5][col - 5]), LVFU(drv[1][row - 5][col - 5]));
@@ -729,7 +752,7 @@ rpError markesteijn_demosaic (int width, int height, const float * const *rawDat
                                     }
                                 }
 
-                                _mm_storeu_si128((__m128i*)&tempstore, _mm_cvtps_epi32(tempv));
+                                _mm_storeu_si128((vint*)&tempstore, _mm_cvtps_epi32(tempv));
                                 homo[d][row][col] = tempstore[0];
                                 homo[d][row][col + 1] = tempstore[4];
                                 homo[d][row][col + 2] = tempstore[8];
@@ -778,7 +801,7 @@ rpError markesteijn_demosaic (int width, int height, const float * const *rawDat
                     for(int d = 0; d < ndir; d++) {
                         for (int row = std::min(top, 8); row < mrow - 8; row++) {
                             int col = startcol;
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                             int endcol = row < mrow - 9 ? mcol - 8 : mcol - 23;
 
                             // crunching 16 values at once is faster than summing up column sums
@@ -821,13 +844,13 @@ rpError markesteijn_demosaic (int width, int height, const float * const *rawDat
                     }
 
                     // calculate maximum of homogeneity maps per pixel. Vectorized calculation is a tiny bit faster than on the fly calculation in next step
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                     vint maskv = _mm_set1_epi8(31);
 #endif
 
                     for (int row = std::min(top, 8); row < mrow - 8; row++) {
                         int col = startcol;
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                         int endcol = row < mrow - 9 ? mcol - 8 : mcol - 23;
 
                         for (; col < endcol; col += 16) {
@@ -864,10 +887,16 @@ rpError markesteijn_demosaic (int width, int height, const float * const *rawDat
                     }
 
 
+                    clock.lap("homogeneity maps");
+
                     /* Average the most homogeneous pixels for the final result: */
                     uint8_t hm[8] = {};
 
-                    for (int row = std::min(top, 8); row < mrow - 8; row++)
+                    for (int row = std::min(top, 8); row < mrow - 8; row++) {
+                        float *const redRow = planar ? output.red[row + top] + left : outRow[0];
+                        float *const greenRow = planar ? output.green[row + top] + left : outRow[1];
+                        float *const blueRow = planar ? output.blue[row + top] + left : outRow[2];
+
                         for (int col = std::min(left, 8); col < mcol - 8; col++) {
 
                             for (int d = 0; d < 4; d++) {
@@ -896,27 +925,61 @@ rpError markesteijn_demosaic (int width, int height, const float * const *rawDat
                                     avg[3]++;
                                 }
 
-                            red[row + top][col + left] = avg[0] / avg[3];
-                            green[row + top][col + left] = avg[1] / avg[3];
-                            blue[row + top][col + left] = avg[2] / avg[3];
+                            redRow[col] = avg[0] / avg[3];
+                            greenRow[col] = avg[1] / avg[3];
+                            blueRow[col] = avg[2] / avg[3];
                         }
 
-                    if((++progressCounter) % 32 == 0) {
-#ifdef _OPENMP
-                        #pragma omp critical (xtransdemosaic)
-#endif
-                        {
-                            progress += progressInc;
-                            progress = min(1.0, progress);
-                            setProgCancel(progress);
+                        if (!planar) {
+                            const int colStart = std::min(left, 8);
+                            writeOutputRow(output, row + top, colStart + left, mcol - 8 - colStart, outRow[0] + colStart, outRow[1] + colStart, outRow[2] + colStart);
                         }
                     }
-
-
+                    clock.lap("output");
+                    tileProgress.done();
                 }
         }
-        free(buffer);
     }
-    xtransborder_demosaic(width, height, 8, rawData, red, green, blue, xtrans);
+    if (!rc && tileProgress.cancelled()) {
+        return RP_CANCELLED;
+    }
+    StageClock clock(timer);
+    xtransborder_demosaic_rows(width, height, 8, 0, height, rawData, output, xtrans);
+    clock.lap("border");
+
+    setProgCancel(1.0);
+
     return rc;
 }
+
+}
+
+rpError markesteijn_demosaic(int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned xtrans[6][6], const float rgb_cam[3][4], const std::function<bool(double)> &setProgCancel, const int passes, const bool useCieLab, std::size_t chunkSize, bool measure)
+{
+    return markesteijn_demosaic_impl(nullptr, width, height, rawData, rpOutput(red, green, blue), xtrans, rgb_cam, setProgCancel, passes, useCieLab, chunkSize, measure);
+}
+
+rpError markesteijn_demosaic(rpContext &context, int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned xtrans[6][6], const float rgb_cam[3][4], const std::function<bool(double)> &setProgCancel, const int passes, const bool useCieLab, std::size_t chunkSize, bool measure)
+{
+    return markesteijn_demosaic_impl(&context, width, height, rawData, rpOutput(red, green, blue), xtrans, rgb_cam, setProgCancel, passes, useCieLab, chunkSize, measure);
+}
+
+rpError markesteijn_demosaic(int width, int height, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned xtrans[6][6], const float rgb_cam[3][4], const std::function<bool(double)> &setProgCancel, const int passes, const bool useCieLab, std::size_t chunkSize, bool measure)
+{
+    return markesteijn_demosaic_impl(nullptr, width, height, rawData, rpOutput(red, green, blue), xtrans, rgb_cam, setProgCancel, passes, useCieLab, chunkSize, measure);
+}
+
+rpError markesteijn_demosaic(rpContext &context, int width, int height, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned xtrans[6][6], const float rgb_cam[3][4], const std::function<bool(double)> &setProgCancel, const int passes, const bool useCieLab, std::size_t chunkSize, bool measure)
+{
+    return markesteijn_demosaic_impl(&context, width, height, rawData, rpOutput(red, green, blue), xtrans, rgb_cam, setProgCancel, passes, useCieLab, chunkSize, measure);
+}
+
+rpError markesteijn_demosaic(rpContext &context, int width, int height, const float * const *rawData, const rpOutput &output, const unsigned xtrans[6][6], const float rgb_cam[3][4], const std::function<bool(double)> &setProgCancel, const int passes, const bool useCieLab, std::size_t chunkSize)
+{
+    return markesteijn_demosaic_impl(&context, width, height, rawData, output, xtrans, rgb_cam, setProgCancel, passes, useCieLab, chunkSize, false);
+}
+
+rpError markesteijn_demosaic(rpContext &context, int width, int height, const uint16_t * const *rawData, const rpOutput &output, const unsigned xtrans[6][6], const float rgb_cam[3][4], const std::function<bool(double)> &setProgCancel, const int passes, const bool useCieLab, std::size_t chunkSize)
+{
+    return markesteijn_demosaic_impl(&context, width, height, rawData, output, xtrans, rgb_cam, setProgCancel, passes, useCieLab, chunkSize, false);
+}
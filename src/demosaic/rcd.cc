@@ -16,13 +16,19 @@
  *  You should have received a copy of the GNU General Public License
  *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <algorithm>
 #include <cmath>
 #include <memory>
+#include <vector>
 
 #include "bayerhelper.h"
 #include "librtprocess.h"
 #include "opthelper.h"
+#include "progress.h"
+#include "rgboutput.h"
 #include "rt_math.h"
+#include "scratch.h"
+#include "stagetimer.h"
 #include "StopWatch.h"
 
 using namespace librtprocess;
@@ -42,55 +48,337 @@ using namespace librtprocess;
 // coefficients in an exact, shorter and more performant formula.
 // In cooperation with Hanno Schwalm (hanno@schwalm-bremen.de) and Luis Sanz Rodriguez this has been tuned for performance.
 
-rpError rcd_demosaic(int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, std::size_t chunkSize, bool measure, bool multiThread)
+namespace
 {
-    BENCHFUN
-
-    std::unique_ptr<StopWatch> stop;
-
-    if (measure) {
-        std::cout << "Demosaicing " << width << "x" << height << " image using rcd with " << chunkSize << " tiles per thread" << std::endl;
-        stop.reset(new StopWatch("rcd demosaic"));
-    }
-    if (!validateBayerCfa(3, cfarray)) {
-        return RP_WRONG_CFA;
-    }
 
-    rpError rc = RP_NO_ERROR;
+constexpr int tileBorder = 9; // avoid tile-overlap errors
+constexpr int rcdBorder = 9;
+constexpr int tileSize = 194;
+constexpr int tileSizeN = tileSize - 2 * tileBorder;
+
+// One image of an rcd run, the rows [stripTop, stripBottom) are computed. Exactly one of rawData and rawData16 is set
+struct RcdFrame {
+    int width;
+    int height;
+    int stripTop;
+    int stripBottom;
+    const float * const *rawData;
+    const uint16_t * const *rawData16;
+    const rpOutput *output;
+    const unsigned (*cfarray)[2];
+    int numTh;
+    int numTw;
+};
+
+// demosaics the interior of tile (tr, tc) of frame using the per thread scratch buffer
+template<typename T>
+TARGET_CLONES
+void rcd_tile(const RcdFrame &frame, const T * const *rawData, int tr, int tc, float *buffer, float outRow[3][tileSize], StageClock &clock)
+{
+    const int width = frame.width;
+    const int height = frame.height;
+    const int stripTop = frame.stripTop;
+    const int stripBottom = frame.stripBottom;
+    const int numTh = frame.numTh;
+    const int numTw = frame.numTw;
+    const rpOutput &output = *frame.output;
+    const unsigned (*cfarray)[2] = frame.cfarray;
 
-    double progress = 0.0;
-    setProgCancel(progress);
-    
-    constexpr int tileBorder = 9; // avoid tile-overlap errors
-    constexpr int rcdBorder = 9;
-    constexpr int tileSize = 194;
-    constexpr int tileSizeN = tileSize - 2 * tileBorder;
-    const int numTh = height / (tileSizeN) + ((height % (tileSizeN)) ? 1 : 0);
-    const int numTw = width / (tileSizeN) + ((width % (tileSizeN)) ? 1 : 0);
     constexpr int w1 = tileSize, w2 = 2 * tileSize, w3 = 3 * tileSize, w4 = 4 * tileSize;
     //Tolerance to avoid dividing by zero
     constexpr float eps = 1e-5f;
     constexpr float epssq = 1e-10f;
     constexpr float scale = 65536.f;
+    // planar outputs are written in place, the interleaved layouts row by row from outRow
+    const bool planar = isPlanar(output);
+
+    float *const cfa = buffer;
+    float (*const rgb)[tileSize * tileSize] = (float (*)[tileSize * tileSize])(cfa + tileSize * tileSize);
+    float *const VH_Dir = cfa + 4 * tileSize * tileSize;
+    float *const PQ_Dir = VH_Dir + tileSize * tileSize;
+    float *const lpf = PQ_Dir; // reuse buffer, they don't overlap in usage
+    float *const P_CDiff_Hpf = PQ_Dir + tileSize * tileSize / 2;
+    float *const Q_CDiff_Hpf = P_CDiff_Hpf + tileSize * tileSize / 2;
+
+    const int rowStart = tr * tileSizeN;
+    const int rowEnd = std::min(rowStart + tileSize, height);
+    if(rowStart + rcdBorder == rowEnd - rcdBorder || rowStart + tileBorder >= stripBottom || rowEnd - tileBorder <= stripTop) {
+        return;
+    }
+    const int colStart = tc * tileSizeN;
+    const int colEnd = std::min(colStart + tileSize, width);
+    if(colStart + rcdBorder == colEnd - rcdBorder) {
+        return;
+    }
+
+    clock.start();
+    const int tileRows = std::min(rowEnd - rowStart, tileSize);
+    const int tilecols = std::min(colEnd - colStart, tileSize);
+
+    // The buffer is reused by the tiles. The colour missing in a row is only interpolated away from the tile border but
+    // read near it, so it starts at 0.
+    for (int row = rowStart; row < rowEnd; row++) {
+        const int c0 = fc(cfarray, row, colStart);
+        const int c1 = fc(cfarray, row, colStart + 1);
+        const int c2 = 3 - c0 - c1;
+        for (int col = colStart, indx = (row - rowStart) * tileSize; col < colEnd; ++col, ++indx) {
+            cfa[indx] = rgb[c0][indx] = rgb[c1][indx] = LIM01(rawData[row][col] / scale);
+            rgb[c2][indx] = 0.f;
+        }
+    }
+
+    clock.lap("tile initialization");
+
+    // Step 1: Find cardinal and diagonal interpolation directions
+    float bufferV[3][tileSize - 8];
+
+    // Step 1.1: Calculate the square of the vertical and horizontal color difference high pass filter
+    for (int row = 3; row < std::min(tileRows - 3, 5); ++row) {
+        for (int col = 4, indx = row * tileSize + col; col < tilecols - 4; ++col, ++indx) {
+            bufferV[row - 3][col - 4] = SQR((cfa[indx - w3] - cfa[indx - w1] - cfa[indx + w1] + cfa[indx + w3]) - 3.f * (cfa[indx - w2] + cfa[indx + w2])  + 6.f * cfa[indx]);
+        }
+    }
+
+    // Step 1.2: Obtain the vertical and horizontal directional discrimination strength
+    // The ring around it is read as neighbourhood but not computed, so it is 0
+    std::fill_n(VH_Dir + 3 * tileSize, tilecols, 0.f);
+    std::fill_n(VH_Dir + (tileRows - 4) * tileSize, tilecols, 0.f);
+    for (int row = 4; row < tileRows - 4; ++row) {
+        VH_Dir[row * tileSize + 3] = VH_Dir[row * tileSize + tilecols - 4] = 0.f;
+    }
+
+    float bufferH[tileSize - 6] ALIGNED16;
+    float* V0 = bufferV[0];
+    float* V1 = bufferV[1];
+    float* V2 = bufferV[2];
+    for (int row = 4; row < tileRows - 4; ++row) {
+        for (int col = 3, indx = row * tileSize + col; col < tilecols - 3; ++col, ++indx) {
+            bufferH[col - 3] = SQR((cfa[indx -  3] - cfa[indx -  1] - cfa[indx +  1] + cfa[indx +  3]) - 3.f * (cfa[indx -  2] + cfa[indx +  2]) + 6.f * cfa[indx]);
+        }
+        for (int col = 4, indx = (row + 1) * tileSize + col; col < tilecols - 4; ++col, ++indx) {
+            V2[col - 4] = SQR((cfa[indx - w3] - cfa[indx - w1] - cfa[indx + w1] + cfa[indx + w3]) - 3.f * (cfa[indx - w2] + cfa[indx + w2])  + 6.f * cfa[indx]);
+        }
+        for (int col = 4, indx = row * tileSize + col; col < tilecols - 4; ++col, ++indx) {
+
+            float V_Stat = std::max(epssq, V0[col - 4] + V1[col - 4] + V2[col - 4]);
+            float H_Stat = std::max(epssq, bufferH[col -  4] + bufferH[col - 3] + bufferH[col -  2]);
+
+            VH_Dir[indx] = V_Stat / (V_Stat + H_Stat);
+        }
+        // rotate pointers from row0, row1, row2 to row1, row2, row0
+        std::swap(V0, V2);
+        std::swap(V0, V1);
+    }
+
+    // Step 2: Low pass filter incorporating green, red and blue local samples from the raw data
+    for (int row = 2; row < tileRows - 2; ++row) {
+        for (int col = 2 + (fc(cfarray, row, 0) & 1), indx = row * tileSize + col, lpindx = indx / 2; col < tilecols - 2; col += 2, indx += 2, ++lpindx) {
+            lpf[lpindx] = cfa[indx] +
+                          0.5f * (cfa[indx - w1] + cfa[indx + w1] + cfa[indx - 1] + cfa[indx + 1]) +
+                          0.25f * (cfa[indx - w1 - 1] + cfa[indx - w1 + 1] + cfa[indx + w1 - 1] + cfa[indx + w1 + 1]);
+        }
+    }
+
+    clock.lap("directions and low pass filter");
+
+    // Step 3: Populate the green channel at blue and red CFA positions
+    for (int row = 4; row < tileRows - 4; ++row) {
+        for (int col = 4 + (fc(cfarray, row, 0) & 1), indx = row * tileSize + col, lpindx = indx / 2; col < tilecols - 4; col += 2, indx += 2, ++lpindx) {
+            // Cardinal gradients
+            const float cfai = cfa[indx];
+            const float N_Grad = eps + (std::fabs(cfa[indx - w1] - cfa[indx + w1]) + std::fabs(cfai - cfa[indx - w2])) + (std::fabs(cfa[indx - w1] - cfa[indx - w3]) + std::fabs(cfa[indx - w2] - cfa[indx - w4]));
+            const float S_Grad = eps + (std::fabs(cfa[indx - w1] - cfa[indx + w1]) + std::fabs(cfai - cfa[indx + w2])) + (std::fabs(cfa[indx + w1] - cfa[indx + w3]) + std::fabs(cfa[indx + w2] - cfa[indx + w4]));
+            const float W_Grad = eps + (std::fabs(cfa[indx -  1] - cfa[indx +  1]) + std::fabs(cfai - cfa[indx -  2])) + (std::fabs(cfa[indx -  1] - cfa[indx -  3]) + std::fabs(cfa[indx -  2] - cfa[indx -  4]));
+            const float E_Grad = eps + (std::fabs(cfa[indx -  1] - cfa[indx +  1]) + std::fabs(cfai - cfa[indx +  2])) + (std::fabs(cfa[indx +  1] - cfa[indx +  3]) + std::fabs(cfa[indx +  2] - cfa[indx +  4]));
+
+            // Cardinal pixel estimations
+            const float lpfi = lpf[lpindx];
+            const float N_Est = cfa[indx - w1] * (lpfi + lpfi) / (eps + lpfi + lpf[lpindx - w1]);
+            const float S_Est = cfa[indx + w1] * (lpfi + lpfi) / (eps + lpfi + lpf[lpindx + w1]);
+            const float W_Est = cfa[indx -  1] * (lpfi + lpfi) / (eps + lpfi + lpf[lpindx -  1]);
+            const float E_Est = cfa[indx +  1] * (lpfi + lpfi) / (eps + lpfi + lpf[lpindx +  1]);
+
+            // Vertical and horizontal estimations
+            const float V_Est = (S_Grad * N_Est + N_Grad * S_Est) / (N_Grad + S_Grad);
+            const float H_Est = (W_Grad * E_Est + E_Grad * W_Est) / (E_Grad + W_Grad);
+
+            // G@B and G@R interpolation
+            // Refined vertical and horizontal local discrimination
+            const float VH_Central_Value = VH_Dir[indx];
+            const float VH_Neighbourhood_Value = 0.25f * ((VH_Dir[indx - w1 - 1] + VH_Dir[indx - w1 + 1]) + (VH_Dir[indx + w1 - 1] + VH_Dir[indx + w1 + 1]));
+
+            const float VH_Disc = std::fabs(0.5f - VH_Central_Value) < std::fabs(0.5f - VH_Neighbourhood_Value) ? VH_Neighbourhood_Value : VH_Central_Value;
+            rgb[1][indx] = intp(VH_Disc, H_Est, V_Est);
+        }
+    }
+
+    /**
+    * STEP 4: Populate the red and blue channels
+    */
+
+    clock.lap("green interpolation");
+
+    // Step 4.0: Calculate the square of the P/Q diagonals color difference high pass filter
+    // The entry after the last computed one is read as neighbourhood for even tile widths, so it is 0
+    for (int row = 3; row < tileRows - 3; ++row) {
+        P_CDiff_Hpf[(row * tileSize + tilecols - 3) / 2] = Q_CDiff_Hpf[(row * tileSize + tilecols - 3) / 2] = 0.f;
+        for (int col = 3, indx = row * tileSize + col, indx2 = indx / 2; col < tilecols - 3; col+=2, indx+=2, indx2++ ) {
+            P_CDiff_Hpf[indx2] = SQR((cfa[indx - w3 - 3] - cfa[indx - w1 - 1] - cfa[indx + w1 + 1] + cfa[indx + w3 + 3]) - 3.f * (cfa[indx - w2 - 2] + cfa[indx + w2 + 2]) + 6.f * cfa[indx]);
+            Q_CDiff_Hpf[indx2] = SQR((cfa[indx - w3 + 3] - cfa[indx - w1 + 1] - cfa[indx + w1 - 1] + cfa[indx + w3 - 3]) - 3.f * (cfa[indx - w2 + 2] + cfa[indx + w2 - 2]) + 6.f * cfa[indx]);
+        }
+    }
+
+    // Step 4.1: Obtain the P/Q diagonals directional discrimination strength
+    // The ring around it is read as neighbourhood but not computed, so it is 0. PQ_Dir shares its memory with lpf, which is no longer needed
+    std::fill_n(PQ_Dir + 3 * tileSize / 2, tileSize / 2, 0.f);
+    std::fill_n(PQ_Dir + (tileRows - 4) * tileSize / 2, tileSize / 2, 0.f);
+    for (int row = 4; row < tileRows - 4; ++row) {
+        PQ_Dir[(row * tileSize + 3) / 2] = PQ_Dir[(row * tileSize + tilecols - 4) / 2] = 0.f;
+    }
+    for (int row = 4; row < tileRows - 4; ++row) {
+        for (int col = 4 + (fc(cfarray, row, 0) & 1), indx = row * tileSize + col, indx2 = indx / 2, indx3 = (indx - w1 - 1) / 2, indx4 = (indx + w1 - 1) / 2; col < tilecols - 4; col += 2, indx += 2, indx2++, indx3++, indx4++ ) {
+            float P_Stat = std::max(epssq, P_CDiff_Hpf[indx3] + P_CDiff_Hpf[indx2] + P_CDiff_Hpf[indx4 + 1]);
+            float Q_Stat = std::max(epssq, Q_CDiff_Hpf[indx3 + 1] + Q_CDiff_Hpf[indx2] + Q_CDiff_Hpf[indx4]);
+            PQ_Dir[indx2] = P_Stat / (P_Stat + Q_Stat);
+        }
+    }
+
+    // Step 4.2: Populate the red and blue channels at blue and red CFA positions
+    for (int row = 4; row < tileRows - 4; ++row) {
+        for (int col = 4 + (fc(cfarray, row, 0) & 1), indx = row * tileSize + col, c = 2 - fc(cfarray, row, col), pqindx = indx / 2, pqindx2 = (indx - w1 - 1) / 2, pqindx3 = (indx + w1 - 1) / 2; col < tilecols - 4; col += 2, indx += 2, ++pqindx, ++pqindx2, ++pqindx3) {
+
+            // Refined P/Q diagonal local discrimination
+            float PQ_Central_Value   = PQ_Dir[pqindx];
+            float PQ_Neighbourhood_Value = 0.25f * (PQ_Dir[pqindx2] + PQ_Dir[pqindx2 + 1] + PQ_Dir[pqindx3] + PQ_Dir[pqindx3 + 1]);
+
+            float PQ_Disc = (std::fabs(0.5f - PQ_Central_Value) < std::fabs(0.5f - PQ_Neighbourhood_Value)) ? PQ_Neighbourhood_Value : PQ_Central_Value;
+
+            // Diagonal gradients
+            float NW_Grad = eps + std::fabs(rgb[c][indx - w1 - 1] - rgb[c][indx + w1 + 1]) + std::fabs(rgb[c][indx - w1 - 1] - rgb[c][indx - w3 - 3]) + std::fabs(rgb[1][indx] - rgb[1][indx - w2 - 2]);
+            float NE_Grad = eps + std::fabs(rgb[c][indx - w1 + 1] - rgb[c][indx + w1 - 1]) + std::fabs(rgb[c][indx - w1 + 1] - rgb[c][indx - w3 + 3]) + std::fabs(rgb[1][indx] - rgb[1][indx - w2 + 2]);
+            float SW_Grad = eps + std::fabs(rgb[c][indx - w1 + 1] - rgb[c][indx + w1 - 1]) + std::fabs(rgb[c][indx + w1 - 1] - rgb[c][indx + w3 - 3]) + std::fabs(rgb[1][indx] - rgb[1][indx + w2 - 2]);
+            float SE_Grad = eps + std::fabs(rgb[c][indx - w1 - 1] - rgb[c][indx + w1 + 1]) + std::fabs(rgb[c][indx + w1 + 1] - rgb[c][indx + w3 + 3]) + std::fabs(rgb[1][indx] - rgb[1][indx + w2 + 2]);
+
+            // Diagonal colour differences
+            float NW_Est = rgb[c][indx - w1 - 1] - rgb[1][indx - w1 - 1];
+            float NE_Est = rgb[c][indx - w1 + 1] - rgb[1][indx - w1 + 1];
+            float SW_Est = rgb[c][indx + w1 - 1] - rgb[1][indx + w1 - 1];
+            float SE_Est = rgb[c][indx + w1 + 1] - rgb[1][indx + w1 + 1];
+
+            // P/Q estimations
+            float P_Est = (NW_Grad * SE_Est + SE_Grad * NW_Est) / (NW_Grad + SE_Grad);
+            float Q_Est = (NE_Grad * SW_Est + SW_Grad * NE_Est) / (NE_Grad + SW_Grad);
+
+            // R@B and B@R interpolation
+            rgb[c][indx] = rgb[1][indx] + intp(PQ_Disc, Q_Est, P_Est);
+        }
+    }
+
+    // Step 4.3: Populate the red and blue channels at green CFA positions
+    for (int row = 4; row < tileRows - 4; ++row) {
+        for (int col = 4 + (fc(cfarray, row, 1) & 1), indx = row * tileSize + col; col < tilecols - 4; col += 2, indx += 2) {
+
+            // Refined vertical and horizontal local discrimination
+            float VH_Central_Value = VH_Dir[indx];
+            float VH_Neighbourhood_Value = 0.25f * ((VH_Dir[indx - w1 - 1] + VH_Dir[indx - w1 + 1]) + (VH_Dir[indx + w1 - 1] + VH_Dir[indx + w1 + 1]));
+
+            float VH_Disc = (std::fabs(0.5f - VH_Central_Value) < std::fabs(0.5f - VH_Neighbourhood_Value)) ? VH_Neighbourhood_Value : VH_Central_Value;
+            float rgb1 = rgb[1][indx];
+            float N1 = eps + std::fabs(rgb1 - rgb[1][indx - w2]);
+            float S1 = eps + std::fabs(rgb1 - rgb[1][indx + w2]);
+            float W1 = eps + std::fabs(rgb1 - rgb[1][indx -  2]);
+            float E1 = eps + std::fabs(rgb1 - rgb[1][indx +  2]);
+
+            float rgb1mw1 = rgb[1][indx - w1];
+            float rgb1pw1 = rgb[1][indx + w1];
+            float rgb1m1 = rgb[1][indx - 1];
+            float rgb1p1 = rgb[1][indx + 1];
+            for (int c = 0; c <= 2; c += 2) {
+                // Cardinal gradients
+                float SNabs = std::fabs(rgb[c][indx - w1] - rgb[c][indx + w1]);
+                float EWabs = std::fabs(rgb[c][indx -  1] - rgb[c][indx +  1]);
+                float N_Grad = N1 + SNabs + std::fabs(rgb[c][indx - w1] - rgb[c][indx - w3]);
+                float S_Grad = S1 + SNabs + std::fabs(rgb[c][indx + w1] - rgb[c][indx + w3]);
+                float W_Grad = W1 + EWabs + std::fabs(rgb[c][indx -  1] - rgb[c][indx -  3]);
+                float E_Grad = E1 + EWabs + std::fabs(rgb[c][indx +  1] - rgb[c][indx +  3]);
+
+                // Cardinal colour differences
+                float N_Est = rgb[c][indx - w1] - rgb1mw1;
+                float S_Est = rgb[c][indx + w1] - rgb1pw1;
+                float W_Est = rgb[c][indx -  1] - rgb1m1;
+                float E_Est = rgb[c][indx +  1] - rgb1p1;
+
+                // Vertical and horizontal estimations
+                float V_Est = (N_Grad * S_Est + S_Grad * N_Est) / (N_Grad + S_Grad);
+                float H_Est = (E_Grad * W_Est + W_Grad * E_Est) / (E_Grad + W_Grad);
+
+                // R@G and B@G interpolation
+                rgb[c][indx] = rgb1 + intp(VH_Disc, H_Est, V_Est);
+            }
+        }
+    }
+
+    clock.lap("red and blue interpolation");
+
+    // For the outermost tiles in all directions we can use a smaller border margin
+    const int firstVertical = std::max(rowStart + ((tr == 0) ? rcdBorder : tileBorder), stripTop);
+    const int lastVertical = std::min(rowEnd - ((tr == numTh - 1) ? rcdBorder : tileBorder), stripBottom);
+    const int firstHorizontal = colStart + ((tc == 0) ? rcdBorder : tileBorder);
+    const int lastHorizontal =  colEnd - ((tc == numTw - 1) ? rcdBorder : tileBorder);
+    for (int row = firstVertical; row < lastVertical; ++row) {
+        float *const redRow = planar ? output.red[row] + firstHorizontal : outRow[0];
+        float *const greenRow = planar ? output.green[row] + firstHorizontal : outRow[1];
+        float *const blueRow = planar ? output.blue[row] + firstHorizontal : outRow[2];
+        for (int col = firstHorizontal; col < lastHorizontal; ++col) {
+            int idx = (row - rowStart) * tileSize + col - colStart ;
+            redRow[col - firstHorizontal] = std::max(0.f, rgb[0][idx] * scale);
+            greenRow[col - firstHorizontal] = std::max(0.f, rgb[1][idx] * scale);
+            blueRow[col - firstHorizontal] = std::max(0.f, rgb[2][idx] * scale);
+        }
+        if (!planar) {
+            writeOutputRow(output, row, firstHorizontal, lastHorizontal - firstHorizontal, redRow, greenRow, blueRow);
+        }
+    }
+    clock.lap("output");
+}
+
+// Demosaics all frames in one parallel region. The tiles of all frames form one work queue
+// and the borders are computed while other threads still work on tiles.
+rpError rcd_demosaic_frames(rpContext *context, RcdFrame *frames, std::size_t count, const std::function<bool(double)> &setProgCancel, std::size_t chunkSize, bool multiThread)
+{
+    BENCHFUN
+
+    StageTimer timer(context, "rcd");
+    // tileOffset[i] is the index of the first tile of frames[i] in the work queue
+    std::vector<int> tileOffset(count + 1, 0);
+    for (std::size_t i = 0; i < count; ++i) {
+        RcdFrame &frame = frames[i];
+        if (!validateBayerCfa(3, frame.cfarray)) {
+            return RP_WRONG_CFA;
+        }
+        frame.numTh = frame.height / (tileSizeN) + ((frame.height % (tileSizeN)) ? 1 : 0);
+        frame.numTw = frame.width / (tileSizeN) + ((frame.width % (tileSizeN)) ? 1 : 0);
+        tileOffset[i + 1] = tileOffset[i] + frame.numTh * frame.numTw;
+    }
+    const int numTiles = tileOffset[count];
+
+    rpError rc = RP_NO_ERROR;
+
+    setProgCancel(0.0);
+    Progress progress(setProgCancel, numTiles);
 
 #ifdef _OPENMP
 #pragma omp parallel if(multiThread)
 #endif
 {
-    int progresscounter = 0;
-    float *const cfa = (float*) calloc(tileSize * tileSize, sizeof *cfa);
-    float (*const rgb)[tileSize * tileSize] = (float (*)[tileSize * tileSize])malloc(3 * sizeof *rgb);
-    float *const VH_Dir = (float*) calloc(tileSize * tileSize, sizeof *VH_Dir);
-    float *const PQ_Dir = (float*) calloc(tileSize * tileSize / 2, sizeof *PQ_Dir);
-    float *const lpf = PQ_Dir; // reuse buffer, they don't overlap in usage
-    float *const P_CDiff_Hpf = (float*) calloc(tileSize * tileSize / 2, sizeof *P_CDiff_Hpf);
-    float *const Q_CDiff_Hpf = (float*) calloc(tileSize * tileSize / 2, sizeof *Q_CDiff_Hpf);
+    // cfa, rgb[3], VH_Dir and the three half sized buffers PQ_Dir, P_CDiff_Hpf and Q_CDiff_Hpf
+    const ScratchBuffer buffer(context, (5 * tileSize * tileSize + 3 * tileSize * tileSize / 2) * sizeof(float));
 
 #ifdef _OPENMP
     #pragma omp critical
 #endif
     {
-        if (!cfa || !rgb || !VH_Dir || ! PQ_Dir || !P_CDiff_Hpf || !Q_CDiff_Hpf) {
+        if (!buffer) {
             rc = RP_MEMORY_ERROR;
         }
     }
@@ -98,244 +386,163 @@ rpError rcd_demosaic(int width, int height, const float * const *rawData, float
     #pragma omp barrier
 #endif
     if (!rc) {
+        float *const data = (float*)buffer.data();
+        float outRow[3][tileSize];
+        StageClock clock(timer);
+
 #ifdef _OPENMP
-        #pragma omp for schedule(dynamic, chunkSize) collapse(2) nowait
+        #pragma omp for schedule(dynamic, chunkSize) nowait
 #endif
-        for(int tr = 0; tr < numTh; ++tr) {
-            for(int tc = 0; tc < numTw; ++tc) {
-                const int rowStart = tr * tileSizeN;
-                const int rowEnd = std::min(rowStart + tileSize, height);
-                if(rowStart + rcdBorder == rowEnd - rcdBorder) {
-                    continue;
-                }
-                const int colStart = tc * tileSizeN;
-                const int colEnd = std::min(colStart + tileSize, width);
-                if(colStart + rcdBorder == colEnd - rcdBorder) {
-                    continue;
-                }
-
-                const int tileRows = std::min(rowEnd - rowStart, tileSize);
-                const int tilecols = std::min(colEnd - colStart, tileSize);
-
-                for (int row = rowStart; row < rowEnd; row++) {
-                    const int c0 = fc(cfarray, row, colStart);
-                    const int c1 = fc(cfarray, row, colStart + 1);
-                    for (int col = colStart, indx = (row - rowStart) * tileSize; col < colEnd; ++col, ++indx) {
-                        cfa[indx] = rgb[c0][indx] = rgb[c1][indx] = LIM01(rawData[row][col] / scale);
-                    }
-                }
-
-                // Step 1: Find cardinal and diagonal interpolation directions
-                float bufferV[3][tileSize - 8];
-
-                // Step 1.1: Calculate the square of the vertical and horizontal color difference high pass filter
-                for (int row = 3; row < std::min(tileRows - 3, 5); ++row) {
-                    for (int col = 4, indx = row * tileSize + col; col < tilecols - 4; ++col, ++indx) {
-                        bufferV[row - 3][col - 4] = SQR((cfa[indx - w3] - cfa[indx - w1] - cfa[indx + w1] + cfa[indx + w3]) - 3.f * (cfa[indx - w2] + cfa[indx + w2])  + 6.f * cfa[indx]);
-                    }
-                }
-
-                // Step 1.2: Obtain the vertical and horizontal directional discrimination strength
-                float bufferH[tileSize - 6] ALIGNED16;
-                float* V0 = bufferV[0];
-                float* V1 = bufferV[1];
-                float* V2 = bufferV[2];
-                for (int row = 4; row < tileRows - 4; ++row) {
-                    for (int col = 3, indx = row * tileSize + col; col < tilecols - 3; ++col, ++indx) {
-                        bufferH[col - 3] = SQR((cfa[indx -  3] - cfa[indx -  1] - cfa[indx +  1] + cfa[indx +  3]) - 3.f * (cfa[indx -  2] + cfa[indx +  2]) + 6.f * cfa[indx]);
-                    }
-                    for (int col = 4, indx = (row + 1) * tileSize + col; col < tilecols - 4; ++col, ++indx) {
-                        V2[col - 4] = SQR((cfa[indx - w3] - cfa[indx - w1] - cfa[indx + w1] + cfa[indx + w3]) - 3.f * (cfa[indx - w2] + cfa[indx + w2])  + 6.f * cfa[indx]);
-                    }
-                    for (int col = 4, indx = row * tileSize + col; col < tilecols - 4; ++col, ++indx) {
-
-                        float V_Stat = std::max(epssq, V0[col - 4] + V1[col - 4] + V2[col - 4]);
-                        float H_Stat = std::max(epssq, bufferH[col -  4] + bufferH[col - 3] + bufferH[col -  2]);
-
-                        VH_Dir[indx] = V_Stat / (V_Stat + H_Stat);
-                    }
-                    // rotate pointers from row0, row1, row2 to row1, row2, row0
-                    std::swap(V0, V2);
-                    std::swap(V0, V1);
-                }
-
-                // Step 2: Low pass filter incorporating green, red and blue local samples from the raw data
-                for (int row = 2; row < tileRows - 2; ++row) {
-                    for (int col = 2 + (fc(cfarray, row, 0) & 1), indx = row * tileSize + col, lpindx = indx / 2; col < tilecols - 2; col += 2, indx += 2, ++lpindx) {
-                        lpf[lpindx] = cfa[indx] +
-                                      0.5f * (cfa[indx - w1] + cfa[indx + w1] + cfa[indx - 1] + cfa[indx + 1]) +
-                                      0.25f * (cfa[indx - w1 - 1] + cfa[indx - w1 + 1] + cfa[indx + w1 - 1] + cfa[indx + w1 + 1]);
-                    }
-                }
-
-                // Step 3: Populate the green channel at blue and red CFA positions
-                for (int row = 4; row < tileRows - 4; ++row) {
-                    for (int col = 4 + (fc(cfarray, row, 0) & 1), indx = row * tileSize + col, lpindx = indx / 2; col < tilecols - 4; col += 2, indx += 2, ++lpindx) {
-                        // Cardinal gradients
-                        const float cfai = cfa[indx];
-                        const float N_Grad = eps + (std::fabs(cfa[indx - w1] - cfa[indx + w1]) + std::fabs(cfai - cfa[indx - w2])) + (std::fabs(cfa[indx - w1] - cfa[indx - w3]) + std::fabs(cfa[indx - w2] - cfa[indx - w4]));
-                        const float S_Grad = eps + (std::fabs(cfa[indx - w1] - cfa[indx + w1]) + std::fabs(cfai - cfa[indx + w2])) + (std::fabs(cfa[indx + w1] - cfa[indx + w3]) + std::fabs(cfa[indx + w2] - cfa[indx + w4]));
-                        const float W_Grad = eps + (std::fabs(cfa[indx -  1] - cfa[indx +  1]) + std::fabs(cfai - cfa[indx -  2])) + (std::fabs(cfa[indx -  1] - cfa[indx -  3]) + std::fabs(cfa[indx -  2] - cfa[indx -  4]));
-                        const float E_Grad = eps + (std::fabs(cfa[indx -  1] - cfa[indx +  1]) + std::fabs(cfai - cfa[indx +  2])) + (std::fabs(cfa[indx +  1] - cfa[indx +  3]) + std::fabs(cfa[indx +  2] - cfa[indx +  4]));
-
-                        // Cardinal pixel estimations
-                        const float lpfi = lpf[lpindx];
-                        const float N_Est = cfa[indx - w1] * (lpfi + lpfi) / (eps + lpfi + lpf[lpindx - w1]);
-                        const float S_Est = cfa[indx + w1] * (lpfi + lpfi) / (eps + lpfi + lpf[lpindx + w1]);
-                        const float W_Est = cfa[indx -  1] * (lpfi + lpfi) / (eps + lpfi + lpf[lpindx -  1]);
-                        const float E_Est = cfa[indx +  1] * (lpfi + lpfi) / (eps + lpfi + lpf[lpindx +  1]);
-
-                        // Vertical and horizontal estimations
-                        const float V_Est = (S_Grad * N_Est + N_Grad * S_Est) / (N_Grad + S_Grad);
-                        const float H_Est = (W_Grad * E_Est + E_Grad * W_Est) / (E_Grad + W_Grad);
-
-                        // G@B and G@R interpolation
-                        // Refined vertical and horizontal local discrimination
-                        const float VH_Central_Value = VH_Dir[indx];
-                        const float VH_Neighbourhood_Value = 0.25f * ((VH_Dir[indx - w1 - 1] + VH_Dir[indx - w1 + 1]) + (VH_Dir[indx + w1 - 1] + VH_Dir[indx + w1 + 1]));
-
-                        const float VH_Disc = std::fabs(0.5f - VH_Central_Value) < std::fabs(0.5f - VH_Neighbourhood_Value) ? VH_Neighbourhood_Value : VH_Central_Value;
-                        rgb[1][indx] = intp(VH_Disc, H_Est, V_Est);
-                    }
-                }
-
-                /**
-                * STEP 4: Populate the red and blue channels
-                */
-
-                // Step 4.0: Calculate the square of the P/Q diagonals color difference high pass filter
-                for (int row = 3; row < tileRows - 3; ++row) {
-                    for (int col = 3, indx = row * tileSize + col, indx2 = indx / 2; col < tilecols - 3; col+=2, indx+=2, indx2++ ) {
-                        P_CDiff_Hpf[indx2] = SQR((cfa[indx - w3 - 3] - cfa[indx - w1 - 1] - cfa[indx + w1 + 1] + cfa[indx + w3 + 3]) - 3.f * (cfa[indx - w2 - 2] + cfa[indx + w2 + 2]) + 6.f * cfa[indx]);
-                        Q_CDiff_Hpf[indx2] = SQR((cfa[indx - w3 + 3] - cfa[indx - w1 + 1] - cfa[indx + w1 - 1] + cfa[indx + w3 - 3]) - 3.f * (cfa[indx - w2 + 2] + cfa[indx + w2 - 2]) + 6.f * cfa[indx]);
-                    }
-                }
-
-                // Step 4.1: Obtain the P/Q diagonals directional discrimination strength
-                for (int row = 4; row < tileRows - 4; ++row) {
-                    for (int col = 4 + (fc(cfarray, row, 0) & 1), indx = row * tileSize + col, indx2 = indx / 2, indx3 = (indx - w1 - 1) / 2, indx4 = (indx + w1 - 1) / 2; col < tilecols - 4; col += 2, indx += 2, indx2++, indx3++, indx4++ ) {
-                        float P_Stat = std::max(epssq, P_CDiff_Hpf[indx3] + P_CDiff_Hpf[indx2] + P_CDiff_Hpf[indx4 + 1]);
-                        float Q_Stat = std::max(epssq, Q_CDiff_Hpf[indx3 + 1] + Q_CDiff_Hpf[indx2] + Q_CDiff_Hpf[indx4]);
-                        PQ_Dir[indx2] = P_Stat / (P_Stat + Q_Stat);
-                    }
-                }
-
-                // Step 4.2: Populate the red and blue channels at blue and red CFA positions
-                for (int row = 4; row < tileRows - 4; ++row) {
-                    for (int col = 4 + (fc(cfarray, row, 0) & 1), indx = row * tileSize + col, c = 2 - fc(cfarray, row, col), pqindx = indx / 2, pqindx2 = (indx - w1 - 1) / 2, pqindx3 = (indx + w1 - 1) / 2; col < tilecols - 4; col += 2, indx += 2, ++pqindx, ++pqindx2, ++pqindx3) {
-
-                        // Refined P/Q diagonal local discrimination
-                        float PQ_Central_Value   = PQ_Dir[pqindx];
-                        float PQ_Neighbourhood_Value = 0.25f * (PQ_Dir[pqindx2] + PQ_Dir[pqindx2 + 1] + PQ_Dir[pqindx3] + PQ_Dir[pqindx3 + 1]);
-
-                        float PQ_Disc = (std::fabs(0.5f - PQ_Central_Value) < std::fabs(0.5f - PQ_Neighbourhood_Value)) ? PQ_Neighbourhood_Value : PQ_Central_Value;
-
-                        // Diagonal gradients
-                        float NW_Grad = eps + std::fabs(rgb[c][indx - w1 - 1] - rgb[c][indx + w1 + 1]) + std::fabs(rgb[c][indx - w1 - 1] - rgb[c][indx - w3 - 3]) + std::fabs(rgb[1][indx] - rgb[1][indx - w2 - 2]);
-                        float NE_Grad = eps + std::fabs(rgb[c][indx - w1 + 1] - rgb[c][indx + w1 - 1]) + std::fabs(rgb[c][indx - w1 + 1] - rgb[c][indx - w3 + 3]) + std::fabs(rgb[1][indx] - rgb[1][indx - w2 + 2]);
-                        float SW_Grad = eps + std::fabs(rgb[c][indx - w1 + 1] - rgb[c][indx + w1 - 1]) + std::fabs(rgb[c][indx + w1 - 1] - rgb[c][indx + w3 - 3]) + std::fabs(rgb[1][indx] - rgb[1][indx + w2 - 2]);
-                        float SE_Grad = eps + std::fabs(rgb[c][indx - w1 - 1] - rgb[c][indx + w1 + 1]) + std::fabs(rgb[c][indx + w1 + 1] - rgb[c][indx + w3 + 3]) + std::fabs(rgb[1][indx] - rgb[1][indx + w2 + 2]);
-
-                        // Diagonal colour differences
-                        float NW_Est = rgb[c][indx - w1 - 1] - rgb[1][indx - w1 - 1];
-                        float NE_Est = rgb[c][indx - w1 + 1] - rgb[1][indx - w1 + 1];
-                        float SW_Est = rgb[c][indx + w1 - 1] - rgb[1][indx + w1 - 1];
-                        float SE_Est = rgb[c][indx + w1 + 1] - rgb[1][indx + w1 + 1];
-
-                        // P/Q estimations
-                        float P_Est = (NW_Grad * SE_Est + SE_Grad * NW_Est) / (NW_Grad + SE_Grad);
-                        float Q_Est = (NE_Grad * SW_Est + SW_Grad * NE_Est) / (NE_Grad + SW_Grad);
-
-                        // R@B and B@R interpolation
-                        rgb[c][indx] = rgb[1][indx] + intp(PQ_Disc, Q_Est, P_Est);
-                    }
-                }
-
-                // Step 4.3: Populate the red and blue channels at green CFA positions
-                for (int row = 4; row < tileRows - 4; ++row) {
-                    for (int col = 4 + (fc(cfarray, row, 1) & 1), indx = row * tileSize + col; col < tilecols - 4; col += 2, indx += 2) {
-
-                        // Refined vertical and horizontal local discrimination
-                        float VH_Central_Value = VH_Dir[indx];
-                        float VH_Neighbourhood_Value = 0.25f * ((VH_Dir[indx - w1 - 1] + VH_Dir[indx - w1 + 1]) + (VH_Dir[indx + w1 - 1] + VH_Dir[indx + w1 + 1]));
-
-                        float VH_Disc = (std::fabs(0.5f - VH_Central_Value) < std::fabs(0.5f - VH_Neighbourhood_Value)) ? VH_Neighbourhood_Value : VH_Central_Value;
-                        float rgb1 = rgb[1][indx];
-                        float N1 = eps + std::fabs(rgb1 - rgb[1][indx - w2]);
-                        float S1 = eps + std::fabs(rgb1 - rgb[1][indx + w2]);
-                        float W1 = eps + std::fabs(rgb1 - rgb[1][indx -  2]);
-                        float E1 = eps + std::fabs(rgb1 - rgb[1][indx +  2]);
-
-                        float rgb1mw1 = rgb[1][indx - w1];
-                        float rgb1pw1 = rgb[1][indx + w1];
-                        float rgb1m1 = rgb[1][indx - 1];
-                        float rgb1p1 = rgb[1][indx + 1];
-                        for (int c = 0; c <= 2; c += 2) {
-                            // Cardinal gradients
-                            float SNabs = std::fabs(rgb[c][indx - w1] - rgb[c][indx + w1]);
-                            float EWabs = std::fabs(rgb[c][indx -  1] - rgb[c][indx +  1]);
-                            float N_Grad = N1 + SNabs + std::fabs(rgb[c][indx - w1] - rgb[c][indx - w3]);
-                            float S_Grad = S1 + SNabs + std::fabs(rgb[c][indx + w1] - rgb[c][indx + w3]);
-                            float W_Grad = W1 + EWabs + std::fabs(rgb[c][indx -  1] - rgb[c][indx -  3]);
-                            float E_Grad = E1 + EWabs + std::fabs(rgb[c][indx +  1] - rgb[c][indx +  3]);
-
-                            // Cardinal colour differences
-                            float N_Est = rgb[c][indx - w1] - rgb1mw1;
-                            float S_Est = rgb[c][indx + w1] - rgb1pw1;
-                            float W_Est = rgb[c][indx -  1] - rgb1m1;
-                            float E_Est = rgb[c][indx +  1] - rgb1p1;
-
-                            // Vertical and horizontal estimations
-                            float V_Est = (N_Grad * S_Est + S_Grad * N_Est) / (N_Grad + S_Grad);
-                            float H_Est = (E_Grad * W_Est + W_Grad * E_Est) / (E_Grad + W_Grad);
-
-                            // R@G and B@G interpolation
-                            rgb[c][indx] = rgb1 + intp(VH_Disc, H_Est, V_Est);
-                        }
-                    }
-                }
-
-                // For the outermost tiles in all directions we can use a smaller border margin
-                const int firstVertical = rowStart + ((tr == 0) ? rcdBorder : tileBorder);
-                const int lastVertical = rowEnd - ((tr == numTh - 1) ? rcdBorder : tileBorder);
-                const int firstHorizontal = colStart + ((tc == 0) ? rcdBorder : tileBorder);
-                const int lastHorizontal =  colEnd - ((tc == numTw - 1) ? rcdBorder : tileBorder);
-                for (int row = firstVertical; row < lastVertical; ++row) {
-                    for (int col = firstHorizontal; col < lastHorizontal; ++col) {
-                        int idx = (row - rowStart) * tileSize + col - colStart ;
-                        red[row][col] = std::max(0.f, rgb[0][idx] * scale);
-                        green[row][col] = std::max(0.f, rgb[1][idx] * scale);
-                        blue[row][col] = std::max(0.f, rgb[2][idx] * scale);
-                    }
-                }
-
-                progresscounter++;
-                if(progresscounter % 32 == 0) {
+        for (int tile = 0; tile < numTiles; ++tile) {
+            if (progress.cancelled()) {
+                continue;
+            }
+            const std::size_t f = std::upper_bound(tileOffset.begin(), tileOffset.end(), tile) - tileOffset.begin() - 1;
+            const RcdFrame &frame = frames[f];
+            const int tr = (tile - tileOffset[f]) / frame.numTw;
+            const int tc = (tile - tileOffset[f]) % frame.numTw;
+            if (frame.rawData) {
+                rcd_tile(frame, frame.rawData, tr, tc, data, outRow, clock);
+            } else {
+                rcd_tile(frame, frame.rawData16, tr, tc, data, outRow, clock);
+            }
+            progress.done();
+        }
+
+        // the borders don't overlap the tile interiors, so they can start before all tiles are done
 #ifdef _OPENMP
-                    #pragma omp critical (rcdprogress)
+        #pragma omp for schedule(dynamic) nowait
 #endif
-                    {
-                        progress += (double)32 * ((tileSizeN) * (tileSizeN)) / (height * width);
-                        progress = progress > 1.0 ? 1.0 : progress;
-                        setProgCancel(progress);
-                    }
-                }
+        for (std::size_t i = 0; i < count; ++i) {
+            if (progress.cancelled()) {
+                continue;
             }
+            const RcdFrame &frame = frames[i];
+            clock.start();
+            if (frame.rawData) {
+                bayerborder_demosaic_rows(frame.width, frame.height, rcdBorder, frame.stripTop, frame.stripBottom, frame.rawData, *frame.output, frame.cfarray);
+            } else {
+                bayerborder_demosaic_rows(frame.width, frame.height, rcdBorder, frame.stripTop, frame.stripBottom, frame.rawData16, *frame.output, frame.cfarray);
+            }
+            clock.lap("border");
         }
     }
-    free(cfa);
-    free(rgb);
-    free(VH_Dir);
-    free(PQ_Dir);
-    free(P_CDiff_Hpf);
-    free(Q_CDiff_Hpf);
 }
-    if (!rc) {
-        rc = bayerborder_demosaic(width, height, rcdBorder, rawData, red, green, blue, cfarray);
-    }
 
+    if (!rc && progress.cancelled()) {
+        return RP_CANCELLED;
+    }
     setProgCancel(1.0);
 
     return rc;
 }
 
+// computes the rows [stripTop, stripBottom) of the image, only the tiles which contribute to these rows are processed
+rpError rcd_demosaic_impl(rpContext *context, int width, int height, int stripTop, int stripBottom, const float * const *rawData, const uint16_t * const *rawData16, const rpOutput &output, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, std::size_t chunkSize, bool measure, bool multiThread)
+{
+    std::unique_ptr<StopWatch> stop;
+
+    if (measure) {
+        std::cout << "Demosaicing " << width << "x" << height << " image using rcd with " << chunkSize << " tiles per thread" << std::endl;
+        stop.reset(new StopWatch("rcd demosaic"));
+    }
+
+    RcdFrame frame = {width, height, stripTop, stripBottom, rawData, rawData16, &output, cfarray, 0, 0};
+    return rcd_demosaic_frames(context, &frame, 1, setProgCancel, chunkSize, multiThread);
+}
+
+rpError rcd_demosaic_impl(rpContext *context, int width, int height, int stripTop, int stripBottom, const float * const *rawData, const rpOutput &output, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, std::size_t chunkSize, bool measure, bool multiThread)
+{
+    return rcd_demosaic_impl(context, width, height, stripTop, stripBottom, rawData, nullptr, output, cfarray, setProgCancel, chunkSize, measure, multiThread);
+}
+
+rpError rcd_demosaic_impl(rpContext *context, int width, int height, int stripTop, int stripBottom, const uint16_t * const *rawData, const rpOutput &output, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, std::size_t chunkSize, bool measure, bool multiThread)
+{
+    return rcd_demosaic_impl(context, width, height, stripTop, stripBottom, nullptr, rawData, output, cfarray, setProgCancel, chunkSize, measure, multiThread);
+}
+
+}
+
+rpError rcd_demosaic(int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, std::size_t chunkSize, bool measure, bool multiThread)
+{
+    return rcd_demosaic_impl(nullptr, width, height, 0, height, rawData, rpOutput(red, green, blue), cfarray, setProgCancel, chunkSize, measure, multiThread);
+}
+
+rpError rcd_demosaic(rpContext &context, int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, std::size_t chunkSize, bool measure, bool multiThread)
+{
+    return rcd_demosaic_impl(&context, width, height, 0, height, rawData, rpOutput(red, green, blue), cfarray, setProgCancel, chunkSize, measure, multiThread);
+}
+
+rpError rcd_demosaic(int width, int height, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, std::size_t chunkSize, bool measure, bool multiThread)
+{
+    return rcd_demosaic_impl(nullptr, width, height, 0, height, rawData, rpOutput(red, green, blue), cfarray, setProgCancel, chunkSize, measure, multiThread);
+}
+
+rpError rcd_demosaic(rpContext &context, int width, int height, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, std::size_t chunkSize, bool measure, bool multiThread)
+{
+    return rcd_demosaic_impl(&context, width, height, 0, height, rawData, rpOutput(red, green, blue), cfarray, setProgCancel, chunkSize, measure, multiThread);
+}
+
+rpError rcd_demosaic(rpContext &context, int width, int height, const float * const *rawData, const rpOutput &output, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, std::size_t chunkSize, bool multiThread)
+{
+    return rcd_demosaic_impl(&context, width, height, 0, height, rawData, output, cfarray, setProgCancel, chunkSize, false, multiThread);
+}
+
+rpError rcd_demosaic(rpContext &context, int width, int height, const uint16_t * const *rawData, const rpOutput &output, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, std::size_t chunkSize, bool multiThread)
+{
+    return rcd_demosaic_impl(&context, width, height, 0, height, rawData, output, cfarray, setProgCancel, chunkSize, false, multiThread);
+}
+
+rpError rcd_demosaic_batch(rpContext &context, const rpBayerFrame *frames, std::size_t count, const std::function<bool(double)> &setProgCancel, std::size_t chunkSize)
+{
+    std::vector<RcdFrame> rcdFrames;
+    rcdFrames.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        const rpBayerFrame &frame = frames[i];
+        rcdFrames.push_back({frame.width, frame.height, 0, frame.height, frame.rawData, frame.rawData ? nullptr : frame.rawData16, &frame.output, frame.cfarray, 0, 0});
+    }
+    return rcd_demosaic_frames(&context, rcdFrames.data(), count, setProgCancel, chunkSize, true);
+}
+
+void rcd_demosaic_strip_input(int height, int stripTop, int stripHeight, int &rawTop, int &rawBottom)
+{
+    stripTop = std::max(stripTop, 0);
+    const int stripBottom = std::min(stripTop + stripHeight, height);
+    // the border rows need their direct neighbours
+    rawTop = std::max(stripTop - 1, 0);
+    rawBottom = std::min(stripBottom + 1, height);
+
+    for (int rowStart = 0; rowStart < height; rowStart += tileSizeN) {
+        const int rowEnd = std::min(rowStart + tileSize, height);
+        if (rowStart + tileBorder < stripBottom && rowEnd - tileBorder > stripTop) {
+            rawTop = std::min(rawTop, rowStart);
+            rawBottom = std::max(rawBottom, rowEnd);
+        }
+    }
+}
+
+namespace
+{
+
+template<typename T>
+rpError rcd_demosaic_strip_impl(rpContext &context, int width, int height, int stripTop, int stripHeight, const T * const *rawData, const rpOutput &output, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, std::size_t chunkSize, bool multiThread)
+{
+    stripTop = std::max(stripTop, 0);
+    const int stripBottom = std::min(stripTop + stripHeight, height);
+    if (stripTop >= stripBottom) {
+        return RP_NO_ERROR;
+    }
+    return rcd_demosaic_impl(&context, width, height, stripTop, stripBottom, rawData, output, cfarray, setProgCancel, chunkSize, false, multiThread);
+}
+
+}
+
+rpError rcd_demosaic_strip(rpContext &context, int width, int height, int stripTop, int stripHeight, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, std::size_t chunkSize, bool multiThread)
+{
+    return rcd_demosaic_strip_impl(context, width, height, stripTop, stripHeight, rawData, rpOutput(red, green, blue), cfarray, setProgCancel, chunkSize, multiThread);
+}
+
+rpError rcd_demosaic_strip(rpContext &context, int width, int height, int stripTop, int stripHeight, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, std::size_t chunkSize, bool multiThread)
+{
+    return rcd_demosaic_strip_impl(context, width, height, stripTop, stripHeight, rawData, rpOutput(red, green, blue), cfarray, setProgCancel, chunkSize, multiThread);
+}
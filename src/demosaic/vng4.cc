@@ -23,15 +23,23 @@
 #include <cmath>
 #include <climits>
 #include "bayerhelper.h"
+#include "float16.h"
 #include "librtprocess.h"
 #include "opthelper.h"
+#include "progress.h"
 #include "rt_math.h"
 #include "StopWatch.h"
 
 using namespace librtprocess;
 
 
-rpError vng4_demosaic (int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel)
+namespace
+{
+
+// Pixel is the type of the interpolation buffer, float or float16<16> for 16 bit raw data
+template<typename T, typename Pixel>
+TARGET_CLONES
+rpError vng4_demosaic_impl(int width, int height, const T * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel)
 {
     BENCHFUN
     if (!validateBayerCfa(4, cfarray)) {
@@ -71,7 +79,7 @@ rpError vng4_demosaic (int width, int height, const float * const *rawData, floa
 
     constexpr unsigned int colors = 4;
 
-    float (*image)[4] = (float (*)[4]) calloc (height * width, sizeof * image);
+    Pixel (*image)[4] = (Pixel (*)[4]) calloc (height * width, sizeof * image);
 
     if (!image) {
         return RP_MEMORY_ERROR;
@@ -137,7 +145,7 @@ rpError vng4_demosaic (int width, int height, const float * const *rawData, floa
             if (ii - 1 > firstRow) {
                 int row = ii - 1;
                 for (int col = 1; col < width - 1; col++) {
-                    float * pix = image[row * width + col];
+                    Pixel * pix = image[row * width + col];
                     int * ip = lcode[row & 15][col & 15];
                     float sum[4] = {};
 
@@ -157,7 +165,7 @@ rpError vng4_demosaic (int width, int height, const float * const *rawData, floa
         if (firstRow > 0 && firstRow < height - 1) {
             const int row = firstRow;
             for (int col = 1; col < width - 1; col++) {
-                float * pix = image[row * width + col];
+                Pixel * pix = image[row * width + col];
                 int * ip = lcode[row & 15][col & 15];
                 float sum[4] = {};
 
@@ -174,7 +182,7 @@ rpError vng4_demosaic (int width, int height, const float * const *rawData, floa
         if (lastRow > 0 && lastRow < height - 1) {
             const int row = lastRow;
             for (int col = 1; col < width - 1; col++) {
-                float * pix = image[row * width + col];
+                Pixel * pix = image[row * width + col];
                 int * ip = lcode[row & 15][col & 15];
                 float sum[4] = {};
 
@@ -221,7 +229,7 @@ rpError vng4_demosaic (int width, int height, const float * const *rawData, floa
 
                     *ipp++ = (y1 * width + x1) * 4 + color;
                     *ipp++ = (y2 * width + x2) * 4 + color;
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                     // at least on machines with SSE2 feature this cast is save
                     *reinterpret_cast<float*>(ipp++) = 1 << weight;
 #else
@@ -254,13 +262,12 @@ rpError vng4_demosaic (int width, int height, const float * const *rawData, floa
 
         progress = 0.2;
         setProgCancel(progress);
+        Progress rowProgress(setProgCancel, std::max(height - 4, 0), progress);
 
 #ifdef _OPENMP
         #pragma omp parallel
 #endif
         {
-            constexpr int progressStep = 64;
-            const double progressInc = (1.0 - progress) / ((height - 2) / progressStep);
             int firstRow = -1;
             int lastRow = -1;
 #ifdef _OPENMP
@@ -269,18 +276,21 @@ rpError vng4_demosaic (int width, int height, const float * const *rawData, floa
 #endif
 
             for (int row = 2; row < height - 2; row++) {    /* Do VNG interpolation */
+                if (rowProgress.cancelled()) {
+                    continue;
+                }
                 if (firstRow == -1) {
                     firstRow = row;
                 }
                 lastRow = row;
                 for (int col = 2; col < width - 2; col++) {
-                    float * pix = image[row * width + col];
+                    Pixel * pix = image[row * width + col];
                     int color = fc(cfarray, row, col);
                     int32_t * ip = code[row & prow][col & pcol];
                     float gval[8] = {};
 
                     while (ip[0] != INT_MAX) {        /* Calculate gradients */
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                         // at least on machines with SSE2 feature this cast is save and saves a lot of int => float conversions
                         const float diff = std::fabs(pix[ip[0]] - pix[ip[1]]) * reinterpret_cast<float*>(ip)[2];
 #else
@@ -333,15 +343,7 @@ rpError vng4_demosaic (int width, int height, const float * const *rawData, floa
                 if (row - 1 > firstRow) {
                     interpolate_row_redblue(rawData, cfarray, red[row - 1], blue[row - 1], green[row - 2], green[row - 1], green[row], row - 1, width);
                 }
-
-                    if((row % progressStep) == 0)
-#ifdef _OPENMP
-                        #pragma omp critical (updateprogress)
-#endif
-                    {
-                        progress += progressInc;
-                        setProgCancel(progress);
-                    }
+                rowProgress.done();
             }
 
             if (firstRow > 2 && firstRow < height - 3) {
@@ -367,10 +369,49 @@ rpError vng4_demosaic (int width, int height, const float * const *rawData, floa
             }
         }
         free(code[0][0]);
+        if (!rc && rowProgress.cancelled()) {
+            rc = RP_CANCELLED;
+        }
     }
     free(image);
 
-    setProgCancel(1.0);
+    if (rc != RP_CANCELLED) {
+        setProgCancel(1.0);
+    }
 
     return rc;
 }
+
+template<typename T>
+rpError vng4_demosaic_impl(const rpContext *context, int width, int height, const T * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel)
+{
+    if (context && context->halfBuffers()) {
+        if (runtimeF16C()) {
+            return vng4_demosaic_impl<T, float16<16, true>>(width, height, rawData, red, green, blue, cfarray, setProgCancel);
+        }
+        return vng4_demosaic_impl<T, float16<16>>(width, height, rawData, red, green, blue, cfarray, setProgCancel);
+    }
+    return vng4_demosaic_impl<T, float>(width, height, rawData, red, green, blue, cfarray, setProgCancel);
+}
+
+}
+
+rpError vng4_demosaic(int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel)
+{
+    return vng4_demosaic_impl(nullptr, width, height, rawData, red, green, blue, cfarray, setProgCancel);
+}
+
+rpError vng4_demosaic(rpContext &context, int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel)
+{
+    return vng4_demosaic_impl(&context, width, height, rawData, red, green, blue, cfarray, setProgCancel);
+}
+
+rpError vng4_demosaic(int width, int height, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel)
+{
+    return vng4_demosaic_impl(nullptr, width, height, rawData, red, green, blue, cfarray, setProgCancel);
+}
+
+rpError vng4_demosaic(rpContext &context, int width, int height, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel)
+{
+    return vng4_demosaic_impl(&context, width, height, rawData, red, green, blue, cfarray, setProgCancel);
+}
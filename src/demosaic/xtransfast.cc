@@ -25,7 +25,11 @@
 
 using namespace librtprocess;
 
-rpError xtransfast_demosaic (int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned xtrans[6][6], const std::function<bool(double)> &setProgCancel)
+namespace
+{
+
+template<typename T>
+rpError xtransfast_demosaic_impl(int width, int height, const T * const *rawData, float **red, float **green, float **blue, const unsigned xtrans[6][6], const std::function<bool(double)> &setProgCancel)
 {
 BENCHFUN
 
@@ -86,3 +90,15 @@ BENCHFUN
 
     return RP_NO_ERROR;
 }
+
+}
+
+rpError xtransfast_demosaic(int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned xtrans[6][6], const std::function<bool(double)> &setProgCancel)
+{
+    return xtransfast_demosaic_impl(width, height, rawData, red, green, blue, xtrans, setProgCancel);
+}
+
+rpError xtransfast_demosaic(int width, int height, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned xtrans[6][6], const std::function<bool(double)> &setProgCancel)
+{
+    return xtransfast_demosaic_impl(width, height, rawData, red, green, blue, xtrans, setProgCancel);
+}
@@ -96,7 +96,7 @@ protected:
     unsigned int upperBound;  // always equals size-1, parameter created for performance reason
 private:
     unsigned int owner;
-#ifdef __SSE2__
+#ifdef RT_VECTOR
     alignas(16) vfloat maxsv;
     alignas(16) vfloat sizev;
     alignas(16) vint sizeiv;
@@ -119,7 +119,7 @@ public:
         upperBound = size - 1;
         maxs = size - 2;
         maxsf = (float)maxs;
-#ifdef __SSE2__
+#ifdef RT_VECTOR
         maxsv =  F2V( maxs );
         sizeiv =  _mm_set1_epi32( (int)(size - 1) );
         sizev = F2V( size - 1 );
@@ -143,7 +143,7 @@ public:
         upperBound = size - 1;
         maxs = size - 2;
         maxsf = (float)maxs;
-#ifdef __SSE2__
+#ifdef RT_VECTOR
         maxsv =  F2V( maxs );
         sizeiv =  _mm_set1_epi32( (int)(size - 1) );
         sizev = F2V( size - 1 );
@@ -158,7 +158,7 @@ public:
     {
         data = nullptr;
         reset();
-#ifdef __SSE2__
+#ifdef RT_VECTOR
         maxsv = ZEROV;
         sizev = ZEROV;
         sizeiv = _mm_setzero_si128();
@@ -222,7 +222,7 @@ public:
             this->upperBound = rhs.upperBound;
             this->maxs = this->size - 2;
             this->maxsf = (float)this->maxs;
-#ifdef __SSE2__
+#ifdef RT_VECTOR
             this->maxsv =  F2V( this->size - 2);
             this->sizeiv =  _mm_set1_epi32( (int)(this->size - 1) );
             this->sizev = F2V( this->size - 1 );
@@ -286,7 +286,7 @@ public:
         return data[ librtprocess::LIM<int>(index, 0, upperBound) ];
     }
 
-#ifdef __SSE2__
+#ifdef RT_VECTOR
 
 
     // NOTE: This function requires LUTs which clips only at lower bound
@@ -299,7 +299,7 @@ public:
         vfloat clampedIndexes = vmaxf(ZEROV, vminf(maxsv, indexv));
         vint indexes = _mm_cvttps_epi32(clampedIndexes);
         int indexArray[4];
-        _mm_storeu_si128(reinterpret_cast<__m128i*>(&indexArray[0]), indexes);
+        _mm_storeu_si128(reinterpret_cast<vint*>(&indexArray[0]), indexes);
 
         // Load data from the table. This reads more than necessary, but there don't seem
         // to exist more granular operations (though we could try non-SSE).
@@ -311,8 +311,8 @@ public:
 
         // Partial 4x4 transpose operation. We want two new vectors, the first consisting
         // of [values[0][0] ... values[3][0]] and the second [values[0][1] ... values[3][1]].
-        __m128i temp0 = _mm_unpacklo_epi32(values[0], values[1]);
-        __m128i temp1 = _mm_unpacklo_epi32(values[2], values[3]);
+        vint temp0 = _mm_unpacklo_epi32(values[0], values[1]);
+        vint temp1 = _mm_unpacklo_epi32(values[2], values[3]);
         vfloat lower = _mm_castsi128_ps(_mm_unpacklo_epi64(temp0, temp1));
         vfloat upper = _mm_castsi128_ps(_mm_unpackhi_epi64(temp0, temp1));
 
@@ -331,7 +331,7 @@ public:
         vfloat clampedIndexes = vmaxf(ZEROV, vminf(maxsv, indexv));
         vint indexes = _mm_cvttps_epi32(clampedIndexes);
         int indexArray[4];
-        _mm_storeu_si128(reinterpret_cast<__m128i*>(&indexArray[0]), indexes);
+        _mm_storeu_si128(reinterpret_cast<vint*>(&indexArray[0]), indexes);
 
         // Load data from the table. This reads more than necessary, but there don't seem
         // to exist more granular operations (though we could try non-SSE).
@@ -343,8 +343,8 @@ public:
 
         // Partial 4x4 transpose operation. We want two new vectors, the first consisting
         // of [values[0][0] ... values[3][0]] and the second [values[0][1] ... values[3][1]].
-        __m128i temp0 = _mm_unpacklo_epi32(values[0], values[1]);
-        __m128i temp1 = _mm_unpacklo_epi32(values[2], values[3]);
+        vint temp0 = _mm_unpacklo_epi32(values[0], values[1]);
+        vint temp1 = _mm_unpacklo_epi32(values[2], values[3]);
         vfloat lower = _mm_castsi128_ps(_mm_unpacklo_epi64(temp0, temp1));
         vfloat upper = _mm_castsi128_ps(_mm_unpackhi_epi64(temp0, temp1));
 
@@ -362,7 +362,7 @@ public:
         vfloat clampedIndexes = vmaxf(ZEROV, vminf(maxsv, indexv));
         vint indexes = _mm_cvttps_epi32(clampedIndexes);
         int indexArray[4];
-        _mm_storeu_si128(reinterpret_cast<__m128i*>(&indexArray[0]), indexes);
+        _mm_storeu_si128(reinterpret_cast<vint*>(&indexArray[0]), indexes);
 
         // Load data from the table. This reads more than necessary, but there don't seem
         // to exist more granular operations (though we could try non-SSE).
@@ -374,8 +374,8 @@ public:
 
         // Partial 4x4 transpose operation. We want two new vectors, the first consisting
         // of [values[0][0] ... values[3][0]] and the second [values[0][1] ... values[3][1]].
-        __m128i temp0 = _mm_unpacklo_epi32(values[0], values[1]);
-        __m128i temp1 = _mm_unpacklo_epi32(values[2], values[3]);
+        vint temp0 = _mm_unpacklo_epi32(values[0], values[1]);
+        vint temp1 = _mm_unpacklo_epi32(values[2], values[3]);
         vfloat lower = _mm_castsi128_ps(_mm_unpacklo_epi64(temp0, temp1));
         vfloat upper = _mm_castsi128_ps(_mm_unpackhi_epi64(temp0, temp1));
 
@@ -541,14 +541,14 @@ public:
         sum = 0.f;
         avg = 0.f;
         int i = 0;
-#ifdef __SSE2__
+#ifdef RT_VECTOR
         vfloat iv = _mm_set_ps(3.f, 2.f, 1.f, 0.f);
         vfloat fourv = F2V(4.f);
         vint sumv = (vint)ZEROV;
         vfloat avgv = ZEROV;
 
         for(; i < static_cast<int>(size) - 3; i += 4) {
-            vint datav = _mm_loadu_si128((__m128i*)&data[i]);
+            vint datav = _mm_loadu_si128((vint*)&data[i]);
             sumv += datav;
             avgv += iv * _mm_cvtepi32_ps(datav);
             iv += fourv;
@@ -595,7 +595,7 @@ public:
         upperBound = size - 1;
         maxs = size - 2;
         maxsf = (float)maxs;
-#ifdef __SSE2__
+#ifdef RT_VECTOR
         maxsv =  F2V( size - 2);
         sizeiv =  _mm_set1_epi32( (int)(size - 1) );
         sizev = F2V( size - 1 );
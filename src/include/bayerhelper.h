@@ -18,8 +18,11 @@
  * along with librtprocess.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <cstdint>
 #include <iostream>
 
+#include "librtprocess.h"
+
 namespace librtprocess {
 
 inline unsigned fc(const unsigned cfa[2][2], unsigned row, unsigned col)
@@ -59,7 +62,16 @@ inline bool validateBayerCfa(unsigned colors, const unsigned cfa[2][2]) {
     return false;
 }
 
-inline void interpolate_row_redblue (const float * const *rawData, const unsigned cfarray[2][2], float* ar, float* ab, const float * const pg, const float * const cg, const float * const ng, int i, int width)
+// bayerborder_demosaic() restricted to the rows [rowStart, rowEnd) of the image, only reads the rows [rowStart - 1, rowEnd + 1)
+// instantiated for float and uint16_t raw data
+template<typename T>
+void bayerborder_demosaic_rows(int winw, int winh, int lborders, int rowStart, int rowEnd, const T * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2]);
+// the same for all output layouts
+template<typename T>
+void bayerborder_demosaic_rows(int winw, int winh, int lborders, int rowStart, int rowEnd, const T * const *rawData, const rpOutput &output, const unsigned cfarray[2][2]);
+
+template<typename T>
+inline void interpolate_row_redblue (const T * const *rawData, const unsigned cfarray[2][2], float* ar, float* ab, const float * const pg, const float * const cg, const float * const ng, int i, int width)
 {
     if (fc(cfarray, i, 0) == 2 || fc(cfarray, i, 1) == 2) {
         std::swap(ar, ab);
@@ -19,9 +19,9 @@
 #ifndef _BOXBLUR_H_
 #define _BOXBLUR_H_
 
-#include <stdlib.h>
-#include <string.h>
-#include <math.h>
+#include <algorithm>
+#include <cstddef>
+#include <vector>
 #include "rt_math.h"
 #include "opthelper.h"
 
@@ -29,611 +29,261 @@
 namespace librtprocess
 {
 
-// classical filtering if the support window is small:
+// Generic box blur engine. Every pass computes running means over 2 * radius + 1 samples along a line, the window
+// shrinks at both ends of the line. Lines have to be at least 2 * radius + 1 samples long.
+// The running sum is divided once per output sample (multiplied with the reciprocal of the window size while the window
+// is full), so the means differ at the rounding level from a blur which updates a running mean in every step.
 
-template<class T, class A> void boxblur (T** src, A** dst, int radx, int rady, int W, int H)
-{
-    //box blur image; box range = (radx,rady)
+template<typename V> inline V boxBlurSplat(float value);
 
-    float* temp = new float[W * H];
+template<> inline float boxBlurSplat<float>(float value)
+{
+    return value;
+}
 
-    if (radx == 0) {
-#ifdef _OPENMP
-        #pragma omp parallel for
-#endif
+#ifdef RT_VECTOR
+template<> inline vfloat boxBlurSplat<vfloat>(float value)
+{
+    return F2V(value);
+}
 
-        for (int row = 0; row < H; row++)
-            for (int col = 0; col < W; col++) {
-                temp[row * W + col] = (float)src[row][col];
-            }
-    } else {
-        //horizontal blur
-#ifdef _OPENMP
-        #pragma omp parallel for
+// transposes the 4x4 block held in a, b, c and d (one row each)
+inline void boxBlurTranspose(vfloat &a, vfloat &b, vfloat &c, vfloat &d)
+{
+    const vfloat ab0 = _mm_unpacklo_ps(a, b);
+    const vfloat cd0 = _mm_unpacklo_ps(c, d);
+    const vfloat ab1 = _mm_unpackhi_ps(a, b);
+    const vfloat cd1 = _mm_unpackhi_ps(c, d);
+    a = _mm_movelh_ps(ab0, cd0);
+    b = _mm_movehl_ps(cd0, ab0);
+    c = _mm_movelh_ps(ab1, cd1);
+    d = _mm_movehl_ps(cd1, ab1);
+}
 #endif
 
-        for (int row = 0; row < H; row++) {
-            int len = radx + 1;
-            temp[row * W + 0] = (float)src[row][0] / len;
+// Blurs N interleaved groups of lines at once, V is float or vfloat (4 lines per group). load(i, k) returns sample i
+// of group k, store(j, k, mean) receives the mean around sample j * samp, so samp > 1 resamples the line.
+template<typename V, int N, typename Load, typename Store>
+inline void boxBlurLine(int length, int radius, int samp, const Load &load, const Store &store)
+{
+    V val[N];
 
-            for (int j = 1; j <= radx; j++) {
-                temp[row * W + 0] += (float)src[row][j] / len;
+    if (radius == 0) {
+        for (int i = 0, j = 0; i < length; i += samp, ++j) {
+            for (int k = 0; k < N; ++k) {
+                store(j, k, load(i, k));
             }
+        }
 
-            for (int col = 1; col <= radx; col++) {
-                temp[row * W + col] = (temp[row * W + col - 1] * len + (float)src[row][col + radx]) / (len + 1);
-                len ++;
-            }
+        return;
+    }
 
-            for (int col = radx + 1; col < W - radx; col++) {
-                temp[row * W + col] = temp[row * W + col - 1] + ((float)(src[row][col + radx] - src[row][col - radx - 1])) / len;
-            }
+    float len = radius + 1;
 
-            for (int col = W - radx; col < W; col++) {
-                temp[row * W + col] = (temp[row * W + col - 1] * len - src[row][col - radx - 1]) / (len - 1);
-                len --;
-            }
-        }
-    }
+    for (int k = 0; k < N; ++k) {
+        V sum = load(0, k);
 
-    if (rady == 0) {
-#ifdef _OPENMP
-        #pragma omp parallel for
-#endif
+        for (int i = 1; i <= radius; ++i) {
+            sum = sum + load(i, k);
+        }
 
-        for (int row = 0; row < H; row++)
-            for (int col = 0; col < W; col++) {
-                dst[row][col] = temp[row * W + col];
-            }
-    } else {
-        //vertical blur
-#ifdef _OPENMP
-        #pragma omp parallel for
-#endif
+        val[k] = sum / boxBlurSplat<V>(len);
+        store(0, k, val[k]);
+    }
 
-        for (int col = 0; col < W; col++) {
-            int len = rady + 1;
-            dst[0][col] = temp[0 * W + col] / len;
+    int next = samp; // next sample to store
+    int j = 1;
 
-            for (int i = 1; i <= rady; i++) {
-                dst[0][col] += temp[i * W + col] / len;
-            }
+    for (int i = 1; i <= radius; ++i) {
+        const V lenv = boxBlurSplat<V>(len);
+        const V lenp1v = boxBlurSplat<V>(len + 1.f);
 
-            for (int row = 1; row <= rady; row++) {
-                dst[row][col] = (dst[(row - 1)][col] * len + temp[(row + rady) * W + col]) / (len + 1);
-                len ++;
-            }
+        for (int k = 0; k < N; ++k) {
+            val[k] = (val[k] * lenv + load(i + radius, k)) / lenp1v;
+        }
 
-            for (int row = rady + 1; row < H - rady; row++) {
-                dst[row][col] = dst[(row - 1)][col] + (temp[(row + rady) * W + col] - temp[(row - rady - 1) * W + col]) / len;
+        len += 1.f;
+        if (i == next) {
+            for (int k = 0; k < N; ++k) {
+                store(j, k, val[k]);
             }
 
-            for (int row = H - rady; row < H; row++) {
-                dst[row][col] = (dst[(row - 1)][col] * len - temp[(row - rady - 1) * W + col]) / (len - 1);
-                len --;
-            }
+            ++j;
+            next += samp;
         }
     }
 
-    delete [] temp;
-}
-
-template<class T, class A> void boxblur (T** src, A** dst, T* buffer, int radx, int rady, int W, int H)
-{
-    //box blur image; box range = (radx,rady)
+    const V rlenv = boxBlurSplat<V>(1.f / len);
 
-    float* temp = buffer;
-
-    if (radx == 0) {
-#ifdef _OPENMP
-        #pragma omp for
-#endif
+    for (int i = radius + 1; i < length - radius; ++i) {
+        for (int k = 0; k < N; ++k) {
+            val[k] = val[k] + (load(i + radius, k) - load(i - radius - 1, k)) * rlenv;
+        }
 
-        for (int row = 0; row < H; row++)
-            for (int col = 0; col < W; col++) {
-                temp[row * W + col] = (float)src[row][col];
+        if (i == next) {
+            for (int k = 0; k < N; ++k) {
+                store(j, k, val[k]);
             }
-    } else {
-        //horizontal blur
-#ifdef _OPENMP
-        #pragma omp for
-#endif
 
-        for (int row = 0; row < H; row++) {
-            float len = radx + 1;
-            float tempval = (float)src[row][0];
-
-            for (int j = 1; j <= radx; j++) {
-                tempval += (float)src[row][j];
-            }
+            ++j;
+            next += samp;
+        }
+    }
 
-            tempval /= len;
-            temp[row * W + 0] = tempval;
+    for (int i = length - radius; i < length; ++i) {
+        const V lenv = boxBlurSplat<V>(len);
+        const V lenm1v = boxBlurSplat<V>(len - 1.f);
 
-            for (int col = 1; col <= radx; col++) {
-                temp[row * W + col] = tempval = (tempval * len + (float)src[row][col + radx]) / (len + 1);
-                len ++;
-            }
+        for (int k = 0; k < N; ++k) {
+            val[k] = (val[k] * lenv - load(i - radius - 1, k)) / lenm1v;
+        }
 
-            for (int col = radx + 1; col < W - radx; col++) {
-                temp[row * W + col] = tempval = tempval + ((float)(src[row][col + radx] - src[row][col - radx - 1])) / len;
+        len -= 1.f;
+        if (i == next) {
+            for (int k = 0; k < N; ++k) {
+                store(j, k, val[k]);
             }
 
-            for (int col = W - radx; col < W; col++) {
-                temp[row * W + col] = tempval = (tempval * len - src[row][col - radx - 1]) / (len - 1);
-                len --;
-            }
+            ++j;
+            next += samp;
         }
     }
+}
 
-    if (rady == 0) {
-#ifdef _OPENMP
-        #pragma omp for
+// Horizontal pass: dst[row][j] is the mean of src[srcY + row][srcX + j * samp - radius .. srcX + j * samp + radius]
+// for 0 <= row < H and 0 <= j <= (W - 1) / samp. The work is shared by the threads of the enclosing parallel region.
+inline void boxBlurHorizontal(float** src, float** dst, int srcY, int srcX, int W, int H, int radius, int samp = 1)
+{
+    const int dstW = (W - 1) / samp + 1;
+#ifdef RT_VECTOR
+    // strips of 4 rows are transposed, so that the vectors run along the rows
+    std::vector<float> line(4 * W);
+    std::vector<float> blurred(4 * dstW);
 #endif
 
-        for (int row = 0; row < H; row++)
-            for (int col = 0; col < W; col++) {
-                dst[row][col] = temp[row * W + col];
-            }
-    } else {
-        const int numCols = 8; // process numCols columns at once for better usage of L1 cpu cache
-#ifdef __SSE2__
-        vfloat  leninitv = F2V( (float)(rady + 1));
-        vfloat  onev = F2V( 1.f );
-        vfloat  tempv, temp1v, lenv, lenp1v, lenm1v, rlenv;
-
 #ifdef _OPENMP
-        #pragma omp for
+    #pragma omp for
 #endif
 
-        for (int col = 0; col < W - 7; col += 8) {
-            lenv = leninitv;
-            tempv = LVFU(temp[0 * W + col]);
-            temp1v = LVFU(temp[0 * W + col + 4]);
-
-            for (int i = 1; i <= rady; i++) {
-                tempv = tempv + LVFU(temp[i * W + col]);
-                temp1v = temp1v + LVFU(temp[i * W + col + 4]);
-            }
-
-            tempv = tempv / lenv;
-            temp1v = temp1v / lenv;
-            STVFU( dst[0][col], tempv);
-            STVFU( dst[0][col + 4], temp1v);
-
-            for (int row = 1; row <= rady; row++) {
-                lenp1v = lenv + onev;
-                tempv = (tempv * lenv + LVFU(temp[(row + rady) * W + col])) / lenp1v;
-                temp1v = (temp1v * lenv + LVFU(temp[(row + rady) * W + col + 4])) / lenp1v;
-                STVFU( dst[row][col], tempv);
-                STVFU( dst[row][col + 4], temp1v);
-                lenv = lenp1v;
-            }
-
-            rlenv = onev / lenv;
+    for (int row = 0; row < H; row += 4) {
+        int r = row;
+#ifdef RT_VECTOR
 
-            for (int row = rady + 1; row < H - rady; row++) {
-                tempv = tempv + (LVFU(temp[(row + rady) * W + col]) - LVFU(temp[(row - rady - 1) * W + col])) * rlenv ;
-                temp1v = temp1v + (LVFU(temp[(row + rady) * W + col + 4]) - LVFU(temp[(row - rady - 1) * W + col + 4])) * rlenv ;
-                STVFU( dst[row][col], tempv);
-                STVFU( dst[row][col + 4], temp1v);
-            }
+        if (H - row >= 4) {
+            const float* const in[4] = {src[srcY + row] + srcX, src[srcY + row + 1] + srcX, src[srcY + row + 2] + srcX, src[srcY + row + 3] + srcX};
+            int col = 0;
 
-            for (int row = H - rady; row < H; row++) {
-                lenm1v = lenv - onev;
-                tempv = (tempv * lenv - LVFU(temp[(row - rady - 1) * W + col])) / lenm1v;
-                temp1v = (temp1v * lenv - LVFU(temp[(row - rady - 1) * W + col + 4])) / lenm1v;
-                STVFU( dst[row][col], tempv);
-                STVFU( dst[row][col + 4], temp1v);
-                lenv = lenm1v;
+            for (; col < W - 3; col += 4) {
+                vfloat a = LVFU(in[0][col]), b = LVFU(in[1][col]), c = LVFU(in[2][col]), d = LVFU(in[3][col]);
+                boxBlurTranspose(a, b, c, d);
+                STVFU(line[4 * col], a);
+                STVFU(line[4 * col + 4], b);
+                STVFU(line[4 * col + 8], c);
+                STVFU(line[4 * col + 12], d);
             }
-        }
 
-#else
-        //vertical blur
-#ifdef _OPENMP
-        #pragma omp for
-#endif
-
-        for (int col = 0; col < W - numCols + 1; col += 8) {
-            float len = rady + 1;
-
-            for(int k = 0; k < numCols; k++) {
-                dst[0][col + k] = temp[0 * W + col + k];
-            }
-
-            for (int i = 1; i <= rady; i++) {
-                for(int k = 0; k < numCols; k++) {
-                    dst[0][col + k] += temp[i * W + col + k];
+            for (; col < W; ++col) {
+                for (int k = 0; k < 4; ++k) {
+                    line[4 * col + k] = in[k][col];
                 }
             }
 
-            for(int k = 0; k < numCols; k++) {
-                dst[0][col + k] /= len;
-            }
+            boxBlurLine<vfloat, 1>(W, radius, samp,
+                [&](int i, int) { return LVFU(line[4 * i]); },
+                [&](int j, int, vfloat v) { STVFU(blurred[4 * j], v); });
 
-            for (int row = 1; row <= rady; row++) {
-                for(int k = 0; k < numCols; k++) {
-                    dst[row][col + k] = (dst[(row - 1)][col + k] * len + temp[(row + rady) * W + col + k]) / (len + 1);
-                }
+            float* const out[4] = {dst[row], dst[row + 1], dst[row + 2], dst[row + 3]};
+            col = 0;
 
-                len ++;
+            for (; col < dstW - 3; col += 4) {
+                vfloat a = LVFU(blurred[4 * col]), b = LVFU(blurred[4 * col + 4]), c = LVFU(blurred[4 * col + 8]), d = LVFU(blurred[4 * col + 12]);
+                boxBlurTranspose(a, b, c, d);
+                STVFU(out[0][col], a);
+                STVFU(out[1][col], b);
+                STVFU(out[2][col], c);
+                STVFU(out[3][col], d);
             }
 
-            for (int row = rady + 1; row < H - rady; row++) {
-                for(int k = 0; k < numCols; k++) {
-                    dst[row][col + k] = dst[(row - 1)][col + k] + (temp[(row + rady) * W + col + k] - temp[(row - rady - 1) * W + col + k]) / len;
+            for (; col < dstW; ++col) {
+                for (int k = 0; k < 4; ++k) {
+                    out[k][col] = blurred[4 * col + k];
                 }
             }
 
-            for (int row = H - rady; row < H; row++) {
-                for(int k = 0; k < numCols; k++) {
-                    dst[row][col + k] = (dst[(row - 1)][col + k] * len - temp[(row - rady - 1) * W + col + k]) / (len - 1);
-                }
-
-                len --;
-            }
+            r += 4;
         }
 
 #endif
-#ifdef _OPENMP
-        #pragma omp single
-#endif
-
-        for (int col = W - (W % numCols); col < W; col++) {
-            float len = rady + 1;
-            dst[0][col] = temp[0 * W + col] / len;
-
-            for (int i = 1; i <= rady; i++) {
-                dst[0][col] += temp[i * W + col] / len;
-            }
-
-            for (int row = 1; row <= rady; row++) {
-                dst[row][col] = (dst[(row - 1)][col] * len + temp[(row + rady) * W + col]) / (len + 1);
-                len ++;
-            }
-
-            for (int row = rady + 1; row < H - rady; row++) {
-                dst[row][col] = dst[(row - 1)][col] + (temp[(row + rady) * W + col] - temp[(row - rady - 1) * W + col]) / len;
-            }
 
-            for (int row = H - rady; row < H; row++) {
-                dst[row][col] = (dst[(row - 1)][col] * len - temp[(row - rady - 1) * W + col]) / (len - 1);
-                len --;
-            }
+        for (; r < std::min(row + 4, H); ++r) {
+            const float* const in = src[srcY + r] + srcX;
+            float* const out = dst[r];
+            boxBlurLine<float, 1>(W, radius, samp,
+                [&](int i, int) { return in[i]; },
+                [&](int j, int, float v) { out[j] = v; });
         }
     }
-
 }
 
-template<class T, class A> void boxblur (T* src, A* dst, A* buffer, int radx, int rady, int W, int H)
+// Vertical pass: dst[j][col] is the mean of src[j * samp - radius .. j * samp + radius][col] for 0 <= col < W and
+// 0 <= j <= (H - 1) / samp. The work is shared by the threads of the enclosing parallel region.
+inline void boxBlurVertical(float** src, float** dst, int W, int H, int radius, int samp = 1)
 {
-    //box blur image; box range = (radx,rady) i.e. box size is (2*radx+1)x(2*rady+1)
-
-    float* temp = buffer;
-
-    if (radx == 0) {
-        for (int row = 0; row < H; row++)
-            for (int col = 0; col < W; col++) {
-                temp[row * W + col] = src[row * W + col];
-            }
-    } else {
-        //horizontal blur
-        for (int row = H - 1; row >= 0; row--) {
-            int len = radx + 1;
-            float tempval = (float)src[row * W];
-
-            for (int j = 1; j <= radx; j++) {
-                tempval += (float)src[row * W + j];
-            }
-
-            tempval = tempval / len;
-            temp[row * W] = tempval;
-
-            for (int col = 1; col <= radx; col++) {
-                tempval = (tempval * len + src[row * W + col + radx]) / (len + 1);
-                temp[row * W + col] = tempval;
-                len ++;
-            }
-
-            float reclen = 1.f / len;
-
-            for (int col = radx + 1; col < W - radx; col++) {
-                tempval = tempval + ((float)(src[row * W + col + radx] - src[row * W + col - radx - 1])) * reclen;
-                temp[row * W + col] = tempval;
-            }
-
-            for (int col = W - radx; col < W; col++) {
-                tempval = (tempval * len - src[row * W + col - radx - 1]) / (len - 1);
-                temp[row * W + col] = tempval;
-                len --;
-            }
-        }
-    }
-
-    if (rady == 0) {
-        for (int row = 0; row < H; row++)
-            for (int col = 0; col < W; col++) {
-                dst[row * W + col] = temp[row * W + col];
-            }
-    } else {
-        //vertical blur
-#ifdef __SSE2__
-        vfloat  leninitv = F2V( (float)(rady + 1));
-        vfloat  onev = F2V( 1.f );
-        vfloat  tempv, temp1v, lenv, lenp1v, lenm1v, rlenv;
-        int col;
-
-        for (col = 0; col < W - 7; col += 8) {
-            lenv = leninitv;
-            tempv = LVFU(temp[0 * W + col]);
-            temp1v = LVFU(temp[0 * W + col + 4]);
-
-            for (int i = 1; i <= rady; i++) {
-                tempv = tempv + LVFU(temp[i * W + col]);
-                temp1v = temp1v + LVFU(temp[i * W + col + 4]);
-            }
-
-            tempv = tempv / lenv;
-            temp1v = temp1v / lenv;
-            STVFU( dst[0 * W + col], tempv);
-            STVFU( dst[0 * W + col + 4], temp1v);
-
-            for (int row = 1; row <= rady; row++) {
-                lenp1v = lenv + onev;
-                tempv = (tempv * lenv + LVFU(temp[(row + rady) * W + col])) / lenp1v;
-                temp1v = (temp1v * lenv + LVFU(temp[(row + rady) * W + col + 4])) / lenp1v;
-                STVFU( dst[row * W + col], tempv);
-                STVFU( dst[row * W + col + 4], temp1v);
-                lenv = lenp1v;
-            }
-
-            rlenv = onev / lenv;
-
-            for (int row = rady + 1; row < H - rady; row++) {
-                tempv = tempv + (LVFU(temp[(row + rady) * W + col]) - LVFU(temp[(row - rady - 1) * W + col])) * rlenv ;
-                temp1v = temp1v + (LVFU(temp[(row + rady) * W + col + 4]) - LVFU(temp[(row - rady - 1) * W + col + 4])) * rlenv ;
-                STVFU( dst[row * W + col], tempv);
-                STVFU( dst[row * W + col + 4], temp1v);
-            }
-
-            for (int row = H - rady; row < H; row++) {
-                lenm1v = lenv - onev;
-                tempv = (tempv * lenv - LVFU(temp[(row - rady - 1) * W + col])) / lenm1v;
-                temp1v = (temp1v * lenv - LVFU(temp[(row - rady - 1) * W + col + 4])) / lenm1v;
-                STVFU( dst[row * W + col], tempv);
-                STVFU( dst[row * W + col + 4], temp1v);
-                lenv = lenm1v;
-            }
-        }
-
-        for (; col < W - 3; col += 4) {
-            lenv = leninitv;
-            tempv = LVFU(temp[0 * W + col]);
-
-            for (int i = 1; i <= rady; i++) {
-                tempv = tempv + LVFU(temp[i * W + col]);
-            }
-
-            tempv = tempv / lenv;
-            STVFU( dst[0 * W + col], tempv);
-
-            for (int row = 1; row <= rady; row++) {
-                lenp1v = lenv + onev;
-                tempv = (tempv * lenv + LVFU(temp[(row + rady) * W + col])) / lenp1v;
-                STVFU( dst[row * W + col], tempv);
-                lenv = lenp1v;
-            }
-
-            rlenv = onev / lenv;
+    // blocks of blockW columns run down the rows together, which uses whole cache lines of every row
+    constexpr int blockW = 32;
+#ifdef _OPENMP
+    #pragma omp for
+#endif
 
-            for (int row = rady + 1; row < H - rady; row++) {
-                tempv = tempv + (LVFU(temp[(row + rady) * W + col]) - LVFU(temp[(row - rady - 1) * W + col])) * rlenv ;
-                STVFU( dst[row * W + col], tempv);
-            }
+    for (int col = 0; col < W; col += blockW) {
+        const int end = std::min(col + blockW, W);
+        int c = col;
+#ifdef RT_VECTOR
 
-            for (int row = H - rady; row < H; row++) {
-                lenm1v = lenv - onev;
-                tempv = (tempv * lenv - LVFU(temp[(row - rady - 1) * W + col])) / lenm1v;
-                STVFU( dst[row * W + col], tempv);
-                lenv = lenm1v;
-            }
+        if (end - c == blockW) {
+            boxBlurLine<vfloat, blockW / 4>(H, radius, samp,
+                [&](int i, int k) { return LVFU(src[i][c + 4 * k]); },
+                [&](int j, int k, vfloat v) { STVFU(dst[j][c + 4 * k], v); });
+            c = end;
         }
 
-        for (; col < W; col++) {
-            int len = rady + 1;
-            dst[0 * W + col] = temp[0 * W + col] / len;
-
-            for (int i = 1; i <= rady; i++) {
-                dst[0 * W + col] += temp[i * W + col] / len;
-            }
-
-            for (int row = 1; row <= rady; row++) {
-                dst[row * W + col] = (dst[(row - 1) * W + col] * len + temp[(row + rady) * W + col]) / (len + 1);
-                len ++;
-            }
-
-            for (int row = rady + 1; row < H - rady; row++) {
-                dst[row * W + col] = dst[(row - 1) * W + col] + (temp[(row + rady) * W + col] - temp[(row - rady - 1) * W + col]) / len;
-            }
-
-            for (int row = H - rady; row < H; row++) {
-                dst[row * W + col] = (dst[(row - 1) * W + col] * len - temp[(row - rady - 1) * W + col]) / (len - 1);
-                len --;
-            }
+        for (; c < end - 3; c += 4) {
+            boxBlurLine<vfloat, 1>(H, radius, samp,
+                [&](int i, int) { return LVFU(src[i][c]); },
+                [&](int j, int, vfloat v) { STVFU(dst[j][c], v); });
         }
 
 #else
 
-        for (int col = 0; col < W; col++) {
-            int len = rady + 1;
-            dst[0 * W + col] = temp[0 * W + col] / len;
-
-            for (int i = 1; i <= rady; i++) {
-                dst[0 * W + col] += temp[i * W + col] / len;
-            }
-
-            for (int row = 1; row <= rady; row++) {
-                dst[row * W + col] = (dst[(row - 1) * W + col] * len + temp[(row + rady) * W + col]) / (len + 1);
-                len ++;
-            }
-
-            for (int row = rady + 1; row < H - rady; row++) {
-                dst[row * W + col] = dst[(row - 1) * W + col] + (temp[(row + rady) * W + col] - temp[(row - rady - 1) * W + col]) / len;
-            }
-
-            for (int row = H - rady; row < H; row++) {
-                dst[row * W + col] = (dst[(row - 1) * W + col] * len - temp[(row - rady - 1) * W + col]) / (len - 1);
-                len --;
-            }
+        if (end - c == blockW) {
+            boxBlurLine<float, blockW>(H, radius, samp,
+                [&](int i, int k) { return src[i][c + k]; },
+                [&](int j, int k, float v) { dst[j][c + k] = v; });
+            c = end;
         }
 
 #endif
-    }
-
-}
-
-template<class T, class A> void boxabsblur (T* src, A* dst, int radx, int rady, int W, int H, float * temp)
-{
-
-    //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
-    //box blur image; box range = (radx,rady) i.e. box size is (2*radx+1)x(2*rady+1)
 
-    if (radx == 0) {
-        for (int row = 0; row < H; row++)
-            for (int col = 0; col < W; col++) {
-                temp[row * W + col] = fabs(src[row * W + col]);
-            }
-    } else {
-        //horizontal blur
-        for (int row = 0; row < H; row++) {
-            int len = radx + 1;
-            float tempval = fabsf((float)src[row * W + 0]);
-
-            for (int j = 1; j <= radx; j++) {
-                tempval += fabsf((float)src[row * W + j]);
-            }
-
-            tempval /= len;
-            temp[row * W + 0] = tempval;
-
-            for (int col = 1; col <= radx; col++) {
-                tempval = (tempval * len + fabsf(src[row * W + col + radx])) / (len + 1);
-                temp[row * W + col] = tempval;
-                len ++;
-            }
-
-            float rlen = 1.f / (float)len;
-
-            for (int col = radx + 1; col < W - radx; col++) {
-                tempval = tempval + ((float)(fabsf(src[row * W + col + radx]) - fabsf(src[row * W + col - radx - 1]))) * rlen;
-                temp[row * W + col] = tempval;
-            }
-
-            for (int col = W - radx; col < W; col++) {
-                tempval = (tempval * len - fabsf(src[row * W + col - radx - 1])) / (len - 1);
-                temp[row * W + col] = tempval;
-                len --;
-            }
+        for (; c < end; ++c) {
+            boxBlurLine<float, 1>(H, radius, samp,
+                [&](int i, int) { return src[i][c]; },
+                [&](int j, int, float v) { dst[j][c] = v; });
         }
     }
+}
 
-    if (rady == 0) {
-        for (int row = 0; row < H; row++)
-            for (int col = 0; col < W; col++) {
-                dst[row * W + col] = temp[row * W + col];
-            }
-    } else {
-        //vertical blur
-#ifdef __SSE2__
-        vfloat  leninitv = F2V( (float)(rady + 1));
-        vfloat  onev = F2V( 1.f );
-        vfloat  tempv, lenv, lenp1v, lenm1v, rlenv;
-
-        for (int col = 0; col < W - 3; col += 4) {
-            lenv = leninitv;
-            tempv = LVF(temp[0 * W + col]);
-
-            for (int i = 1; i <= rady; i++) {
-                tempv = tempv + LVF(temp[i * W + col]);
-            }
-
-            tempv = tempv / lenv;
-            STVF(dst[0 * W + col], tempv);
-
-            for (int row = 1; row <= rady; row++) {
-                lenp1v = lenv + onev;
-                tempv = (tempv * lenv + LVF(temp[(row + rady) * W + col])) / lenp1v;
-                STVF(dst[row * W + col], tempv);
-                lenv = lenp1v;
-            }
-
-            rlenv = onev / lenv;
-
-            for (int row = rady + 1; row < H - rady; row++) {
-                tempv = tempv + (LVF(temp[(row + rady) * W + col]) - LVF(temp[(row - rady - 1) * W + col])) * rlenv;
-                STVF(dst[row * W + col], tempv);
-            }
-
-            for (int row = H - rady; row < H; row++) {
-                lenm1v = lenv - onev;
-                tempv = (tempv * lenv - LVF(temp[(row - rady - 1) * W + col])) / lenm1v;
-                STVF(dst[row * W + col], tempv);
-                lenv = lenm1v;
-            }
-        }
-
-        for (int col = W - (W % 4); col < W; col++) {
-            int len = rady + 1;
-            dst[0 * W + col] = temp[0 * W + col] / len;
-
-            for (int i = 1; i <= rady; i++) {
-                dst[0 * W + col] += temp[i * W + col] / len;
-            }
-
-            for (int row = 1; row <= rady; row++) {
-                dst[row * W + col] = (dst[(row - 1) * W + col] * len + temp[(row + rady) * W + col]) / (len + 1);
-                len ++;
-            }
-
-            for (int row = rady + 1; row < H - rady; row++) {
-                dst[row * W + col] = dst[(row - 1) * W + col] + (temp[(row + rady) * W + col] - temp[(row - rady - 1) * W + col]) / len;
-            }
-
-            for (int row = H - rady; row < H; row++) {
-                dst[row * W + col] = (dst[(row - 1) * W + col] * len - temp[(row - rady - 1) * W + col]) / (len - 1);
-                len --;
-            }
-        }
-
-#else
-
-        for (int col = 0; col < W; col++) {
-            int len = rady + 1;
-            dst[0 * W + col] = temp[0 * W + col] / len;
-
-            for (int i = 1; i <= rady; i++) {
-                dst[0 * W + col] += temp[i * W + col] / len;
-            }
-
-            for (int row = 1; row <= rady; row++) {
-                dst[row * W + col] = (dst[(row - 1) * W + col] * len + temp[(row + rady) * W + col]) / (len + 1);
-                len ++;
-            }
-
-            for (int row = rady + 1; row < H - rady; row++) {
-                dst[row * W + col] = dst[(row - 1) * W + col] + (temp[(row + rady) * W + col] - temp[(row - rady - 1) * W + col]) / len;
-            }
-
-            for (int row = H - rady; row < H; row++) {
-                dst[row * W + col] = (dst[(row - 1) * W + col] * len - temp[(row - rady - 1) * W + col]) / (len - 1);
-                len --;
-            }
-        }
+// box blur image; box range = (radx,rady), buffer holds W * H floats. Has to be called from all threads of a
+// parallel region (or outside of one).
+inline void boxblur(float** src, float** dst, float* buffer, int radx, int rady, int W, int H)
+{
+    std::vector<float*> temp(H);
 
-#endif
+    for (int row = 0; row < H; ++row) {
+        temp[row] = buffer + static_cast<std::size_t>(row) * W;
     }
 
+    boxBlurHorizontal(src, temp.data(), 0, 0, W, H, radx);
+    boxBlurVertical(temp.data(), dst, W, H, rady);
 }
 
 }
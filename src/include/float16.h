@@ -0,0 +1,194 @@
+/*
+ * This file is part of librtprocess.
+ *
+ * librtprocess is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * librtprocess is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with librtprocess.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#if defined(__F16C__) || defined(RTPROCESS_TARGET_CLONES)
+#include <immintrin.h>
+#endif
+
+#include "opthelper.h"
+
+namespace librtprocess
+{
+
+// IEEE 754 half precision conversions, rounding to nearest even. Without F16C they are done in software.
+// Values above the half range become infinity, NaN stays NaN.
+inline uint16_t floatToHalf(float value)
+{
+#ifdef __F16C__
+    return _cvtss_sh(value, 0);
+#else
+    uint32_t f;
+    memcpy(&f, &value, sizeof(f));
+    const uint32_t sign = (f >> 16) & 0x8000;
+    f &= 0x7fffffff;
+
+    uint32_t h;
+    if (f >= 0x47800000) { // 65536.f and above, inf or nan
+        h = f > 0x7f800000 ? 0x7e00 : 0x7c00;
+    } else if (f < 0x38800000) { // subnormal half or zero, let the float addition do the rounding
+        float tmp;
+        memcpy(&tmp, &f, sizeof(tmp));
+        tmp += 0.5f;
+        memcpy(&h, &tmp, sizeof(h));
+        h -= 0x3f000000;
+    } else {
+        const uint32_t odd = (f >> 13) & 1;
+        h = (f + 0xc8000fff + odd) >> 13; // rebias the exponent and round the mantissa
+    }
+    return sign | h;
+#endif
+}
+
+inline float halfToFloat(uint16_t value)
+{
+#ifdef __F16C__
+    return _cvtsh_ss(value);
+#else
+    uint32_t f = static_cast<uint32_t>(value & 0x7fff) << 13;
+    const uint32_t exponent = f & 0x0f800000;
+    f += 0x38000000; // rebias the exponent
+    if (exponent == 0x0f800000) { // inf or nan
+        f += 0x38000000;
+    } else if (exponent == 0) { // zero or subnormal
+        f += 0x00800000;
+        float tmp;
+        memcpy(&tmp, &f, sizeof(tmp));
+        tmp -= 6.103515625e-05f; // 2^-14
+        memcpy(&f, &tmp, sizeof(f));
+    }
+    f |= static_cast<uint32_t>(value & 0x8000) << 16;
+    float result;
+    memcpy(&result, &f, sizeof(result));
+    return result;
+#endif
+}
+
+#if defined(RTPROCESS_TARGET_CLONES) && !defined(__F16C__)
+// F16C is not enabled for the build, but the x86-64-v3 and v4 clones of TARGET_CLONES functions inline these
+// conversions. The baseline clone calls them, so use them only if runtimeF16C() returned true.
+inline bool runtimeF16C()
+{
+    return __builtin_cpu_supports("f16c");
+}
+
+__attribute__ ((target ("f16c"))) inline uint16_t floatToHalfF16C(float value)
+{
+    return _cvtss_sh(value, 0);
+}
+
+__attribute__ ((target ("f16c"))) inline float halfToFloatF16C(uint16_t value)
+{
+    return _cvtsh_ss(value);
+}
+#else
+// F16C is enabled for the whole build or can't be selected at runtime, the conversions above are used
+inline bool runtimeF16C()
+{
+    return false;
+}
+
+inline uint16_t floatToHalfF16C(float value)
+{
+    return floatToHalf(value);
+}
+
+inline float halfToFloatF16C(uint16_t value)
+{
+    return halfToFloat(value);
+}
+#endif
+
+// Element of intermediate buffers stored as half float, which converts implicitly from and to float.
+// Values are divided by Scale (a power of two, so the precision is unchanged) when stored to keep e.g. 16 bit raw
+// data below the largest half float, 65504. The relative precision is 2^-11.
+// F16C selects the conversions of runtimeF16C(), for functions which are only called if it returned true.
+template<int Scale = 1, bool F16C = false>
+class float16
+{
+public:
+    float16() = default;
+    float16(float value) : bits(F16C ? floatToHalfF16C(value * (1.f / Scale)) : floatToHalf(value * (1.f / Scale))) {}
+
+    operator float() const
+    {
+        return (F16C ? halfToFloatF16C(bits) : halfToFloat(bits)) * Scale;
+    }
+
+private:
+    uint16_t bits;
+};
+
+#ifdef RT_VECTOR
+#if defined(RTPROCESS_TARGET_CLONES) && !defined(__F16C__)
+__attribute__ ((target ("f16c"))) inline vfloat LVFHF16C(const uint16_t &a)
+{
+    return _mm_cvtph_ps(_mm_loadl_epi64(reinterpret_cast<const vint*>(&a)));
+}
+
+__attribute__ ((target ("f16c"))) inline void STVFHF16C(uint16_t &a, vfloat value)
+{
+    _mm_storel_epi64(reinterpret_cast<vint*>(&a), _mm_cvtps_ph(value, 0));
+}
+#endif
+
+// load and store 4 half floats from / to unaligned memory, F16C as for float16
+template<bool F16C = false>
+inline vfloat LVFH(const uint16_t &a)
+{
+#if defined(__F16C__)
+    return _mm_cvtph_ps(_mm_loadl_epi64(reinterpret_cast<const vint*>(&a)));
+#elif defined(RTPROCESS_NEON)
+    return vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(&a)));
+#else
+#ifdef RTPROCESS_TARGET_CLONES
+    if (F16C) {
+        return LVFHF16C(a);
+    }
+#endif
+    const uint16_t *p = &a;
+    return _mm_setr_ps(halfToFloat(p[0]), halfToFloat(p[1]), halfToFloat(p[2]), halfToFloat(p[3]));
+#endif
+}
+
+template<bool F16C = false>
+inline void STVFH(uint16_t &a, vfloat value)
+{
+#if defined(__F16C__)
+    _mm_storel_epi64(reinterpret_cast<vint*>(&a), _mm_cvtps_ph(value, 0));
+#elif defined(RTPROCESS_NEON)
+    vst1_u16(&a, vreinterpret_u16_f16(vcvt_f16_f32(value)));
+#else
+#ifdef RTPROCESS_TARGET_CLONES
+    if (F16C) {
+        STVFHF16C(a, value);
+        return;
+    }
+#endif
+    float values[4];
+    _mm_storeu_ps(values, value);
+    uint16_t *p = &a;
+    for (int i = 0; i < 4; ++i) {
+        p[i] = floatToHalf(values[i]);
+    }
+#endif
+}
+#endif
+
+}
@@ -237,7 +237,7 @@ template<class T> void gaussHorizontal3 (T** src, T** dst, int W, int H, const f
 #endif
 }
 
-#ifdef __SSE2__
+#ifdef RT_VECTOR
 template<class T> void gaussVertical3 (T** src, T** dst, int W, int H, const float c0, const float c1)
 {
     vfloat Tv = F2V(0.f), Tm1v, Tp1v;
@@ -328,7 +328,7 @@ template<class T> void gaussVertical3 (T** src, T** dst, int W, int H, const flo
 }
 #endif
 
-#ifdef __SSE2__
+#ifdef RT_VECTOR
 // fast gaussian approximation if the support window is large
 template<class T> void gaussHorizontalSse (T** src, T** dst, const int W, const int H, const float sigma)
 {
@@ -496,7 +496,7 @@ template<class T> void gaussHorizontal (T** src, T** dst, const int W, const int
 #endif
 }
 
-#ifdef __SSE2__
+#ifdef RT_VECTOR
 template<class T> void gaussVerticalSse (T** src, T** dst, const int W, const int H, const float sigma)
 {
     double b1, b2, b3, B, M[3][3];
@@ -639,7 +639,7 @@ template<class T> void gaussVerticalSse (T** src, T** dst, const int W, const in
 }
 #endif
 
-#ifdef __SSE2__
+#ifdef RT_VECTOR
 template<class T> void gaussVerticalSsemult (T** RESTRICT src, T** RESTRICT dst, const int W, const int H, const float sigma)
 {
     double b1, b2, b3, B, M[3][3];
@@ -1018,7 +1018,7 @@ template<class T> void gaussVertical (T** src, T** dst, const int W, const int H
 #endif
 }
 
-#ifndef __SSE2__
+#ifndef RT_VECTOR
 template<class T> void gaussVerticaldiv (T** src, T** dst, T** divBuffer, const int W, const int H, const double sigma)
 {
     double b1, b2, b3, B, M[3][3];
@@ -1308,7 +1308,7 @@ template<class T> void gaussianBlurImpl(T** src, T** dst, const int W, const int
                 gaussVertical3<T>   (dst, dst, W, H, c0, c1);
             }
         } else {
-#ifdef __SSE2__
+#ifdef RT_VECTOR
 
             if (sigma < GAUSS_DOUBLE) {
                 switch (gausstype) {
@@ -0,0 +1,741 @@
+////////////////////////////////////////////////////////////////
+//
+//  this code was taken from http://shibatch.sourceforge.net/
+//  Many thanks to the author of original version: Naoki Shibata
+//
+//   Copyright Naoki Shibata and contributors 2010 - 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+//  This version contains modifications made by Ingo Weyrich
+//
+//  AArch64 NEON implementation of the vector layer of helpersse2.h.
+//  The build defines RTPROCESS_NEON for AArch64 targets, then the RT_VECTOR code paths
+//  use the functions and macros of this file instead of the SSE2 ones.
+//
+////////////////////////////////////////////////////////////////
+
+#if !defined(__ARM_NEON) || !defined(__aarch64__)
+#error NEON vector layer needs an AArch64 target.
+#endif
+
+#ifdef __GNUC__
+#define INLINE __inline
+#else
+#define INLINE inline
+#endif
+
+#include <arm_neon.h>
+
+#include <stdint.h>
+
+typedef float64x2_t vdouble;
+typedef int32x4_t vint;
+typedef int32x4_t vmask;
+
+typedef float32x4_t vfloat;
+typedef int32x4_t vint2;
+
+// The vectorized code paths use some SSE2 intrinsics directly. These are the intrinsics they need, declared outside
+// of the global namespace where their names are reserved.
+#define _MM_SHUFFLE(fp3,fp2,fp1,fp0) (((fp3) << 6) | ((fp2) << 4) | ((fp1) << 2) | (fp0))
+
+namespace sse2neon
+{
+
+static INLINE vfloat _mm_set_ps(float e3, float e2, float e1, float e0)
+{
+    const vfloat v = {e0, e1, e2, e3};
+    return v;
+}
+static INLINE vfloat _mm_setr_ps(float e0, float e1, float e2, float e3)
+{
+    const vfloat v = {e0, e1, e2, e3};
+    return v;
+}
+static INLINE vfloat _mm_set_ss(float e0)
+{
+    return vsetq_lane_f32(e0, vdupq_n_f32(0.f), 0);
+}
+static INLINE vint _mm_set_epi32(int e3, int e2, int e1, int e0)
+{
+    const vint v = {e0, e1, e2, e3};
+    return v;
+}
+static INLINE vint _mm_set1_epi32(int i)
+{
+    return vdupq_n_s32(i);
+}
+static INLINE vint _mm_set1_epi8(char b)
+{
+    return vreinterpretq_s32_s8(vdupq_n_s8(b));
+}
+static INLINE vint _mm_setzero_si128()
+{
+    return vdupq_n_s32(0);
+}
+
+static INLINE vfloat _mm_loadu_ps(const float *p)
+{
+    return vld1q_f32(p);
+}
+static INLINE void _mm_storeu_ps(float *p, vfloat a)
+{
+    vst1q_f32(p, a);
+}
+static INLINE vint _mm_load_si128(const vint *p)
+{
+    return vld1q_s32(reinterpret_cast<const int32_t*>(p));
+}
+static INLINE vint _mm_loadu_si128(const vint *p)
+{
+    return vld1q_s32(reinterpret_cast<const int32_t*>(p));
+}
+static INLINE void _mm_store_si128(vint *p, vint a)
+{
+    vst1q_s32(reinterpret_cast<int32_t*>(p), a);
+}
+static INLINE void _mm_storeu_si128(vint *p, vint a)
+{
+    vst1q_s32(reinterpret_cast<int32_t*>(p), a);
+}
+static INLINE vdouble _mm_setzero_pd()
+{
+    return vdupq_n_f64(0.0);
+}
+static INLINE vdouble _mm_loadu_pd(const double *p)
+{
+    return vld1q_f64(p);
+}
+static INLINE void _mm_storeu_pd(double *p, vdouble a)
+{
+    vst1q_f64(p, a);
+}
+static INLINE vdouble _mm_add_pd(vdouble a, vdouble b)
+{
+    return vaddq_f64(a, b);
+}
+static INLINE vdouble _mm_mul_pd(vdouble a, vdouble b)
+{
+    return vmulq_f64(a, b);
+}
+
+static INLINE vint _mm_castps_si128(vfloat a)
+{
+    return vreinterpretq_s32_f32(a);
+}
+static INLINE vfloat _mm_castsi128_ps(vint a)
+{
+    return vreinterpretq_f32_s32(a);
+}
+
+static INLINE vfloat _mm_and_ps(vfloat a, vfloat b)
+{
+    return vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(a), vreinterpretq_u32_f32(b)));
+}
+static INLINE vfloat _mm_andnot_ps(vfloat a, vfloat b)
+{
+    return vreinterpretq_f32_u32(vbicq_u32(vreinterpretq_u32_f32(b), vreinterpretq_u32_f32(a)));
+}
+static INLINE vint _mm_and_si128(vint a, vint b)
+{
+    return vandq_s32(a, b);
+}
+static INLINE vint _mm_andnot_si128(vint a, vint b)
+{
+    return vbicq_s32(b, a);
+}
+static INLINE vint _mm_srli_epi32(vint a, int count)
+{
+    return vreinterpretq_s32_u32(vshlq_u32(vreinterpretq_u32_s32(a), vdupq_n_s32(-count)));
+}
+
+static INLINE vfloat _mm_cvtepi32_ps(vint a)
+{
+    return vcvtq_f32_s32(a);
+}
+static INLINE vint _mm_cvtps_epi32(vfloat a)
+{
+    // SSE2 rounds to nearest even with the default rounding mode
+    return vcvtnq_s32_f32(a);
+}
+static INLINE vint _mm_cvttps_epi32(vfloat a)
+{
+    return vcvtq_s32_f32(a);
+}
+static INLINE int _mm_cvtsi128_si32(vint a)
+{
+    return vgetq_lane_s32(a, 0);
+}
+static INLINE float _mm_cvtss_f32(vfloat a)
+{
+    return vgetq_lane_f32(a, 0);
+}
+static INLINE vfloat _mm_add_ss(vfloat a, vfloat b)
+{
+    return vsetq_lane_f32(vgetq_lane_f32(a, 0) + vgetq_lane_f32(b, 0), a, 0);
+}
+
+static INLINE vfloat _mm_movehl_ps(vfloat a, vfloat b)
+{
+    return vcombine_f32(vget_high_f32(b), vget_high_f32(a));
+}
+static INLINE vfloat _mm_movelh_ps(vfloat a, vfloat b)
+{
+    return vcombine_f32(vget_low_f32(a), vget_low_f32(b));
+}
+static INLINE vfloat _mm_unpacklo_ps(vfloat a, vfloat b)
+{
+    return vzip1q_f32(a, b);
+}
+static INLINE vfloat _mm_unpackhi_ps(vfloat a, vfloat b)
+{
+    return vzip2q_f32(a, b);
+}
+static INLINE vint _mm_unpacklo_epi32(vint a, vint b)
+{
+    return vzip1q_s32(a, b);
+}
+static INLINE vint _mm_unpacklo_epi64(vint a, vint b)
+{
+    return vreinterpretq_s32_s64(vzip1q_s64(vreinterpretq_s64_s32(a), vreinterpretq_s64_s32(b)));
+}
+static INLINE vint _mm_unpackhi_epi64(vint a, vint b)
+{
+    return vreinterpretq_s32_s64(vzip2q_s64(vreinterpretq_s64_s32(a), vreinterpretq_s64_s32(b)));
+}
+// imm is a constant in all callers, the compiler reduces the lane accesses to one or two permute instructions
+static INLINE vfloat _mm_shuffle_ps(vfloat a, vfloat b, int imm)
+{
+    const vfloat v = {a[imm & 3], a[(imm >> 2) & 3], b[(imm >> 4) & 3], b[(imm >> 6) & 3]};
+    return v;
+}
+static INLINE vint _mm_shuffle_epi32(vint a, int imm)
+{
+    const vint v = {a[imm & 3], a[(imm >> 2) & 3], a[(imm >> 4) & 3], a[(imm >> 6) & 3]};
+    return v;
+}
+
+static INLINE int _mm_movemask_ps(vfloat a)
+{
+    const int32x4_t shift = {0, 1, 2, 3};
+    return vaddvq_u32(vshlq_u32(vshrq_n_u32(vreinterpretq_u32_f32(a), 31), shift));
+}
+static INLINE vfloat _mm_rcp_ps(vfloat a)
+{
+    // the NEON estimate has only 8 bits, one Newton-Raphson step gets it close to the 12 bits of rcpps
+    const float32x4_t r = vrecpeq_f32(a);
+    return vmulq_f32(vrecpsq_f32(a, r), r);
+}
+static INLINE vfloat _mm_cmpunord_ps(vfloat a, vfloat b)
+{
+    return vreinterpretq_f32_u32(vmvnq_u32(vandq_u32(vceqq_f32(a, a), vceqq_f32(b, b))));
+}
+
+static INLINE vint _mm_adds_epi8(vint a, vint b)
+{
+    return vreinterpretq_s32_s8(vqaddq_s8(vreinterpretq_s8_s32(a), vreinterpretq_s8_s32(b)));
+}
+static INLINE vint _mm_cmpgt_epi8(vint a, vint b)
+{
+    return vreinterpretq_s32_u8(vcgtq_s8(vreinterpretq_s8_s32(a), vreinterpretq_s8_s32(b)));
+}
+static INLINE vint _mm_cmplt_epi8(vint a, vint b)
+{
+    return vreinterpretq_s32_u8(vcltq_s8(vreinterpretq_s8_s32(a), vreinterpretq_s8_s32(b)));
+}
+static INLINE vint _mm_adds_epu8(vint a, vint b)
+{
+    return vreinterpretq_s32_u8(vqaddq_u8(vreinterpretq_u8_s32(a), vreinterpretq_u8_s32(b)));
+}
+static INLINE vint _mm_subs_epu8(vint a, vint b)
+{
+    return vreinterpretq_s32_u8(vqsubq_u8(vreinterpretq_u8_s32(a), vreinterpretq_u8_s32(b)));
+}
+static INLINE vint _mm_max_epu8(vint a, vint b)
+{
+    return vreinterpretq_s32_u8(vmaxq_u8(vreinterpretq_u8_s32(a), vreinterpretq_u8_s32(b)));
+}
+
+}
+using namespace sse2neon;
+
+//
+#define LVF(x) vld1q_f32((float*)&x)
+#define LVFU(x) vld1q_f32(&x)
+#define STVF(x,y) vst1q_f32(&x,y)
+#define STVFU(x,y) vst1q_f32(&x,y)
+#define LVI(x) vld1q_s32((int32_t*)&x)
+
+#define PERMUTEPS(a,mask) _mm_shuffle_ps(a,a,mask)
+
+static INLINE vfloat LC2VFU(const float &a)
+{
+    // Load 8 floats from a and combine a[0],a[2],a[4] and a[6] into a vector of 4 floats
+    return vld2q_f32(&a).val[0];
+}
+
+// Store a vector of 4 floats in a[0],a[2],a[4] and a[6]
+#define STC2VFU(a,v) {\
+                         float32x4x2_t TSTV = vld2q_f32(&a);\
+                         TSTV.val[0] = v;\
+                         vst2q_f32(&a, TSTV);\
+                     }
+
+#define ZEROV vdupq_n_f32(0.f)
+#define F2V(a) vdupq_n_f32((a))
+
+static INLINE vint vrint_vi_vd(vdouble vd)
+{
+    return vcombine_s32(vmovn_s64(vcvtnq_s64_f64(vd)), vdup_n_s32(0));
+}
+static INLINE vint vtruncate_vi_vd(vdouble vd)
+{
+    return vcombine_s32(vmovn_s64(vcvtq_s64_f64(vd)), vdup_n_s32(0));
+}
+static INLINE vdouble vcast_vd_vi(vint vi)
+{
+    return vcvtq_f64_s64(vmovl_s32(vget_low_s32(vi)));
+}
+static INLINE vdouble vcast_vd_d(double d)
+{
+    return vdupq_n_f64(d);
+}
+static INLINE vint vcast_vi_i(int i)
+{
+    return vcombine_s32(vdup_n_s32(i), vdup_n_s32(0));
+}
+
+static INLINE vmask vreinterpret_vm_vd(vdouble vd)
+{
+    return vreinterpretq_s32_f64(vd);
+}
+static INLINE vdouble vreinterpret_vd_vm(vint vm)
+{
+    return vreinterpretq_f64_s32(vm);
+}
+
+static INLINE vmask vreinterpret_vm_vf(vfloat vf)
+{
+    return vreinterpretq_s32_f32(vf);
+}
+static INLINE vfloat vreinterpret_vf_vm(vmask vm)
+{
+    return vreinterpretq_f32_s32(vm);
+}
+
+//
+
+static INLINE vfloat vcast_vf_f(float f)
+{
+    return vdupq_n_f32(f);
+}
+
+// Don't use intrinsics here. The compiler contracts vaddf(vmulf(a,b),c) to a fused multiply-add only when vaddf and vmulf don't use intrinsics
+static INLINE vfloat vaddf(vfloat x, vfloat y)
+{
+    return x + y;
+}
+static INLINE vfloat vsubf(vfloat x, vfloat y)
+{
+    return x - y;
+}
+static INLINE vfloat vmulf(vfloat x, vfloat y)
+{
+    return x * y;
+}
+static INLINE vfloat vdivf(vfloat x, vfloat y)
+{
+    return x / y;
+}
+static INLINE vfloat vmlaf(vfloat x, vfloat y, vfloat z) {
+    return x * y + z;
+}
+static INLINE vfloat vrecf(vfloat x)
+{
+    return vdivf(vcast_vf_f(1.0f), x);
+}
+static INLINE vfloat vsqrtf(vfloat x)
+{
+    return vsqrtq_f32(x);
+}
+// The NEON min and max return NaN if one of the arguments is NaN. Like SSE2 these return y then.
+static INLINE vfloat vmaxf(vfloat x, vfloat y)
+{
+    return vbslq_f32(vcgtq_f32(x, y), x, y);
+}
+static INLINE vfloat vminf(vfloat x, vfloat y)
+{
+    return vbslq_f32(vcltq_f32(x, y), x, y);
+}
+
+//
+
+static INLINE vdouble vadd(vdouble x, vdouble y)
+{
+    return x + y;
+}
+static INLINE vdouble vsub(vdouble x, vdouble y)
+{
+    return x - y;
+}
+static INLINE vdouble vmul(vdouble x, vdouble y)
+{
+    return x * y;
+}
+static INLINE vdouble vdiv(vdouble x, vdouble y)
+{
+    return x / y;
+}
+static INLINE vdouble vrec(vdouble x)
+{
+    return vdupq_n_f64(1.0) / x;
+}
+static INLINE vdouble vsqrt(vdouble x)
+{
+    return vsqrtq_f64(x);
+}
+static INLINE vdouble vmla(vdouble x, vdouble y, vdouble z)
+{
+    return vadd(vmul(x, y), z);
+}
+
+static INLINE vdouble vmax(vdouble x, vdouble y)
+{
+    return vbslq_f64(vcgtq_f64(x, y), x, y);
+}
+static INLINE vdouble vmin(vdouble x, vdouble y)
+{
+    return vbslq_f64(vcltq_f64(x, y), x, y);
+}
+
+static INLINE vdouble vabs(vdouble d)
+{
+    return vabsq_f64(d);
+}
+static INLINE vdouble vneg(vdouble d)
+{
+    return vnegq_f64(d);
+}
+
+//
+
+static INLINE vint vaddi(vint x, vint y)
+{
+    return vaddq_s32(x, y);
+}
+static INLINE vint vsubi(vint x, vint y)
+{
+    return vsubq_s32(x, y);
+}
+
+static INLINE vint vandi(vint x, vint y)
+{
+    return vandq_s32(x, y);
+}
+static INLINE vint vandnoti(vint x, vint y)
+{
+    return vbicq_s32(y, x);
+}
+static INLINE vint vori(vint x, vint y)
+{
+    return vorrq_s32(x, y);
+}
+static INLINE vint vxori(vint x, vint y)
+{
+    return veorq_s32(x, y);
+}
+
+// the shift counts are constants in all callers, the compiler uses the immediate forms then
+static INLINE vint vslli(vint x, int c)
+{
+    return vshlq_s32(x, vdupq_n_s32(c));
+}
+static INLINE vint vsrli(vint x, int c)
+{
+    return vreinterpretq_s32_u32(vshlq_u32(vreinterpretq_u32_s32(x), vdupq_n_s32(-c)));
+}
+static INLINE vint vsrai(vint x, int c)
+{
+    return vshlq_s32(x, vdupq_n_s32(-c));
+}
+
+//
+
+static INLINE vmask vandm(vmask x, vmask y)
+{
+    return vandq_s32(x, y);
+}
+static INLINE vmask vandnotm(vmask x, vmask y)
+{
+    return vbicq_s32(y, x);
+}
+static INLINE vmask vorm(vmask x, vmask y)
+{
+    return vorrq_s32(x, y);
+}
+static INLINE vmask vxorm(vmask x, vmask y)
+{
+    return veorq_s32(x, y);
+}
+static INLINE vmask vnotm(vmask x)
+{
+    return vmvnq_s32(x);
+}
+
+static INLINE vmask vmask_eq(vdouble x, vdouble y)
+{
+    return vreinterpretq_s32_u64(vceqq_f64(x, y));
+}
+static INLINE vmask vmask_neq(vdouble x, vdouble y)
+{
+    return vmvnq_s32(vreinterpretq_s32_u64(vceqq_f64(x, y)));
+}
+static INLINE vmask vmask_lt(vdouble x, vdouble y)
+{
+    return vreinterpretq_s32_u64(vcltq_f64(x, y));
+}
+static INLINE vmask vmask_le(vdouble x, vdouble y)
+{
+    return vreinterpretq_s32_u64(vcleq_f64(x, y));
+}
+static INLINE vmask vmask_gt(vdouble x, vdouble y)
+{
+    return vreinterpretq_s32_u64(vcgtq_f64(x, y));
+}
+static INLINE vmask vmask_ge(vdouble x, vdouble y)
+{
+    return vreinterpretq_s32_u64(vcgeq_f64(x, y));
+}
+
+static INLINE vmask vmaskf_eq(vfloat x, vfloat y)
+{
+    return vreinterpretq_s32_u32(vceqq_f32(x, y));
+}
+static INLINE vmask vmaskf_neq(vfloat x, vfloat y)
+{
+    return vreinterpretq_s32_u32(vmvnq_u32(vceqq_f32(x, y)));
+}
+static INLINE vmask vmaskf_lt(vfloat x, vfloat y)
+{
+    return vreinterpretq_s32_u32(vcltq_f32(x, y));
+}
+static INLINE vmask vmaskf_le(vfloat x, vfloat y)
+{
+    return vreinterpretq_s32_u32(vcleq_f32(x, y));
+}
+static INLINE vmask vmaskf_gt(vfloat x, vfloat y)
+{
+    return vreinterpretq_s32_u32(vcgtq_f32(x, y));
+}
+static INLINE vmask vmaskf_ge(vfloat x, vfloat y)
+{
+    return vreinterpretq_s32_u32(vcgeq_f32(x, y));
+}
+
+
+static INLINE vmask vmaski_eq(vint x, vint y)
+{
+    // widen the mask of the two ints in the low half to the two doubles
+    const vmask s = vreinterpretq_s32_u32(vceqq_s32(x, y));
+    return vzip1q_s32(s, s);
+}
+
+static INLINE vdouble vsel(vmask mask, vdouble x, vdouble y)
+{
+    return vbslq_f64(vreinterpretq_u64_s32(mask), x, y);
+}
+
+static INLINE vint vseli_lt(vdouble d0, vdouble d1, vint x, vint y)
+{
+    const uint32x4_t mask = vcombine_u32(vmovn_u64(vcltq_f64(d0, d1)), vdup_n_u32(0));
+    return vbslq_s32(mask, x, y);
+}
+
+//
+
+static INLINE vint2 vcast_vi2_vm(vmask vm)
+{
+    return vm;
+}
+static INLINE vmask vcast_vm_vi2(vint2 vi)
+{
+    return vi;
+}
+
+static INLINE vint2 vrint_vi2_vf(vfloat vf)
+{
+    return vcvtnq_s32_f32(vf);
+}
+static INLINE vint2 vtruncate_vi2_vf(vfloat vf)
+{
+    return vcvtq_s32_f32(vf);
+}
+static INLINE vfloat vcast_vf_vi2(vint2 vi)
+{
+    return vcvtq_f32_s32(vcast_vm_vi2(vi));
+}
+static INLINE vint2 vcast_vi2_i(int i)
+{
+    return vdupq_n_s32(i);
+}
+
+static INLINE vint2 vaddi2(vint2 x, vint2 y)
+{
+    return vaddi(x, y);
+}
+static INLINE vint2 vsubi2(vint2 x, vint2 y)
+{
+    return vsubi(x, y);
+}
+
+static INLINE vint2 vandi2(vint2 x, vint2 y)
+{
+    return vandi(x, y);
+}
+static INLINE vint2 vandnoti2(vint2 x, vint2 y)
+{
+    return vandnoti(x, y);
+}
+static INLINE vint2 vori2(vint2 x, vint2 y)
+{
+    return vori(x, y);
+}
+static INLINE vint2 vxori2(vint2 x, vint2 y)
+{
+    return vxori(x, y);
+}
+
+static INLINE vint2 vslli2(vint2 x, int c)
+{
+    return vslli(x, c);
+}
+static INLINE vint2 vsrli2(vint2 x, int c)
+{
+    return vsrli(x, c);
+}
+static INLINE vint2 vsrai2(vint2 x, int c)
+{
+    return vsrai(x, c);
+}
+
+static INLINE vmask vmaski2_eq(vint2 x, vint2 y)
+{
+    return vreinterpretq_s32_u32(vceqq_s32(x, y));
+}
+static INLINE vint2 vseli2(vmask m, vint2 x, vint2 y)
+{
+    return vbslq_s32(vreinterpretq_u32_s32(m), x, y);
+}
+
+//
+
+static INLINE double vcast_d_vd(vdouble v)
+{
+    return vgetq_lane_f64(v, 0);
+}
+
+static INLINE float vcast_f_vf(vfloat v)
+{
+    return vgetq_lane_f32(v, 0);
+}
+
+static INLINE vmask vsignbit(vdouble d)
+{
+    return vreinterpretq_s32_u64(vandq_u64(vreinterpretq_u64_f64(d), vdupq_n_u64(0x8000000000000000ULL)));
+}
+
+static INLINE vdouble vsign(vdouble d)
+{
+    return vreinterpretq_f64_s32(vorm(vreinterpretq_s32_f64(vdupq_n_f64(1.0)), vsignbit(d)));
+}
+
+static INLINE vdouble vmulsign(vdouble x, vdouble y)
+{
+    return vreinterpretq_f64_s32(vxori(vreinterpretq_s32_f64(x), vsignbit(y)));
+}
+
+static INLINE vmask vmask_isinf(vdouble d)
+{
+    return vmask_eq(vabs(d), vdupq_n_f64(INFINITY));
+}
+
+static INLINE vmask vmask_ispinf(vdouble d)
+{
+    return vmask_eq(d, vdupq_n_f64(INFINITY));
+}
+
+static INLINE vmask vmask_isminf(vdouble d)
+{
+    return vmask_eq(d, vdupq_n_f64(-INFINITY));
+}
+
+static INLINE vmask vmask_isnan(vdouble d)
+{
+    return vmask_neq(d, d);
+}
+
+static INLINE vdouble visinf(vdouble d)
+{
+    return vreinterpretq_f64_s32(vandm(vmask_isinf(d), vorm(vsignbit(d), vreinterpretq_s32_f64(vdupq_n_f64(1.0)))));
+}
+
+static INLINE vdouble visinf2(vdouble d, vdouble m)
+{
+    return vreinterpretq_f64_s32(vandm(vmask_isinf(d), vorm(vsignbit(d), vreinterpretq_s32_f64(m))));
+}
+
+//
+
+static INLINE vdouble vpow2i(vint q)
+{
+    // q holds two ints in the low half
+    return vreinterpretq_f64_s64(vshlq_n_s64(vmovl_s32(vadd_s32(vget_low_s32(q), vdup_n_s32(0x3ff))), 52));
+}
+
+static INLINE vdouble vldexp(vdouble x, vint q)
+{
+    vint m = vsrai(q, 31);
+    m = vslli(vsubi(vsrai(vaddi(m, q), 9), m), 7);
+    q = vsubi(q, vslli(m, 2));
+    vdouble y = vpow2i(m);
+    return vmul(vmul(vmul(vmul(vmul(x, y), y), y), y), vpow2i(q));
+}
+
+static INLINE vint vilogbp1(vdouble d)
+{
+    vint m = vmask_lt(d, vcast_vd_d(4.9090934652977266E-91));
+    d = vsel(m, vmul(vcast_vd_d(2.037035976334486E90), d), d);
+    // upper 32 bits of each double
+    const int32x2_t q = vreinterpret_s32_u32(vshr_n_u32(vshrn_n_u64(vreinterpretq_u64_f64(d), 32), 20));
+    const uint32x2_t m2 = vmovn_u64(vreinterpretq_u64_s32(m));
+    return vcombine_s32(vbsl_s32(m2, vsub_s32(q, vdup_n_s32(300 + 0x3fe)), vsub_s32(q, vdup_n_s32(0x3fe))), vdup_n_s32(0));
+}
+
+static INLINE vdouble vupper(vdouble d)
+{
+    return vreinterpretq_f64_u64(vandq_u64(vreinterpretq_u64_f64(d), vdupq_n_u64(0xfffffffff8000000ULL)));
+}
+
+//
+
+typedef struct {
+    vdouble x, y;
+} vdouble2;
+
+static INLINE vdouble2 dd(vdouble h, vdouble l)
+{
+    vdouble2 ret = {h, l};
+    return ret;
+}
+
+static INLINE vdouble2 vsel2(vmask mask, vdouble2 x, vdouble2 y)
+{
+    return dd(vsel(mask, x.x, y.x), vsel(mask, x.y, y.y));
+}
+
+static INLINE vdouble2 abs_d(vdouble2 x)
+{
+    return dd(vabs(x.x), vreinterpretq_f64_s32(vxori(vsignbit(x.x), vreinterpretq_s32_f64(x.y))));
+}
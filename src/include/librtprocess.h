@@ -24,6 +24,8 @@
 
 #include <functional>
 #include <cstddef>
+#include <cstdint>
+#include <string>
 
 #ifndef LIBRTPROCESS_STATIC
 // DLL interface export/import macros are only available for MSVC for now, 
@@ -43,22 +45,273 @@
 #   define RTPROCESS_API
 #endif
 
-enum rpError {RP_NO_ERROR, RP_MEMORY_ERROR, RP_WRONG_CFA, RP_CACORRECT_ERROR};
+enum rpError {RP_NO_ERROR, RP_MEMORY_ERROR, RP_WRONG_CFA, RP_CACORRECT_ERROR, RP_CANCELLED};
+
+// The setProgCancel callbacks receive the progress in [0, 1]. Returning true from the callback of amaze, rcd,
+// markesteijn, ahd, bayerfast, vng4 or CA_correct stops the routine after the tiles which are in work and makes
+// it return RP_CANCELLED. The output is incomplete in that case.
+
+namespace librtprocess {
+class ScratchBuffer;
+class StageTimer;
+}
+
+// Receives the time spent in one stage of a routine, e.g. ("amaze", "green interpolation", 12.3).
+// Called once per stage after the routine has finished, followed by a call for the stage "total",
+// which is the wall clock time of the whole routine. The time of stages processed tile by tile in parallel
+// is the sum over all threads, the time of all other stages is wall clock time.
+typedef std::function<void(const char *routine, const char *stage, double milliseconds)> rpStageCallback;
+
+// Reusable working space for the tiled algorithms (amaze, rcd, markesteijn, bayerfast, ahd) and per call
+// stage timings for all routines which take a context.
+// Every thread gets its own 64 byte aligned arena, which grows to the largest tile buffer requested so far
+// and is kept until release() is called or the context is destroyed.
+// Passing the same context to repeated calls avoids allocating and zeroing the tile buffers on each call.
+// A context must not be used by more than one call at the same time.
+class RTPROCESS_API rpContext
+{
+public:
+    rpContext();
+    ~rpContext();
+
+    rpContext(const rpContext&) = delete;
+    rpContext& operator =(const rpContext&) = delete;
+
+    // free all arenas, they will be allocated again by the next call which uses the context
+    void release();
+    // number of bytes currently held by the arenas
+    std::size_t size() const;
+    // report the stage timings of all following calls which use the context, an empty function disables it
+    void setStageCallback(const rpStageCallback &callback);
+    // store the large full size intermediate buffers of the following calls which use the context (the interpolation
+    // buffer of vng4_demosaic and the interpolated G of CA_correct) as IEEE half floats. This halves their memory and
+    // bandwidth at a relative precision of 2^-11 in those buffers. Off by default.
+    void setHalfBuffers(bool enable);
+    bool halfBuffers() const;
+
+private:
+    friend class librtprocess::ScratchBuffer;
+    friend class librtprocess::StageTimer;
+    rpStageCallback stageCallback;
+    bool useHalfBuffers;
+    struct Arena;
+    Arena *arenas;
+    int numArenas;
+};
+
+// Memory layouts for the result of amaze_demosaic, rcd_demosaic and markesteijn_demosaic
+enum rpOutputLayout {
+    RP_OUTPUT_PLANAR_FLOAT,     // separate red, green and blue float planes
+    RP_OUTPUT_RGB_FLOAT,        // interleaved rgb float
+    RP_OUTPUT_RGBA_HALF,        // interleaved rgba IEEE half float, alpha is 1
+    RP_OUTPUT_RGB_UINT16        // interleaved rgb unsigned 16 bit, rounded and clipped to [0, 65535]
+};
+
+// Describes where a demosaicer stores its result. For the interleaved layouts rows[y] points to the first pixel of row y
+// and the values are multiplied by scale, e.g. 1 / 65535 for normalized half floats.
+struct rpOutput {
+    rpOutput(float **redPlane, float **greenPlane, float **bluePlane) :
+        layout(RP_OUTPUT_PLANAR_FLOAT), red(redPlane), green(greenPlane), blue(bluePlane), rows(nullptr), scale(1.f) {}
+    rpOutput(rpOutputLayout interleavedLayout, void **interleavedRows, float valueScale = 1.f) :
+        layout(interleavedLayout), red(nullptr), green(nullptr), blue(nullptr), rows(interleavedRows), scale(valueScale) {}
+
+    rpOutputLayout layout;
+    float **red;
+    float **green;
+    float **blue;
+    void **rows;
+    float scale;
+};
+
 RTPROCESS_API rpError bayerborder_demosaic(int winw, int winh, int lborders, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2]);
 RTPROCESS_API void xtransborder_demosaic(int winw, int winh, int border, const float * const *rawData, float **red, float **green, float **blue, const unsigned xtrans[6][6]);
 RTPROCESS_API rpError ahd_demosaic (int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const float rgb_cam[3][4], const std::function<bool(double)> &setProgCancel);
+RTPROCESS_API rpError ahd_demosaic(rpContext &context, int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const float rgb_cam[3][4], const std::function<bool(double)> &setProgCancel);
 RTPROCESS_API rpError amaze_demosaic(int raw_width, int raw_height, int winx, int winy, int winw, int winh, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double initGain, int border, float inputScale, float outputScale, std::size_t chunkSize = 2, bool measure = false);
+RTPROCESS_API rpError amaze_demosaic(rpContext &context, int raw_width, int raw_height, int winx, int winy, int winw, int winh, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double initGain, int border, float inputScale, float outputScale, std::size_t chunkSize = 2, bool measure = false);
 RTPROCESS_API rpError bayerfast_demosaic(int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double initGain);
+RTPROCESS_API rpError bayerfast_demosaic(rpContext &context, int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double initGain);
 RTPROCESS_API rpError dcb_demosaic(int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, int iterations, bool dcb_enhance);
 RTPROCESS_API rpError hphd_demosaic(int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel);
 RTPROCESS_API rpError rcd_demosaic(int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, std::size_t chunkSize = 2, bool measure = false, bool multiThread = true);
+RTPROCESS_API rpError rcd_demosaic(rpContext &context, int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, std::size_t chunkSize = 2, bool measure = false, bool multiThread = true);
 RTPROCESS_API rpError markesteijn_demosaic(int width, int height, const float * const *rawdata, float **red, float **green, float **blue, const unsigned xtrans[6][6], const float rgb_cam[3][4], const std::function<bool(double)> &setProgCancel, const int passes, const bool useCieLab, std::size_t chunkSize = 2, bool measure = false);
+RTPROCESS_API rpError markesteijn_demosaic(rpContext &context, int width, int height, const float * const *rawdata, float **red, float **green, float **blue, const unsigned xtrans[6][6], const float rgb_cam[3][4], const std::function<bool(double)> &setProgCancel, const int passes, const bool useCieLab, std::size_t chunkSize = 2, bool measure = false);
 RTPROCESS_API rpError xtransfast_demosaic(int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned xtrans[6][6], const std::function<bool(double)> &setProgCancel);
 RTPROCESS_API rpError vng4_demosaic (int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel);
+RTPROCESS_API rpError vng4_demosaic (rpContext &context, int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel);
 RTPROCESS_API rpError igv_demosaic(int winw, int winh, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel);
 RTPROCESS_API rpError lmmse_demosaic(int width, int height, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, int iterations);
+// Row strip versions of amaze_demosaic and rcd_demosaic for bounded memory. They compute the rows [stripTop, stripTop + stripHeight)
+// of a width x height image with the same result as a call for the whole image. rawData, red, green and blue are indexed with
+// image rows, but only the raw rows [rawTop, rawBottom) returned by the matching *_strip_input() function and the output rows of
+// the strip are accessed, so the rows can live in ring buffers of about strip height + 2 tile heights (160 rows for amaze,
+// 194 rows for rcd). Tiles which span the border between two strips are computed for both strips, so strips should be
+// considerably higher than a tile.
+RTPROCESS_API void amaze_demosaic_strip_input(int height, int stripTop, int stripHeight, int &rawTop, int &rawBottom);
+RTPROCESS_API rpError amaze_demosaic_strip(rpContext &context, int width, int height, int stripTop, int stripHeight, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double initGain, int border, float inputScale, float outputScale, std::size_t chunkSize = 2);
+RTPROCESS_API void rcd_demosaic_strip_input(int height, int stripTop, int stripHeight, int &rawTop, int &rawBottom);
+RTPROCESS_API rpError rcd_demosaic_strip(rpContext &context, int width, int height, int stripTop, int stripHeight, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, std::size_t chunkSize = 2, bool multiThread = true);
+// The demosaicers also read the raw data directly as unsigned 16 bit integers, as delivered by most raw decoders. The values
+// are converted to float while the tiles are loaded and have to be in the same range as the float raw data.
+RTPROCESS_API rpError bayerborder_demosaic(int winw, int winh, int lborders, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2]);
+RTPROCESS_API void xtransborder_demosaic(int winw, int winh, int border, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned xtrans[6][6]);
+RTPROCESS_API rpError ahd_demosaic (int width, int height, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const float rgb_cam[3][4], const std::function<bool(double)> &setProgCancel);
+RTPROCESS_API rpError ahd_demosaic(rpContext &context, int width, int height, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const float rgb_cam[3][4], const std::function<bool(double)> &setProgCancel);
+RTPROCESS_API rpError amaze_demosaic(int raw_width, int raw_height, int winx, int winy, int winw, int winh, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double initGain, int border, float inputScale, float outputScale, std::size_t chunkSize = 2, bool measure = false);
+RTPROCESS_API rpError amaze_demosaic(rpContext &context, int raw_width, int raw_height, int winx, int winy, int winw, int winh, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double initGain, int border, float inputScale, float outputScale, std::size_t chunkSize = 2, bool measure = false);
+RTPROCESS_API rpError bayerfast_demosaic(int width, int height, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double initGain);
+RTPROCESS_API rpError bayerfast_demosaic(rpContext &context, int width, int height, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double initGain);
+RTPROCESS_API rpError dcb_demosaic(int width, int height, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, int iterations, bool dcb_enhance);
+RTPROCESS_API rpError hphd_demosaic(int width, int height, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel);
+RTPROCESS_API rpError rcd_demosaic(int width, int height, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, std::size_t chunkSize = 2, bool measure = false, bool multiThread = true);
+RTPROCESS_API rpError rcd_demosaic(rpContext &context, int width, int height, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, std::size_t chunkSize = 2, bool measure = false, bool multiThread = true);
+RTPROCESS_API rpError markesteijn_demosaic(int width, int height, const uint16_t * const *rawdata, float **red, float **green, float **blue, const unsigned xtrans[6][6], const float rgb_cam[3][4], const std::function<bool(double)> &setProgCancel, const int passes, const bool useCieLab, std::size_t chunkSize = 2, bool measure = false);
+RTPROCESS_API rpError markesteijn_demosaic(rpContext &context, int width, int height, const uint16_t * const *rawdata, float **red, float **green, float **blue, const unsigned xtrans[6][6], const float rgb_cam[3][4], const std::function<bool(double)> &setProgCancel, const int passes, const bool useCieLab, std::size_t chunkSize = 2, bool measure = false);
+RTPROCESS_API rpError xtransfast_demosaic(int width, int height, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned xtrans[6][6], const std::function<bool(double)> &setProgCancel);
+RTPROCESS_API rpError vng4_demosaic (int width, int height, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel);
+RTPROCESS_API rpError vng4_demosaic (rpContext &context, int width, int height, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel);
+RTPROCESS_API rpError igv_demosaic(int winw, int winh, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel);
+RTPROCESS_API rpError lmmse_demosaic(int width, int height, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, int iterations);
+RTPROCESS_API rpError amaze_demosaic_strip(rpContext &context, int width, int height, int stripTop, int stripHeight, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double initGain, int border, float inputScale, float outputScale, std::size_t chunkSize = 2);
+RTPROCESS_API rpError rcd_demosaic_strip(rpContext &context, int width, int height, int stripTop, int stripHeight, const uint16_t * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, std::size_t chunkSize = 2, bool multiThread = true);
+// Versions which write the tiles straight to an output layout, which saves a separate interleaving pass
+RTPROCESS_API rpError amaze_demosaic(rpContext &context, int raw_width, int raw_height, int winx, int winy, int winw, int winh, const float * const *rawData, const rpOutput &output, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double initGain, int border, float inputScale, float outputScale, std::size_t chunkSize = 2);
+RTPROCESS_API rpError amaze_demosaic(rpContext &context, int raw_width, int raw_height, int winx, int winy, int winw, int winh, const uint16_t * const *rawData, const rpOutput &output, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double initGain, int border, float inputScale, float outputScale, std::size_t chunkSize = 2);
+RTPROCESS_API rpError rcd_demosaic(rpContext &context, int width, int height, const float * const *rawData, const rpOutput &output, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, std::size_t chunkSize = 2, bool multiThread = true);
+RTPROCESS_API rpError rcd_demosaic(rpContext &context, int width, int height, const uint16_t * const *rawData, const rpOutput &output, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, std::size_t chunkSize = 2, bool multiThread = true);
+RTPROCESS_API rpError markesteijn_demosaic(rpContext &context, int width, int height, const float * const *rawData, const rpOutput &output, const unsigned xtrans[6][6], const float rgb_cam[3][4], const std::function<bool(double)> &setProgCancel, const int passes, const bool useCieLab, std::size_t chunkSize = 2);
+RTPROCESS_API rpError markesteijn_demosaic(rpContext &context, int width, int height, const uint16_t * const *rawData, const rpOutput &output, const unsigned xtrans[6][6], const float rgb_cam[3][4], const std::function<bool(double)> &setProgCancel, const int passes, const bool useCieLab, std::size_t chunkSize = 2);
+// One image of a batch for rcd_demosaic_batch. Set either rawData or rawData16, the other one has to be nullptr
+struct rpBayerFrame {
+    int width;
+    int height;
+    const float * const *rawData;
+    const uint16_t * const *rawData16;
+    rpOutput output;
+    unsigned cfarray[2][2];
+};
+// Demosaics count images with rcd in one parallel region. The tiles of all images share one work queue, which keeps all
+// cores busy for small images, and the thread start and scratch allocation are paid once per batch instead of once per image.
+// Returns RP_WRONG_CFA without touching any output if one of the cfa patterns is not a bayer pattern.
+RTPROCESS_API rpError rcd_demosaic_batch(rpContext &context, const rpBayerFrame *frames, std::size_t count, const std::function<bool(double)> &setProgCancel, std::size_t chunkSize = 2);
 // for CA_correct rawDataIn and rawDataOut may point to the same buffer. That's handled fine inside CA_correct
 RTPROCESS_API rpError CA_correct(int winx, int winy, int winw, int winh, const bool autoCA, std::size_t autoIterations, const double cared, const double cablue, bool avoidColourshift, const float * const *rawDataIn, float **rawDataOut, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double fitParams[2][2][16], bool fitParamsIn, float inputScale = 65535.f, float outputScale = 65535.f, size_t chunkSize = 2, bool measure = false);
+RTPROCESS_API rpError CA_correct(rpContext &context, int winx, int winy, int winw, int winh, const bool autoCA, std::size_t autoIterations, const double cared, const double cablue, bool avoidColourshift, const float * const *rawDataIn, float **rawDataOut, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double fitParams[2][2][16], bool fitParamsIn, float inputScale = 65535.f, float outputScale = 65535.f, size_t chunkSize = 2, bool measure = false);
+// Form of a CA model
+enum rpCAModelType {
+    RP_CA_POLYNOMIAL,   // shifts per colour and direction as polynomials of order polyOrder (2 to RP_CA_MAX_ORDER) in vblock and hblock
+    RP_CA_RADIAL        // a constant shift plus a radial shift around the image centre, polyOrder (1 to RP_CA_MAX_ORDER) terms
+};
+constexpr int RP_CA_MAX_ORDER = 6;
+
+// Fitted chromatic aberration of CA_correct: the vertical and horizontal shifts of red and blue over the block grid of a
+// width x height image, blocks are 112 pixels apart.
+// RP_CA_POLYNOMIAL: fitParams[colour][direction][polyOrder * i + j] is the coefficient of vblock^i * hblock^j.
+// RP_CA_RADIAL: with d the offset of a block from the image centre in blocks and r2 its squared distance relative to half the
+// image diagonal, the shift is fitParams[colour][1][0..1] + d * (fitParams[colour][0][0] + fitParams[colour][0][1] * r2 + ...).
+// It has fewer parameters, so it's cheaper to fit and apply and more robust with few usable blocks.
+// Applying a model to an image of another size, e.g. after detecting it on a downscaled frame, evaluates it at the
+// corresponding position and scales the shifts with the size.
+struct RTPROCESS_API rpCAModel {
+    rpCAModel();
+
+    bool valid() const;
+    // one line of text which deserialize() reads back, e.g. for sidecar files
+    std::string serialize() const;
+    // returns false and keeps the model unchanged if text is not a serialized model
+    bool deserialize(const std::string &text);
+
+    rpCAModelType type;
+    int width;
+    int height;
+    int polyOrder;
+    double fitParams[2][2][RP_CA_MAX_ORDER * RP_CA_MAX_ORDER];
+};
+
+// Thread safe store of CA models per lens and focal length, so a model detected once can be reused for a whole shoot.
+// Focal lengths are matched to 0.1 mm.
+class RTPROCESS_API rpCAModelCache
+{
+public:
+    rpCAModelCache();
+    ~rpCAModelCache();
+
+    rpCAModelCache(const rpCAModelCache&) = delete;
+    rpCAModelCache& operator =(const rpCAModelCache&) = delete;
+
+    // adds or replaces the model of lens at focalLength
+    void insert(const std::string &lens, double focalLength, const rpCAModel &model);
+    // returns false if there is no model for lens at focalLength
+    bool find(const std::string &lens, double focalLength, rpCAModel &model) const;
+    void clear();
+    std::size_t size() const;
+    // all entries, one per line, for storing the cache between sessions
+    std::string serialize() const;
+    // adds the entries of text, returns false if a line could not be read
+    bool deserialize(const std::string &text);
+
+private:
+    struct Entries;
+    Entries *entries;
+};
+
+// CA_correct split in detection and correction. CA_detect fits the model of rawData and leaves the model unchanged
+// if it fails. CA_apply corrects rawDataIn with a model without running the detection.
+// blockStep > 1 makes CA_detect analyse only every blockStep-th block in both directions, which takes about
+// 1 / blockStep^2 of the time. The polynomial fit over the sparse blocks is close to the full one as long as enough
+// blocks remain (2 for previews of 10+ MP images, 4 for 40+ MP).
+// type and order select the form of the model, e.g. order 5 or 6 for ultra wide lenses. The order is lowered step by step
+// down to 2 (polynomial) or 1 (radial) until there are at least 3 usable blocks per parameter of the fit, counting only the
+// blocks analysed with blockStep. model.polyOrder receives the order which was fitted.
+RTPROCESS_API rpError CA_detect(rpContext &context, int winx, int winy, int winw, int winh, const float * const *rawData, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, rpCAModel &model, float inputScale = 65535.f, size_t chunkSize = 2, int blockStep = 1, rpCAModelType type = RP_CA_POLYNOMIAL, int order = 4);
+RTPROCESS_API rpError CA_apply(rpContext &context, int winx, int winy, int winw, int winh, const rpCAModel &model, bool avoidColourshift, const float * const *rawDataIn, float **rawDataOut, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, float inputScale = 65535.f, float outputScale = 65535.f, size_t chunkSize = 2);
+// Result of CA_correct_auto
+struct rpCAStats {
+    rpCAStats() : iterations(0), residual(0.0), converged(false) {}
+    std::size_t iterations; // correction passes which were applied
+    double residual; // RMS in pixels of the corrections of the last fit over the blocks with data, not the largest one
+    bool converged; // residual of the last fit stayed below the tolerance, so it wasn't applied
+};
+// CA_correct with autoCA, which iterates until the RMS of the fitted corrections (the fitted shifts limited to 4 pixels)
+// stays below tolerance pixels or maxIterations corrections have been applied. After the first iteration only the blocks
+// whose residual shift is not yet within the tolerance are analysed again. type and order select the model as for CA_detect.
+RTPROCESS_API rpError CA_correct_auto(rpContext &context, int winx, int winy, int winw, int winh, std::size_t maxIterations, double tolerance, bool avoidColourshift, const float * const *rawDataIn, float **rawDataOut, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, rpCAStats &stats, float inputScale = 65535.f, float outputScale = 65535.f, size_t chunkSize = 2, rpCAModelType type = RP_CA_POLYNOMIAL, int order = 4);
+// CA_apply fused with amaze_demosaic or rcd_demosaic. The image is corrected and demosaiced in strips, so the corrected raw
+// data never exists for the whole image. The result is the same as CA_apply of the whole image with avoidColourshift off
+// and outputScale = inputScale, followed by the demosaic.
+RTPROCESS_API rpError CA_amaze_demosaic(rpContext &context, int width, int height, const rpCAModel &model, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double initGain, int border, float inputScale = 65535.f, float outputScale = 65535.f, size_t chunkSize = 2);
+RTPROCESS_API rpError CA_rcd_demosaic(rpContext &context, int width, int height, const rpCAModel &model, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, size_t chunkSize = 2);
+// CA_correct in bounded memory for a width x height image. The detection only keeps data per CA block and the correction
+// runs in strips of a few blocks, so the scratch memory grows with the width of the image but not with its height.
+// Without avoidColourshift the result is the same as CA_correct of the whole image. With avoidColourshift the colour
+// shift factors are blurred per strip and measured against the input of each iteration, which differs slightly.
+RTPROCESS_API rpError CA_correct_tiled(rpContext &context, int width, int height, const bool autoCA, std::size_t autoIterations, const double cared, const double cablue, bool avoidColourshift, const float * const *rawDataIn, float **rawDataOut, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double fitParams[2][2][16], bool fitParamsIn, float inputScale = 65535.f, float outputScale = 65535.f, size_t chunkSize = 2);
+// worst case scratch memory in bytes of CA_correct (tiled = false) or CA_correct_tiled (tiled = true) of a width x height image
+// with the current number of OpenMP threads
+RTPROCESS_API std::size_t CA_correct_scratch_size(int width, int height, bool avoidColourshift, bool tiled);
+// CA correction of X-Trans raw data, which fits the same models as CA_detect to the shifts of R and B against G.
+// Without modelIn autoIterations passes of detection and correction are run with a model of the given type and order,
+// model is the fit of the last one. With modelIn the model is applied once. rawDataOut may be rawDataIn.
+RTPROCESS_API rpError CA_correct_xtrans(rpContext &context, int width, int height, std::size_t autoIterations, const float * const *rawDataIn, float **rawDataOut, const unsigned xtrans[6][6], const std::function<bool(double)> &setProgCancel, rpCAModel &model, bool modelIn = false, float inputScale = 65535.f, float outputScale = 65535.f, size_t chunkSize = 2, rpCAModelType type = RP_CA_POLYNOMIAL, int order = 4);
+enum rpHLMethod {
+    RP_HL_DIRECTIONAL,  // extend the highlight colours into the clipped areas from four directions
+    RP_HL_PYRAMID       // fill the clipped areas from a Gaussian pyramid of the highlight colours, faster for large areas
+};
 RTPROCESS_API rpError HLRecovery_inpaint(const int width, const int height, float **red, float **green, float **blue, const float chmax[3], const float clmax[3], const std::function<bool(double)> &setProgCancel);
+// With sparse the connected clipped regions are found first and each padded region is processed on its own, regions
+// which don't share a box in parallel. Images with a few small highlights then cost little more than finding them.
+// The highlight statistics are taken per region instead of over the bounding box of all clipped pixels, so the
+// result differs slightly when there is more than one region.
+// method selects how the highlight colours are extended into the clipped areas, the clip levels are the same for both.
+RTPROCESS_API rpError HLRecovery_inpaint(rpContext &context, const int width, const int height, float **red, float **green, float **blue, const float chmax[3], const float clmax[3], const std::function<bool(double)> &setProgCancel, bool sparse = false, rpHLMethod method = RP_HL_DIRECTIONAL);
+// HLRecovery_inpaint in bounded memory. The image is processed in tiles of tileSize x tileSize pixels which contain
+// clipped pixels, each together with its surroundings up to the reach of the highlight extension (256 pixels). The
+// highlight statistics are taken per tile and the extension can't reach further than the surroundings, so large
+// clipped areas are recovered differently from HLRecovery_inpaint.
+RTPROCESS_API rpError HLRecovery_inpaint_tiled(rpContext &context, const int width, const int height, float **red, float **green, float **blue, const float chmax[3], const float clmax[3], const std::function<bool(double)> &setProgCancel, int tileSize = 1024, rpHLMethod method = RP_HL_DIRECTIONAL);
+// approximate peak scratch memory in bytes of HLRecovery_inpaint (tiled = false), whose worst case is clipping
+// all over the image, or HLRecovery_inpaint_tiled (tiled = true) of a width x height image
+RTPROCESS_API std::size_t HLRecovery_inpaint_scratch_size(int width, int height, bool tiled, int tileSize = 1024);
 
 #endif
@@ -24,7 +24,10 @@
 
     #define pow_F(a,b) (xexpf(b*xlogf(a)))
 
-    #ifdef __SSE2__
+    // RT_VECTOR enables the vfloat code paths. They use SSE2 on x86, on AArch64 the build defines RTPROCESS_NEON
+    // and helperneon.h implements the vector layer with NEON.
+    #if defined(__SSE2__) || defined(RTPROCESS_NEON)
+        #define RT_VECTOR
         #include "sleefsseavx.h"
     #endif
 
@@ -41,4 +44,14 @@
         #define ALIGNED64
         #define ALIGNED16
     #endif
+
+    // Functions marked with TARGET_CLONES are compiled for x86-64-v4 (AVX-512), x86-64-v3 (AVX2, FMA) and the
+    // baseline target. The best version for the cpu is selected when the library is loaded. The vfloat kernels stay
+    // 4 wide but use the VEX encoding, scalar loops get auto-vectorized for the wider registers. The library is built
+    // with -ffp-contract=off then, so the clones don't fuse multiply-adds and give the same results as the baseline.
+    #if defined(RTPROCESS_TARGET_CLONES) && defined(__SSE2__)
+        #define TARGET_CLONES __attribute__ ((target_clones ("arch=x86-64-v4", "arch=x86-64-v3", "default")))
+    #else
+        #define TARGET_CLONES
+    #endif
 #endif
@@ -0,0 +1,58 @@
+/*
+ * This file is part of librtprocess.
+ *
+ * librtprocess is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * librtprocess is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with librtprocess.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+
+namespace librtprocess
+{
+
+// Progress and cancellation of a parallel loop over work items, e.g. tiles. Threads count finished items with an
+// atomic increment instead of a critical section. Only one thread at a time calls setProgCancel, at most once per
+// 1/100 of the items and always with increasing values in [begin, end]. If setProgCancel returns true, cancelled()
+// becomes true and the loops skip their remaining items.
+class Progress
+{
+public:
+    Progress(const std::function<bool(double)> &callback, std::size_t numItems, double beginValue = 0.0, double endValue = 1.0);
+
+    Progress(const Progress&) = delete;
+    Progress& operator =(const Progress&) = delete;
+
+    // marks count items as done and reports the progress if it's this thread's turn, thread safe
+    void done(std::size_t count = 1);
+
+    bool cancelled() const
+    {
+        return cancel.load(std::memory_order_relaxed);
+    }
+
+private:
+    const std::function<bool(double)> &setProgCancel;
+    const std::size_t items;
+    const std::size_t step;
+    const double begin;
+    const double range;
+    std::atomic<std::size_t> counter;
+    std::atomic<std::size_t> nextReport;
+    std::atomic<bool> reporting;
+    std::atomic<bool> cancel;
+};
+
+}
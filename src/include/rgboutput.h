@@ -0,0 +1,33 @@
+/*
+ * This file is part of librtprocess.
+ *
+ * librtprocess is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * librtprocess is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with librtprocess.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "librtprocess.h"
+
+namespace librtprocess
+{
+
+inline bool isPlanar(const rpOutput &output)
+{
+    return output.layout == RP_OUTPUT_PLANAR_FLOAT;
+}
+
+// Stores the pixels [col, col + count) of an image row, given as planar float values in r, g and b, to the output.
+// Works for all layouts, but the tiled demosaicers write planar outputs directly.
+void writeOutputRow(const rpOutput &output, int row, int col, int count, const float *r, const float *g, const float *b);
+
+}
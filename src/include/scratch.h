@@ -0,0 +1,55 @@
+/*
+ * This file is part of librtprocess.
+ *
+ * librtprocess is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * librtprocess is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with librtprocess.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstddef>
+
+#include "librtprocess.h"
+
+namespace librtprocess
+{
+
+// Per thread working space of the tiled algorithms. Has to be constructed inside the parallel region.
+// With a context the arena of the calling thread is used (and grown if needed), without a context
+// the buffer is allocated here and freed in the destructor.
+// The buffer is aligned to 64 bytes. Freshly allocated memory is zeroed, memory reused from a context
+// keeps the values of the previous call.
+class ScratchBuffer
+{
+public:
+    ScratchBuffer(rpContext *context, std::size_t size);
+    ~ScratchBuffer();
+
+    ScratchBuffer(const ScratchBuffer&) = delete;
+    ScratchBuffer& operator =(const ScratchBuffer&) = delete;
+
+    char *data() const
+    {
+        return buffer;
+    }
+
+    explicit operator bool() const
+    {
+        return buffer;
+    }
+
+private:
+    char *buffer;
+    char *owned;
+};
+
+}
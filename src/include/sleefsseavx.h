@@ -18,8 +18,12 @@
 
 #include <assert.h>
 #include "rt_math.h"
-#ifdef __SSE2__
+#ifdef RT_VECTOR
+#ifdef RTPROCESS_NEON
+#include "helperneon.h"
+#else
 #include "helpersse2.h"
+#endif
 
 #ifdef ENABLE_AVX
 #include "helperavx.h"
@@ -921,6 +925,15 @@ static INLINE vfloat vnegf(vfloat f) { return (vfloat)vxorm((vmask)f, (vmask)vca
 		return _mm_blendv_epi8(y,x,mask);
 	}
 
+#elif defined(RTPROCESS_NEON)
+	static INLINE vfloat vself(vmask mask, vfloat x, vfloat y) {
+		return vbslq_f32(vreinterpretq_u32_s32(mask), x, y);
+	}
+
+	static INLINE vint vselc(vmask mask, vint x, vint y) {
+		return vbslq_s32(vreinterpretq_u32_s32(mask), x, y);
+	}
+
 #else
 	// three instructions when using SSE2
 	static INLINE vfloat vself(vmask mask, vfloat x, vfloat y) {
@@ -1390,8 +1403,12 @@ static inline void vswap( vmask condition, vfloat &a, vfloat &b) {
 
 static inline float vhadd( vfloat a ) {
     // returns a[0] + a[1] + a[2] + a[3]
+#ifdef RTPROCESS_NEON
+    return vaddvq_f32(a);
+#else
     a += _mm_movehl_ps(a, a);
     return _mm_cvtss_f32(_mm_add_ss(a, _mm_shuffle_ps(a, a, 1)));
+#endif
 }
 
 static INLINE vfloat vmul2f(vfloat a){
@@ -1415,9 +1432,14 @@ static INLINE vfloat vdup(vfloat a){
 static INLINE vfloat vaddc2vfu(float &a)
 {
     // loads a[0]..a[7] and returns { a[0]+a[1], a[2]+a[3], a[4]+a[5], a[6]+a[7] }
+#ifdef RTPROCESS_NEON
+    const float32x4x2_t av = vld2q_f32(&a);
+    return av.val[0] + av.val[1];
+#else
     vfloat a1 = _mm_loadu_ps( &a );
     vfloat a2 = _mm_loadu_ps( (&a) + 4 );
     return _mm_shuffle_ps(a1,a2,_MM_SHUFFLE( 2,0,2,0 )) + _mm_shuffle_ps(a1,a2,_MM_SHUFFLE( 3,1,3,1 ));
+#endif
 }
 
 static INLINE vfloat vadivapb (vfloat a, vfloat b) {
@@ -1426,10 +1448,31 @@ static INLINE vfloat vadivapb (vfloat a, vfloat b) {
 
 static INLINE void vconvertrgbrgbrgbrgb2rrrrggggbbbb (const float * src, vfloat &rv, vfloat &gv, vfloat &bv) { // cool function name, isn't it ? :P
     // converts a sequence of 4 float RGB triplets to 3 red, green and blue quadruples
+#ifdef RTPROCESS_NEON
+    const float32x4x3_t rgbv = vld3q_f32(src);
+    rv = rgbv.val[0];
+    gv = rgbv.val[1];
+    bv = rgbv.val[2];
+#else
     rv = _mm_setr_ps(src[0],src[3],src[6],src[9]);
     gv = _mm_setr_ps(src[1],src[4],src[7],src[10]);
     bv = _mm_setr_ps(src[2],src[5],src[8],src[11]);
+#endif
+}
+
+static INLINE vfloat LVFRAW(const float &a) {
+    // loads a[0]..a[3] of a raw row stored as float
+    return LVFU(a);
+}
+
+static INLINE vfloat LVFRAW(const uint16_t &a) {
+    // loads a[0]..a[3] of a raw row stored as unsigned 16 bit integers and converts them to float
+#ifdef RTPROCESS_NEON
+    return vcvtq_f32_u32(vmovl_u16(vld1_u16(&a)));
+#else
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(&a)), _mm_setzero_si128()));
+#endif
 }
 
-#endif // __SSE2__
+#endif // RT_VECTOR
 #endif // SLEEFSSEAVX
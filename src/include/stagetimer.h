@@ -0,0 +1,89 @@
+/*
+ * This file is part of librtprocess.
+ *
+ * librtprocess is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * librtprocess is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with librtprocess.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <chrono>
+#include <vector>
+
+#include "librtprocess.h"
+
+namespace librtprocess
+{
+
+struct StageTime {
+    const char *stage;
+    double seconds;
+    std::chrono::steady_clock::time_point begin; // stages are reported in the order in which they were first entered
+};
+
+// Collects the stage timings of one call of a routine and reports them to the stage callback
+// of the context when it goes out of scope. Without a context or callback it does nothing.
+class StageTimer
+{
+public:
+    StageTimer(const rpContext *context, const char *routine);
+    ~StageTimer();
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator =(const StageTimer&) = delete;
+
+    bool enabled() const
+    {
+        return callback;
+    }
+
+private:
+    friend class StageClock;
+    // thread safe
+    void add(const std::vector<StageTime> &times);
+
+    const rpStageCallback *callback;
+    const char *routine;
+    std::chrono::steady_clock::time_point startTime;
+    std::vector<StageTime> stages;
+};
+
+// Measures the stages of one thread. lap() assigns the time since construction, the last start() or the
+// last lap() to a stage. The times are added to the timer when the clock goes out of scope.
+class StageClock
+{
+public:
+    explicit StageClock(StageTimer &stageTimer) : timer(stageTimer)
+    {
+        start();
+    }
+    ~StageClock();
+
+    StageClock(const StageClock&) = delete;
+    StageClock& operator =(const StageClock&) = delete;
+
+    void start()
+    {
+        if (timer.enabled()) {
+            last = std::chrono::steady_clock::now();
+        }
+    }
+
+    void lap(const char *stage);
+
+private:
+    StageTimer &timer;
+    std::chrono::steady_clock::time_point last;
+    std::vector<StageTime> times;
+};
+
+}
@@ -18,8 +18,11 @@
  * along with librtprocess.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <cstdint>
 #include <iostream>
 
+#include "librtprocess.h"
+
 namespace librtprocess {
 
 inline int fc(const unsigned cfa[6][6], unsigned row,  unsigned col) {
@@ -108,4 +111,10 @@ inline bool validateXtransCfa(const  unsigned cfa[6][6]) {
 
     return false;
 }
+
+// xtransborder_demosaic() restricted to the rows [rowStart, rowEnd) of the image, for all output layouts.
+// Instantiated for float and uint16_t raw data.
+template<typename T>
+void xtransborder_demosaic_rows(int winw, int winh, int border, int rowStart, int rowEnd, const T * const *rawData, const rpOutput &output, const unsigned xtrans[6][6]);
+
 }
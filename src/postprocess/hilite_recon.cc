@@ -22,394 +22,85 @@
 //
 ////////////////////////////////////////////////////////////////
 
+#include <algorithm>
 #include <cstddef>
 #include <cmath>
+#include <vector>
 #include "array2D.h"
+#include "boxblur.h"
 #include "librtprocess.h"
 #include "rt_math.h"
 #include "opthelper.h"
+#include "progress.h"
+#include "stagetimer.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 //#define VERBOSE
 
 using librtprocess::SQR;
+using librtprocess::LIM;
+using librtprocess::intp;
 using librtprocess::max;
 using librtprocess::min;
+using librtprocess::StageTimer;
+using librtprocess::StageClock;
 
 //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
-void boxblur2(float** src, float** dst, float** temp, int startY, int startX, int H, int W, int box )
+TARGET_CLONES
+void boxblur2(float** src, float** dst, float** temp, int startY, int startX, int H, int W, int box, bool multiThread)
 {
     //box blur image channel; box size = 2*box+1
-    //horizontal blur
-#ifdef _OPENMP
-    #pragma omp parallel for
-#endif
-
-    for (int row = 0; row < H; row++) {
-        int len = box + 1;
-	temp[row][0] = src[row + startY][startX] / len;
-
-        for (int j = 1; j <= box; j++) {
-	    temp[row][0] += src[row + startY][j + startX] / len;
-        }
-
-        for (int col = 1; col <= box; col++) {
-            temp[row][col] = (temp[row][col - 1] * len + src[row + startY][col + box + startX]) / (len + 1);
-            len ++;
-        }
-
-        for (int col = box + 1; col < W - box; col++) {
-            temp[row][col] = temp[row][col - 1] + (src[row + startY][col + box + startX] - src[row + startY][col - box - 1 + startX]) / len;
-        }
-
-        for (int col = W - box; col < W; col++) {
-            temp[row][col] = (temp[row][col - 1] * len - src[row + startY][col - box - 1 + startX]) / (len - 1);
-            len --;
-        }
-    }
-
-#ifdef __SSE2__
-    //vertical blur
 #ifdef _OPENMP
-    #pragma omp parallel
+    #pragma omp parallel if(multiThread)
 #endif
     {
-        float len = box + 1;
-        vfloat lenv = F2V( len );
-        vfloat lenp1v = F2V( len + 1.0f );
-        vfloat onev = F2V( 1.0f );
-        vfloat tempv, temp2v;
-#ifdef _OPENMP
-        #pragma omp for nowait
-#endif
-
-        for (int col = 0; col < W - 7; col += 8) {
-            tempv = LVFU(temp[0][col]) / lenv;
-            temp2v = LVFU(temp[0][col + 4]) / lenv;
-
-            for (int i = 1; i <= box; i++) {
-                tempv = tempv + LVFU(temp[i][col]) / lenv;
-                temp2v = temp2v + LVFU(temp[i][col + 4]) / lenv;
-            }
-
-            _mm_storeu_ps( &dst[0][col], tempv);
-            _mm_storeu_ps( &dst[0][col + 4], temp2v);
-
-            for (int row = 1; row <= box; row++) {
-                tempv = (tempv * lenv + LVFU(temp[(row + box)][col])) / lenp1v;
-                temp2v = (temp2v * lenv + LVFU(temp[(row + box)][col + 4])) / lenp1v;
-                _mm_storeu_ps( &dst[row][col], tempv);
-                _mm_storeu_ps( &dst[row][col + 4], temp2v);
-                lenv = lenp1v;
-                lenp1v = lenp1v + onev;
-            }
-
-            for (int row = box + 1; row < H - box; row++) {
-                tempv = tempv + (LVFU(temp[(row + box)][col]) - LVFU(temp[(row - box - 1)][col])) / lenv;
-                temp2v = temp2v + (LVFU(temp[(row + box)][col + 4]) - LVFU(temp[(row - box - 1)][col + 4])) / lenv;
-                _mm_storeu_ps( &dst[row][col], tempv);
-                _mm_storeu_ps( &dst[row][col + 4], temp2v);
-            }
-
-            for (int row = H - box; row < H; row++) {
-                lenp1v = lenv;
-                lenv = lenv - onev;
-                tempv = (tempv * lenp1v - LVFU(temp[(row - box - 1)][col])) / lenv;
-                temp2v = (temp2v * lenp1v - LVFU(temp[(row - box - 1)][col + 4])) / lenv;
-                _mm_storeu_ps( &dst[row][col], tempv );
-                _mm_storeu_ps( &dst[row][col + 4], temp2v );
-            }
-        }
-
-#ifdef _OPENMP
-        #pragma omp single
-#endif
-        {
-            for (int col = W - (W % 8); col < W - 3; col += 4) {
-                tempv = LVFU(temp[0][col]) / lenv;
-
-                for (int i = 1; i <= box; i++) {
-                    tempv = tempv + LVFU(temp[i][col]) / lenv;
-                }
-
-                _mm_storeu_ps( &dst[0][col], tempv);
-
-                for (int row = 1; row <= box; row++) {
-                    tempv = (tempv * lenv + LVFU(temp[(row + box)][col])) / lenp1v;
-                    _mm_storeu_ps( &dst[row][col], tempv);
-                    lenv = lenp1v;
-                    lenp1v = lenp1v + onev;
-                }
-
-                for (int row = box + 1; row < H - box; row++) {
-                    tempv = tempv + (LVFU(temp[(row + box)][col]) - LVFU(temp[(row - box - 1)][col])) / lenv;
-                    _mm_storeu_ps( &dst[row][col], tempv);
-                }
-
-                for (int row = H - box; row < H; row++) {
-                    lenp1v = lenv;
-                    lenv = lenv - onev;
-                    tempv = (tempv * lenp1v - LVFU(temp[(row - box - 1)][col])) / lenv;
-                    _mm_storeu_ps( &dst[row][col], tempv );
-                }
-            }
-
-            for (int col = W - (W % 4); col < W; col++) {
-                int llen = box + 1;
-                dst[0][col] = temp[0][col] / llen;
-
-                for (int i = 1; i <= box; i++) {
-                    dst[0][col] += temp[i][col] / llen;
-                }
-
-                for (int row = 1; row <= box; row++) {
-                    dst[row][col] = (dst[(row - 1)][col] * llen + temp[(row + box)][col]) / (llen + 1);
-                    llen ++;
-                }
-
-                for (int row = box + 1; row < H - box; row++) {
-                    dst[row][col] = dst[(row - 1)][col] + (temp[(row + box)][col] - temp[(row - box - 1)][col]) / llen;
-                }
-
-                for (int row = H - box; row < H; row++) {
-                    dst[row][col] = (dst[(row - 1)][col] * llen - temp[(row - box - 1)][col]) / (llen - 1);
-                    llen --;
-                }
-            }
-        }
-    }
-
-#else
-    //vertical blur
-#ifdef _OPENMP
-    #pragma omp parallel for
-#endif
-
-    for (int col = 0; col < W; col++) {
-        int len = box + 1;
-        dst[0][col] = temp[0][col] / len;
-
-        for (int i = 1; i <= box; i++) {
-            dst[0][col] += temp[i][col] / len;
-        }
-
-        for (int row = 1; row <= box; row++) {
-            dst[row][col] = (dst[(row - 1)][col] * len + temp[(row + box)][col]) / (len + 1);
-            len ++;
-        }
-
-        for (int row = box + 1; row < H - box; row++) {
-            dst[row][col] = dst[(row - 1)][col] + (temp[(row + box)][col] - temp[(row - box - 1)][col]) / len;
-        }
-
-        for (int row = H - box; row < H; row++) {
-            dst[row][col] = (dst[(row - 1)][col] * len - temp[(row - box - 1)][col]) / (len - 1);
-            len --;
-        }
+        librtprocess::boxBlurHorizontal(src, temp, startY, startX, W, H, box);
+        librtprocess::boxBlurVertical(temp, dst, W, H, box);
     }
-
-#endif
-
 }
 
-void boxblur_resamp(float **src, float **dst, float ** temp, int H, int W, int box, int samp )
+TARGET_CLONES
+void boxblur_resamp(float **src, float **dst, float ** temp, int H, int W, int box, int samp, bool multiThread)
 {
-
-#ifdef _OPENMP
-    #pragma omp parallel
-#endif
-    {
-#ifdef _OPENMP
-        #pragma omp for
-#endif
-
-        //box blur image channel; box size = 2*box+1
-        //horizontal blur
-        for (int row = 0; row < H; row++)
-        {
-            int len = box + 1;
-            float tempval = src[row][0] / len;
-
-            for (int j = 1; j <= box; j++) {
-                tempval += src[row][j] / len;
-            }
-
-            temp[row][0] = tempval;
-
-            for (int col = 1; col <= box; col++) {
-                tempval = (tempval * len + src[row][col + box]) / (len + 1);
-
-                if(col % samp == 0) {
-                    temp[row][col / samp] = tempval;
-                }
-
-                len ++;
-            }
-
-            float oneByLen = 1.f / (float)len;
-
-            for (int col = box + 1; col < W - box; col++) {
-                tempval = tempval + (src[row][col + box] - src[row][col - box - 1]) * oneByLen;
-
-                if(col % samp == 0) {
-                    temp[row][col / samp] = tempval;
-                }
-            }
-
-            for (int col = W - box; col < W; col++) {
-                tempval = (tempval * len - src[row][col - box - 1]) / (len - 1);
-
-                if(col % samp == 0) {
-                    temp[row][col / samp] = tempval;
-                }
-
-                len --;
-            }
-        }
-    }
-
-    static const int numCols = 8;   // process numCols columns at once for better L1 CPU cache usage
+    //box blur image channel; box size = 2*box+1, keeps every samp-th pixel in both directions
 #ifdef _OPENMP
-    #pragma omp parallel
+    #pragma omp parallel if(multiThread)
 #endif
     {
-        float tempvalN[numCols] ALIGNED16;
-#ifdef _OPENMP
-        #pragma omp for nowait
-#endif
-
-        //vertical blur
-        for (int col = 0; col < (W / samp) - (numCols - 1); col += numCols) {
-            int len = box + 1;
-
-            for(int n = 0; n < numCols; n++) {
-                tempvalN[n] = temp[0][col + n] / len;
-            }
-
-            for (int i = 1; i <= box; i++) {
-                for(int n = 0; n < numCols; n++) {
-                    tempvalN[n] += temp[i][col + n] / len;
-                }
-            }
-
-            for(int n = 0; n < numCols; n++) {
-                dst[0][col + n] = tempvalN[n];
-            }
-
-            for (int row = 1; row <= box; row++) {
-                for(int n = 0; n < numCols; n++) {
-                    tempvalN[n] = (tempvalN[n] * len + temp[(row + box)][col + n]) / (len + 1);
-                }
-
-                if(row % samp == 0) {
-                    for(int n = 0; n < numCols; n++) {
-                        dst[row / samp][col + n] = tempvalN[n];
-                    }
-                }
-
-                len ++;
-            }
-
-            for (int row = box + 1; row < H - box; row++) {
-                for(int n = 0; n < numCols; n++) {
-                    tempvalN[n] = tempvalN[n] + (temp[(row + box)][col + n] - temp[(row - box - 1)][col + n]) / len;
-                }
-
-                if(row % samp == 0) {
-                    for(int n = 0; n < numCols; n++) {
-                        dst[row / samp][col + n] = tempvalN[n];
-                    }
-                }
-            }
-
-            for (int row = H - box; row < H; row++) {
-                for(int n = 0; n < numCols; n++) {
-                    tempvalN[n] = (tempvalN[n] * len - temp[(row - box - 1)][col + n]) / (len - 1);
-                }
-
-                if(row % samp == 0) {
-                    for(int n = 0; n < numCols; n++) {
-                        dst[row / samp][col + n] = tempvalN[n];
-                    }
-                }
-
-                len --;
-            }
-        }
-
-        // process remaining columns
-#ifdef _OPENMP
-        #pragma omp single
-#endif
-        {
-
-            //vertical blur
-            for (int col = (W / samp) - ((W / samp) % numCols); col < W / samp; col++) {
-                int len = box + 1;
-                float tempval = temp[0][col] / len;
-
-                for (int i = 1; i <= box; i++) {
-                    tempval += temp[i][col] / len;
-                }
-
-                dst[0][col] = tempval;
-
-                for (int row = 1; row <= box; row++) {
-                    tempval = (tempval * len + temp[(row + box)][col]) / (len + 1);
-
-                    if(row % samp == 0) {
-                        dst[row / samp][col] = tempval;
-                    }
-
-                    len ++;
-                }
-
-                for (int row = box + 1; row < H - box; row++) {
-                    tempval = tempval + (temp[(row + box)][col] - temp[(row - box - 1)][col]) / len;
-
-                    if(row % samp == 0) {
-                        dst[row / samp][col] = tempval;
-                    }
-                }
-
-                for (int row = H - box; row < H; row++) {
-                    tempval = (tempval * len - temp[(row - box - 1)][col]) / (len - 1);
-
-                    if(row % samp == 0) {
-                        dst[row / samp][col] = tempval;
-                    }
-
-                    len --;
-                }
-            }
-        }
+        librtprocess::boxBlurHorizontal(src, temp, 0, 0, W, H, box, samp);
+        librtprocess::boxBlurVertical(temp, dst, W / samp, H, box, samp);
     }
-
-
 }
 
-rpError HLRecovery_inpaint (const int width, const int height, float** red, float** green, float** blue, const float chmax[3], const float clmax[3], const std::function<bool(double)> &setProgCancel)
+namespace
 {
-    double progress = 0.0;
-
-    setProgCancel(progress);
 
+// padding of the clipped areas, the reach of the highlight extension
+constexpr int blurBorder = 256;
 
-    constexpr int range = 2;
-    constexpr int pitch = 4;
+// clip and blend levels of HLRecovery_inpaint derived from chmax and clmax
+struct HLLevels {
+    float max_f[3];
+    float thresh[3];
+    float medFactor[3];
+    float whitept;
+    float clippt;
+    float blendpt;
+};
 
+HLLevels hlLevels(const float chmax[3], const float clmax[3])
+{
     constexpr float threshpct = 0.25f;
     constexpr float maxpct = 0.95f;
-    constexpr float epsilon = 0.00001f;
     //%%%%%%%%%%%%%%%%%%%%
     //for blend algorithm:
     constexpr float blendthresh = 1.0;
     constexpr int ColorCount = 3;
-    // Transform matrixes rgb>lab and back
-    constexpr float trans[ColorCount][ColorCount] =
-    { { 1.f, 1.f, 1.f }, { 1.7320508f, -1.7320508f, 0.f }, { -1.f, -1.f, 2.f } };
-    constexpr float itrans[ColorCount][ColorCount] =
-    { { 1.f, 0.8660254f, -0.5f }, { 1.f, -0.8660254f, -0.5f }, { 1.f, 0.f, 1.f } };
+
 
 #ifdef VERBOSE
         for(int c = 0; c < 3; c++) {
@@ -489,479 +180,612 @@ rpError HLRecovery_inpaint (const int width, const int height, float** red, floa
         medFactor[c] = max(1.0f, max_f[c] / medpt) / (-blendpt);
     }
 
-    int minx = width - 1;
-    int maxx = 0;
-    int miny = height - 1;
-    int maxy = 0;
+    HLLevels levels;
+    for (int c = 0; c < ColorCount; c++) {
+        levels.max_f[c] = max_f[c];
+        levels.thresh[c] = thresh[c];
+        levels.medFactor[c] = medFactor[c];
+    }
+    levels.whitept = whitept;
+    levels.clippt = clippt;
+    levels.blendpt = blendpt;
+    return levels;
+}
 
-// Current MSVC version doesn't support these way of calling OMP
-#ifndef _MSC_VER
-    #pragma omp parallel for reduction(min:minx,miny) reduction(max:maxx,maxy) schedule(dynamic, 16)
+// Fills the gaps of the highlight map by extending the highlight colours from the four directions. hilite_dir gets the
+// extensions from the top (0 - 3) and from the bottom (4 - 7), hilite_dir0 and hilite_dir4 the transposed ones from
+// the left and from the right.
+void hlDirectionalFill(multi_array2D<float, 4> &hilite, multi_array2D<float, 8> &hilite_dir, multi_array2D<float, 4> &hilite_dir0, multi_array2D<float, 4> &hilite_dir4, int hfw, int hfh, double &progress, const std::function<bool(double)> &setProgCancel)
+{
+    constexpr float epsilon = 0.00001f;
+
+    // Every sweep carries the data line by line and each line only depends on the one before, but the cells of a line
+    // are independent. So the lines are split over all threads, which synchronise once per line, and the weight and
+    // the three colours of a cell are computed together.
+#ifdef _OPENMP
+    #pragma omp parallel
 #endif
-    for (int i = 0; i < height; ++i) {
-        for (int j = 0; j< width; ++j) {
-            if(red[i][j] >= max_f[0] || green[i][j] >= max_f[1] || blue[i][j] >= max_f[2]) {
-                minx = std::min(minx, j);
-                maxx = std::max(maxx, j);
-                miny = std::min(miny, i);
-                maxy = std::max(maxy, i);
+    {
+        //fill gaps in highlight map by directional extension
+        //raster scan from four corners
+        for (int j = 1; j < hfw - 1; j++) {
+#ifdef _OPENMP
+            #pragma omp for
+#endif
+            for (int i = 2; i < hfh - 2; i++) {
+                //from left
+                if (hilite[3][i][j] > epsilon) {
+                    hilite_dir0[3][j][i] = 1.f;
+                    for (int c = 0; c < 3; c++) {
+                        hilite_dir0[c][j][i] = hilite[c][i][j] / hilite[3][i][j];
+                    }
+                } else {
+                    const float wtsum = hilite_dir0[3][j - 1][i - 2] + hilite_dir0[3][j - 1][i - 1] + hilite_dir0[3][j - 1][i] + hilite_dir0[3][j - 1][i + 1] + hilite_dir0[3][j - 1][i + 2];
+                    hilite_dir0[3][j][i] = wtsum == 0.f ? 0.f : 0.1f;
+                    for (int c = 0; c < 3; c++) {
+                        hilite_dir0[c][j][i] = 0.1f * ((hilite_dir0[c][j - 1][i - 2] + hilite_dir0[c][j - 1][i - 1] + hilite_dir0[c][j - 1][i] + hilite_dir0[c][j - 1][i + 1] + hilite_dir0[c][j - 1][i + 2]) / (wtsum + epsilon));
+                    }
+                }
             }
         }
-    }
-
-
-    constexpr int blurBorder = 256;
-    minx = std::max(0, minx - blurBorder);
-    miny = std::max(0, miny - blurBorder);
-    maxx = std::min(width - 1, maxx + blurBorder);
-    maxy = std::min(height - 1, maxy + blurBorder);
-    const int blurWidth = maxx - minx + 1;
-    const int blurHeight = maxy - miny + 1;
-
-    multi_array2D<float, 3> channelblur(blurWidth, blurHeight, 0, 48);
-    array2D<float> temp(blurWidth, blurHeight); // allocate temporary buffer
 
-    // blur RGB channels
-
-    boxblur2(red, channelblur[0], temp, miny, minx, blurHeight, blurWidth, 4);
-
-    progress += 0.05;
-    setProgCancel(progress);
-
-    boxblur2(green, channelblur[1], temp, miny, minx, blurHeight, blurWidth, 4);
+#ifdef _OPENMP
+        #pragma omp for nowait
+#endif
+        for (int j = 1; j < hfw - 1; j++) {
+            for (int c = 0; c < 4; c++) {
+                if(hilite[3][2][j] <= epsilon) {
+                    hilite_dir[0 + c][0][j]  = hilite_dir0[c][j][2];
+                }
 
-    progress += 0.05;
-    setProgCancel(progress);
+                if(hilite[3][3][j] <= epsilon) {
+                    hilite_dir[0 + c][1][j]  = hilite_dir0[c][j][3];
+                }
 
-    boxblur2(blue, channelblur[2], temp, miny, minx, blurHeight, blurWidth, 4);
+                if(hilite[3][hfh - 3][j] <= epsilon) {
+                    hilite_dir[4 + c][hfh - 1][j] = hilite_dir0[c][j][hfh - 3];
+                }
 
-    progress += 0.05;
-    setProgCancel(progress);
+                if(hilite[3][hfh - 4][j] <= epsilon) {
+                    hilite_dir[4 + c][hfh - 2][j] = hilite_dir0[c][j][hfh - 4];
+                }
+            }
+        }
 
-    // reduce channel blur to one array
 #ifdef _OPENMP
-    #pragma omp parallel for
+        #pragma omp for
 #endif
-
-    for(int i = 0; i < blurHeight; i++)
-        for(int j = 0; j < blurWidth; j++) {
-            channelblur[0][i][j] = fabsf(channelblur[0][i][j] - red[i + miny][j + minx]) + fabsf(channelblur[1][i][j] - green[i + miny][j + minx]) + fabsf(channelblur[2][i][j] - blue[i + miny][j + minx]);
+        for (int i = 2; i < hfh - 2; i++) {
+            for (int c = 0; c < 4; c++) {
+                if(hilite[3][i][hfw - 2] <= epsilon) {
+                    hilite_dir4[c][hfw - 1][i] = hilite_dir0[c][hfw - 2][i];
+                }
+            }
         }
 
-    for (int c = 1; c < 3; c++) {
-        channelblur[c].free();    //free up some memory
-    }
-
-    progress += 0.05;
-    setProgCancel(progress);
-
-    multi_array2D<float, 4> hilite_full(blurWidth, blurHeight, ARRAY2D_CLEAR_DATA, 32);
-
-    progress += 0.10;
-    setProgCancel(progress);
+#ifdef _OPENMP
+        #pragma omp single nowait
+#endif
+        {
+            progress += 0.05;
+            setProgCancel(progress);
+        }
 
-    double hipass_sum = 0.f;
-    int hipass_norm = 0;
+        for (int j = hfw - 2; j > 0; j--) {
+#ifdef _OPENMP
+            #pragma omp for
+#endif
+            for (int i = 2; i < hfh - 2; i++) {
+                //from right
+                if (hilite[3][i][j] > epsilon) {
+                    hilite_dir4[3][j][i] = 1.f;
+                    for (int c = 0; c < 3; c++) {
+                        hilite_dir4[c][j][i] = hilite[c][i][j] / hilite[3][i][j];
+                    }
+                } else {
+                    const float wtsum = hilite_dir4[3][(j + 1)][(i - 2)] + hilite_dir4[3][(j + 1)][(i - 1)] + hilite_dir4[3][(j + 1)][(i)] + hilite_dir4[3][(j + 1)][(i + 1)] + hilite_dir4[3][(j + 1)][(i + 2)];
+                    hilite_dir4[3][j][i] = wtsum == 0.f ? 0.f : 0.1f;
+                    for (int c = 0; c < 3; c++) {
+                        hilite_dir4[c][j][i] = 0.1f * ((hilite_dir4[c][(j + 1)][(i - 2)] + hilite_dir4[c][(j + 1)][(i - 1)] + hilite_dir4[c][(j + 1)][(i)] + hilite_dir4[c][(j + 1)][(i + 1)] + hilite_dir4[c][(j + 1)][(i + 2)]) / (wtsum + epsilon));
+                    }
+                }
+            }
+        }
 
-    // set up which pixels are clipped or near clipping
 #ifdef _OPENMP
-    #pragma omp parallel for reduction(+:hipass_sum,hipass_norm) schedule(dynamic,16)
+        #pragma omp for
 #endif
+        for (int j = hfw - 2; j > 0; j--) {
+            for (int c = 0; c < 4; c++) {
+                if(hilite[3][2][j] <= epsilon) {
+                    hilite_dir[0 + c][0][j] += hilite_dir4[c][j][2];
+                }
 
-    for (int i = 0; i < blurHeight; i++) {
-        for (int j = 0; j < blurWidth; j++) {
-            //if one or more channels is highlight but none are blown, add to highlight accumulator
-            if ((red[i + miny][j + minx] > thresh[0] || green[i + miny][j + minx] > thresh[1] || blue[i + miny][j + minx] > thresh[2]) &&
-                    (red[i + miny][j + minx] < max_f[0] && green[i + miny][j + minx] < max_f[1] && blue[i + miny][j + minx] < max_f[2])) {
+                if(hilite[3][hfh - 3][j] <= epsilon) {
+                    hilite_dir[4 + c][hfh - 1][j] += hilite_dir4[c][j][hfh - 3];
+                }
+            }
+        }
 
-                hipass_sum += static_cast<double>(channelblur[0][i][j]);
-                hipass_norm ++;
+#ifdef _OPENMP
+        #pragma omp for
+#endif
+        for (int i = 2; i < hfh - 2; i++) {
+            for (int c = 0; c < 4; c++) {
+                if(hilite[3][i][0] <= epsilon) {
+                    hilite_dir[0 + c][i - 2][0] += hilite_dir4[c][0][i];
+                    hilite_dir[4 + c][i + 2][0] += hilite_dir4[c][0][i];
+                }
 
-                hilite_full[0][i][j] = red[i + miny][j + minx];
-                hilite_full[1][i][j] = green[i + miny][j + minx];
-                hilite_full[2][i][j] = blue[i + miny][j + minx];
-                hilite_full[3][i][j] = 1.f;
+                if(hilite[3][i][1] <= epsilon) {
+                    hilite_dir[0 + c][i - 2][1] += hilite_dir4[c][1][i];
+                    hilite_dir[4 + c][i + 2][1] += hilite_dir4[c][1][i];
+                }
 
+                if(hilite[3][i][hfw - 2] <= epsilon) {
+                    hilite_dir[0 + c][i - 2][hfw - 2] += hilite_dir4[c][hfw - 2][i];
+                    hilite_dir[4 + c][i + 2][hfw - 2] += hilite_dir4[c][hfw - 2][i];
+                }
             }
         }
-    }//end of filling highlight array
 
-    float hipass_ave = 2.0 * hipass_sum / (hipass_norm + static_cast<double>(epsilon));
-
-    progress += 0.05;
-    setProgCancel(progress);
-
-    array2D<float> hilite_full4(blurWidth, blurHeight);
-    //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
-    //blur highlight data
-    boxblur2(hilite_full[3], hilite_full4, temp, 0, 0, blurHeight, blurWidth, 1);
+#ifdef _OPENMP
+        #pragma omp single nowait
+#endif
+        {
+            progress += 0.05;
+            setProgCancel(progress);
+        }
 
-    temp.free(); // free temporary buffer
+        for (int i = 1; i < hfh - 1; i++) {
+#ifdef _OPENMP
+            #pragma omp for
+#endif
+            for (int j = 2; j < hfw - 2; j++) {
+                //from top
+                if (hilite[3][i][j] > epsilon) {
+                    hilite_dir[0 + 3][i][j] = 1.f;
+                    for (int c = 0; c < 3; c++) {
+                        hilite_dir[0 + c][i][j] = hilite[c][i][j] / hilite[3][i][j];
+                    }
+                } else {
+                    const float wtsum = hilite_dir[0 + 3][i - 1][j - 2] + hilite_dir[0 + 3][i - 1][j - 1] + hilite_dir[0 + 3][i - 1][j] + hilite_dir[0 + 3][i - 1][j + 1] + hilite_dir[0 + 3][i - 1][j + 2];
+                    hilite_dir[0 + 3][i][j] = wtsum == 0.f ? 0.f : 0.1f;
+                    for (int c = 0; c < 3; c++) {
+                        hilite_dir[0 + c][i][j] = 0.1f * ((hilite_dir[0 + c][i - 1][j - 2] + hilite_dir[0 + c][i - 1][j - 1] + hilite_dir[0 + c][i - 1][j] + hilite_dir[0 + c][i - 1][j + 1] + hilite_dir[0 + c][i - 1][j + 2]) / (wtsum + epsilon));
+                    }
+                }
+            }
+        }
 
-    progress += 0.05;
-    setProgCancel(progress);
+#ifdef _OPENMP
+        #pragma omp for
+#endif
+        for (int j = 2; j < hfw - 2; j++) {
+            for (int c = 0; c < 4; c++) {
+                if(hilite[3][hfh - 2][j] <= epsilon) {
+                    hilite_dir[4 + c][hfh - 1][j] += hilite_dir[0 + c][hfh - 2][j];
+                }
+            }
+        }
 
 #ifdef _OPENMP
-    #pragma omp parallel for schedule(dynamic,16)
+        #pragma omp single nowait
 #endif
+        {
+            progress += 0.05;
+            setProgCancel(progress);
+        }
 
-    for (int i = 0; i < blurHeight; i++) {
-        for (int j = 0; j < blurWidth; j++) {
-            if (channelblur[0][i][j] > hipass_ave) {
-                //too much variation
-                hilite_full[0][i][j] = hilite_full[1][i][j] = hilite_full[2][i][j] = hilite_full[3][i][j] = 0.f;
-                continue;
+        for (int i = hfh - 2; i > 0; i--) {
+#ifdef _OPENMP
+            #pragma omp for
+#endif
+            for (int j = 2; j < hfw - 2; j++) {
+                //from bottom
+                if (hilite[3][i][j] > epsilon) {
+                    hilite_dir[4 + 3][i][j] = 1.f;
+                    for (int c = 0; c < 3; c++) {
+                        hilite_dir[4 + c][i][j] = hilite[c][i][j] / hilite[3][i][j];
+                    }
+                } else {
+                    const float wtsum = hilite_dir[4 + 3][(i + 1)][(j - 2)] + hilite_dir[4 + 3][(i + 1)][(j - 1)] + hilite_dir[4 + 3][(i + 1)][(j)] + hilite_dir[4 + 3][(i + 1)][(j + 1)] + hilite_dir[4 + 3][(i + 1)][(j + 2)];
+                    hilite_dir[4 + 3][i][j] = wtsum == 0.f ? 0.f : 0.1f;
+                    for (int c = 0; c < 3; c++) {
+                        hilite_dir[4 + c][i][j] = 0.1f * ((hilite_dir[4 + c][(i + 1)][(j - 2)] + hilite_dir[4 + c][(i + 1)][(j - 1)] + hilite_dir[4 + c][(i + 1)][(j)] + hilite_dir[4 + c][(i + 1)][(j + 1)] + hilite_dir[4 + c][(i + 1)][(j + 2)]) / (wtsum + epsilon));
+                    }
+                }
             }
+        }
 
-            if (hilite_full4[i][j] > epsilon && hilite_full4[i][j] < 0.95f) {
-                //too near an edge, could risk using CA affected pixels, therefore omit
-                hilite_full[0][i][j] = hilite_full[1][i][j] = hilite_full[2][i][j] = hilite_full[3][i][j] = 0.f;
+        // The weights from the bottom are then extended once more like the colours, which gives them values just
+        // below 0.1 instead of 0.1. The serial code did this by running its colour loop over the weight plane too.
+        for (int i = hfh - 2; i > 0; i--) {
+#ifdef _OPENMP
+            #pragma omp for
+#endif
+            for (int j = 2; j < hfw - 2; j++) {
+                if (hilite[3][i][j] > epsilon) {
+                    hilite_dir[4 + 3][i][j] = hilite[3][i][j] / hilite[3][i][j];
+                } else {
+                    const float wtsum = hilite_dir[4 + 3][(i + 1)][(j - 2)] + hilite_dir[4 + 3][(i + 1)][(j - 1)] + hilite_dir[4 + 3][(i + 1)][(j)] + hilite_dir[4 + 3][(i + 1)][(j + 1)] + hilite_dir[4 + 3][(i + 1)][(j + 2)];
+                    hilite_dir[4 + 3][i][j] = 0.1f * (wtsum / (wtsum + epsilon));
+                }
             }
         }
     }
 
-    channelblur[0].free();    //free up some memory
-    hilite_full4.free();    //free up some memory
+    progress += 0.05;
+    setProgCancel(progress);
 
-    int hfh = (blurHeight - (blurHeight % pitch)) / pitch;
-    int hfw = (blurWidth - (blurWidth % pitch)) / pitch;
+    //fill in edges
+    for (int dir = 0; dir < 2; dir++) {
+        for (int i = 1; i < hfh - 1; i++)
+            for (int c = 0; c < 4; c++) {
+                hilite_dir[dir * 4 + c][i][0] = hilite_dir[dir * 4 + c][i][1];
+                hilite_dir[dir * 4 + c][i][hfw - 1] = hilite_dir[dir * 4 + c][i][hfw - 2];
+            }
 
-    multi_array2D<float, 4> hilite(hfw + 1, hfh + 1, ARRAY2D_CLEAR_DATA, 48);
+        for (int j = 1; j < hfw - 1; j++)
+            for (int c = 0; c < 4; c++) {
+                hilite_dir[dir * 4 + c][0][j] = hilite_dir[dir * 4 + c][1][j];
+                hilite_dir[dir * 4 + c][hfh - 1][j] = hilite_dir[dir * 4 + c][hfh - 2][j];
+            }
 
-    //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
-    // blur and resample highlight data; range=size of blur, pitch=sample spacing
+        for (int c = 0; c < 4; c++) {
+            hilite_dir[dir * 4 + c][0][0] = hilite_dir[dir * 4 + c][1][0] = hilite_dir[dir * 4 + c][0][1] = hilite_dir[dir * 4 + c][1][1] = hilite_dir[dir * 4 + c][2][2];
+            hilite_dir[dir * 4 + c][0][hfw - 1] = hilite_dir[dir * 4 + c][1][hfw - 1] = hilite_dir[dir * 4 + c][0][hfw - 2] = hilite_dir[dir * 4 + c][1][hfw - 2] = hilite_dir[dir * 4 + c][2][hfw - 3];
+            hilite_dir[dir * 4 + c][hfh - 1][0] = hilite_dir[dir * 4 + c][hfh - 2][0] = hilite_dir[dir * 4 + c][hfh - 1][1] = hilite_dir[dir * 4 + c][hfh - 2][1] = hilite_dir[dir * 4 + c][hfh - 3][2];
+            hilite_dir[dir * 4 + c][hfh - 1][hfw - 1] = hilite_dir[dir * 4 + c][hfh - 2][hfw - 1] = hilite_dir[dir * 4 + c][hfh - 1][hfw - 2] = hilite_dir[dir * 4 + c][hfh - 2][hfw - 2] = hilite_dir[dir * 4 + c][hfh - 3][hfw - 3];
+        }
+    }
 
-    array2D<float> temp2((blurWidth / pitch) + ((blurWidth % pitch) == 0 ? 0 : 1), blurHeight);
+    for (int i = 1; i < hfh - 1; i++)
+        for (int c = 0; c < 4; c++) {
+            hilite_dir0[c][0][i] = hilite_dir0[c][1][i];
+            hilite_dir0[c][hfw - 1][i] = hilite_dir0[c][hfw - 2][i];
+        }
 
-    for (int m = 0; m < 4; m++) {
-        boxblur_resamp(hilite_full[m], hilite[m], temp2, blurHeight, blurWidth, range, pitch);
+    for (int j = 1; j < hfw - 1; j++)
+        for (int c = 0; c < 4; c++) {
+            hilite_dir0[c][j][0] = hilite_dir0[c][j][1];
+            hilite_dir0[c][j][hfh - 1] = hilite_dir0[c][j][hfh - 2];
+        }
 
-        progress += 0.05;
-        setProgCancel(progress);
+    for (int c = 0; c < 4; c++) {
+        hilite_dir0[c][0][0] = hilite_dir0[c][0][1] = hilite_dir0[c][1][0] = hilite_dir0[c][1][1] = hilite_dir0[c][2][2];
+        hilite_dir0[c][hfw - 1][0] = hilite_dir0[c][hfw - 1][1] = hilite_dir0[c][hfw - 2][0] = hilite_dir0[c][hfw - 2][1] = hilite_dir0[c][hfw - 3][2];
+        hilite_dir0[c][0][hfh - 1] = hilite_dir0[c][0][hfh - 2] = hilite_dir0[c][1][hfh - 1] = hilite_dir0[c][1][hfh - 2] = hilite_dir0[c][2][hfh - 3];
+        hilite_dir0[c][hfw - 1][hfh - 1] = hilite_dir0[c][hfw - 1][hfh - 2] = hilite_dir0[c][hfw - 2][hfh - 1] = hilite_dir0[c][hfw - 2][hfh - 2] = hilite_dir0[c][hfw - 3][hfh - 3];
     }
 
-    temp2.free();
+    for (int i = 1; i < hfh - 1; i++)
+        for (int c = 0; c < 4; c++) {
+            hilite_dir4[c][0][i] = hilite_dir4[c][1][i];
+            hilite_dir4[c][hfw - 1][i] = hilite_dir4[c][hfw - 2][i];
+        }
+
+    for (int j = 1; j < hfw - 1; j++)
+        for (int c = 0; c < 4; c++) {
+            hilite_dir4[c][j][0] = hilite_dir4[c][j][1];
+            hilite_dir4[c][j][hfh - 1] = hilite_dir4[c][j][hfh - 2];
+        }
 
     for (int c = 0; c < 4; c++) {
-        hilite_full[c].free();    //free up some memory
+        hilite_dir4[c][0][0] = hilite_dir4[c][0][1] = hilite_dir4[c][1][0] = hilite_dir4[c][1][1] = hilite_dir4[c][2][2];
+        hilite_dir4[c][hfw - 1][0] = hilite_dir4[c][hfw - 1][1] = hilite_dir4[c][hfw - 2][0] = hilite_dir4[c][hfw - 2][1] = hilite_dir4[c][hfw - 3][2];
+        hilite_dir4[c][0][hfh - 1] = hilite_dir4[c][0][hfh - 2] = hilite_dir4[c][1][hfh - 1] = hilite_dir4[c][1][hfh - 2] = hilite_dir4[c][2][hfh - 3];
+        hilite_dir4[c][hfw - 1][hfh - 1] = hilite_dir4[c][hfw - 1][hfh - 2] = hilite_dir4[c][hfw - 2][hfh - 1] = hilite_dir4[c][hfw - 2][hfh - 2] = hilite_dir4[c][hfw - 3][hfh - 3];
     }
 
-    multi_array2D<float, 8> hilite_dir(hfw, hfh, ARRAY2D_CLEAR_DATA, 64);
-    // for faster processing we create two buffers using (height,width) instead of (width,height)
-    multi_array2D<float, 4> hilite_dir0(hfh, hfw, ARRAY2D_CLEAR_DATA, 64);
-    multi_array2D<float, 4> hilite_dir4(hfh, hfw, ARRAY2D_CLEAR_DATA, 64);
-
     progress += 0.05;
     setProgCancel(progress);
+}
 
-    //fill gaps in highlight map by directional extension
-    //raster scan from four corners
-    for (int j = 1; j < hfw - 1; j++) {
-        for (int i = 2; i < hfh - 2; i++) {
-            //from left
-            if (hilite[3][i][j] > epsilon) {
-                hilite_dir0[3][j][i] = 1.f;
-            } else {
-                hilite_dir0[3][j][i] = (hilite_dir0[0 + 3][j - 1][i - 2] + hilite_dir0[0 + 3][j - 1][i - 1] + hilite_dir0[0 + 3][j - 1][i] + hilite_dir0[0 + 3][j - 1][i + 1] + hilite_dir0[0 + 3][j - 1][i + 2]) == 0.f ? 0.f : 0.1f;
-            }
-        }
-
-        if(hilite[3][2][j] <= epsilon) {
-            hilite_dir[0 + 3][0][j]  = hilite_dir0[3][j][2];
-        }
+// Fills the highlight colours into every cell of the highlight map with a Gaussian pyramid (push-pull). The colours of
+// the cells with highlight data are reduced level by level with a [1 3 3 1] kernel, the weights saturating at 1, and
+// then expanded back, each level filling its cells with little or no weight from the level above. The cost is linear
+// in the number of cells however large the clipped areas are. The result is stored like the extension from the left,
+// transposed in hilite_dir0 with a weight of 1.
+void hlPyramidFill(multi_array2D<float, 4> &hilite, multi_array2D<float, 4> &hilite_dir0, int hfw, int hfh)
+{
+    constexpr float epsilon = 0.00001f;
 
-        if(hilite[3][3][j] <= epsilon) {
-            hilite_dir[0 + 3][1][j]  = hilite_dir0[3][j][3];
+    // colours and weight of a level, interleaved
+    struct Level {
+        Level(int w, int h) : width(w), height(h), data(static_cast<std::size_t>(w) * h * 4) {}
+        float *cell(int i, int j)
+        {
+            return &data[(static_cast<std::size_t>(i) * width + j) * 4];
         }
+        int width, height;
+        std::vector<float> data;
+    };
 
-        if(hilite[3][hfh - 3][j] <= epsilon) {
-            hilite_dir[4 + 3][hfh - 1][j] = hilite_dir0[3][j][hfh - 3];
-        }
+    std::vector<Level> levels;
+    levels.emplace_back(hfw, hfh);
 
-        if(hilite[3][hfh - 4][j] <= epsilon) {
-            hilite_dir[4 + 3][hfh - 2][j] = hilite_dir0[3][j][hfh - 4];
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for (int i = 0; i < hfh; i++) {
+        for (int j = 0; j < hfw; j++) {
+            float *cell = levels[0].cell(i, j);
+            if (hilite[3][i][j] > epsilon) {
+                for (int c = 0; c < 3; c++) {
+                    cell[c] = hilite[c][i][j] / hilite[3][i][j];
+                }
+                cell[3] = 1.f;
+            }
         }
     }
 
-    for (int i = 2; i < hfh - 2; i++) {
-        if(hilite[3][i][hfw - 2] <= epsilon) {
-            hilite_dir4[3][hfw - 1][i] = hilite_dir0[3][hfw - 2][i];
+    // reduce
+    constexpr float kernel[4] = {1.f, 3.f, 3.f, 1.f};
+    while (levels.back().width > 1 || levels.back().height > 1) {
+        Level &fine = levels.back();
+        Level coarse((fine.width + 1) / 2, (fine.height + 1) / 2);
+#ifdef _OPENMP
+        #pragma omp parallel for
+#endif
+        for (int i = 0; i < coarse.height; i++) {
+            for (int j = 0; j < coarse.width; j++) {
+                float sum[4] = {};
+                for (int di = 0; di < 4; di++) {
+                    const int fi = LIM(2 * i - 1 + di, 0, fine.height - 1);
+                    for (int dj = 0; dj < 4; dj++) {
+                        const float *src = fine.cell(fi, LIM(2 * j - 1 + dj, 0, fine.width - 1));
+                        const float wt = kernel[di] * kernel[dj] * src[3];
+                        for (int c = 0; c < 3; c++) {
+                            sum[c] += wt * src[c];
+                        }
+                        sum[3] += wt;
+                    }
+                }
+                float *cell = coarse.cell(i, j);
+                if (sum[3] > 0.f) {
+                    for (int c = 0; c < 3; c++) {
+                        cell[c] = sum[c] / sum[3];
+                    }
+                    // a fully covered neighbourhood sums to 64, a quarter of it saturates
+                    cell[3] = min(sum[3] / 16.f, 1.f);
+                }
+            }
         }
+        levels.push_back(std::move(coarse));
     }
 
-
+    // expand, each fine cell interpolates the coarse level bilinearly at its centre
+    for (std::size_t l = levels.size() - 1; l > 0; l--) {
+        Level &coarse = levels[l];
+        Level &fine = levels[l - 1];
 #ifdef _OPENMP
-    #pragma omp parallel for
+        #pragma omp parallel for
 #endif
-
-    for (int c = 0; c < 3; c++) {
-        for (int j = 1; j < hfw - 1; j++) {
-            for (int i = 2; i < hfh - 2; i++) {
-                //from left
-                if (hilite[3][i][j] > epsilon) {
-                    hilite_dir0[c][j][i] = hilite[c][i][j] / hilite[3][i][j];
-                } else {
-                    hilite_dir0[c][j][i] = 0.1f * ((hilite_dir0[0 + c][j - 1][i - 2] + hilite_dir0[0 + c][j - 1][i - 1] + hilite_dir0[0 + c][j - 1][i] + hilite_dir0[0 + c][j - 1][i + 1] + hilite_dir0[0 + c][j - 1][i + 2]) /
-                                                   (hilite_dir0[0 + 3][j - 1][i - 2] + hilite_dir0[0 + 3][j - 1][i - 1] + hilite_dir0[0 + 3][j - 1][i] + hilite_dir0[0 + 3][j - 1][i + 1] + hilite_dir0[0 + 3][j - 1][i + 2] + epsilon));
+        for (int i = 0; i < fine.height; i++) {
+            const float y = LIM((i - 0.5f) * 0.5f, 0.f, coarse.height - 1.f);
+            const int i0 = min(static_cast<int>(y), coarse.height - 1);
+            const int i1 = min(i0 + 1, coarse.height - 1);
+            const float fy = y - i0;
+            for (int j = 0; j < fine.width; j++) {
+                const float x = LIM((j - 0.5f) * 0.5f, 0.f, coarse.width - 1.f);
+                const int j0 = min(static_cast<int>(x), coarse.width - 1);
+                const int j1 = min(j0 + 1, coarse.width - 1);
+                const float fx = x - j0;
+                float *cell = fine.cell(i, j);
+                const float wt = cell[3];
+                for (int c = 0; c < 3; c++) {
+                    const float top = intp(fx, coarse.cell(i0, j1)[c], coarse.cell(i0, j0)[c]);
+                    const float bottom = intp(fx, coarse.cell(i1, j1)[c], coarse.cell(i1, j0)[c]);
+                    cell[c] = wt * cell[c] + (1.f - wt) * intp(fy, bottom, top);
                 }
-            }
-
-            if(hilite[3][2][j] <= epsilon) {
-                hilite_dir[0 + c][0][j]  = hilite_dir0[c][j][2];
-            }
-
-            if(hilite[3][3][j] <= epsilon) {
-                hilite_dir[0 + c][1][j]  = hilite_dir0[c][j][3];
-            }
-
-            if(hilite[3][hfh - 3][j] <= epsilon) {
-                hilite_dir[4 + c][hfh - 1][j] = hilite_dir0[c][j][hfh - 3];
-            }
-
-            if(hilite[3][hfh - 4][j] <= epsilon) {
-                hilite_dir[4 + c][hfh - 2][j] = hilite_dir0[c][j][hfh - 4];
+                cell[3] = 1.f;
             }
         }
+    }
 
-        for (int i = 2; i < hfh - 2; i++) {
-            if(hilite[3][i][hfw - 2] <= epsilon) {
-                hilite_dir4[c][hfw - 1][i] = hilite_dir0[c][hfw - 2][i];
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for (int j = 0; j < hfw; j++) {
+        for (int i = 0; i < hfh; i++) {
+            const float *cell = levels[0].cell(i, j);
+            for (int c = 0; c < 3; c++) {
+                hilite_dir0[c][j][i] = cell[c];
             }
+            hilite_dir0[3][j][i] = 1.f;
         }
     }
+}
 
-    progress += 0.05;
-    setProgCancel(progress);
+// Reconstructs the clipped pixels of the box [minx, minx + blurWidth) x [miny, miny + blurHeight). Only pixels inside
+// the box are read or written, so boxes which don't overlap can be processed concurrently. Then multiThread is false and
+// the box runs on the calling thread only.
+TARGET_CLONES
+void hlRecoverBox(const HLLevels &levels, rpHLMethod method, float** red, float** green, float** blue, int minx, int miny, int blurWidth, int blurHeight, StageTimer &timer, const std::function<bool(double)> &setProgCancel, bool multiThread)
+{
+    StageClock clock(timer);
+    double progress = 0.0;
 
-    for (int j = hfw - 2; j > 0; j--) {
-        for (int i = 2; i < hfh - 2; i++) {
-            //from right
-            if (hilite[3][i][j] > epsilon) {
-                hilite_dir4[3][j][i] = 1.f;
-            } else {
-                hilite_dir4[3][j][i] = (hilite_dir4[3][(j + 1)][(i - 2)] + hilite_dir4[3][(j + 1)][(i - 1)] + hilite_dir4[3][(j + 1)][(i)] + hilite_dir4[3][(j + 1)][(i + 1)] + hilite_dir4[3][(j + 1)][(i + 2)]) == 0.f ? 0.f : 0.1f;
-            }
-        }
+    constexpr int range = 2;
+    constexpr int pitch = 4;
 
-        if(hilite[3][2][j] <= epsilon) {
-            hilite_dir[0 + 3][0][j] += hilite_dir4[3][j][2];
-        }
+    constexpr float epsilon = 0.00001f;
+    constexpr int ColorCount = 3;
+    // Transform matrixes rgb>lab and back
+    constexpr float trans[ColorCount][ColorCount] =
+    { { 1.f, 1.f, 1.f }, { 1.7320508f, -1.7320508f, 0.f }, { -1.f, -1.f, 2.f } };
+    constexpr float itrans[ColorCount][ColorCount] =
+    { { 1.f, 0.8660254f, -0.5f }, { 1.f, -0.8660254f, -0.5f }, { 1.f, 0.f, 1.f } };
 
-        if(hilite[3][hfh - 3][j] <= epsilon) {
-            hilite_dir[4 + 3][hfh - 1][j] += hilite_dir4[3][j][hfh - 3];
-        }
-    }
+    const float (&max_f)[3] = levels.max_f;
+    const float (&thresh)[3] = levels.thresh;
+    const float (&medFactor)[3] = levels.medFactor;
+    const float whitept = levels.whitept;
+    const float clippt = levels.clippt;
+    const float blendpt = levels.blendpt;
 
-    for (int i = 2; i < hfh - 2; i++) {
-        if(hilite[3][i][0] <= epsilon) {
-            hilite_dir[0 + 3][i - 2][0] += hilite_dir4[3][0][i];
-            hilite_dir[4 + 3][i + 2][0] += hilite_dir4[3][0][i];
-        }
 
-        if(hilite[3][i][1] <= epsilon) {
-            hilite_dir[0 + 3][i - 2][1] += hilite_dir4[3][1][i];
-            hilite_dir[4 + 3][i + 2][1] += hilite_dir4[3][1][i];
-        }
+    multi_array2D<float, 3> channelblur(blurWidth, blurHeight, 0, 48);
+    array2D<float> temp(blurWidth, blurHeight); // allocate temporary buffer
 
-        if(hilite[3][i][hfw - 2] <= epsilon) {
-            hilite_dir[0 + 3][i - 2][hfw - 2] += hilite_dir4[3][hfw - 2][i];
-            hilite_dir[4 + 3][i + 2][hfw - 2] += hilite_dir4[3][hfw - 2][i];
-        }
-    }
+    // blur RGB channels
 
-#ifdef _OPENMP
-    #pragma omp parallel for
-#endif
+    boxblur2(red, channelblur[0], temp, miny, minx, blurHeight, blurWidth, 4, multiThread);
 
-    for (int c = 0; c < 3; c++) {
-        for (int j = hfw - 2; j > 0; j--) {
-            for (int i = 2; i < hfh - 2; i++) {
-                //from right
-                if (hilite[3][i][j] > epsilon) {
-                    hilite_dir4[c][j][i] = hilite[c][i][j] / hilite[3][i][j];
-                } else {
-                    hilite_dir4[c][j][i] = 0.1f * ((hilite_dir4[c][(j + 1)][(i - 2)] + hilite_dir4[c][(j + 1)][(i - 1)] + hilite_dir4[c][(j + 1)][(i)] + hilite_dir4[c][(j + 1)][(i + 1)] + hilite_dir4[c][(j + 1)][(i + 2)]) /
-                                                  (hilite_dir4[3][(j + 1)][(i - 2)] + hilite_dir4[3][(j + 1)][(i - 1)] + hilite_dir4[3][(j + 1)][(i)] + hilite_dir4[3][(j + 1)][(i + 1)] + hilite_dir4[3][(j + 1)][(i + 2)] + epsilon));
-                }
-            }
+    progress += 0.05;
+    setProgCancel(progress);
 
-            if(hilite[3][2][j] <= epsilon) {
-                hilite_dir[0 + c][0][j] += hilite_dir4[c][j][2];
-            }
+    boxblur2(green, channelblur[1], temp, miny, minx, blurHeight, blurWidth, 4, multiThread);
 
-            if(hilite[3][hfh - 3][j] <= epsilon) {
-                hilite_dir[4 + c][hfh - 1][j] += hilite_dir4[c][j][hfh - 3];
-            }
-        }
+    progress += 0.05;
+    setProgCancel(progress);
 
-        for (int i = 2; i < hfh - 2; i++) {
-            if(hilite[3][i][0] <= epsilon) {
-                hilite_dir[0 + c][i - 2][0] += hilite_dir4[c][0][i];
-                hilite_dir[4 + c][i + 2][0] += hilite_dir4[c][0][i];
-            }
+    boxblur2(blue, channelblur[2], temp, miny, minx, blurHeight, blurWidth, 4, multiThread);
 
-            if(hilite[3][i][1] <= epsilon) {
-                hilite_dir[0 + c][i - 2][1] += hilite_dir4[c][1][i];
-                hilite_dir[4 + c][i + 2][1] += hilite_dir4[c][1][i];
-            }
+    progress += 0.05;
+    setProgCancel(progress);
 
-            if(hilite[3][i][hfw - 2] <= epsilon) {
-                hilite_dir[0 + c][i - 2][hfw - 2] += hilite_dir4[c][hfw - 2][i];
-                hilite_dir[4 + c][i + 2][hfw - 2] += hilite_dir4[c][hfw - 2][i];
-            }
+    // reduce channel blur to one array
+#ifdef _OPENMP
+    #pragma omp parallel for if(multiThread)
+#endif
+
+    for(int i = 0; i < blurHeight; i++)
+        for(int j = 0; j < blurWidth; j++) {
+            channelblur[0][i][j] = fabsf(channelblur[0][i][j] - red[i + miny][j + minx]) + fabsf(channelblur[1][i][j] - green[i + miny][j + minx]) + fabsf(channelblur[2][i][j] - blue[i + miny][j + minx]);
         }
+
+    for (int c = 1; c < 3; c++) {
+        channelblur[c].free();    //free up some memory
     }
+    clock.lap("channel blur");
 
     progress += 0.05;
     setProgCancel(progress);
 
-    for (int i = 1; i < hfh - 1; i++)
-        for (int j = 2; j < hfw - 2; j++) {
-            //from top
-            if (hilite[3][i][j] > epsilon) {
-                hilite_dir[0 + 3][i][j] = 1.f;
-            } else {
-                hilite_dir[0 + 3][i][j] = (hilite_dir[0 + 3][i - 1][j - 2] + hilite_dir[0 + 3][i - 1][j - 1] + hilite_dir[0 + 3][i - 1][j] + hilite_dir[0 + 3][i - 1][j + 1] + hilite_dir[0 + 3][i - 1][j + 2]) == 0.f ? 0.f : 0.1f;
-            }
-        }
+    multi_array2D<float, 4> hilite_full(blurWidth, blurHeight, ARRAY2D_CLEAR_DATA, 32);
 
-    for (int j = 2; j < hfw - 2; j++) {
-        if(hilite[3][hfh - 2][j] <= epsilon) {
-            hilite_dir[4 + 3][hfh - 1][j] += hilite_dir[0 + 3][hfh - 2][j];
-        }
-    }
+    progress += 0.10;
+    setProgCancel(progress);
 
+    double hipass_sum = 0.f;
+    int hipass_norm = 0;
+
+    // set up which pixels are clipped or near clipping
 #ifdef _OPENMP
-    #pragma omp parallel for
+    #pragma omp parallel for reduction(+:hipass_sum,hipass_norm) schedule(dynamic,16) if(multiThread)
 #endif
 
-    for (int c = 0; c < 3; c++) {
-        for (int i = 1; i < hfh - 1; i++) {
-            for (int j = 2; j < hfw - 2; j++) {
-                //from top
-                if (hilite[3][i][j] > epsilon) {
-                    hilite_dir[0 + c][i][j] = hilite[c][i][j] / hilite[3][i][j];
-                } else {
-                    hilite_dir[0 + c][i][j] = 0.1f * ((hilite_dir[0 + c][i - 1][j - 2] + hilite_dir[0 + c][i - 1][j - 1] + hilite_dir[0 + c][i - 1][j] + hilite_dir[0 + c][i - 1][j + 1] + hilite_dir[0 + c][i - 1][j + 2]) /
-                                                     (hilite_dir[0 + 3][i - 1][j - 2] + hilite_dir[0 + 3][i - 1][j - 1] + hilite_dir[0 + 3][i - 1][j] + hilite_dir[0 + 3][i - 1][j + 1] + hilite_dir[0 + 3][i - 1][j + 2] + epsilon));
-                }
-            }
-        }
+    for (int i = 0; i < blurHeight; i++) {
+        for (int j = 0; j < blurWidth; j++) {
+            //if one or more channels is highlight but none are blown, add to highlight accumulator
+            if ((red[i + miny][j + minx] > thresh[0] || green[i + miny][j + minx] > thresh[1] || blue[i + miny][j + minx] > thresh[2]) &&
+                    (red[i + miny][j + minx] < max_f[0] && green[i + miny][j + minx] < max_f[1] && blue[i + miny][j + minx] < max_f[2])) {
+
+                hipass_sum += static_cast<double>(channelblur[0][i][j]);
+                hipass_norm ++;
+
+                hilite_full[0][i][j] = red[i + miny][j + minx];
+                hilite_full[1][i][j] = green[i + miny][j + minx];
+                hilite_full[2][i][j] = blue[i + miny][j + minx];
+                hilite_full[3][i][j] = 1.f;
 
-        for (int j = 2; j < hfw - 2; j++) {
-            if(hilite[3][hfh - 2][j] <= epsilon) {
-                hilite_dir[4 + c][hfh - 1][j] += hilite_dir[0 + c][hfh - 2][j];
             }
         }
-    }
+    }//end of filling highlight array
+
+    float hipass_ave = 2.0 * hipass_sum / (hipass_norm + static_cast<double>(epsilon));
+
+    progress += 0.05;
+    setProgCancel(progress);
+
+    array2D<float> hilite_full4(blurWidth, blurHeight);
+    //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+    //blur highlight data
+    boxblur2(hilite_full[3], hilite_full4, temp, 0, 0, blurHeight, blurWidth, 1, multiThread);
+
+    temp.free(); // free temporary buffer
 
     progress += 0.05;
     setProgCancel(progress);
 
-    for (int i = hfh - 2; i > 0; i--)
-        for (int j = 2; j < hfw - 2; j++) {
-            //from bottom
-            if (hilite[3][i][j] > epsilon) {
-                hilite_dir[4 + 3][i][j] = 1.f;
-            } else {
-                hilite_dir[4 + 3][i][j] = (hilite_dir[4 + 3][(i + 1)][(j - 2)] + hilite_dir[4 + 3][(i + 1)][(j - 1)] + hilite_dir[4 + 3][(i + 1)][(j)] + hilite_dir[4 + 3][(i + 1)][(j + 1)] + hilite_dir[4 + 3][(i + 1)][(j + 2)]) == 0.f ? 0.f : 0.1f;
-            }
-        }
-
 #ifdef _OPENMP
-    #pragma omp parallel for
+    #pragma omp parallel for schedule(dynamic,16) if(multiThread)
 #endif
 
-    for (int c = 0; c < 4; c++) {
-        for (int i = hfh - 2; i > 0; i--) {
-            for (int j = 2; j < hfw - 2; j++) {
-                //from bottom
-                if (hilite[3][i][j] > epsilon) {
-                    hilite_dir[4 + c][i][j] = hilite[c][i][j] / hilite[3][i][j];
-                } else {
-                    hilite_dir[4 + c][i][j] = 0.1f * ((hilite_dir[4 + c][(i + 1)][(j - 2)] + hilite_dir[4 + c][(i + 1)][(j - 1)] + hilite_dir[4 + c][(i + 1)][(j)] + hilite_dir[4 + c][(i + 1)][(j + 1)] + hilite_dir[4 + c][(i + 1)][(j + 2)]) /
-                                                     (hilite_dir[4 + 3][(i + 1)][(j - 2)] + hilite_dir[4 + 3][(i + 1)][(j - 1)] + hilite_dir[4 + 3][(i + 1)][(j)] + hilite_dir[4 + 3][(i + 1)][(j + 1)] + hilite_dir[4 + 3][(i + 1)][(j + 2)] + epsilon));
-                }
+    for (int i = 0; i < blurHeight; i++) {
+        for (int j = 0; j < blurWidth; j++) {
+            if (channelblur[0][i][j] > hipass_ave) {
+                //too much variation
+                hilite_full[0][i][j] = hilite_full[1][i][j] = hilite_full[2][i][j] = hilite_full[3][i][j] = 0.f;
+                continue;
+            }
+
+            if (hilite_full4[i][j] > epsilon && hilite_full4[i][j] < 0.95f) {
+                //too near an edge, could risk using CA affected pixels, therefore omit
+                hilite_full[0][i][j] = hilite_full[1][i][j] = hilite_full[2][i][j] = hilite_full[3][i][j] = 0.f;
             }
         }
     }
 
-    progress += 0.05;
-    setProgCancel(progress);
+    channelblur[0].free();    //free up some memory
+    hilite_full4.free();    //free up some memory
+    clock.lap("highlight map");
 
-    //fill in edges
-    for (int dir = 0; dir < 2; dir++) {
-        for (int i = 1; i < hfh - 1; i++)
-            for (int c = 0; c < 4; c++) {
-                hilite_dir[dir * 4 + c][i][0] = hilite_dir[dir * 4 + c][i][1];
-                hilite_dir[dir * 4 + c][i][hfw - 1] = hilite_dir[dir * 4 + c][i][hfw - 2];
-            }
+    int hfh = (blurHeight - (blurHeight % pitch)) / pitch;
+    int hfw = (blurWidth - (blurWidth % pitch)) / pitch;
 
-        for (int j = 1; j < hfw - 1; j++)
-            for (int c = 0; c < 4; c++) {
-                hilite_dir[dir * 4 + c][0][j] = hilite_dir[dir * 4 + c][1][j];
-                hilite_dir[dir * 4 + c][hfh - 1][j] = hilite_dir[dir * 4 + c][hfh - 2][j];
-            }
+    multi_array2D<float, 4> hilite(hfw + 1, hfh + 1, ARRAY2D_CLEAR_DATA, 48);
 
-        for (int c = 0; c < 4; c++) {
-            hilite_dir[dir * 4 + c][0][0] = hilite_dir[dir * 4 + c][1][0] = hilite_dir[dir * 4 + c][0][1] = hilite_dir[dir * 4 + c][1][1] = hilite_dir[dir * 4 + c][2][2];
-            hilite_dir[dir * 4 + c][0][hfw - 1] = hilite_dir[dir * 4 + c][1][hfw - 1] = hilite_dir[dir * 4 + c][0][hfw - 2] = hilite_dir[dir * 4 + c][1][hfw - 2] = hilite_dir[dir * 4 + c][2][hfw - 3];
-            hilite_dir[dir * 4 + c][hfh - 1][0] = hilite_dir[dir * 4 + c][hfh - 2][0] = hilite_dir[dir * 4 + c][hfh - 1][1] = hilite_dir[dir * 4 + c][hfh - 2][1] = hilite_dir[dir * 4 + c][hfh - 3][2];
-            hilite_dir[dir * 4 + c][hfh - 1][hfw - 1] = hilite_dir[dir * 4 + c][hfh - 2][hfw - 1] = hilite_dir[dir * 4 + c][hfh - 1][hfw - 2] = hilite_dir[dir * 4 + c][hfh - 2][hfw - 2] = hilite_dir[dir * 4 + c][hfh - 3][hfw - 3];
-        }
-    }
+    //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+    // blur and resample highlight data; range=size of blur, pitch=sample spacing
 
-    for (int i = 1; i < hfh - 1; i++)
-        for (int c = 0; c < 4; c++) {
-            hilite_dir0[c][0][i] = hilite_dir0[c][1][i];
-            hilite_dir0[c][hfw - 1][i] = hilite_dir0[c][hfw - 2][i];
-        }
+    array2D<float> temp2((blurWidth / pitch) + ((blurWidth % pitch) == 0 ? 0 : 1), blurHeight);
 
-    for (int j = 1; j < hfw - 1; j++)
-        for (int c = 0; c < 4; c++) {
-            hilite_dir0[c][j][0] = hilite_dir0[c][j][1];
-            hilite_dir0[c][j][hfh - 1] = hilite_dir0[c][j][hfh - 2];
-        }
+    for (int m = 0; m < 4; m++) {
+        boxblur_resamp(hilite_full[m], hilite[m], temp2, blurHeight, blurWidth, range, pitch, multiThread);
 
-    for (int c = 0; c < 4; c++) {
-        hilite_dir0[c][0][0] = hilite_dir0[c][0][1] = hilite_dir0[c][1][0] = hilite_dir0[c][1][1] = hilite_dir0[c][2][2];
-        hilite_dir0[c][hfw - 1][0] = hilite_dir0[c][hfw - 1][1] = hilite_dir0[c][hfw - 2][0] = hilite_dir0[c][hfw - 2][1] = hilite_dir0[c][hfw - 3][2];
-        hilite_dir0[c][0][hfh - 1] = hilite_dir0[c][0][hfh - 2] = hilite_dir0[c][1][hfh - 1] = hilite_dir0[c][1][hfh - 2] = hilite_dir0[c][2][hfh - 3];
-        hilite_dir0[c][hfw - 1][hfh - 1] = hilite_dir0[c][hfw - 1][hfh - 2] = hilite_dir0[c][hfw - 2][hfh - 1] = hilite_dir0[c][hfw - 2][hfh - 2] = hilite_dir0[c][hfw - 3][hfh - 3];
+        progress += 0.05;
+        setProgCancel(progress);
     }
 
-    for (int i = 1; i < hfh - 1; i++)
-        for (int c = 0; c < 4; c++) {
-            hilite_dir4[c][0][i] = hilite_dir4[c][1][i];
-            hilite_dir4[c][hfw - 1][i] = hilite_dir4[c][hfw - 2][i];
-        }
-
-    for (int j = 1; j < hfw - 1; j++)
-        for (int c = 0; c < 4; c++) {
-            hilite_dir4[c][j][0] = hilite_dir4[c][j][1];
-            hilite_dir4[c][j][hfh - 1] = hilite_dir4[c][j][hfh - 2];
-        }
+    temp2.free();
 
     for (int c = 0; c < 4; c++) {
-        hilite_dir4[c][0][0] = hilite_dir4[c][0][1] = hilite_dir4[c][1][0] = hilite_dir4[c][1][1] = hilite_dir4[c][2][2];
-        hilite_dir4[c][hfw - 1][0] = hilite_dir4[c][hfw - 1][1] = hilite_dir4[c][hfw - 2][0] = hilite_dir4[c][hfw - 2][1] = hilite_dir4[c][hfw - 3][2];
-        hilite_dir4[c][0][hfh - 1] = hilite_dir4[c][0][hfh - 2] = hilite_dir4[c][1][hfh - 1] = hilite_dir4[c][1][hfh - 2] = hilite_dir4[c][2][hfh - 3];
-        hilite_dir4[c][hfw - 1][hfh - 1] = hilite_dir4[c][hfw - 1][hfh - 2] = hilite_dir4[c][hfw - 2][hfh - 1] = hilite_dir4[c][hfw - 2][hfh - 2] = hilite_dir4[c][hfw - 3][hfh - 3];
+        hilite_full[c].free();    //free up some memory
     }
+    clock.lap("blur and resample");
+
+    // the pyramid fill only needs hilite_dir0
+    const bool directional = method == RP_HL_DIRECTIONAL;
+    multi_array2D<float, 8> hilite_dir(directional ? hfw : 0, directional ? hfh : 0, ARRAY2D_CLEAR_DATA, 64);
+    // for faster processing we create two buffers using (height,width) instead of (width,height)
+    multi_array2D<float, 4> hilite_dir0(hfh, hfw, ARRAY2D_CLEAR_DATA, 64);
+    multi_array2D<float, 4> hilite_dir4(directional ? hfh : 0, directional ? hfw : 0, ARRAY2D_CLEAR_DATA, 64);
 
     progress += 0.05;
     setProgCancel(progress);
 
+    if (directional) {
+        hlDirectionalFill(hilite, hilite_dir, hilite_dir0, hilite_dir4, hfw, hfh, progress, setProgCancel);
+    } else {
+        hlPyramidFill(hilite, hilite_dir0, hfw, hfh);
+        progress += 0.25;
+        setProgCancel(progress);
+    }
+
     //free up some memory
     for(int c = 0; c < 4; c++) {
         hilite[c].free();
     }
+    clock.lap(directional ? "directional fill" : "pyramid fill");
 
     //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
     // now reconstruct clipped channels using color ratios
 
 #ifdef _OPENMP
-    #pragma omp parallel for schedule(dynamic,16)
+    #pragma omp parallel for schedule(dynamic,16) if(multiThread)
 #endif
 
     for (int i = 0; i < blurHeight; i++) {
@@ -1077,33 +901,34 @@ rpError HLRecovery_inpaint (const int width, const int height, float** red, floa
                 clipfix[2] = dirwt * hilite_dir0[2][j1][i1];
             }
 
-            for (int dir = 0; dir < 2; dir++) {
-                float Yhil = 1.f / ( hilite_dir[dir * 4 + 0][i1][j1] + hilite_dir[dir * 4 + 1][i1][j1] + hilite_dir[dir * 4 + 2][i1][j1]);
-
-                if (Yhil < 2.f) {
-                    float dirwt = 1.f / (1.f + 65535.f * (SQR(rgb_blend[0] - hilite_dir[dir * 4 + 0][i1][j1] * Yhil) +
-                                                          SQR(rgb_blend[1] - hilite_dir[dir * 4 + 1][i1][j1] * Yhil) +
-                                                          SQR(rgb_blend[2] - hilite_dir[dir * 4 + 2][i1][j1] * Yhil)));
-                    totwt += dirwt;
-                    dirwt /= (hilite_dir[dir * 4 + 3][i1][j1] + epsilon);
-                    clipfix[0] += dirwt * hilite_dir[dir * 4 + 0][i1][j1];
-                    clipfix[1] += dirwt * hilite_dir[dir * 4 + 1][i1][j1];
-                    clipfix[2] += dirwt * hilite_dir[dir * 4 + 2][i1][j1];
+            if (directional) {
+                for (int dir = 0; dir < 2; dir++) {
+                    float Yhil = 1.f / ( hilite_dir[dir * 4 + 0][i1][j1] + hilite_dir[dir * 4 + 1][i1][j1] + hilite_dir[dir * 4 + 2][i1][j1]);
+
+                    if (Yhil < 2.f) {
+                        float dirwt = 1.f / (1.f + 65535.f * (SQR(rgb_blend[0] - hilite_dir[dir * 4 + 0][i1][j1] * Yhil) +
+                                                              SQR(rgb_blend[1] - hilite_dir[dir * 4 + 1][i1][j1] * Yhil) +
+                                                              SQR(rgb_blend[2] - hilite_dir[dir * 4 + 2][i1][j1] * Yhil)));
+                        totwt += dirwt;
+                        dirwt /= (hilite_dir[dir * 4 + 3][i1][j1] + epsilon);
+                        clipfix[0] += dirwt * hilite_dir[dir * 4 + 0][i1][j1];
+                        clipfix[1] += dirwt * hilite_dir[dir * 4 + 1][i1][j1];
+                        clipfix[2] += dirwt * hilite_dir[dir * 4 + 2][i1][j1];
+                    }
                 }
-            }
-
 
-            Yhi = 1.f / (hilite_dir4[0][j1][i1] + hilite_dir4[1][j1][i1] + hilite_dir4[2][j1][i1]);
+                Yhi = 1.f / (hilite_dir4[0][j1][i1] + hilite_dir4[1][j1][i1] + hilite_dir4[2][j1][i1]);
 
-            if (Yhi < 2.f) {
-                float dirwt = 1.f / (1.f + 65535.f * (SQR(rgb_blend[0] - hilite_dir4[0][j1][i1] * Yhi) +
-                                                      SQR(rgb_blend[1] - hilite_dir4[1][j1][i1] * Yhi) +
-                                                      SQR(rgb_blend[2] - hilite_dir4[2][j1][i1] * Yhi)));
-                totwt += dirwt;
-                dirwt /= (hilite_dir4[3][j1][i1] + epsilon);
-                clipfix[0] += dirwt * hilite_dir4[0][j1][i1];
-                clipfix[1] += dirwt * hilite_dir4[1][j1][i1];
-                clipfix[2] += dirwt * hilite_dir4[2][j1][i1];
+                if (Yhi < 2.f) {
+                    float dirwt = 1.f / (1.f + 65535.f * (SQR(rgb_blend[0] - hilite_dir4[0][j1][i1] * Yhi) +
+                                                          SQR(rgb_blend[1] - hilite_dir4[1][j1][i1] * Yhi) +
+                                                          SQR(rgb_blend[2] - hilite_dir4[2][j1][i1] * Yhi)));
+                    totwt += dirwt;
+                    dirwt /= (hilite_dir4[3][j1][i1] + epsilon);
+                    clipfix[0] += dirwt * hilite_dir4[0][j1][i1];
+                    clipfix[1] += dirwt * hilite_dir4[1][j1][i1];
+                    clipfix[2] += dirwt * hilite_dir4[2][j1][i1];
+                }
             }
 
             if(totwt == 0.f) {
@@ -1154,8 +979,419 @@ rpError HLRecovery_inpaint (const int width, const int height, float** red, floa
         }
     }
 
+
+    clock.lap("reconstruction");
+}
+
+
+// inclusive pixel bounds of an image region
+struct HLBox {
+    HLBox(int left, int top, int right, int bottom) : x0(left), y0(top), x1(right), y1(bottom) {}
+
+    double area() const
+    {
+        return static_cast<double>(x1 - x0 + 1) * (y1 - y0 + 1);
+    }
+
+    int x0, y0, x1, y1;
+};
+
+// Finds the clipped regions of the image and returns boxes around them, padded by border and merged until no two boxes
+// overlap. The clipped pixels are grouped in cells of cellSize x cellSize pixels. Cells closer than the padding end up in
+// the same box, so the connected regions are found on the cell grid dilated by the padding.
+std::vector<HLBox> hlClippedBoxes(const int width, const int height, const float * const *red, const float * const *green, const float * const *blue, const float max_f[3], int border)
+{
+    constexpr int cellSize = 16;
+    const int cellsW = (width + cellSize - 1) / cellSize;
+    const int cellsH = (height + cellSize - 1) / cellSize;
+
+    // exact bounding box of the clipped pixels of each cell, empty if x0 > x1
+    std::vector<HLBox> cells(static_cast<std::size_t>(cellsW) * cellsH, HLBox(width, height, -1, -1));
+
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic, 4)
+#endif
+    for (int cy = 0; cy < cellsH; ++cy) {
+        HLBox *cellRow = &cells[static_cast<std::size_t>(cy) * cellsW];
+        for (int i = cy * cellSize; i < std::min((cy + 1) * cellSize, height); ++i) {
+            for (int j = 0; j < width; ++j) {
+                if (red[i][j] >= max_f[0] || green[i][j] >= max_f[1] || blue[i][j] >= max_f[2]) {
+                    HLBox &cell = cellRow[j / cellSize];
+                    cell.x0 = std::min(cell.x0, j);
+                    cell.x1 = std::max(cell.x1, j);
+                    cell.y0 = std::min(cell.y0, i);
+                    cell.y1 = std::max(cell.y1, i);
+                }
+            }
+        }
+    }
+
+    // dilate the clipped cells by the padding, separably with running counts
+    const int pad = (border + cellSize - 1) / cellSize;
+    std::vector<char> rowDilated(cells.size());
+    std::vector<char> dilated(cells.size());
+
+#ifdef _OPENMP
+    #pragma omp parallel
+#endif
+    {
+#ifdef _OPENMP
+        #pragma omp for
+#endif
+        for (int cy = 0; cy < cellsH; ++cy) {
+            const std::size_t rowStart = static_cast<std::size_t>(cy) * cellsW;
+            int count = 0;
+            for (int cx = 0; cx < std::min(pad, cellsW); ++cx) {
+                count += cells[rowStart + cx].x0 <= cells[rowStart + cx].x1;
+            }
+            for (int cx = 0; cx < cellsW; ++cx) {
+                if (cx + pad < cellsW) {
+                    count += cells[rowStart + cx + pad].x0 <= cells[rowStart + cx + pad].x1;
+                }
+                rowDilated[rowStart + cx] = count > 0;
+                if (cx - pad >= 0) {
+                    count -= cells[rowStart + cx - pad].x0 <= cells[rowStart + cx - pad].x1;
+                }
+            }
+        }
+#ifdef _OPENMP
+        #pragma omp for
+#endif
+        for (int cx = 0; cx < cellsW; ++cx) {
+            int count = 0;
+            for (int cy = 0; cy < std::min(pad, cellsH); ++cy) {
+                count += rowDilated[static_cast<std::size_t>(cy) * cellsW + cx];
+            }
+            for (int cy = 0; cy < cellsH; ++cy) {
+                if (cy + pad < cellsH) {
+                    count += rowDilated[static_cast<std::size_t>(cy + pad) * cellsW + cx];
+                }
+                dilated[static_cast<std::size_t>(cy) * cellsW + cx] = count > 0;
+                if (cy - pad >= 0) {
+                    count -= rowDilated[static_cast<std::size_t>(cy - pad) * cellsW + cx];
+                }
+            }
+        }
+    }
+
+    // connected regions of the dilated cells, each gets the bounding box of its clipped pixels
+    std::vector<HLBox> boxes;
+    std::vector<int> stack;
+    for (std::size_t start = 0; start < dilated.size(); ++start) {
+        if (!dilated[start]) {
+            continue;
+        }
+        HLBox box(width, height, -1, -1);
+        dilated[start] = 0;
+        stack.push_back(static_cast<int>(start));
+        while (!stack.empty()) {
+            const int index = stack.back();
+            stack.pop_back();
+            const HLBox &cell = cells[index];
+            if (cell.x0 <= cell.x1) {
+                box.x0 = std::min(box.x0, cell.x0);
+                box.x1 = std::max(box.x1, cell.x1);
+                box.y0 = std::min(box.y0, cell.y0);
+                box.y1 = std::max(box.y1, cell.y1);
+            }
+            const int cy = index / cellsW;
+            const int cx = index % cellsW;
+            for (int ny = std::max(cy - 1, 0); ny <= std::min(cy + 1, cellsH - 1); ++ny) {
+                for (int nx = std::max(cx - 1, 0); nx <= std::min(cx + 1, cellsW - 1); ++nx) {
+                    const int neighbour = ny * cellsW + nx;
+                    if (dilated[neighbour]) {
+                        dilated[neighbour] = 0;
+                        stack.push_back(neighbour);
+                    }
+                }
+            }
+        }
+        boxes.emplace_back(std::max(0, box.x0 - border), std::max(0, box.y0 - border), std::min(width - 1, box.x1 + border), std::min(height - 1, box.y1 + border));
+    }
+
+    // the padded boxes of regions with concave shapes can still overlap
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        for (std::size_t a = 0; a < boxes.size(); ++a) {
+            for (std::size_t b = a + 1; b < boxes.size(); ++b) {
+                if (boxes[a].x0 <= boxes[b].x1 && boxes[b].x0 <= boxes[a].x1 && boxes[a].y0 <= boxes[b].y1 && boxes[b].y0 <= boxes[a].y1) {
+                    boxes[a] = HLBox(std::min(boxes[a].x0, boxes[b].x0), std::min(boxes[a].y0, boxes[b].y0), std::max(boxes[a].x1, boxes[b].x1), std::max(boxes[a].y1, boxes[b].y1));
+                    boxes[b] = boxes.back();
+                    boxes.pop_back();
+                    merged = true;
+                    --b;
+                }
+            }
+        }
+    }
+
+    return boxes;
+}
+
+rpError HLRecovery_inpaint_impl(rpContext *context, const int width, const int height, float** red, float** green, float** blue, const float chmax[3], const float clmax[3], const std::function<bool(double)> &setProgCancel, bool sparse, rpHLMethod method)
+{
+    StageTimer timer(context, "HLRecovery_inpaint");
+    StageClock clock(timer);
+
+    setProgCancel(0.0);
+
+    const HLLevels levels = hlLevels(chmax, clmax);
+    const float (&max_f)[3] = levels.max_f;
+
+    if (sparse) {
+        std::vector<HLBox> boxes = hlClippedBoxes(width, height, red, green, blue, max_f, blurBorder);
+        clock.lap("clipped area");
+
+        // boxes with a large share of the clipped area are processed one after the other by all threads, the others
+        // concurrently by one thread each
+        std::sort(boxes.begin(), boxes.end(), [](const HLBox &a, const HLBox &b) {
+            return a.area() > b.area();
+        });
+        double totalArea = 0.0;
+        for (const auto &box : boxes) {
+            totalArea += box.area();
+        }
+#ifdef _OPENMP
+        const int numThreads = omp_get_max_threads();
+#else
+        const int numThreads = 1;
+#endif
+        std::size_t numLarge = 0;
+        double done = 0.0;
+        while (numLarge < boxes.size() && (numLarge == 0 || boxes[numLarge].area() * numThreads > totalArea)) {
+            const HLBox &box = boxes[numLarge];
+            const double begin = done / totalArea;
+            const double end = (done + box.area()) / totalArea;
+            hlRecoverBox(levels, method, red, green, blue, box.x0, box.y0, box.x1 - box.x0 + 1, box.y1 - box.y0 + 1, timer, [&setProgCancel, begin, end](double p) {
+                return setProgCancel(begin + p * (end - begin));
+            }, true);
+            done += box.area();
+            ++numLarge;
+        }
+
+        if (numLarge < boxes.size()) {
+            librtprocess::Progress progress(setProgCancel, boxes.size() - numLarge, done / totalArea);
+            const std::function<bool(double)> noProgress = [](double) {
+                return false;
+            };
+#ifdef _OPENMP
+            #pragma omp parallel for schedule(dynamic)
+#endif
+            for (std::size_t i = numLarge; i < boxes.size(); ++i) {
+                const HLBox &box = boxes[i];
+                hlRecoverBox(levels, method, red, green, blue, box.x0, box.y0, box.x1 - box.x0 + 1, box.y1 - box.y0 + 1, timer, noProgress, false);
+                progress.done();
+            }
+        }
+
+        setProgCancel(1.00);
+        return RP_NO_ERROR;
+    }
+
+
+    int minx = width - 1;
+    int maxx = 0;
+    int miny = height - 1;
+    int maxy = 0;
+
+// Current MSVC version doesn't support these way of calling OMP
+#ifndef _MSC_VER
+    #pragma omp parallel for reduction(min:minx,miny) reduction(max:maxx,maxy) schedule(dynamic, 16)
+#endif
+    for (int i = 0; i < height; ++i) {
+        for (int j = 0; j< width; ++j) {
+            if(red[i][j] >= max_f[0] || green[i][j] >= max_f[1] || blue[i][j] >= max_f[2]) {
+                minx = std::min(minx, j);
+                maxx = std::max(maxx, j);
+                miny = std::min(miny, i);
+                maxy = std::max(maxy, i);
+            }
+        }
+    }
+
+    minx = std::max(0, minx - blurBorder);
+    miny = std::max(0, miny - blurBorder);
+    maxx = std::min(width - 1, maxx + blurBorder);
+    maxy = std::min(height - 1, maxy + blurBorder);
+    const int blurWidth = maxx - minx + 1;
+    const int blurHeight = maxy - miny + 1;
+    clock.lap("clipped area");
+
+    hlRecoverBox(levels, method, red, green, blue, minx, miny, blurWidth, blurHeight, timer, setProgCancel, true);
+
     setProgCancel(1.00);
 
     return RP_NO_ERROR;
 
 }// end of HLReconstruction
+
+}
+
+rpError HLRecovery_inpaint(const int width, const int height, float** red, float** green, float** blue, const float chmax[3], const float clmax[3], const std::function<bool(double)> &setProgCancel)
+{
+    return HLRecovery_inpaint_impl(nullptr, width, height, red, green, blue, chmax, clmax, setProgCancel, false, RP_HL_DIRECTIONAL);
+}
+
+rpError HLRecovery_inpaint(rpContext &context, const int width, const int height, float** red, float** green, float** blue, const float chmax[3], const float clmax[3], const std::function<bool(double)> &setProgCancel, bool sparse, rpHLMethod method)
+{
+    return HLRecovery_inpaint_impl(&context, width, height, red, green, blue, chmax, clmax, setProgCancel, sparse, method);
+}
+
+rpError HLRecovery_inpaint_tiled(rpContext &context, const int width, const int height, float** red, float** green, float** blue, const float chmax[3], const float clmax[3], const std::function<bool(double)> &setProgCancel, int tileSize, rpHLMethod method)
+{
+    StageTimer timer(&context, "HLRecovery_inpaint_tiled");
+    StageClock clock(timer);
+
+    setProgCancel(0.0);
+
+    const HLLevels levels = hlLevels(chmax, clmax);
+    const float (&max_f)[3] = levels.max_f;
+
+    // bounding boxes of the clipped pixels of the tiles of tileSize x tileSize pixels, empty if x0 > x1
+    tileSize = std::max(tileSize, 64);
+    const int tilesW = (width + tileSize - 1) / tileSize;
+    const int tilesH = (height + tileSize - 1) / tileSize;
+    std::vector<HLBox> tiles(static_cast<std::size_t>(tilesW) * tilesH, HLBox(width, height, -1, -1));
+
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic)
+#endif
+    for (int t = 0; t < tilesW * tilesH; ++t) {
+        const int x0 = (t % tilesW) * tileSize;
+        const int y0 = (t / tilesW) * tileSize;
+        HLBox &box = tiles[t];
+        for (int i = y0; i < std::min(y0 + tileSize, height); ++i) {
+            for (int j = x0; j < std::min(x0 + tileSize, width); ++j) {
+                if (red[i][j] >= max_f[0] || green[i][j] >= max_f[1] || blue[i][j] >= max_f[2]) {
+                    box.x0 = std::min(box.x0, j);
+                    box.x1 = std::max(box.x1, j);
+                    box.y0 = std::min(box.y0, i);
+                    box.y1 = std::max(box.y1, i);
+                }
+            }
+        }
+    }
+
+    tiles.erase(std::remove_if(tiles.begin(), tiles.end(), [](const HLBox &box) {
+        return box.x0 > box.x1;
+    }), tiles.end());
+    clock.lap("clipped area");
+
+    // The clipped pixels of every tile are processed with their surroundings up to blurBorder. A recovered core is kept
+    // aside until the padded areas of all later tiles which overlap it have been copied into the tile buffer, so every
+    // tile sees the original data and not the recovered pixels of its neighbours. lastReader[t] is the last tile whose
+    // padded area overlaps the core of tile t. The tiles are in row major order, so this holds back about one row of
+    // cores.
+    std::vector<std::size_t> lastReader(tiles.size());
+    for (std::size_t t = 0; t < tiles.size(); ++t) {
+        lastReader[t] = t;
+        for (std::size_t u = t + 1; u < tiles.size() && (tiles[u].y0 / tileSize) * tileSize - blurBorder <= tiles[t].y1; ++u) {
+            if (tiles[u].x0 - blurBorder <= tiles[t].x1 && tiles[u].x1 + blurBorder >= tiles[t].x0 &&
+                tiles[u].y0 - blurBorder <= tiles[t].y1 && tiles[u].y1 + blurBorder >= tiles[t].y0) {
+                lastReader[t] = u;
+            }
+        }
+    }
+
+    const int bufferWidth = std::min(tileSize + 2 * blurBorder, width);
+    const int bufferHeight = std::min(tileSize + 2 * blurBorder, height);
+    multi_array2D<float, 3> tile(tiles.empty() ? 0 : bufferWidth, tiles.empty() ? 0 : bufferHeight);
+    float **const rgb[3] = {red, green, blue};
+
+    // recovered cores which are not written back yet, each holds the 3 channels of its core
+    struct PendingCore {
+        PendingCore(std::size_t index, std::size_t size) : tile(index), data(3 * size) {}
+        std::size_t tile;
+        std::vector<float> data;
+    };
+    std::vector<PendingCore> pending;
+
+    for (std::size_t t = 0; t < tiles.size(); ++t) {
+        const HLBox &core = tiles[t];
+        const int left = std::max(0, core.x0 - blurBorder);
+        const int top = std::max(0, core.y0 - blurBorder);
+        const int tileWidth = std::min(width - 1, core.x1 + blurBorder) - left + 1;
+        const int tileHeight = std::min(height - 1, core.y1 + blurBorder) - top + 1;
+
+        StageClock copyClock(timer);
+#ifdef _OPENMP
+        #pragma omp parallel for
+#endif
+        for (int i = 0; i < tileHeight; ++i) {
+            for (int c = 0; c < 3; ++c) {
+                std::copy(rgb[c][top + i] + left, rgb[c][top + i] + left + tileWidth, tile[c][i]);
+            }
+        }
+        copyClock.lap("tile copy");
+
+        const double begin = static_cast<double>(t) / tiles.size();
+        const double end = static_cast<double>(t + 1) / tiles.size();
+        hlRecoverBox(levels, method, tile[0], tile[1], tile[2], 0, 0, tileWidth, tileHeight, timer, [&setProgCancel, begin, end](double p) {
+            return setProgCancel(begin + p * (end - begin));
+        }, true);
+
+        copyClock.start();
+        const int coreWidth = core.x1 - core.x0 + 1;
+        const int coreHeight = core.y1 - core.y0 + 1;
+        const std::size_t coreSize = static_cast<std::size_t>(coreWidth) * coreHeight;
+        pending.emplace_back(t, coreSize);
+        float *const saved = pending.back().data.data();
+#ifdef _OPENMP
+        #pragma omp parallel for
+#endif
+        for (int i = 0; i < coreHeight; ++i) {
+            for (int c = 0; c < 3; ++c) {
+                const float *row = tile[c][core.y0 + i - top] + core.x0 - left;
+                std::copy(row, row + coreWidth, saved + c * coreSize + static_cast<std::size_t>(i) * coreWidth);
+            }
+        }
+
+        // write back the cores which no later tile reads
+        for (auto it = pending.begin(); it != pending.end();) {
+            if (lastReader[it->tile] > t) {
+                ++it;
+                continue;
+            }
+            const HLBox &done = tiles[it->tile];
+            const int doneWidth = done.x1 - done.x0 + 1;
+            const std::size_t doneSize = static_cast<std::size_t>(doneWidth) * (done.y1 - done.y0 + 1);
+            const float *const data = it->data.data();
+#ifdef _OPENMP
+            #pragma omp parallel for
+#endif
+            for (int i = done.y0; i <= done.y1; ++i) {
+                for (int c = 0; c < 3; ++c) {
+                    const float *row = data + c * doneSize + static_cast<std::size_t>(i - done.y0) * doneWidth;
+                    std::copy(row, row + doneWidth, rgb[c][i] + done.x0);
+                }
+            }
+            it = pending.erase(it);
+        }
+        copyClock.lap("tile copy");
+    }
+
+    setProgCancel(1.00);
+
+    return RP_NO_ERROR;
+}
+
+std::size_t HLRecovery_inpaint_scratch_size(int width, int height, bool tiled, int tileSize)
+{
+    // the peak of hlRecoverBox is 7 planes of the box, the channel blurs, the highlight map and its blur and a temporary
+    constexpr std::size_t boxPlanes = 7;
+    if (!tiled) {
+        return boxPlanes * width * height * sizeof(float);
+    }
+    tileSize = std::max(tileSize, 64);
+    const std::size_t bufferWidth = std::min(tileSize + 2 * blurBorder, width);
+    const std::size_t bufferHeight = std::min(tileSize + 2 * blurBorder, height);
+    // the cores held back until no later tile reads them, tiles within the reach of blurBorder in row major order
+    const std::size_t tilesW = (width + tileSize - 1) / tileSize;
+    const std::size_t tilesH = (height + tileSize - 1) / tileSize;
+    const std::size_t reach = (blurBorder + tileSize - 1) / tileSize;
+    const std::size_t pendingTiles = std::min(tilesW * tilesH, reach * tilesW + reach + 1);
+    const std::size_t pendingPixels = std::min(static_cast<std::size_t>(width) * height, pendingTiles * tileSize * tileSize);
+    const std::size_t tileList = tilesW * tilesH * (sizeof(HLBox) + sizeof(std::size_t));
+    return (boxPlanes + 3) * bufferWidth * bufferHeight * sizeof(float) + 3 * pendingPixels * sizeof(float) + tileList;
+}
@@ -22,98 +22,439 @@
 //
 ////////////////////////////////////////////////////////////////
 
+#include <algorithm>
+#include <array>
+#include <cstring>
 #include <memory>
+#include <vector>
 
 #include "bayerhelper.h"
+#include "float16.h"
 #include "gauss.h"
 #include "librtprocess.h"
 #include "jaggedarray.h"
 #include "rt_math.h"
 #include "median.h"
+#include "progress.h"
 #include "StopWatch.h"
+#include "stagetimer.h"
+#include "xtranshelper.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace {
 
-bool LinEqSolve(int nDim, double* pfMatr, double* pfVect, double pfSolution[16])
+double dotProduct(const double *a, const double *b, int n)
 {
-//==============================================================================
-// return 1 if system not solving, 0 if system solved
-// nDim - system dimension
-// pfMatr - matrix with coefficients
-// pfVect - vector with free members
-// pfSolution - vector with system solution
-// pfMatr becomes triangular after function call
-// pfVect changes after function call
-//
-// Developer: Henry Guennadi Levkin
-//
-//==============================================================================
+    int i = 0;
+    double result = 0.0;
+#ifdef RT_VECTOR
+    vdouble sumv = _mm_setzero_pd();
+    for (; i < n - 1; i += 2) {
+        sumv = _mm_add_pd(sumv, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    }
+    double sums[2];
+    _mm_storeu_pd(sums, sumv);
+    result = sums[0] + sums[1];
+#endif
+    for (; i < n; ++i) {
+        result += a[i] * b[i];
+    }
+    return result;
+}
 
-    double fAcc;
+// Cholesky factorisation of the symmetric n x n matrix of which the lower triangle is given, replaced by the lower
+// triangular factor. The matrix is scaled to a unit diagonal first, which keeps the factorisation accurate for the badly
+// conditioned normal equations of the polynomial fit, scale receives the factors. Returns false if the matrix is not
+// positive definite.
+bool choleskyFactor(int n, double *matrix, double *scale)
+{
+    for (int i = 0; i < n; ++i) {
+        if (!(matrix[i * n + i] > 0.0)) {
+            return false;
+        }
+        scale[i] = 1.0 / sqrt(matrix[i * n + i]);
+    }
 
-    int i, j, k;
+    for (int i = 0; i < n; ++i) {
+        double *rowI = matrix + i * n;
+        for (int j = 0; j <= i; ++j) {
+            rowI[j] *= scale[i] * scale[j];
+        }
+        for (int j = 0; j < i; ++j) {
+            const double *rowJ = matrix + j * n;
+            rowI[j] = (rowI[j] - dotProduct(rowI, rowJ, j)) / rowJ[j];
+        }
+        const double diagonal = rowI[i] - dotProduct(rowI, rowI, i);
+        if (!(diagonal > 0.0)) {
+            return false;
+        }
+        rowI[i] = sqrt(diagonal);
+    }
+    return true;
+}
 
-    for(k = 0; k < (nDim - 1); k++) { // base row of matrix
-        // search of line with max element
-        double fMaxElem = fabs( pfMatr[k * nDim + k] );
-        int m = k;
+// solves matrix * solution = vect with the factor and scale of choleskyFactor
+void choleskySolve(int n, const double *factor, const double *scale, const double *vect, double *solution)
+{
+    for (int i = 0; i < n; ++i) {
+        solution[i] = (scale[i] * vect[i] - dotProduct(factor + i * n, solution, i)) / factor[i * n + i];
+    }
+    for (int i = n - 1; i >= 0; --i) {
+        for (int k = i + 1; k < n; ++k) {
+            solution[i] -= factor[k * n + i] * solution[k];
+        }
+        solution[i] /= factor[i * n + i];
+    }
+    for (int i = 0; i < n; ++i) {
+        solution[i] *= scale[i];
+    }
+}
 
-        for (i = k + 1; i < nDim; i++) {
-            if(fMaxElem < fabs(pfMatr[i * nDim + k]) ) {
-                fMaxElem = pfMatr[i * nDim + k];
-                m = i;
-            }
+}
+
+using namespace std;
+using namespace librtprocess;
+
+namespace
+{
+
+constexpr int maxParams = RP_CA_MAX_ORDER * RP_CA_MAX_ORDER;
+
+// Centre and scale of the radial model of a width x height image in block coordinates, blocks are 112 pixels apart
+// and the first one is centred at pixel 56
+struct RadialGeometry {
+    RadialGeometry(int width, int height) :
+        vCentre((height / 2.0 - 56.0) / 112.0 + 1.0),
+        hCentre((width / 2.0 - 56.0) / 112.0 + 1.0),
+        scale(std::hypot(width, height) / (2.0 * 112.0))
+    {
+    }
+
+    double vCentre;
+    double hCentre;
+    double scale;
+};
+
+// coefficients of x^p in ((x - centre) / scale)^i, transform[p][i]
+void centredPowers(int order, double centre, double scale, double transform[RP_CA_MAX_ORDER][RP_CA_MAX_ORDER])
+{
+    for (int p = 0; p < order; ++p) {
+        for (int i = 0; i < order; ++i) {
+            transform[p][i] = 0.0;
+        }
+    }
+    transform[0][0] = 1.0;
+    for (int i = 1; i < order; ++i) {
+        for (int p = 0; p <= i; ++p) {
+            transform[p][i] = ((p > 0 ? transform[p - 1][i - 1] : 0.0) - centre * transform[p][i - 1]) / scale;
         }
+    }
+}
 
-        // permutation of base line (index k) and max element line(index m)
-        if(m != k) {
-            for(i = k; i < nDim; i++) {
-                fAcc               = pfMatr[k * nDim + i];
-                pfMatr[k * nDim + i] = pfMatr[m * nDim + i];
-                pfMatr[m * nDim + i] = fAcc;
+// The polynomial is fitted in block coordinates centred on the grid, which keeps the normal equations of higher orders
+// well conditioned. This gives the coefficients of vblock^p * hblock^q of the model from the centred ones.
+void uncentrePolynomial(int order, const double *centred, double vCentre, double vScale, double hCentre, double hScale, double *result)
+{
+    double vTransform[RP_CA_MAX_ORDER][RP_CA_MAX_ORDER];
+    double hTransform[RP_CA_MAX_ORDER][RP_CA_MAX_ORDER];
+    centredPowers(order, vCentre, vScale, vTransform);
+    centredPowers(order, hCentre, hScale, hTransform);
+    for (int p = 0; p < order; ++p) {
+        for (int q = 0; q < order; ++q) {
+            double sum = 0.0;
+            for (int i = p; i < order; ++i) {
+                for (int j = q; j < order; ++j) {
+                    sum += vTransform[p][i] * centred[order * i + j] * hTransform[q][j];
+                }
             }
+            result[order * p + q] = sum;
+        }
+    }
+}
 
-            fAcc = pfVect[k];
-            pfVect[k] = pfVect[m];
-            pfVect[m] = fAcc;
+// CA shifts of a model at a block position of the image it was fitted on
+void modelShifts(const rpCAModel &model, double vpos, double hpos, float shifts[2][2])
+{
+    if (model.type == RP_CA_RADIAL) {
+        const RadialGeometry geometry(model.width, model.height);
+        const double dv = vpos - geometry.vCentre;
+        const double dh = hpos - geometry.hCentre;
+        const double r2 = (SQR(dv) + SQR(dh)) / SQR(geometry.scale);
+        for (int c = 0; c < 2; c++) {
+            double radial = 0.0;
+            for (int k = model.polyOrder - 1; k >= 0; k--) {
+                radial = radial * r2 + model.fitParams[c][0][k];
+            }
+            shifts[c][0] = model.fitParams[c][1][0] + dv * radial;
+            shifts[c][1] = model.fitParams[c][1][1] + dh * radial;
         }
+        return;
+    }
 
-        if( pfMatr[k * nDim + k] == 0.) {
-            //linear system has no solution
-            return false; // needs improvement !!!
+    const int polyord = model.polyOrder;
+    double sums[2][2] = {};
+    double powVblock = 1.0;
+    for (int i = 0; i < polyord; i++) {
+        double powHblock = powVblock;
+        for (int j = 0; j < polyord; j++) {
+            sums[0][0] += powHblock * model.fitParams[0][0][polyord * i + j];
+            sums[0][1] += powHblock * model.fitParams[0][1][polyord * i + j];
+            sums[1][0] += powHblock * model.fitParams[1][0][polyord * i + j];
+            sums[1][1] += powHblock * model.fitParams[1][1][polyord * i + j];
+            powHblock *= hpos;
         }
+        powVblock *= vpos;
+    }
+    shifts[0][0] = sums[0][0];
+    shifts[0][1] = sums[0][1];
+    shifts[1][0] = sums[1][0];
+    shifts[1][1] = sums[1][1];
+}
 
-        // triangulation of matrix with coefficients
-        for(j = (k + 1); j < nDim; j++) { // current row of matrix
-            fAcc = - pfMatr[j * nDim + k] / pfMatr[k * nDim + k];
+// Normal equations of the fit of the block shifts, which are shared by the threads of a parallel region
+struct CAFit {
+    CAFit(rpCAModelType modelType, int polyOrder) :
+        type(modelType),
+        order(polyOrder),
+        numpar(modelType == RP_CA_RADIAL ? polyOrder + 2 : SQR(polyOrder)),
+        polymat{},
+        shiftmat{},
+        numblox{0, 0}
+    {}
+
+    rpCAModelType type;
+    int order;
+    //number of parameters per colour
+    int numpar;
+    // lower triangle of the matrix of each colour
+    double polymat[2][maxParams * maxParams];
+    double shiftmat[2][2][maxParams];
+    int numblox[2];
+};
+
+// Fits the model to the shifts of the blocks of a vblsz x hblsz grid, every blockStep-th block in both directions.
+// Has to be called by all threads of a parallel region. On success the model of the W x H image is set,
+// otherwise processpasstwo is cleared.
+void fitBlockShifts(CAFit &fit, const float *blockwt, const float (*blockshifts)[2][2], const float blockvar[2][2], int vblsz, int hblsz, int blockStep, int W, int H, rpCAModel &model, bool &processpasstwo)
+{
+    const bool radial = fit.type == RP_CA_RADIAL;
+    int &polyord = fit.order;
+    int &numpar = fit.numpar;
+    double (&polymat)[2][maxParams * maxParams] = fit.polymat;
+    double (&shiftmat)[2][2][maxParams] = fit.shiftmat;
+    int (&numblox)[2] = fit.numblox;
+
+    //blocks outside of the block grid mirror the ones inside, the neighbours of a block are on the analysed lattice
+    const auto neighbour = [blockStep](int block, int offset, int size) {
+        int result = block + offset * blockStep;
+        if (result < 1 || result > size - 2) {
+            result = block - offset * blockStep;
+        }
+        return (result < 1 || result > size - 2) ? block : result;
+    };
+
+    // Each thread accumulates the normal equations of its blocks, which are summed up afterwards.
+    // The matrix only depends on the block weights, so it's the same for both directions and only
+    // its lower triangle is needed
+    double polymatThr[2][maxParams * maxParams] = {}, shiftmatThr[2][2][maxParams] = {};
+    int numbloxThr[2] = {0, 0};
+    // adds a weighted equation basis * params = value to the normal equations
+    const auto addEquation = [numpar](const double *basis, double weight, double value, double *matrix, double *vect) {
+        for (int k = 0; k < numpar; k++) {
+            const double weighted = basis[k] * weight;
+            double *row = matrix + numpar * k;
+            for (int l = 0; l <= k; l++) {
+                row[l] += weighted * basis[l];
+            }
+            vect[k] += weighted * value;
+        }
+    };
+    // the polynomial is fitted in coordinates centred on the block grid, see uncentrePolynomial()
+    const double vCentre = (vblsz - 1) / 2.0, vScale = std::max((vblsz - 3) / 2.0, 1.0);
+    const double hCentre = (hblsz - 1) / 2.0, hScale = std::max((hblsz - 3) / 2.0, 1.0);
+    const RadialGeometry geometry(W, H);
 
-            for(i = k; i < nDim; i++) {
-                pfMatr[j * nDim + i] = pfMatr[j * nDim + i] + fAcc * pfMatr[k * nDim + i];
+#ifdef _OPENMP
+    #pragma omp for schedule(dynamic) nowait
+#endif
+    for (int vblock = 1; vblock < vblsz - 1; vblock += blockStep)
+        for (int hblock = 1; hblock < hblsz - 1; hblock += blockStep) {
+            const int up = neighbour(vblock, -1, vblsz) * hblsz;
+            const int down = neighbour(vblock, 1, vblsz) * hblsz;
+            const int left = neighbour(hblock, -1, hblsz);
+            const int right = neighbour(hblock, 1, hblsz);
+            const float weight = blockwt[vblock * hblsz + hblock];
+            // polynomial: the monomials of the block position, used for both directions
+            // radial: the constant shifts and the radial terms of each direction
+            double basis[2][maxParams];
+            if (radial) {
+                const double dv = vblock - geometry.vCentre;
+                const double dh = hblock - geometry.hCentre;
+                const double r2 = (SQR(dv) + SQR(dh)) / SQR(geometry.scale);
+                basis[0][0] = basis[1][1] = 1.0;
+                basis[0][1] = basis[1][0] = 0.0;
+                double powR2 = 1.0;
+                for (int k = 0; k < polyord; k++) {
+                    basis[0][2 + k] = dv * powR2;
+                    basis[1][2 + k] = dh * powR2;
+                    powR2 *= r2;
+                }
+            } else {
+                double powVblock = 1.0;
+                for (int i = 0; i < polyord; i++) {
+                    double powHblock = powVblock;
+                    for (int j = 0; j < polyord; j++) {
+                        basis[0][polyord * i + j] = powHblock;
+                        powHblock *= (hblock - hCentre) / hScale;
+                    }
+                    powVblock *= (vblock - vCentre) / vScale;
+                }
             }
+            // block 3x3 median of blockshifts for robustness
+            for (int c = 0; c < 2; c ++) {
+                float bstemp[2];
+                for (int dir = 0; dir < 2; dir++) {
+                    //temporary storage for median filter
+                    const std::array<float, 9> p = {
+                        blockshifts[up + left][c][dir],
+                        blockshifts[up + hblock][c][dir],
+                        blockshifts[up + right][c][dir],
+                        blockshifts[vblock * hblsz + left][c][dir],
+                        blockshifts[vblock * hblsz + hblock][c][dir],
+                        blockshifts[vblock * hblsz + right][c][dir],
+                        blockshifts[down + left][c][dir],
+                        blockshifts[down + hblock][c][dir],
+                        blockshifts[down + right][c][dir]
+                    };
+                    bstemp[dir] = median(p);
+                }
 
-            pfVect[j] = pfVect[j] + fAcc * pfVect[k]; // free member recalculation
+                //now prepare coefficient matrix; use only data points within caautostrength/2 std devs of zero
+                if (SQR(bstemp[0]) > 8.f * blockvar[0][c] || SQR(bstemp[1]) > 8.f * blockvar[1][c]) {
+                    continue;
+                }
+
+                numbloxThr[c]++;
+
+                if (radial) {
+                    // both directions share the radial terms, so they form one system
+                    addEquation(basis[0], weight, bstemp[0], polymatThr[c], shiftmatThr[c][0]);
+                    addEquation(basis[1], weight, bstemp[1], polymatThr[c], shiftmatThr[c][0]);
+                } else {
+                    // the matrix is the same for both directions
+                    addEquation(basis[0], weight, bstemp[0], polymatThr[c], shiftmatThr[c][0]);
+                    for (int k = 0; k < numpar; k++) {
+                        shiftmatThr[c][1][k] += basis[0][k] * weight * bstemp[1];
+                    }
+                }
+            }//c
+        }//blocks
+
+#ifdef _OPENMP
+    #pragma omp critical (cafitreduce)
+#endif
+    {
+        for (int c = 0; c < 2; c++) {
+            numblox[c] += numbloxThr[c];
+            for (int i = 0; i < numpar * numpar; i++) {
+                polymat[c][i] += polymatThr[c][i];
+            }
+            for (int i = 0; i < numpar; i++) {
+                shiftmat[c][0][i] += shiftmatThr[c][0][i];
+                shiftmat[c][1][i] += shiftmatThr[c][1][i];
+            }
         }
     }
+#ifdef _OPENMP
+    #pragma omp barrier
+    #pragma omp single
+#endif
+    {
+        numblox[1] = std::min(numblox[0], numblox[1]);
+
+        // lowers the order of the fit by one, the equations of the lower order are part of those of the current one
+        const int minOrder = radial ? 1 : 2;
+        const auto lowerOrder = [&]() {
+            const int lowerOrd = polyord - 1;
+            const int lowerParams = radial ? lowerOrd + 2 : SQR(lowerOrd);
+            const auto index = [&](int k) {
+                return radial ? k : polyord * (k / lowerOrd) + k % lowerOrd;
+            };
+            for (int c = 0; c < 2; c++) {
+                for (int k = 0; k < lowerParams; k++) {
+                    for (int l = 0; l <= k; l++) {
+                        polymat[c][lowerParams * k + l] = polymat[c][numpar * index(k) + index(l)];
+                    }
+                    shiftmat[c][0][k] = shiftmat[c][0][index(k)];
+                    shiftmat[c][1][k] = shiftmat[c][1][index(k)];
+                }
+            }
+            polyord = lowerOrd;
+            numpar = lowerParams;
+        };
+
+        //if too few data points for the number of parameters, the fit follows the noise of the block shifts. Lower the order
+        //until there are at least 3 blocks per parameter (and 32 blocks above the linear order)
+        while (polyord > minOrder && numblox[1] < std::max(32, 3 * numpar)) {
+            lowerOrder();
+        }
+        if (numblox[1] < 10) {
 
-    for(k = (nDim - 1); k >= 0; k--) {
-        pfSolution[k] = pfVect[k];
-
-        for(i = (k + 1); i < nDim; i++) {
-            pfSolution[k] -= (pfMatr[k * nDim + i] * pfSolution[i]);
+            std::cout << "numblox = " << numblox[1] << std::endl;
+            processpasstwo = false;
         }
 
-        pfSolution[k] = pfSolution[k] / pfMatr[k * nDim + k];
-    }
+        //factor the normal equations, if they can't be solved retry with the next lower order
+        double factor[2][maxParams * maxParams];
+        double scale[2][maxParams];
+        while (processpasstwo) {
+            bool factored = true;
+            for (int c = 0; c < 2 && factored; c++) {
+                std::copy(polymat[c], polymat[c] + numpar * numpar, factor[c]);
+                factored = choleskyFactor(numpar, factor[c], scale[c]);
+            }
+            if (factored) {
+                break;
+            } else if (polyord > minOrder) {
+                lowerOrder();
+            } else {
+                std::cout << "CA correction pass failed -- can't solve linear equations" << std::endl;
+                processpasstwo = false;
+            }
+        }
 
-    return true;
-}
-//end of linear equation solver
+        if(processpasstwo)
+
+            //fit parameters to blockshifts
+            for (int c = 0; c < 2; c++) {
+                double solution[maxParams];
+                if (radial) {
+                    choleskySolve(numpar, factor[c], scale[c], shiftmat[c][0], solution);
+                    model.fitParams[c][1][0] = solution[0];
+                    model.fitParams[c][1][1] = solution[1];
+                    std::copy(solution + 2, solution + numpar, model.fitParams[c][0]);
+                } else {
+                    for (int dir = 0; dir < 2; dir++) {
+                        choleskySolve(numpar, factor[c], scale[c], shiftmat[c][dir], solution);
+                        uncentrePolynomial(polyord, solution, vCentre, vScale, hCentre, hScale, model.fitParams[c][dir]);
+                    }
+                }
+            }
 
+        if (processpasstwo) {
+            model.type = fit.type;
+            model.width = W;
+            model.height = H;
+            model.polyOrder = polyord;
+        }
+    }
 }
 
-using namespace std;
-using namespace librtprocess;
-rpError CA_correct(
+TARGET_CLONES
+rpError CA_correct_impl(
+    rpContext *context,
     int winx,
     int winy,
     int winw,
@@ -127,8 +468,14 @@ rpError CA_correct(
     float **rawDataOut,
     const unsigned cfarray[2][2],
     const std::function<bool(double)> &setProgCancel,
-    double fitParams[2][2][16],
-    bool fitParamsIn,
+    rpCAModel &model,
+    bool modelIn,
+    bool detectOnly,
+    int blockStep,
+    int imageTop,
+    int imageHeight,
+    double tolerance,
+    rpCAStats *stats,
     float inputScale,
     float outputScale,
     std::size_t chunkSize,
@@ -144,6 +491,8 @@ rpError CA_correct(
         stop.reset(new StopWatch("CA correction"));
     }
 
+    StageTimer timer(context, "CA_correct");
+
     constexpr int ts = 128;
     constexpr int tsh = ts / 2;
     constexpr int cb = 2; // 2 pixels border will be excluded from correction
@@ -162,11 +511,17 @@ rpError CA_correct(
     std::unique_ptr<JaggedArray<float>> redFactor;
     std::unique_ptr<JaggedArray<float>> blueFactor;
     std::unique_ptr<JaggedArray<float>> oldraw;
-    if (avoidColourshift) {
+    if (avoidColourshift && !detectOnly) {
         redFactor.reset(new JaggedArray<float>((W + 1 - 2 * cb) / 2, (H + 1 - 2 * cb) / 2));
         blueFactor.reset(new JaggedArray<float>((W + 1 - 2 * cb) / 2, (H + 1 - 2 * cb) / 2));
+        if(!*redFactor.get() || !*blueFactor.get()) {
+            return RP_MEMORY_ERROR;
+        }
+    }
+    if (avoidColourshift && !detectOnly && rawDataOut == rawDataIn) {
+        // the colour shift factors compare with the input, which is overwritten when correcting in place
         oldraw.reset(new JaggedArray<float>((W + 1- 2 * cb) / 2, H- 2 * cb));
-        if(!*redFactor.get() || !*blueFactor.get() || !*oldraw.get()) {
+        if(!*oldraw.get()) {
             return RP_MEMORY_ERROR;
         }
         // copy raw values before ca correction
@@ -180,7 +535,7 @@ rpError CA_correct(
         }
     }
 
-    if (rawDataOut && rawDataOut != rawDataIn) {
+    if (!detectOnly && rawDataOut && rawDataOut != rawDataIn) {
         // copy raw values before ca correction
 #ifdef _OPENMP
         #pragma omp parallel for
@@ -192,8 +547,7 @@ rpError CA_correct(
         }
     }
 
-    double progress = 0.0;
-    setProgCancel(progress);
+    setProgCancel(0.0);
 
     const int width = W + (W & 1), height = H;
     constexpr int border = 8;
@@ -204,17 +558,32 @@ rpError CA_correct(
     const int vblsz = ceil((float)(height + border2) / (ts - border2) + 2 + vz1);
     const int hblsz = ceil((float)(width + border2) / (ts - border2) + 2 + hz1);
 
-    //temporary array to store simple interpolation of G
-    std::unique_ptr<float[]> buffer(new (std::nothrow) float[height * width + vblsz * hblsz * (2 * 2 + 1)]);
-
-    float *Gtmp = buffer.get();
-    if (!Gtmp) {
+    // the manual correction is relative to the blocks of the image the window is part of
+    const int imageBlockTop = imageTop / (ts - border2);
+    const int imageVblsz = ceil((float)(imageHeight + border2) / (ts - border2) + 2 + ((imageHeight + border2) % (ts - border2) == 0 ? 1 : 0));
+
+    //temporary array to store simple interpolation of G, not needed when only detecting
+    const std::size_t imageSize = detectOnly ? 0 : static_cast<std::size_t>(height) * width;
+    // with half buffers the interpolated G is stored as half floats in its own array and buffer only holds RawDataTmp
+    const bool halfG = context && context->halfBuffers();
+    const bool halfGF16C = halfG && runtimeF16C();
+    const std::size_t rawDataTmpOffset = halfG ? 0 : (winh * (winw + (winw & 1))) / 2;
+    const std::size_t blockOffset = halfG ? (detectOnly ? 0 : (static_cast<std::size_t>(height) * (winw + (winw & 1))) / 2) : imageSize;
+    std::unique_ptr<float[]> buffer(new (std::nothrow) float[blockOffset + vblsz * hblsz * (2 * 2 + 1)]);
+    std::unique_ptr<uint16_t[]> gtmpHalfBuffer(halfG ? new (std::nothrow) uint16_t[imageSize / 2] : nullptr);
+
+    if (!buffer || (halfG && !gtmpHalfBuffer)) {
         return RP_MEMORY_ERROR;
     }
+    float *Gtmp = buffer.get();
+    uint16_t *GtmpHalf = gtmpHalfBuffer.get();
+    const auto getGtmp = [Gtmp, GtmpHalf, halfG](std::size_t indx) {
+        return halfG ? halfToFloat(GtmpHalf[indx]) : Gtmp[indx];
+    };
 
-    float *RawDataTmp = Gtmp + (winh * (winw + (winw & 1))) / 2;
+    float *RawDataTmp = Gtmp + rawDataTmpOffset;
     //block CA shift values and weight assigned to block
-    float *const blockwt = Gtmp + height * width;
+    float *const blockwt = Gtmp + blockOffset;
     memset(blockwt, 0, vblsz * hblsz * (2 * 2 + 1) * sizeof(float));
     float (*blockshifts)[2][2] = (float (*)[2][2])(blockwt + vblsz * hblsz);
 
@@ -226,7 +595,48 @@ rpError CA_correct(
             ? std::max<size_t>(autoIterations, 1)
             : 1;
 
-    const bool fitParamsSet = fitParamsIn && iterations < 2;
+    const bool fitParamsSet = modelIn && iterations < 2;
+    // without a model the form and order of the model passed in select the fit
+    const rpCAModelType requestedType = model.type;
+    const int requestedOrder = model.polyOrder > 0 ? LIM(model.polyOrder, requestedType == RP_CA_RADIAL ? 1 : 2, RP_CA_MAX_ORDER) : 4;
+    // the detection reads the corrected data of the previous iteration, detectOnly runs one iteration on the input
+    const float * const *detectionData = detectOnly ? rawDataIn : rawDataOut;
+
+    // A model detected on an image of another size is evaluated at the corresponding position of that image
+    // and its shifts are scaled to the size of this image. Blocks are ts - border2 pixels apart.
+    // The window may also be the rows [imageTop, imageTop + H) of an image imageHeight rows high, which the model applies to.
+    const bool rescaleModel = fitParamsSet && (model.width != W || model.height != imageHeight || imageTop != 0);
+    const auto modelBlock = [](int block, int offset, double modelSize, double size) {
+        constexpr double centre = ts / 2 - border;
+        return (((block - 1) * (ts - border2) + centre + offset) * modelSize / size - centre) / (ts - border2) + 1;
+    };
+
+    // the detection pass runs over the padded image, the correction pass over the window
+    const auto numTiles = [](int size) {
+        return std::max((size + border + ts - border2 - 1) / (ts - border2), 0);
+    };
+    // blockStep > 1 (only used for detectOnly, which doesn't need Gtmp) analyses every blockStep-th block in both directions
+    const auto numDetectionTiles = [&](int size) {
+        return (numTiles(size) + blockStep - 1) / blockStep;
+    };
+    const int detectionTiles = autoCA ? numDetectionTiles(height) * numDetectionTiles(width - (W & 1)) : 0;
+    const int tilesWide = numTiles(winw);
+    const int correctionTiles = detectOnly ? 0 : numTiles(winh) * tilesWide;
+    std::vector<float> tileShiftData(correctionTiles * 2 * 2);
+    float (*const tileShifts)[2][2] = reinterpret_cast<float (*)[2][2]>(tileShiftData.data());
+    Progress progress(setProgCancel, iterations * (detectionTiles + correctionTiles));
+
+    // With a tolerance the iterations stop once the rms of the fitted shifts is below it, and blocks whose shift
+    // is within the tolerance are not analysed in the next iteration. Their shift is estimated from the correction
+    // they got and their G interpolation from the last analysis is reused.
+    const bool converge = tolerance > 0.0;
+    std::vector<char> settled(converge ? vblsz * hblsz : 0, 0);
+    // shifts of the blocks in the last iteration and the correction applied to them afterwards
+    std::vector<std::array<float, 4>> lastShifts(converge ? vblsz * hblsz : 0);
+    std::vector<std::array<float, 4>> lastCorrections(converge ? vblsz * hblsz : 0);
+    bool converged = false;
+    double residual = 0.0;
+    std::size_t passes = 0;
 
     rpError rc = RP_NO_ERROR;
     for (size_t it = 0; it < iterations && processpasstwo; ++it) {
@@ -234,9 +644,8 @@ rpError CA_correct(
         float blocksqave[2][2] = {};
         float blockdenom[2][2] = {};
         float blockvar[2][2];
-
-        //order of 2d polynomial fit (polyord), and numpar=polyord^2
-        int polyord = 4, numpar = 16;
+        // normal equations of the fit of the requested form and order
+        CAFit fit(requestedType, requestedOrder);
 
         constexpr float eps = 1e-5f, eps2 = 1e-10f; //tolerance to avoid dividing by zero
 
@@ -245,8 +654,6 @@ rpError CA_correct(
         #pragma omp parallel
 #endif
         {
-            int progresscounter = 0;
-
             //direction of the CA shift in a tile
             int GRBdir[2][3];
 
@@ -259,7 +666,7 @@ rpError CA_correct(
             // assign working space
             constexpr int buffersize = ts * ts + 8 * ts * tsh + 8 * 16;
             constexpr int buffersizePassTwo = ts * ts + 4 * ts * tsh + 4 * 16;
-            std::unique_ptr<float[]> bufferThr(new (std::nothrow) float[(autoCA && !fitParamsSet) ? buffersize : buffersizePassTwo]);
+            std::unique_ptr<float[]> bufferThr(new (std::nothrow) float[autoCA ? buffersize : buffersizePassTwo]);
             float *data = bufferThr.get();
 #ifdef _OPENMP
             #pragma omp critical
@@ -273,6 +680,7 @@ rpError CA_correct(
             #pragma omp barrier
 #endif
             if (!rc) {
+                StageClock clock(timer);
                 // shift the beginning of all arrays but the first by 64 bytes to avoid cache miss conflicts on CPUs which have <= 4-way associative L1-Cache
 
                 //rgb data in a tile
@@ -281,7 +689,8 @@ rpError CA_correct(
                 rgb[1] = data + ts * tsh + 16;
                 rgb[2] = data + ts * ts + ts * tsh + 32;
 
-                if (autoCA && !fitParamsSet) {
+                if (autoCA) {
+                    // with a given model only the interpolated G of this pass is needed, the correction pass reads it from Gtmp
                     //high pass filter for R/B in vertical direction
                     float *rbhpfh  = data + 2 * ts * ts + 48;
                     //high pass filter for R/B in horizontal direction
@@ -307,11 +716,19 @@ rpError CA_correct(
 #ifdef _OPENMP
                     #pragma omp for collapse(2) schedule(dynamic, chunkSize) nowait
 #endif
-                    for (int top = -border ; top < height; top += ts - border2)
-                        for (int left = -border; left < width - (W & 1); left += ts - border2) {
-                            memset(data, 0, buffersize * sizeof(float));
+                    for (int top = -border ; top < height; top += (ts - border2) * blockStep)
+                        for (int left = -border; left < width - (W & 1); left += (ts - border2) * blockStep) {
+                            if (progress.cancelled()) {
+                                continue;
+                            }
                             const int vblock = ((top + border) / (ts - border2)) + 1;
                             const int hblock = ((left + border) / (ts - border2)) + 1;
+                            if (converge && settled[vblock * hblsz + hblock]) {
+                                progress.done();
+                                continue;
+                            }
+                            clock.start();
+                            memset(data, 0, buffersize * sizeof(float));
                             const int bottom = std::min(top + ts, height + border);
                             const int right  = std::min(left + ts, width - (W & 1) + border);
                             const int rr1 = bottom - top;
@@ -325,7 +742,7 @@ rpError CA_correct(
                             // rgb values should be floating point numbers between 0 and 1
                             // after white balance multipliers are applied
 
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                             vfloat cinScalev = F2V(inputScale);
 #endif
 
@@ -333,18 +750,18 @@ rpError CA_correct(
                                 int row = rr + top;
                                 int cc = ccmin;
                                 int col = cc + left;
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                                 int c0 = fc(cfarray, rr, cc);
                                 if(c0 == 1) {
-                                    rgb[c0][rr * ts + cc] = rawDataOut[row][col] / inputScale;
+                                    rgb[c0][rr * ts + cc] = detectionData[row][col] / inputScale;
                                     cc++;
                                     col++;
                                     c0 = fc(cfarray, rr, cc);
                                 }
                                 int indx1 = rr * ts + cc;
                                 for (; cc < ccmax - 7; cc+=8, col+=8, indx1 += 8) {
-                                    vfloat val1 = LVFU(rawDataOut[row][col]) / cinScalev;
-                                    vfloat val2 = LVFU(rawDataOut[row][col + 4]) / cinScalev;
+                                    vfloat val1 = LVFU(detectionData[row][col]) / cinScalev;
+                                    vfloat val2 = LVFU(detectionData[row][col + 4]) / cinScalev;
                                     vfloat nonGreenv = _mm_shuffle_ps(val1,val2,_MM_SHUFFLE( 2,0,2,0 ));
                                     STVFU(rgb[c0][indx1 >> 1], nonGreenv);
                                     STVFU(rgb[1][indx1], val1);
@@ -354,7 +771,7 @@ rpError CA_correct(
                                 for (; cc < ccmax; cc++, col++) {
                                     int c = fc(cfarray, rr, cc);
                                     int indx = rr * ts + cc;
-                                    rgb[c][indx >> ((c & 1) ^ 1)] = rawDataOut[row][col] / inputScale;
+                                    rgb[c][indx >> ((c & 1) ^ 1)] = detectionData[row][col] / inputScale;
                                 }
                             }
 
@@ -371,7 +788,7 @@ rpError CA_correct(
                                 for (int rr = 0; rr < border; rr++)
                                     for (int cc = ccmin; cc < ccmax; cc++) {
                                         int c = fc(cfarray, rr, cc);
-                                        rgb[c][((rrmax + rr)*ts + cc) >> ((c & 1) ^ 1)] = rawDataOut[(height - rr - 2)][left + cc] / inputScale;
+                                        rgb[c][((rrmax + rr)*ts + cc) >> ((c & 1) ^ 1)] = detectionData[(height - rr - 2)][left + cc] / inputScale;
                                     }
                             }
 
@@ -387,7 +804,7 @@ rpError CA_correct(
                                 for (int rr = rrmin; rr < rrmax; rr++)
                                     for (int cc = 0; cc < border; cc++) {
                                         int c = fc(cfarray, rr, cc);
-                                        rgb[c][(rr * ts + ccmax + cc) >> ((c & 1) ^ 1)] = rawDataOut[(top + rr)][(width - cc - 2)] / inputScale;
+                                        rgb[c][(rr * ts + ccmax + cc) >> ((c & 1) ^ 1)] = detectionData[(top + rr)][(width - cc - 2)] / inputScale;
                                     }
                             }
 
@@ -396,7 +813,7 @@ rpError CA_correct(
                                 for (int rr = 0; rr < border; rr++)
                                     for (int cc = 0; cc < border; cc++) {
                                         int c = fc(cfarray, rr, cc);
-                                        rgb[c][(rr * ts + cc) >> ((c & 1) ^ 1)] = rawDataOut[border2 - rr][border2 - cc] / inputScale;
+                                        rgb[c][(rr * ts + cc) >> ((c & 1) ^ 1)] = detectionData[border2 - rr][border2 - cc] / inputScale;
                                     }
                             }
 
@@ -404,7 +821,7 @@ rpError CA_correct(
                                 for (int rr = 0; rr < border; rr++)
                                     for (int cc = 0; cc < border; cc++) {
                                         int c = fc(cfarray, rr, cc);
-                                        rgb[c][((rrmax + rr)*ts + ccmax + cc) >> ((c & 1) ^ 1)] = rawDataOut[(height - rr - 2)][(width - cc - 2)] / inputScale;
+                                        rgb[c][((rrmax + rr)*ts + ccmax + cc) >> ((c & 1) ^ 1)] = detectionData[(height - rr - 2)][(width - cc - 2)] / inputScale;
                                     }
                             }
 
@@ -412,7 +829,7 @@ rpError CA_correct(
                                 for (int rr = 0; rr < border; rr++)
                                     for (int cc = 0; cc < border; cc++) {
                                         int c = fc(cfarray, rr, cc);
-                                        rgb[c][(rr * ts + ccmax + cc) >> ((c & 1) ^ 1)] = rawDataOut[(border2 - rr)][(width - cc - 2)] / inputScale;
+                                        rgb[c][(rr * ts + ccmax + cc) >> ((c & 1) ^ 1)] = detectionData[(border2 - rr)][(width - cc - 2)] / inputScale;
                                     }
                             }
 
@@ -420,7 +837,7 @@ rpError CA_correct(
                                 for (int rr = 0; rr < border; rr++)
                                     for (int cc = 0; cc < border; cc++) {
                                         int c = fc(cfarray, rr, cc);
-                                        rgb[c][((rrmax + rr)*ts + cc) >> ((c & 1) ^ 1)] = rawDataOut[(height - rr - 2)][(border2 - cc)] / inputScale;
+                                        rgb[c][((rrmax + rr)*ts + cc) >> ((c & 1) ^ 1)] = detectionData[(height - rr - 2)][(border2 - cc)] / inputScale;
                                     }
                             }
 
@@ -428,7 +845,7 @@ rpError CA_correct(
                             //end of initialization
 
 
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                             vfloat onev = F2V(1.f);
                             vfloat epsv = F2V(eps);
 #endif
@@ -437,7 +854,7 @@ rpError CA_correct(
                                 int cc = 3 + (fc(cfarray, rr,3) & 1);
                                 int indx = rr * ts + cc;
                                 int c = fc(cfarray, rr,cc);
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                                 for (; cc < cc1 - 9; cc+=8, indx+=8) {
                                     //compute directional weights using image gradients
                                     vfloat rgb1mv1v = LC2VFU(rgb[1][indx - v1]);
@@ -469,30 +886,46 @@ rpError CA_correct(
                                     rgb[1][indx] = (wtu * rgb[1][indx - v1] + wtd * rgb[1][indx + v1] + wtl * rgb[1][indx - 1] + wtr * rgb[1][indx + 1]) / (wtu + wtd + wtl + wtr);
                                 }
 
-                                if (row > -1 && row < height) {
+                                if (!detectOnly && row > -1 && row < height) {
                                     int offset = (fc(cfarray, row,std::max(left + 3, 0)) & 1);
                                     int col = std::max(left + 3, 0) + offset;
                                     int indx1 = rr * ts + 3 - (left < 0 ? (left+3) : 0) + offset;
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                                     for(; col < std::min(cc1 + left - 3, width) - 7; col+=8, indx1+=8) {
-                                        STVFU(Gtmp[(row * width + col) >> 1], LC2VFU(rgb[1][indx1]));
+                                        if (halfGF16C) {
+                                            STVFH<true>(GtmpHalf[(row * width + col) >> 1], LC2VFU(rgb[1][indx1]));
+                                        } else if (halfG) {
+                                            STVFH(GtmpHalf[(row * width + col) >> 1], LC2VFU(rgb[1][indx1]));
+                                        } else {
+                                            STVFU(Gtmp[(row * width + col) >> 1], LC2VFU(rgb[1][indx1]));
+                                        }
                                     }
 #endif
                                     for(; col < std::min(cc1 + left - 3, width); col+=2, indx1+=2) {
-                                        Gtmp[(row * width + col) >> 1] = rgb[1][indx1];
+                                        if (halfG) {
+                                            GtmpHalf[(row * width + col) >> 1] = floatToHalf(rgb[1][indx1]);
+                                        } else {
+                                            Gtmp[(row * width + col) >> 1] = rgb[1][indx1];
+                                        }
                                     }
                                 }
 
                             }
 
-#ifdef __SSE2__
+                            if (fitParamsSet) {
+                                clock.lap("detection");
+                                progress.done();
+                                continue;
+                            }
+
+#ifdef RT_VECTOR
                             vfloat zd25v = F2V(0.25f);
 #endif
                             for (int rr = 4; rr < rr1 - 4; rr++) {
                                 int cc = 4 + (fc(cfarray, rr, 2) & 1);
                                 int indx = rr * ts + cc;
                                 int c = fc(cfarray, rr, cc);
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                                 for (; cc < cc1 - 10; cc += 8, indx += 8) {
                                     vfloat rgb1v = LC2VFU(rgb[1][indx]);
                                     vfloat rgbcv = LVFU(rgb[c][indx >> 1]);
@@ -547,7 +980,7 @@ rpError CA_correct(
                                 }
                             }
 
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                             vfloat zd3v = F2V(0.3f);
                             vfloat zd1v = F2V(0.1f);
                             vfloat zd5v = F2V(0.5f);
@@ -559,7 +992,7 @@ rpError CA_correct(
                                 int cc = 8 + (fc(cfarray, rr, 2) & 1);
                                 int indx = rr * ts + cc;
                                 int c = fc(cfarray, rr, cc);
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                                 vfloat coeff00v = ZEROV;
                                 vfloat coeff01v = ZEROV;
                                 vfloat coeff02v = ZEROV;
@@ -674,28 +1107,15 @@ rpError CA_correct(
                                 }//vert/hor
                             }//colour
 
-                            progresscounter++;
-
-                            if(progresscounter % 8 == 0)
-#ifdef _OPENMP
-                                #pragma omp critical (cadetectpass1)
-#endif
-                            {
-                                progress += (double)(8.0 * (ts - border2) * (ts - border2)) / (2 * height * width);
-
-                                if (progress > 1.0) {
-                                    progress = 1.0;
-                                }
-                                setProgCancel(progress);
-                            }
-
+                            clock.lap("detection");
+                            progress.done();
                         }
 
                     //end of diagnostic pass
 #ifdef _OPENMP
                     #pragma omp critical (cadetectpass2)
 #endif
-                    {
+                    if (!fitParamsSet) {
                         for (int dir = 0; dir < 2; dir++)
                             for (int c = 0; c < 2; c++) {
                                 blockdenom[dir][c] += blockdenomthr[dir][c];
@@ -705,142 +1125,137 @@ rpError CA_correct(
                     }
 #ifdef _OPENMP
                     #pragma omp barrier
-
-                    #pragma omp single
 #endif
-                    {
-                        for (int dir = 0; dir < 2; dir++)
-                            for (int c = 0; c < 2; c++) {
-                                if (blockdenom[dir][c]) {
-                                    blockvar[dir][c] = blocksqave[dir][c] / blockdenom[dir][c] - SQR(blockave[dir][c] / blockdenom[dir][c]);
-                                } else {
-                                    processpasstwo = false;
-                                    std::cout << "blockdenom vanishes" << std::endl;
-                                    break;
+                    if (!fitParamsSet) {
+                        StageClock fitClock(timer);
+#ifdef _OPENMP
+                        #pragma omp single
+#endif
+                        {
+                            if (converge && it > 0) {
+                                // A correction pass removes only a part of the shift. The part is measured on the analysed blocks and
+                                // the estimated shifts of the settled blocks are reduced by the same part of their correction.
+                                double removed = 0.0, applied = 0.0;
+                                for (int block = 0; block < vblsz * hblsz; block++) {
+                                    if (!settled[block] && blockwt[block] > 0.f) {
+                                        for (int i = 0; i < 4; i++) {
+                                            const float shift = blockshifts[block][i >> 1][i & 1];
+                                            if (fabsf(shift) < 2.0f && fabsf(lastShifts[block][i]) < 2.0f) {
+                                                removed += (lastShifts[block][i] - shift) * lastCorrections[block][i];
+                                                applied += SQR(lastCorrections[block][i]);
+                                            }
+                                        }
+                                    }
                                 }
-                            }
-
-                        //now prepare for CA correction pass
-                        //first, fill border blocks of blockshift array
-                        if(processpasstwo) {
-                            for (int vblock = 1; vblock < vblsz - 1; vblock++) { //left and right sides
-                                for (int c = 0; c < 2; c++) {
-                                    for (int i = 0; i < 2; i++) {
-                                        blockshifts[vblock * hblsz][c][i] = blockshifts[(vblock) * hblsz + 2][c][i];
-                                        blockshifts[vblock * hblsz + hblsz - 1][c][i] = blockshifts[(vblock) * hblsz + hblsz - 3][c][i];
+                                const float gain = applied > 0.0 ? LIM(removed / applied, 0.0, 1.0) : 1.f;
+                                for (int block = 0; block < vblsz * hblsz; block++) {
+                                    if (settled[block] && blockwt[block] > 0.f) {
+                                        for (int i = 0; i < 4; i++) {
+                                            float &shift = blockshifts[block][i >> 1][i & 1];
+                                            shift -= gain * lastCorrections[block][i];
+                                            if (fabsf(shift) < 2.0f) {
+                                                blockave[i & 1][i >> 1] += shift;
+                                                blocksqave[i & 1][i >> 1] += SQR(shift);
+                                                blockdenom[i & 1][i >> 1] += 1;
+                                            }
+                                        }
                                     }
                                 }
                             }
-
-                            for (int hblock = 0; hblock < hblsz; hblock++) { //top and bottom sides
+                            for (int dir = 0; dir < 2; dir++)
                                 for (int c = 0; c < 2; c++) {
-                                    for (int i = 0; i < 2; i++) {
-                                        blockshifts[hblock][c][i] = blockshifts[2 * hblsz + hblock][c][i];
-                                        blockshifts[(vblsz - 1)*hblsz + hblock][c][i] = blockshifts[(vblsz - 3) * hblsz + hblock][c][i];
+                                    if (blockdenom[dir][c]) {
+                                        blockvar[dir][c] = blocksqave[dir][c] / blockdenom[dir][c] - SQR(blockave[dir][c] / blockdenom[dir][c]);
+                                    } else {
+                                        processpasstwo = false;
+                                        std::cout << "blockdenom vanishes" << std::endl;
+                                        break;
                                     }
                                 }
-                            }
-
-                            //end of filling border pixels of blockshift array
-
-                            //initialize fit arrays
-                            double polymat[2][2][256], shiftmat[2][2][16];
-
-                            for (int i = 0; i < 256; i++) {
-                                polymat[0][0][i] = polymat[0][1][i] = polymat[1][0][i] = polymat[1][1][i] = 0;
-                            }
-
-                            for (int i = 0; i < 16; i++) {
-                                shiftmat[0][0][i] = shiftmat[0][1][i] = shiftmat[1][0][i] = shiftmat[1][1][i] = 0;
-                            }
+                        }
 
-                            int numblox[2] = {0, 0};
-
-                            for (int vblock = 1; vblock < vblsz - 1; vblock++)
-                                for (int hblock = 1; hblock < hblsz - 1; hblock++) {
-                                    // block 3x3 median of blockshifts for robustness
-                                    for (int c = 0; c < 2; c ++) {
-                                        float bstemp[2];
-                                        for (int dir = 0; dir < 2; dir++) {
-                                            //temporary storage for median filter
-                                            const std::array<float, 9> p = {
-                                                blockshifts[(vblock - 1) * hblsz + hblock - 1][c][dir],
-                                                blockshifts[(vblock - 1) * hblsz + hblock][c][dir],
-                                                blockshifts[(vblock - 1) * hblsz + hblock + 1][c][dir],
-                                                blockshifts[(vblock) * hblsz + hblock - 1][c][dir],
-                                                blockshifts[(vblock) * hblsz + hblock][c][dir],
-                                                blockshifts[(vblock) * hblsz + hblock + 1][c][dir],
-                                                blockshifts[(vblock + 1) * hblsz + hblock - 1][c][dir],
-                                                blockshifts[(vblock + 1) * hblsz + hblock][c][dir],
-                                                blockshifts[(vblock + 1) * hblsz + hblock + 1][c][dir]
-                                            };
-                                            bstemp[dir] = median(p);
-                                        }
+                        //now prepare for CA correction pass
+                        if(processpasstwo) {
+                            fitBlockShifts(fit, blockwt, blockshifts, blockvar, vblsz, hblsz, blockStep, W, H, model, processpasstwo);
+                        }
 
-                                        //now prepare coefficient matrix; use only data points within caautostrength/2 std devs of zero
-                                        if (SQR(bstemp[0]) > 8.f * blockvar[0][c] || SQR(bstemp[1]) > 8.f * blockvar[1][c]) {
-                                            continue;
+                        if (processpasstwo && converge) {
+#ifdef _OPENMP
+                            #pragma omp single
+#endif
+                            {
+                                // The rms of the correction over the blocks with data decides about convergence. Blocks whose
+                                // shift is within the tolerance are settled and not analysed in the next iteration.
+                                double sum = 0.0;
+                                int count = 0;
+                                for (int vblock = 1; vblock < vblsz - 1; vblock++) {
+                                    for (int hblock = 1; hblock < hblsz - 1; hblock++) {
+                                        const int block = vblock * hblsz + hblock;
+                                        float shifts[2][2];
+                                        modelShifts(model, vblock, hblock, shifts);
+                                        bool withinTolerance = true;
+                                        for (int i = 0; i < 4; i++) {
+                                            const float correction = LIM(shifts[i >> 1][i & 1], -3.99f, 3.99f);
+                                            lastShifts[block][i] = blockshifts[block][i >> 1][i & 1];
+                                            lastCorrections[block][i] = correction;
+                                            withinTolerance = withinTolerance && fabsf(lastShifts[block][i]) < tolerance;
+                                            if (blockwt[block] > 0.f) {
+                                                sum += SQR(correction);
+                                                ++count;
+                                            }
                                         }
-
-                                        numblox[c]++;
-
-                                        for (int dir = 0; dir < 2; dir++) {
-                                            double powVblockInit = 1.0;
-                                            for (int i = 0; i < polyord; i++) {
-                                                double powHblockInit = 1.0;
-                                                for (int j = 0; j < polyord; j++) {
-                                                    double powVblock = powVblockInit;
-                                                    for (int m = 0; m < polyord; m++) {
-                                                        double powHblock = powHblockInit;
-                                                        for (int n = 0; n < polyord; n++) {
-                                                            polymat[c][dir][numpar * (polyord * i + j) + (polyord * m + n)] += powVblock * powHblock * blockwt[vblock * hblsz + hblock];
-                                                            powHblock *= hblock;
-                                                        }
-                                                        powVblock *= vblock;
-                                                    }
-                                                    shiftmat[c][dir][(polyord * i + j)] += powVblockInit * powHblockInit * bstemp[dir] * blockwt[vblock * hblsz + hblock];
-                                                    powHblockInit *= hblock;
-                                                }
-                                                powVblockInit *= vblock;
-                                            }//monomials
-                                        }//dir
-                                    }//c
-                                }//blocks
-
-                            numblox[1] = std::min(numblox[0], numblox[1]);
-
-                            //if too few data points, restrict the order of the fit to linear
-                            if (numblox[1] < 32) {
-                                polyord = 2;
-                                numpar = 4;
-
-                                if (numblox[1] < 10) {
-
-                                    std::cout << "numblox = " << numblox[1] << std::endl;
-                                    processpasstwo = false;
+                                        // blocks without data will have none in the next iteration either
+                                        settled[block] = withinTolerance || blockwt[block] <= 0.f;
+                                    }
                                 }
+                                residual = count ? sqrt(sum / count) : 0.0;
+                                converged = residual < tolerance;
                             }
-
-                            if(processpasstwo)
-
-                                //fit parameters to blockshifts
-                                for (int c = 0; c < 2; c++)
-                                    for (int dir = 0; dir < 2; dir++) {
-                                        if (!LinEqSolve(numpar, polymat[c][dir], shiftmat[c][dir], fitParams[c][dir])) {
-                                            std::cout << "CA correction pass failed -- can't solve linear equations for colour %d direction " << c << std::endl;
-                                            processpasstwo = false;
-                                        }
-                                    }
                         }
 
                         //fitparams[polyord*i+j] gives the coefficients of (vblock^i hblock^j) in a polynomial fit for i,j<=4
+                        fitClock.lap("fit");
                     }
                     //end of initialization for CA correction pass
                     //only executed if autoCA is true
                 }
 
                 // Main algorithm: Tile loop
-                if(processpasstwo) {
+                if(processpasstwo && !detectOnly && !converged) {
+                    // the CA shifts of all tiles are evaluated before the pass
+#ifdef _OPENMP
+                    #pragma omp for
+#endif
+                    for (int tile = 0; tile < correctionTiles; tile++) {
+                        const int vblock = (winy + (tile / tilesWide) * (ts - border2)) / (ts - border2) + 1;
+                        const int hblock = (winx + (tile % tilesWide) * (ts - border2)) / (ts - border2) + 1;
+                        float (&lblockshifts)[2][2] = tileShifts[tile];
+                        if (!autoCA) {
+                            float hfrac = -((float)(hblock - 0.5) / (hblsz - 2) - 0.5);
+                            float vfrac = -((float)(vblock + imageBlockTop - 0.5) / (imageVblsz - 2) - 0.5) * imageHeight / width;
+                            lblockshifts[0][0] = 2 * vfrac * cared;
+                            lblockshifts[0][1] = 2 * hfrac * cared;
+                            lblockshifts[1][0] = 2 * vfrac * cablue;
+                            lblockshifts[1][1] = 2 * hfrac * cablue;
+                        } else {
+                            //CA auto correction; use CA diagnostic pass to set shift parameters
+                            const double vpos = rescaleModel ? modelBlock(vblock, imageTop, model.height, imageHeight) : vblock;
+                            const double hpos = rescaleModel ? modelBlock(hblock, 0, model.width, W) : hblock;
+                            modelShifts(model, vpos, hpos, lblockshifts);
+                            if (rescaleModel) {
+                                for (int c = 0; c < 2; ++c) {
+                                    lblockshifts[c][0] *= static_cast<double>(imageHeight) / model.height;
+                                    lblockshifts[c][1] *= static_cast<double>(W) / model.width;
+                                }
+                            }
+                            constexpr float bslim = 3.99; //max allowed CA shift
+                            lblockshifts[0][0] = LIM(lblockshifts[0][0], -bslim, bslim);
+                            lblockshifts[0][1] = LIM(lblockshifts[0][1], -bslim, bslim);
+                            lblockshifts[1][0] = LIM(lblockshifts[1][0], -bslim, bslim);
+                            lblockshifts[1][1] = LIM(lblockshifts[1][1], -bslim, bslim);
+                        }
+                    }
+
                     float *grbdiff = data + 2 * ts * ts + 48; // there is no overlap in buffer usage => share
                     //green interpolated to optical sample points for R/B
                     float *gshift  = data + 2 * ts * ts + ts * tsh + 64; // there is no overlap in buffer usage => share
@@ -849,10 +1264,12 @@ rpError CA_correct(
 #endif
                     for (int top = winy-border; top < winy+winh; top += ts - border2)
                       for (int left = winx-border; left < winx+winw; left += ts - border2) {
+                            if (progress.cancelled()) {
+                                continue;
+                            }
+                            clock.start();
                             memset(data, 0, buffersizePassTwo * sizeof(float));
-                            float lblockshifts[2][2];
-                            const int vblock = ((top + border) / (ts - border2)) + 1;
-                            const int hblock = ((left + border) / (ts - border2)) + 1;
+                            const float (&lblockshifts)[2][2] = tileShifts[((top - winy + border) / (ts - border2)) * tilesWide + (left - winx + border) / (ts - border2)];
                             const int bottom = std::min(top + ts, winy + winh + border);
                             const int right  = std::min(left + ts, winx + winw + border);
                             const int rr1 = bottom - top;
@@ -867,7 +1284,7 @@ rpError CA_correct(
                             // rgb values should be floating point number between 0 and 1
                             // after white balance multipliers are applied
 
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                             vfloat cinscalev = F2V(inputScale);
                             vmask gmask = _mm_set_epi32(0, 0xffffffff, 0, 0xffffffff);
 #endif
@@ -877,7 +1294,7 @@ rpError CA_correct(
                                 int col = cc + left;
                                 int indx = row * width + col;
                                 int indx1 = rr * ts + cc;
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                                 int c = fc(cfarray, rr, cc);
                                 if(c & 1) {
                                     rgb[1][indx1] = rawDataOut[row][col] / inputScale;
@@ -891,7 +1308,7 @@ rpError CA_correct(
                                     vfloat val1v = LVFU(rawDataOut[row][col]) / cinscalev;
                                     vfloat val2v = LVFU(rawDataOut[row][col + 4]) / cinscalev;
                                     STVFU(rgb[c][indx1 >> 1], _mm_shuffle_ps(val1v, val2v, _MM_SHUFFLE(2, 0, 2, 0)));
-                                    vfloat gtmpv = LVFU(Gtmp[indx >> 1]);
+                                    vfloat gtmpv = halfGF16C ? LVFH<true>(GtmpHalf[indx >> 1]) : halfG ? LVFH(GtmpHalf[indx >> 1]) : LVFU(Gtmp[indx >> 1]);
                                     STVFU(rgb[1][indx1], vself(gmask, PERMUTEPS(gtmpv, _MM_SHUFFLE(1, 1, 0, 0)), val1v));
                                     STVFU(rgb[1][indx1 + 4], vself(gmask, PERMUTEPS(gtmpv, _MM_SHUFFLE(3, 3, 2, 2)), val2v));
                                 }
@@ -901,7 +1318,7 @@ rpError CA_correct(
                                     rgb[cl][indx1 >> ((cl & 1) ^ 1)] = rawDataOut[row][col] / inputScale;
 
                                     if ((cl & 1) == 0) {
-                                        rgb[1][indx1] = Gtmp[indx >> 1];
+                                        rgb[1][indx1] = getGtmp(indx >> 1);
                                     }
                                 }
                             }
@@ -922,7 +1339,7 @@ rpError CA_correct(
                                         int c = fc(cfarray, rr, cc);
                                         rgb[c][((rrmax + rr)*ts + cc) >> ((c & 1) ^ 1)] = (rawDataOut[(height - rr - 2)][left + cc]) / inputScale;
                                         if ((c & 1) == 0) {
-                                            rgb[1][(rrmax + rr)*ts + cc] = Gtmp[((height - rr - 2) * width + left + cc) >> 1];
+                                            rgb[1][(rrmax + rr)*ts + cc] = getGtmp(((height - rr - 2) * width + left + cc) >> 1);
                                         }
                                     }
                             }
@@ -942,7 +1359,7 @@ rpError CA_correct(
                                         int c = fc(cfarray, rr, cc);
                                         rgb[c][(rr * ts + ccmax + cc) >> ((c & 1) ^ 1)] = (rawDataOut[(top + rr)][(width - cc - 2)]) / inputScale;
                                         if ((c & 1) == 0) {
-                                            rgb[1][rr * ts + ccmax + cc] = Gtmp[((top + rr) * width + (width - cc - 2)) >> 1];
+                                            rgb[1][rr * ts + ccmax + cc] = getGtmp(((top + rr) * width + (width - cc - 2)) >> 1);
                                         }
                                     }
                             }
@@ -954,7 +1371,7 @@ rpError CA_correct(
                                         int c = fc(cfarray, rr, cc);
                                         rgb[c][(rr * ts + cc) >> ((c & 1) ^ 1)] = (rawDataOut[border2 - rr][border2 - cc]) / inputScale;
                                         if ((c & 1) == 0) {
-                                            rgb[1][rr * ts + cc] = Gtmp[((border2 - rr) * width + border2 - cc) >> 1];
+                                            rgb[1][rr * ts + cc] = getGtmp(((border2 - rr) * width + border2 - cc) >> 1);
                                         }
                                     }
                             }
@@ -965,7 +1382,7 @@ rpError CA_correct(
                                         int c = fc(cfarray, rr, cc);
                                         rgb[c][((rrmax + rr)*ts + ccmax + cc) >> ((c & 1) ^ 1)] = (rawDataOut[(height - rr - 2)][(width - cc - 2)]) / inputScale;
                                         if ((c & 1) == 0) {
-                                            rgb[1][(rrmax + rr)*ts + ccmax + cc] = Gtmp[((height - rr - 2) * width + (width - cc - 2)) >> 1];
+                                            rgb[1][(rrmax + rr)*ts + ccmax + cc] = getGtmp(((height - rr - 2) * width + (width - cc - 2)) >> 1);
                                         }
                                     }
                             }
@@ -976,7 +1393,7 @@ rpError CA_correct(
                                         int c = fc(cfarray, rr, cc);
                                         rgb[c][(rr * ts + ccmax + cc) >> ((c & 1) ^ 1)] = (rawDataOut[(border2 - rr)][(width - cc - 2)]) / inputScale;
                                         if ((c & 1) == 0) {
-                                            rgb[1][rr * ts + ccmax + cc] = Gtmp[((border2 - rr) * width + (width - cc - 2)) >> 1];
+                                            rgb[1][rr * ts + ccmax + cc] = getGtmp(((border2 - rr) * width + (width - cc - 2)) >> 1);
                                         }
                                     }
                             }
@@ -987,15 +1404,15 @@ rpError CA_correct(
                                         int c = fc(cfarray, rr, cc);
                                         rgb[c][((rrmax + rr)*ts + cc) >> ((c & 1) ^ 1)] = (rawDataOut[(height - rr - 2)][(border2 - cc)]) / inputScale;
                                         if ((c & 1) == 0) {
-                                            rgb[1][(rrmax + rr)*ts + cc] = Gtmp[((height - rr - 2) * width + (border2 - cc)) >> 1];
+                                            rgb[1][(rrmax + rr)*ts + cc] = getGtmp(((height - rr - 2) * width + (border2 - cc)) >> 1);
                                         }
                                     }
                             }
 
                             //end of border fill
 
-                            if (!autoCA || fitParamsSet) {
-#ifdef __SSE2__
+                            if (!autoCA) {
+#ifdef RT_VECTOR
                                 const vfloat onev = F2V(1.f);
                                 const vfloat epsv = F2V(eps);
 #endif
@@ -1003,7 +1420,7 @@ rpError CA_correct(
                                 //manual CA correction; use red/blue slider values to set CA shift parameters
                                 for (int rr = 3; rr < rr1 - 3; rr++) {
                                     int cc = 3 + fc(cfarray, rr, 1), c = fc(cfarray, rr,cc), indx = rr * ts + cc;
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                                     for (; cc < cc1 - 10; cc += 8, indx += 8) {
                                         //compute directional weights using image gradients
                                         vfloat val1v = epsv + vabsf(LC2VFU(rgb[1][(rr + 1) * ts + cc]) - LC2VFU(rgb[1][(rr - 1) * ts + cc]));
@@ -1030,35 +1447,6 @@ rpError CA_correct(
                                     }
                                 }
                             }
-                            if (!autoCA) {
-                                float hfrac = -((float)(hblock - 0.5) / (hblsz - 2) - 0.5);
-                                float vfrac = -((float)(vblock - 0.5) / (vblsz - 2) - 0.5) * height / width;
-                                lblockshifts[0][0] = 2 * vfrac * cared;
-                                lblockshifts[0][1] = 2 * hfrac * cared;
-                                lblockshifts[1][0] = 2 * vfrac * cablue;
-                                lblockshifts[1][1] = 2 * hfrac * cablue;
-                            } else {
-                                //CA auto correction; use CA diagnostic pass to set shift parameters
-                                lblockshifts[0][0] = lblockshifts[0][1] = 0;
-                                lblockshifts[1][0] = lblockshifts[1][1] = 0;
-                                double powVblock = 1.0;
-                                for (int i = 0; i < polyord; i++) {
-                                    double powHblock = powVblock;
-                                    for (int j = 0; j < polyord; j++) {
-                                        lblockshifts[0][0] += powHblock * fitParams[0][0][polyord * i + j];
-                                        lblockshifts[0][1] += powHblock * fitParams[0][1][polyord * i + j];
-                                        lblockshifts[1][0] += powHblock * fitParams[1][0][polyord * i + j];
-                                        lblockshifts[1][1] += powHblock * fitParams[1][1][polyord * i + j];
-                                        powHblock *= hblock;
-                                    }
-                                    powVblock *= vblock;
-                                }
-                                constexpr float bslim = 3.99; //max allowed CA shift
-                                lblockshifts[0][0] = LIM(lblockshifts[0][0], -bslim, bslim);
-                                lblockshifts[0][1] = LIM(lblockshifts[0][1], -bslim, bslim);
-                                lblockshifts[1][0] = LIM(lblockshifts[1][0], -bslim, bslim);
-                                lblockshifts[1][1] = LIM(lblockshifts[1][1], -bslim, bslim);
-                            }//end of setting CA shift parameters
 
 
                             for (int c = 0; c < 3; c += 2) {
@@ -1092,7 +1480,7 @@ rpError CA_correct(
                                 int indxff = (rr + shiftvfloor[c]) * ts + cc + shifthfloor[c];
                                 int indxcc = (rr + shiftvceil[c]) * ts + cc + shifthceil[c];
                                 int indxcf = (rr + shiftvceil[c]) * ts + cc + shifthfloor[c];
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                                 vfloat shifthfracv = F2V(shifthfrac[c]);
                                 vfloat shiftvfracv = F2V(shiftvfrac[c]);
                                 for (; cc < cc1 - 10; cc += 8, indxfc += 8, indxff += 8, indxcc += 8, indxcf += 8, indx += 4) {
@@ -1128,7 +1516,7 @@ rpError CA_correct(
                             shiftvfrac[0] /= 2.f;
                             shiftvfrac[2] /= 2.f;
 
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                             vfloat zd25v = F2V(0.25f);
                             vfloat onev = F2V(1.f);
                             vfloat zd5v = F2V(0.5f);
@@ -1139,7 +1527,7 @@ rpError CA_correct(
                                 int c = fc(cfarray, rr, cc);
                                 int GRBdir0 = GRBdir[0][c];
                                 int GRBdir1 = GRBdir[1][c];
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                                 vfloat shifthfracc = F2V(shifthfrac[c]);
                                 vfloat shiftvfracc = F2V(shiftvfrac[c]);
                                 for (int indx = rr * ts + cc; cc < cc1 - 14; cc += 8, indx += 8) {
@@ -1213,7 +1601,7 @@ rpError CA_correct(
                                 }
                             }
 
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                             vfloat coutScalev = F2V(outputScale);
 #endif
                             // copy CA corrected results to temporary image matrix
@@ -1223,7 +1611,7 @@ rpError CA_correct(
                                 int cc = border + (fc(cfarray, rr, 2) & 1);
                                 int indx = ((row-winy) * (winw + (winw & 1)) + cc + left - winx) >> 1;
                                 int indx1 = (rr * ts + cc) >> 1;
-#ifdef __SSE2__
+#ifdef RT_VECTOR
                                 for (; indx < ((row-winy) * (winw + (winw & 1)) + cc1 - border - 7 + left - winx) >> 1; indx+=4, indx1 += 4) {
                                     STVFU(RawDataTmp[indx], coutScalev * LVFU(rgb[c][indx1]));
                                 }
@@ -1233,129 +1621,778 @@ rpError CA_correct(
                                 }
                             }
 
-                            progresscounter++;
+                            clock.lap("correction");
+                            progress.done();
+                        }
 
-                            if(progresscounter % 8 == 0)
 #ifdef _OPENMP
-                                #pragma omp critical (cacorrect)
+                    #pragma omp barrier
+#endif
+                    // copy temporary image matrix back to image matrix unless the pass was cancelled.
+                    // After the barrier all threads agree on cancelled()
+                    if (!progress.cancelled()) {
+#ifdef RT_VECTOR
+                        const vfloat onev = F2V(1.f);
+                        const vfloat twov = F2V(2.f);
+                        const vfloat zd5v = F2V(0.5f);
+#endif
+#ifdef _OPENMP
+                        #pragma omp for
 #endif
-                            {
-                                progress += (double)(8.0 * (ts - border2) * (ts - border2)) / (2 * height * width);
 
-                                if (progress > 1.0) {
-                                    progress = 1.0;
+                        for(int row = cb; row < winh - cb; row++) {
+                            int col = cb + (fc(cfarray, row + winy, winx) & 1);
+                            int indx = (row * (winw + (winw & 1)) + col) >> 1;
+#ifdef RT_VECTOR
+                            for (; col < (winw + (winw & 1)) - 7 - cb; col += 8, indx += 4) {
+                                vfloat val = LVFU(RawDataTmp[indx]);
+                                STC2VFU(rawDataOut[row + winy][col + winx], val);
+                            }
+#endif
+                            for (; col < (winw + (winw & 1)) - cb; col += 2, indx++) {
+                                rawDataOut[row + winy][col + winx] = RawDataTmp[indx];
+                            }
+
+                            // odd height => the factors of one channel are not set in the last row, both channels use the
+                            // values of the preceding row there
+                            const int i = row - cb;
+                            if (avoidColourshift && !(H % 2 && i == H - 2 * cb - 1)) {
+                                // to avoid or at least reduce the colour shift caused by raw ca correction we compute the per pixel
+                                // difference factors of red and blue channel while the row is in cache, blur them and apply the
+                                // result on the result of raw ca correction
+                                const int firstCol = fc(cfarray, row + winy, winx) & 1;
+                                JaggedArray<float>* nonGreen = fc(cfarray, row + winy, winx + firstCol) == 0 ? redFactor.get() : blueFactor.get();
+                                float *factors = (*nonGreen)[i / 2];
+                                // the values before ca correction
+                                const float *oldvals = oldraw ? (*oldraw)[i] : rawDataIn[row + winy] + winx + cb;
+                                const float *newvals = rawDataOut[row + winy] + winx + cb;
+                                int j = firstCol;
+#ifdef RT_VECTOR
+                                for (; j < W - 7 - 2 * cb; j += 8) {
+                                    const vfloat newv = LC2VFU(newvals[j]);
+                                    const vfloat oldv = oldraw ? LVFU(oldvals[j / 2]) : LC2VFU(oldvals[j]);
+                                    vfloat factorv = oldv / newv;
+                                    factorv = vself(vmaskf_le(newv, onev), onev, factorv);
+                                    factorv = vself(vmaskf_le(oldv, onev), onev, factorv);
+                                    STVFU(factors[j / 2], LIMV(factorv, zd5v, twov));
+                                }
+#endif
+                                for (; j < W - 2 * cb; j += 2) {
+                                    const float oldval = oldraw ? oldvals[j / 2] : oldvals[j];
+                                    factors[j / 2] = (newvals[j] <= 1.f || oldval <= 1.f) ? 1.f : LIM(oldval / newvals[j], 0.5f, 2.f);
+                                }
+                                if (W % 2 && firstCol) {
+                                    // odd width => factors for one channel are not set in last column => use value of preceding column
+                                    factors[(W - 2 * cb + 1) / 2 - 1] = factors[(W - 2 * cb + 1) / 2 - 2];
+                                }
+                                if (H % 2 && i >= H - 2 * cb - 3) {
+                                    std::copy(factors, factors + (W + 1 - 2 * cb) / 2, (*nonGreen)[(H - 2 * cb + 1) / 2 - 1]);
                                 }
+                            }
+                        }
+
+                        if (avoidColourshift) {
+                            StageClock shiftClock(timer);
+                            // blur correction factors
+                            gaussianBlur(*redFactor, *redFactor, (W + 1 - 2 * cb) / 2, (H + 1 - 2 * cb) / 2, 30.0);
+                            gaussianBlur(*blueFactor, *blueFactor, (W + 1 - 2 * cb) / 2, (H + 1 - 2 * cb) / 2, 30.0);
 
-                                setProgCancel(progress);
+                            // apply correction factors to avoid (reduce) colour shift
+#ifdef _OPENMP
+                            #pragma omp for
+#endif
+                            for (int i = 0; i < H - 2 * cb; ++i) {
+                                const int firstCol = fc(cfarray, i + cb + winy, winx) & 1;
+                                const int colour = fc(cfarray, i + cb + winy, winx + firstCol);
+                                const float *factors = (colour == 0 ? *redFactor : *blueFactor)[i / 2];
+                                float *row = rawDataOut[i + cb + winy] + winx + cb;
+                                for (int j = firstCol; j < W - 2 * cb; j += 2) {
+                                    row[j] *= factors[j / 2];
+                                }
                             }
+                            shiftClock.lap("avoid colour shift");
                         }
+                    }
+                }
+            }
+        }
+
+        if (!rc && progress.cancelled()) {
+            rc = RP_CANCELLED;
+            break;
+        }
+        if (converged) {
+            break;
+        }
+        if (!rc && processpasstwo) {
+            ++passes;
+        }
+    }
 
+    if (rc != RP_CANCELLED) {
+        setProgCancel(1.0);
+    }
+
+    if (stats) {
+        stats->iterations = passes;
+        stats->residual = residual;
+        stats->converged = converged;
+    }
+
+    return rc ? rc : (processpasstwo ? RP_NO_ERROR : RP_CACORRECT_ERROR);
+}
+
+// fitParams of CA_correct are 4th order polynomials
+void setFitParams(rpCAModel &model, const double fitParams[2][2][16])
+{
+    model.type = RP_CA_POLYNOMIAL;
+    model.polyOrder = 4;
+    for (int c = 0; c < 2; ++c) {
+        for (int dir = 0; dir < 2; ++dir) {
+            std::copy(fitParams[c][dir], fitParams[c][dir] + 16, model.fitParams[c][dir]);
+        }
+    }
+}
+
+// a fit which fell back to order 2 is stored as the equal 4th order polynomial
+void getFitParams(const rpCAModel &model, double fitParams[2][2][16])
+{
+    const int order = model.polyOrder;
+    for (int c = 0; c < 2; ++c) {
+        for (int dir = 0; dir < 2; ++dir) {
+            for (int i = 0; i < 16; ++i) {
+                fitParams[c][dir][i] = 0.0;
+            }
+            for (int i = 0; i < std::min(order, 4); ++i) {
+                for (int j = 0; j < std::min(order, 4); ++j) {
+                    fitParams[c][dir][4 * i + j] = model.fitParams[c][dir][order * i + j];
+                }
+            }
+        }
+    }
+}
+
+rpError CA_correct_fitParams(rpContext *context, int winx, int winy, int winw, int winh, const bool autoCA, std::size_t autoIterations, const double cared, const double cablue, bool avoidColourshift, const float * const *rawDataIn, float **rawDataOut, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double fitParams[2][2][16], bool fitParamsIn, float inputScale, float outputScale, std::size_t chunkSize, bool measure)
+{
+    // fitParams passed in are always 4th order polynomials fitted on an image of this size
+    rpCAModel model;
+    model.width = winw - winx;
+    model.height = winh - winy;
+    setFitParams(model, fitParams);
+    const rpError rc = CA_correct_impl(context, winx, winy, winw, winh, autoCA, autoIterations, cared, cablue, avoidColourshift, rawDataIn, rawDataOut, cfarray, setProgCancel, model, fitParamsIn, false, 1, 0, winh - winy, 0.0, nullptr, inputScale, outputScale, chunkSize, measure);
+    getFitParams(model, fitParams);
+    return rc;
+}
+
+}
+
+rpError CA_correct(int winx, int winy, int winw, int winh, const bool autoCA, std::size_t autoIterations, const double cared, const double cablue, bool avoidColourshift, const float * const *rawDataIn, float **rawDataOut, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double fitParams[2][2][16], bool fitParamsIn, float inputScale, float outputScale, std::size_t chunkSize, bool measure)
+{
+    return CA_correct_fitParams(nullptr, winx, winy, winw, winh, autoCA, autoIterations, cared, cablue, avoidColourshift, rawDataIn, rawDataOut, cfarray, setProgCancel, fitParams, fitParamsIn, inputScale, outputScale, chunkSize, measure);
+}
+
+rpError CA_correct(rpContext &context, int winx, int winy, int winw, int winh, const bool autoCA, std::size_t autoIterations, const double cared, const double cablue, bool avoidColourshift, const float * const *rawDataIn, float **rawDataOut, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double fitParams[2][2][16], bool fitParamsIn, float inputScale, float outputScale, std::size_t chunkSize, bool measure)
+{
+    return CA_correct_fitParams(&context, winx, winy, winw, winh, autoCA, autoIterations, cared, cablue, avoidColourshift, rawDataIn, rawDataOut, cfarray, setProgCancel, fitParams, fitParamsIn, inputScale, outputScale, chunkSize, measure);
+}
+
+rpError CA_detect(rpContext &context, int winx, int winy, int winw, int winh, const float * const *rawData, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, rpCAModel &model, float inputScale, std::size_t chunkSize, int blockStep, rpCAModelType type, int order)
+{
+    rpCAModel detected;
+    detected.type = type;
+    detected.polyOrder = order;
+    const rpError rc = CA_correct_impl(&context, winx, winy, winw, winh, true, 1, 0.0, 0.0, false, rawData, nullptr, cfarray, setProgCancel, detected, false, true, std::max(blockStep, 1), 0, winh - winy, 0.0, nullptr, inputScale, 65535.f, chunkSize, false);
+    if (rc == RP_NO_ERROR) {
+        model = detected;
+    }
+    return rc;
+}
+
+rpError CA_apply(rpContext &context, int winx, int winy, int winw, int winh, const rpCAModel &model, bool avoidColourshift, const float * const *rawDataIn, float **rawDataOut, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, float inputScale, float outputScale, std::size_t chunkSize)
+{
+    if (!model.valid()) {
+        return RP_CACORRECT_ERROR;
+    }
+    rpCAModel applied = model;
+    return CA_correct_impl(&context, winx, winy, winw, winh, true, 1, 0.0, 0.0, avoidColourshift, rawDataIn, rawDataOut, cfarray, setProgCancel, applied, true, false, 1, 0, winh - winy, 0.0, nullptr, inputScale, outputScale, chunkSize, false);
+}
+
+rpError CA_correct_auto(rpContext &context, int winx, int winy, int winw, int winh, std::size_t maxIterations, double tolerance, bool avoidColourshift, const float * const *rawDataIn, float **rawDataOut, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, rpCAStats &stats, float inputScale, float outputScale, std::size_t chunkSize, rpCAModelType type, int order)
+{
+    stats = rpCAStats();
+    rpCAModel model;
+    model.type = type;
+    model.polyOrder = order;
+    return CA_correct_impl(&context, winx, winy, winw, winh, true, maxIterations, 0.0, 0.0, avoidColourshift, rawDataIn, rawDataOut, cfarray, setProgCancel, model, false, false, 1, 0, winh - winy, std::max(tolerance, 1e-6), &stats, inputScale, outputScale, chunkSize, false);
+}
+
+namespace
+{
+
+// CA correction fused with a demosaicer: the image is processed in strips of whole CA blocks, each strip is CA corrected
+// into a buffer holding just the raw rows its demosaic needs and then demosaiced from there. The rows of the CA blocks
+// around a strip are corrected as well, so the result is the same as CA_apply of the whole image followed by the
+// demosaic, while the corrected raw image is never stored completely.
+template<typename StripInput, typename Demosaic>
+rpError CA_demosaic_strips(rpContext &context, int width, int height, const rpCAModel &model, const float * const *rawData, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, float inputScale, std::size_t chunkSize, StripInput stripInput, Demosaic demosaic)
+{
+    if (!model.valid()) {
+        return RP_CACORRECT_ERROR;
+    }
+
+    constexpr int blockSize = 112; // CA_correct tile size minus its borders
+    constexpr int stripHeight = 8 * blockSize;
+    constexpr int margin = 16; // rows a corrected row depends on
+    const int numStrips = (height + stripHeight - 1) / stripHeight;
+
+    // corrected rows of a strip: all raw rows of its demosaic plus the margin, starting at a block boundary to keep the tiles of
+    // CA_correct in place
+    const auto correctedRows = [&](int stripTop, int &caTop, int &caBottom) {
+        int rawTop, rawBottom;
+        stripInput(height, stripTop, stripHeight, rawTop, rawBottom);
+        caTop = std::max(rawTop - margin, 0) / blockSize * blockSize;
+        caBottom = std::min(rawBottom + margin, height);
+    };
+
+    int maxRows = 0;
+    for (int stripTop = 0; stripTop < height; stripTop += stripHeight) {
+        int caTop, caBottom;
+        correctedRows(stripTop, caTop, caBottom);
+        maxRows = std::max(maxRows, caBottom - caTop);
+    }
+    std::unique_ptr<float[]> buffer(new (std::nothrow) float[static_cast<std::size_t>(maxRows) * width]);
+    if (!buffer) {
+        return RP_MEMORY_ERROR;
+    }
+    std::vector<float*> corrected(height);
+
+    rpCAModel applied = model;
+    rpError rc = RP_NO_ERROR;
+    for (int strip = 0; strip < numStrips && !rc; ++strip) {
+        const int stripTop = strip * stripHeight;
+        int caTop, caBottom;
+        correctedRows(stripTop, caTop, caBottom);
+        for (int row = caTop; row < caBottom; ++row) {
+            corrected[row] = buffer.get() + static_cast<std::size_t>(row - caTop) * width;
+        }
+
+        // the CA correction gets the first half of the progress of a strip, the demosaic the second
+        rc = CA_correct_impl(&context, 0, 0, width, caBottom - caTop, true, 1, 0.0, 0.0, false, rawData + caTop, corrected.data() + caTop, cfarray, [&](double p) {
+            return setProgCancel((strip + 0.5 * p) / numStrips);
+        }, applied, true, false, 1, caTop, height, 0.0, nullptr, inputScale, inputScale, chunkSize, false);
+        if (!rc) {
+            rc = demosaic(stripTop, stripHeight, corrected.data(), [&](double p) {
+                return setProgCancel((strip + 0.5 + 0.5 * p) / numStrips);
+            });
+        }
+    }
+
+    return rc;
+}
+
+}
+
+rpError CA_amaze_demosaic(rpContext &context, int width, int height, const rpCAModel &model, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double initGain, int border, float inputScale, float outputScale, std::size_t chunkSize)
+{
+    return CA_demosaic_strips(context, width, height, model, rawData, cfarray, setProgCancel, inputScale, chunkSize, amaze_demosaic_strip_input,
+        [&](int stripTop, int stripHeight, const float * const *corrected, const std::function<bool(double)> &progress) {
+            return amaze_demosaic_strip(context, width, height, stripTop, stripHeight, corrected, red, green, blue, cfarray, progress, initGain, border, inputScale, outputScale, chunkSize);
+        });
+}
+
+rpError CA_rcd_demosaic(rpContext &context, int width, int height, const rpCAModel &model, const float * const *rawData, float **red, float **green, float **blue, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, std::size_t chunkSize)
+{
+    return CA_demosaic_strips(context, width, height, model, rawData, cfarray, setProgCancel, 65535.f, chunkSize, rcd_demosaic_strip_input,
+        [&](int stripTop, int stripHeight, const float * const *corrected, const std::function<bool(double)> &progress) {
+            return rcd_demosaic_strip(context, width, height, stripTop, stripHeight, corrected, red, green, blue, cfarray, progress, chunkSize);
+        });
+}
+
+namespace
+{
+
+constexpr int caBlockSize = 112; // CA_correct tile size minus its borders
+constexpr int caMargin = 16; // rows a corrected row depends on
+// CA_correct_tiled corrects strips of this many rows. Rows around a strip are corrected as well, with avoidColourshift
+// enough of them to cover the gaussian blur of the colour shift factors (sigma 30 at half resolution).
+constexpr int caStripHeight = 4 * caBlockSize;
+constexpr int caColourShiftHalo = 240;
+static_assert(caStripHeight > caColourShiftHalo + caMargin + caBlockSize, "a strip must not need rows corrected two strips before");
+
+int caThreads()
+{
 #ifdef _OPENMP
-                    #pragma omp barrier
-                    // copy temporary image matrix back to image matrix
-                    #pragma omp for
+    return omp_get_max_threads();
+#else
+    return 1;
 #endif
+}
 
-                    for(int row = cb; row < winh - cb; row++) {
-                        int col = cb + (fc(cfarray, row + winy, winx) & 1);
-                        int indx = (row * (winw + (winw & 1)) + col) >> 1;
-#ifdef __SSE2__
-                        for (; col < (winw + (winw & 1)) - 7 - cb; col += 8, indx += 4) {
-                            vfloat val = LVFU(RawDataTmp[indx]);
-                            STC2VFU(rawDataOut[row + winy][col + winx], val);
-                        }
+// scratch memory in bytes of CA_correct_impl for a width x height window
+std::size_t caScratchSize(int width, int height, bool detectOnly, bool avoidColourshift, bool inPlace, bool converge)
+{
+    constexpr int ts = 128;
+    constexpr int border2 = 16;
+    constexpr int cb = 2;
+    const std::size_t W = width + (width & 1);
+    const std::size_t H = height;
+    const std::size_t vblsz = (H + border2) / (ts - border2) + 3;
+    const std::size_t hblsz = (W + border2) / (ts - border2) + 3;
+    const std::size_t tileBuffer = ts * ts + 8 * ts * (ts / 2) + 8 * 16;
+
+    std::size_t size = ((detectOnly ? 0 : H * W) + vblsz * hblsz * (2 * 2 + 1) + caThreads() * tileBuffer) * sizeof(float);
+    if (avoidColourshift && !detectOnly) {
+        const std::size_t factorWidth = (width + 1 - 2 * cb) / 2;
+        const std::size_t factorHeight = (height + 1 - 2 * cb) / 2;
+        size += 2 * factorWidth * factorHeight * sizeof(float) + 2 * factorHeight * sizeof(float*);
+        if (inPlace) {
+            size += factorWidth * (height - 2 * cb) * sizeof(float) + (height - 2 * cb) * sizeof(float*);
+        }
+    }
+    if (converge) {
+        size += vblsz * hblsz * (sizeof(char) + 2 * sizeof(std::array<float, 4>));
+    }
+    return size;
+}
+
+// rows [caTop, caBottom) CA_correct_tiled corrects for the strip starting at stripTop, caTop is at a block boundary to keep
+// the tiles of CA_correct in place
+void caTiledRows(int height, int stripTop, bool avoidColourshift, int &caTop, int &caBottom)
+{
+    const int halo = caMargin + (avoidColourshift ? caColourShiftHalo : 0);
+    caTop = std::max(stripTop - halo, 0) / caBlockSize * caBlockSize;
+    caBottom = std::min(stripTop + caStripHeight + halo, height);
+}
+
+// largest number of rows corrected for a strip and of input rows which have to be kept for the next strip when correcting in place
+void caTiledSizes(int height, bool avoidColourshift, int &maxRows, int &maxKept)
+{
+    maxRows = maxKept = 0;
+    for (int stripTop = 0; stripTop < height; stripTop += caStripHeight) {
+        int caTop, caBottom, nextTop, nextBottom;
+        caTiledRows(height, stripTop, avoidColourshift, caTop, caBottom);
+        caTiledRows(height, stripTop + caStripHeight, avoidColourshift, nextTop, nextBottom);
+        maxRows = std::max(maxRows, caBottom - caTop);
+        maxKept = std::max(maxKept, std::min(stripTop + caStripHeight, height) - nextTop);
+    }
+}
+
+}
+
+rpError CA_correct_tiled(rpContext &context, int width, int height, const bool autoCA, std::size_t autoIterations, const double cared, const double cablue, bool avoidColourshift, const float * const *rawDataIn, float **rawDataOut, const unsigned cfarray[2][2], const std::function<bool(double)> &setProgCancel, double fitParams[2][2][16], bool fitParamsIn, float inputScale, float outputScale, std::size_t chunkSize)
+{
+    // The detection of each iteration only keeps per block data, the correction runs in strips which are corrected into a
+    // buffer of a few blocks height and copied to rawDataOut from there. When correcting in place the input rows the next
+    // strip needs are kept before copying, as rawDataOut already holds the corrected data of the strip.
+    rpCAModel model;
+    model.width = width;
+    model.height = height;
+    setFitParams(model, fitParams);
+
+    const std::size_t iterations = autoCA ? std::max<std::size_t>(autoIterations, 1) : 1;
+    const bool detect = autoCA && !(fitParamsIn && iterations < 2);
+    const int numStrips = (height + caStripHeight - 1) / caStripHeight;
+
+    int maxRows, maxKept;
+    caTiledSizes(height, avoidColourshift, maxRows, maxKept);
+    const bool inPlace = rawDataIn == rawDataOut;
+    std::unique_ptr<float[]> buffer(new (std::nothrow) float[static_cast<std::size_t>(maxRows + (inPlace || iterations > 1 ? maxKept : 0)) * width]);
+    if (!buffer) {
+        return RP_MEMORY_ERROR;
+    }
+    float *const kept = buffer.get() + static_cast<std::size_t>(maxRows) * width;
+    std::vector<float*> corrected(height);
+    std::vector<const float*> input(height);
+
+    setProgCancel(0.0);
+    rpError rc = RP_NO_ERROR;
+    for (std::size_t it = 0; it < iterations && !rc; ++it) {
+        // the detection gets the first half of the progress of an iteration, the correction the second
+        const double correctionStart = detect ? 0.5 : 0.0;
+        const auto iterationProgress = [&](double p) {
+            return setProgCancel((it + p) / iterations);
+        };
+        const float * const *source = it == 0 ? rawDataIn : rawDataOut;
+        if (detect) {
+            rc = CA_correct_impl(&context, 0, 0, width, height, true, 1, 0.0, 0.0, false, source, nullptr, cfarray, [&](double p) {
+                return iterationProgress(0.5 * p);
+            }, model, false, true, 1, 0, height, 0.0, nullptr, inputScale, outputScale, chunkSize, false);
+        }
+        std::copy(source, source + height, input.begin());
+
+        for (int strip = 0; strip < numStrips && !rc; ++strip) {
+            const int stripTop = strip * caStripHeight;
+            const int stripBottom = std::min(stripTop + caStripHeight, height);
+            int caTop, caBottom;
+            caTiledRows(height, stripTop, avoidColourshift, caTop, caBottom);
+            for (int row = caTop; row < caBottom; ++row) {
+                corrected[row] = buffer.get() + static_cast<std::size_t>(row - caTop) * width;
+            }
+
+            rc = CA_correct_impl(&context, 0, 0, width, caBottom - caTop, autoCA, 1, cared, cablue, avoidColourshift, input.data() + caTop, corrected.data() + caTop, cfarray, [&](double p) {
+                return iterationProgress(correctionStart + (1.0 - correctionStart) * (strip + p) / numStrips);
+            }, model, true, false, 1, caTop, height, 0.0, nullptr, inputScale, outputScale, chunkSize, false);
+            if (rc) {
+                break;
+            }
+
+            if (source == rawDataOut && strip + 1 < numStrips) {
+                int nextTop, nextBottom;
+                caTiledRows(height, stripBottom, avoidColourshift, nextTop, nextBottom);
+                for (int row = nextTop; row < stripBottom; ++row) {
+                    float *keptRow = kept + static_cast<std::size_t>(row - nextTop) * width;
+                    memcpy(keptRow, source[row], width * sizeof(float));
+                    input[row] = keptRow;
+                }
+            }
+#ifdef _OPENMP
+            #pragma omp parallel for
 #endif
-                        for (; col < (winw + (winw & 1)) - cb; col += 2, indx++) {
-                            rawDataOut[row + winy][col + winx] = RawDataTmp[indx];
+            for (int row = stripTop; row < stripBottom; ++row) {
+                memcpy(rawDataOut[row], corrected[row], width * sizeof(float));
+            }
+        }
+    }
+
+    if (!rc) {
+        getFitParams(model, fitParams);
+        setProgCancel(1.0);
+    }
+    return rc;
+}
+
+std::size_t CA_correct_scratch_size(int width, int height, bool avoidColourshift, bool tiled)
+{
+    if (!tiled) {
+        return caScratchSize(width, height, false, avoidColourshift, true, false);
+    }
+    int maxRows, maxKept;
+    caTiledSizes(height, avoidColourshift, maxRows, maxKept);
+    const std::size_t buffers = static_cast<std::size_t>(maxRows + maxKept) * width * sizeof(float) + 2 * height * sizeof(float*);
+    return buffers + std::max(caScratchSize(width, height, true, false, false, false), caScratchSize(width, maxRows, false, avoidColourshift, false, false));
+}
+
+namespace
+{
+
+// X-Trans tiles have the size and the borders of the CA_correct tiles, so the blocks and the model are the same
+constexpr int xtTileSize = 128;
+constexpr int xtBorder = 8;
+// R, B and G above this level (after scaling to [0, 1]) don't take part in the detection
+constexpr float xtClipLevel = 0.95f;
+
+// G of the part of the tile at top, left which is in the image, scaled by scale. R and B pixels get the mean of their
+// horizontal and vertical G neighbours, which every X-Trans R and B pixel has apart from the image border.
+void xtransGreen(const float * const *rawData, const unsigned xtrans[6][6], int width, int height, int top, int left, float scale, float *green)
+{
+    const int rowEnd = std::min(top + xtTileSize, height);
+    const int colEnd = std::min(left + xtTileSize, width);
+    for (int row = std::max(top, 0); row < rowEnd; ++row) {
+        float *greenRow = green + (row - top) * xtTileSize - left;
+        for (int col = std::max(left, 0); col < colEnd; ++col) {
+            if (fc(xtrans, row, col) == 1) {
+                greenRow[col] = rawData[row][col] * scale;
+                continue;
+            }
+            float sum = 0.f;
+            int count = 0;
+            for (int pass = 0; pass < 2 && !count; ++pass) {
+                // the diagonal neighbours are only used if there are no horizontal and vertical ones
+                for (int dy = -1; dy <= 1; ++dy) {
+                    for (int dx = -1; dx <= 1; ++dx) {
+                        const int y = row + dy, x = col + dx;
+                        const bool orthogonal = (dy == 0) != (dx == 0);
+                        if (orthogonal == (pass == 0) && y >= 0 && y < height && x >= 0 && x < width && fc(xtrans, y, x) == 1) {
+                            sum += rawData[y][x];
+                            ++count;
                         }
                     }
                 }
             }
+            greenRow[col] = count ? sum * scale / count : 0.f;
+        }
+    }
+}
+
+// Measures the shifts of R and B against G in the inner part of a tile. With c(p) ~ k * G(p + s) for the gain k of the
+// tile, c(p) - k * G(p) ~ k * grad G(p) . s gives the shift s by linear least squares. Returns the weight of the block,
+// the smallest eigenvalue of the normal equations relative to the residual, or 0 if a shift can't be measured.
+float xtransTileShifts(const float * const *rawData, const unsigned xtrans[6][6], int width, int height, int top, int left, float scale, const float *green, float shifts[2][2])
+{
+    constexpr double eps = 1e-5, eps2 = 1e-10;
+    const int rowBegin = std::max(top + xtBorder, 1), rowEnd = std::min(top + xtTileSize - xtBorder, height - 1);
+    const int colBegin = std::max(left + xtBorder, 1), colEnd = std::min(left + xtTileSize - xtBorder, width - 1);
+    const auto G = [green, top, left](int row, int col) {
+        return green[(row - top) * xtTileSize + col - left];
+    };
+    const auto usable = [&](int row, int col) {
+        return rawData[row][col] * scale < xtClipLevel && G(row, col) < xtClipLevel && G(row - 1, col) < xtClipLevel && G(row + 1, col) < xtClipLevel && G(row, col - 1) < xtClipLevel && G(row, col + 1) < xtClipLevel;
+    };
+
+    double colourSum[3] = {}, greenSum[3] = {};
+    for (int row = rowBegin; row < rowEnd; ++row) {
+        for (int col = colBegin; col < colEnd; ++col) {
+            const int c = fc(xtrans, row, col);
+            if (c != 1 && usable(row, col)) {
+                colourSum[c] += rawData[row][col] * scale;
+                greenSum[c] += G(row, col);
+            }
+        }
+    }
+
+    double gain[3], mat[3][3] = {}, vect[3][2] = {}, diffSum[3] = {};
+    for (int c = 0; c < 3; c += 2) {
+        gain[c] = greenSum[c] > eps ? colourSum[c] / greenSum[c] : 0.0;
+    }
+    for (int row = rowBegin; row < rowEnd; ++row) {
+        for (int col = colBegin; col < colEnd; ++col) {
+            const int c = fc(xtrans, row, col);
+            if (c != 1 && usable(row, col)) {
+                const double gradV = 0.5 * gain[c] * (G(row + 1, col) - G(row - 1, col));
+                const double gradH = 0.5 * gain[c] * (G(row, col + 1) - G(row, col - 1));
+                const double diff = rawData[row][col] * scale - gain[c] * G(row, col);
+                mat[c][0] += SQR(gradV);
+                mat[c][1] += gradV * gradH;
+                mat[c][2] += SQR(gradH);
+                vect[c][0] += gradV * diff;
+                vect[c][1] += gradH * diff;
+                diffSum[c] += SQR(diff);
+            }
+        }
+    }
+
+    float weight = 1.f;
+    for (int c = 0; c < 3; c += 2) {
+        const double det = mat[c][0] * mat[c][2] - SQR(mat[c][1]);
+        const double trace = mat[c][0] + mat[c][2];
+        const double minEigen = 0.5 * (trace - sqrt(std::max(SQR(trace) - 4.0 * det, 0.0)));
+        if (gain[c] <= 0.0 || minEigen <= eps2) {
+            shifts[c >> 1][0] = shifts[c >> 1][1] = 17.f;
+            weight = 0.f;
+            continue;
+        }
+        const double shiftV = (mat[c][2] * vect[c][0] - mat[c][1] * vect[c][1]) / det;
+        const double shiftH = (mat[c][0] * vect[c][1] - mat[c][1] * vect[c][0]) / det;
+        shifts[c >> 1][0] = shiftV;
+        shifts[c >> 1][1] = shiftH;
+        const double residual = std::max(diffSum[c] - shiftV * vect[c][0] - shiftH * vect[c][1], 0.0);
+        weight = std::min<float>(weight, minEigen / (eps + residual));
+    }
+    return weight;
+}
+
+// Corrects R and B in the inner part of a tile by moving them to the position of G: c(p) * G(p) / G(p + s)
+void xtransTileCorrect(float **rawData, const unsigned xtrans[6][6], int width, int height, int top, int left, const float *green, const float shifts[2][2])
+{
+    // below about 1/512 of the range the ratio is damped to not amplify the noise
+    constexpr float offset = 1.f / 512.f;
+    const int rowBegin = std::max(top + xtBorder, 0), rowEnd = std::min(top + xtTileSize - xtBorder, height);
+    const int colBegin = std::max(left + xtBorder, 0), colEnd = std::min(left + xtTileSize - xtBorder, width);
+    const int rowMax = std::min(top + xtTileSize, height) - 1, colMax = std::min(left + xtTileSize, width) - 1;
+    const auto G = [=](int row, int col) {
+        return green[(LIM(row, std::max(top, 0), rowMax) - top) * xtTileSize + LIM(col, std::max(left, 0), colMax) - left];
+    };
+
+    for (int c = 0; c < 2; ++c) {
+        // G at p + s is interpolated bilinearly
+        const int shiftV = floor(shifts[c][0]), shiftH = floor(shifts[c][1]);
+        const float fracV = shifts[c][0] - shiftV, fracH = shifts[c][1] - shiftH;
+        for (int row = rowBegin; row < rowEnd; ++row) {
+            for (int col = colBegin; col < colEnd; ++col) {
+                if (fc(xtrans, row, col) != 2 * c) {
+                    continue;
+                }
+                const int y = row + shiftV, x = col + shiftH;
+                const float shifted = intp(fracV, intp(fracH, G(y + 1, x + 1), G(y + 1, x)), intp(fracH, G(y, x + 1), G(y, x)));
+                const float ratio = LIM((std::max(G(row, col), 0.f) + offset) / (std::max(shifted, 0.f) + offset), 0.25f, 4.f);
+                rawData[row][col] *= ratio;
+            }
         }
+    }
+}
+
+}
 
-        if (!rc && avoidColourshift) {
-            // to avoid or at least reduce the colour shift caused by raw ca correction we compute the per pixel difference factors
-            // of red and blue channel and apply a gaussian blur to them.
-            // Then we apply the resulting factors per pixel on the result of raw ca correction
+rpError CA_correct_xtrans(rpContext &context, int width, int height, std::size_t autoIterations, const float * const *rawDataIn, float **rawDataOut, const unsigned xtrans[6][6], const std::function<bool(double)> &setProgCancel, rpCAModel &model, bool modelIn, float inputScale, float outputScale, std::size_t chunkSize, rpCAModelType type, int order)
+{
+    BENCHFUN
+    StageTimer timer(&context, "CA_correct_xtrans");
+
+    if (!validateXtransCfa(xtrans)) {
+        return RP_WRONG_CFA;
+    }
+    if (modelIn && !model.valid()) {
+        return RP_CACORRECT_ERROR;
+    }
 
+    constexpr int step = xtTileSize - 2 * xtBorder;
+    const int vblsz = ceil((float)(height + 2 * xtBorder) / step + 2 + ((height + 2 * xtBorder) % step == 0 ? 1 : 0));
+    const int hblsz = ceil((float)(width + 2 * xtBorder) / step + 2 + ((width + 2 * xtBorder) % step == 0 ? 1 : 0));
+    const int tilesHigh = (height + xtBorder + step - 1) / step;
+    const int tilesWide = (width + xtBorder + step - 1) / step;
+    const int numTiles = tilesHigh * tilesWide;
+
+    //block CA shift values and weight assigned to block, shifts of the tiles
+    std::vector<float> blockwt(vblsz * hblsz);
+    std::vector<float> blockshiftData(vblsz * hblsz * 2 * 2);
+    float (*const blockshifts)[2][2] = reinterpret_cast<float (*)[2][2]>(blockshiftData.data());
+    std::vector<float> tileShiftData(numTiles * 2 * 2);
+    float (*const tileShifts)[2][2] = reinterpret_cast<float (*)[2][2]>(tileShiftData.data());
+
+    const std::size_t iterations = modelIn ? 1 : std::max<std::size_t>(autoIterations, 1);
+    Progress progress(setProgCancel, iterations * (modelIn ? 1 : 2) * numTiles);
+
+    // the detection and the correction work on rawDataOut in the output scale, the correction only changes R and B,
+    // which the G interpolation of the other tiles doesn't read
+    if (rawDataOut != rawDataIn || inputScale != outputScale) {
+        const float factor = outputScale / inputScale;
 #ifdef _OPENMP
-            #pragma omp parallel
+        #pragma omp parallel for
+#endif
+        for (int row = 0; row < height; ++row) {
+            for (int col = 0; col < width; ++col) {
+                rawDataOut[row][col] = rawDataIn[row][col] * factor;
+            }
+        }
+    }
+    const float scale = 1.f / outputScale;
+
+    rpCAModel fitted = model;
+    bool processpasstwo = true;
+    rpError rc = RP_NO_ERROR;
+    for (std::size_t it = 0; it < iterations && processpasstwo && !rc; ++it) {
+        CAFit fit(type, order > 0 ? LIM(order, type == RP_CA_RADIAL ? 1 : 2, RP_CA_MAX_ORDER) : 4);
+        float blockave[2][2] = {}, blocksqave[2][2] = {}, blockdenom[2][2] = {}, blockvar[2][2];
+
+#ifdef _OPENMP
+        #pragma omp parallel
+#endif
+        {
+            std::unique_ptr<float[]> green(new (std::nothrow) float[xtTileSize * xtTileSize]);
+#ifdef _OPENMP
+            #pragma omp critical
 #endif
             {
-#ifdef __SSE2__
-                const vfloat onev = F2V(1.f);
-                const vfloat twov = F2V(2.f);
-                const vfloat zd5v = F2V(0.5f);
+                if (!green) {
+                    rc = RP_MEMORY_ERROR;
+                }
+            }
+#ifdef _OPENMP
+            #pragma omp barrier
 #endif
+            if (!rc) {
+                StageClock clock(timer);
+                if (!modelIn) {
+                    float blockavethr[2][2] = {}, blocksqavethr[2][2] = {}, blockdenomthr[2][2] = {};
 #ifdef _OPENMP
-                #pragma omp for
+                    #pragma omp for schedule(dynamic, chunkSize) nowait
 #endif
-                for (int i = winy; i < winh - 2 * cb; ++i) {
-                    const int firstCol = winx + (fc(cfarray, i, winx) & 1);
-                    const int colour = fc(cfarray, i, firstCol);
-                    JaggedArray<float>* nonGreen = colour == 0 ? redFactor.get() : blueFactor.get();
-                    int j = firstCol;
-#ifdef __SSE2__
-                    for (; j < winw - 7 - 2 * cb; j += 8) {
-                        const vfloat newvals = LC2VFU(rawDataOut[i + cb][j + cb]);
-                        const vfloat oldvals = LVFU((*oldraw)[i - winy][(j - winx) / 2]);
-                        vfloat factors = oldvals / newvals;
-                        factors = vself(vmaskf_le(newvals, onev), onev, factors);
-                        factors = vself(vmaskf_le(oldvals, onev), onev, factors);
-                        STVFU((*nonGreen)[(i - winy) / 2][(j - winx) / 2], LIMV(factors, zd5v, twov));
+                    for (int tile = 0; tile < numTiles; ++tile) {
+                        if (progress.cancelled()) {
+                            continue;
+                        }
+                        clock.start();
+                        const int top = (tile / tilesWide) * step - xtBorder;
+                        const int left = (tile % tilesWide) * step - xtBorder;
+                        const int block = (tile / tilesWide + 1) * hblsz + tile % tilesWide + 1;
+                        xtransGreen(rawDataOut, xtrans, width, height, top, left, scale, green.get());
+                        float (&shifts)[2][2] = blockshifts[block];
+                        blockwt[block] = xtransTileShifts(rawDataOut, xtrans, width, height, top, left, scale, green.get(), shifts);
+                        for (int c = 0; c < 2; ++c) {
+                            for (int dir = 0; dir < 2; ++dir) {
+                                if (fabsf(shifts[c][dir]) < 2.0f) {
+                                    blockavethr[dir][c] += shifts[c][dir];
+                                    blocksqavethr[dir][c] += SQR(shifts[c][dir]);
+                                    blockdenomthr[dir][c] += 1;
+                                }
+                            }
+                        }
+                        clock.lap("detection");
+                        progress.done();
                     }
+#ifdef _OPENMP
+                    #pragma omp critical (caxtransdetect)
 #endif
-                    for (; j < winw - 2 * cb; j += 2) {
-                        (*nonGreen)[(i - winy) / 2][(j - winx) / 2] = (rawDataOut[i + cb][j + cb] <= 1.f || (*oldraw)[i - winy][(j - winx) / 2] <= 1.f) ? 1.f : librtprocess::LIM((*oldraw)[i - winy][(j - winx) / 2] / rawDataOut[i + cb][j + cb], 0.5f, 2.f);
+                    for (int dir = 0; dir < 2; dir++) {
+                        for (int c = 0; c < 2; c++) {
+                            blockdenom[dir][c] += blockdenomthr[dir][c];
+                            blocksqave[dir][c] += blocksqavethr[dir][c];
+                            blockave[dir][c] += blockavethr[dir][c];
+                        }
                     }
-                }
-
 #ifdef _OPENMP
-                #pragma omp single
+                    #pragma omp barrier
+                    #pragma omp single
 #endif
-                {
-                    if (H % 2) {
-                        // odd height => factors are not set in last row => use values of preceding row
-                        // odd height => factors are not set in last row => use values of preceding row
-                        for (int j = 0; j < (W + 1 - 2 * cb) / 2; ++j) {
-                            (*redFactor)[(H - 2 * cb + 1) / 2 - 1][j] = (*redFactor)[(H - 2 * cb + 1) / 2 - 2][j];
-                            (*blueFactor)[(H - 2 * cb + 1) / 2 - 1][j] = (*blueFactor)[(H - 2 * cb + 1) / 2 - 2][j];
+                    for (int dir = 0; dir < 2; dir++) {
+                        for (int c = 0; c < 2; c++) {
+                            if (blockdenom[dir][c]) {
+                                blockvar[dir][c] = blocksqave[dir][c] / blockdenom[dir][c] - SQR(blockave[dir][c] / blockdenom[dir][c]);
+                            } else {
+                                processpasstwo = false;
+                            }
                         }
                     }
-
-                    if (W % 2) {
-                        // odd width => factors for one channel are not set in last column => use value of preceding column
-                        const int ngRow = winy + (1 - (fc(cfarray, winy, winx) & 1));
-                        const int ngCol = winx + (fc(cfarray, ngRow, winx) & 1);
-                        const int colour = fc(cfarray, ngRow, ngCol);
-                        JaggedArray<float>* nonGreen = colour == 0 ? redFactor.get() : blueFactor.get();
-                        for (int i = 0; i < (H + 1 - 2 * cb) / 2; ++i) {
-                            (*nonGreen)[i][(W - 2 * cb + 1) / 2 - 1] = (*nonGreen)[i][(W - 2* cb + 1) / 2 - 2];
-                        }
+                    if (processpasstwo && !progress.cancelled()) {
+                        StageClock fitClock(timer);
+                        fitBlockShifts(fit, blockwt.data(), blockshifts, blockvar, vblsz, hblsz, 1, width, height, fitted, processpasstwo);
+                        fitClock.lap("fit");
                     }
                 }
 
-                // blur correction factors
-                gaussianBlur(*redFactor, *redFactor, (W + 1 - 2 * cb) / 2, (H + 1 - 2 * cb) / 2, 30.0);
-                gaussianBlur(*blueFactor, *blueFactor, (W + 1 - 2 * cb) / 2, (H + 1 - 2 * cb) / 2, 30.0);
-
-                // apply correction factors to avoid (reduce) colour shift
+                if (processpasstwo && !progress.cancelled()) {
+                    // a model of an image of another size is evaluated at the corresponding position and its shifts are scaled
+                    const double vScale = static_cast<double>(fitted.height) / height;
+                    const double hScale = static_cast<double>(fitted.width) / width;
+                    const auto modelBlock = [step](int block, double sizeScale) {
+                        constexpr double centre = xtTileSize / 2 - xtBorder;
+                        return (((block - 1) * step + centre) * sizeScale - centre) / step + 1;
+                    };
+#ifdef _OPENMP
+                    #pragma omp for
+#endif
+                    for (int tile = 0; tile < numTiles; ++tile) {
+                        float shifts[2][2];
+                        modelShifts(fitted, modelBlock(tile / tilesWide + 1, vScale), modelBlock(tile % tilesWide + 1, hScale), shifts);
+                        for (int c = 0; c < 2; ++c) {
+                            tileShifts[tile][c][0] = LIM<float>(shifts[c][0] / vScale, -3.99f, 3.99f);
+                            tileShifts[tile][c][1] = LIM<float>(shifts[c][1] / hScale, -3.99f, 3.99f);
+                        }
+                    }
 #ifdef _OPENMP
-                #pragma omp for
+                    #pragma omp for schedule(dynamic, chunkSize)
 #endif
-                for (int i = winy; i < winh - 2 * cb; ++i) {
-                    const int firstCol = winx + (fc(cfarray, i, winx) & 1);
-                    const int colour = fc(cfarray, i, firstCol);
-                    JaggedArray<float>* nonGreen = colour == 0 ? redFactor.get() : blueFactor.get();
-                    for (int j = firstCol; j < winw - 2 * cb; j += 2) {
-                        rawDataOut[i + cb][j + cb] *= (*nonGreen)[i/2][j/2];
+                    for (int tile = 0; tile < numTiles; ++tile) {
+                        if (progress.cancelled()) {
+                            continue;
+                        }
+                        clock.start();
+                        const int top = (tile / tilesWide) * step - xtBorder;
+                        const int left = (tile % tilesWide) * step - xtBorder;
+                        xtransGreen(rawDataOut, xtrans, width, height, top, left, scale, green.get());
+                        xtransTileCorrect(rawDataOut, xtrans, width, height, top, left, green.get(), tileShifts[tile]);
+                        clock.lap("correction");
+                        progress.done();
                     }
                 }
             }
         }
+        if (!rc && progress.cancelled()) {
+            rc = RP_CANCELLED;
+        }
     }
 
-    setProgCancel(1.0);
-
-    return rc ? rc : (processpasstwo ? RP_NO_ERROR : RP_CACORRECT_ERROR);
+    if (rc != RP_CANCELLED) {
+        setProgCancel(1.0);
+    }
+    if (rc) {
+        return rc;
+    }
+    if (!processpasstwo) {
+        return RP_CACORRECT_ERROR;
+    }
+    if (!modelIn) {
+        model = fitted;
+    }
+    return RP_NO_ERROR;
 }
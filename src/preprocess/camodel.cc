@@ -0,0 +1,216 @@
+/*
+ * This file is part of librtprocess.
+ *
+ * librtprocess is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * librtprocess is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with librtprocess.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cmath>
+#include <cstring>
+#include <locale>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <utility>
+
+#include "librtprocess.h"
+
+namespace
+{
+
+constexpr const char *modelTag = "rpCAModel";
+// version 1 only had polynomial models, version 2 stores the type after the version
+constexpr int modelVersion = 2;
+
+// number of fitParams per colour and direction
+int numParams(const rpCAModel &model, int dir)
+{
+    if (model.type == RP_CA_RADIAL) {
+        return dir == 0 ? model.polyOrder : 2;
+    }
+    return model.polyOrder * model.polyOrder;
+}
+
+void writeModel(std::ostream &stream, const rpCAModel &model)
+{
+    stream << modelTag << ' ' << modelVersion << ' ' << model.type << ' ' << model.width << ' ' << model.height << ' ' << model.polyOrder;
+    stream.precision(17);
+    for (int c = 0; c < 2; ++c) {
+        for (int dir = 0; dir < 2; ++dir) {
+            for (int i = 0; i < numParams(model, dir); ++i) {
+                stream << ' ' << model.fitParams[c][dir][i];
+            }
+        }
+    }
+}
+
+bool readModel(std::istream &stream, rpCAModel &model)
+{
+    std::string tag;
+    int version;
+    if (!(stream >> tag >> version) || tag != modelTag || version < 1 || version > modelVersion) {
+        return false;
+    }
+    rpCAModel result;
+    result.type = RP_CA_POLYNOMIAL;
+    if (version > 1) {
+        int type;
+        if (!(stream >> type) || (type != RP_CA_POLYNOMIAL && type != RP_CA_RADIAL)) {
+            return false;
+        }
+        result.type = static_cast<rpCAModelType>(type);
+    }
+    if (!(stream >> result.width >> result.height >> result.polyOrder)) {
+        return false;
+    }
+    if (result.polyOrder < 1 || result.polyOrder > RP_CA_MAX_ORDER) {
+        return false;
+    }
+    for (int c = 0; c < 2; ++c) {
+        for (int dir = 0; dir < 2; ++dir) {
+            for (int i = 0; i < numParams(result, dir); ++i) {
+                if (!(stream >> result.fitParams[c][dir][i])) {
+                    return false;
+                }
+            }
+        }
+    }
+    if (!result.valid()) {
+        return false;
+    }
+    model = result;
+    return true;
+}
+
+// focal lengths are matched to 0.1 mm
+std::pair<std::string, long> cacheKey(const std::string &lens, double focalLength)
+{
+    return {lens, std::lround(focalLength * 10.0)};
+}
+
+}
+
+rpCAModel::rpCAModel() :
+    type(RP_CA_POLYNOMIAL),
+    width(0),
+    height(0),
+    polyOrder(0)
+{
+    memset(fitParams, 0, sizeof(fitParams));
+}
+
+bool rpCAModel::valid() const
+{
+    const int minOrder = type == RP_CA_RADIAL ? 1 : 2;
+    return width > 0 && height > 0 && polyOrder >= minOrder && polyOrder <= RP_CA_MAX_ORDER;
+}
+
+// the streams use the classic locale, so the text doesn't depend on the global locale of the program
+std::string rpCAModel::serialize() const
+{
+    std::ostringstream stream;
+    stream.imbue(std::locale::classic());
+    writeModel(stream, *this);
+    return stream.str();
+}
+
+bool rpCAModel::deserialize(const std::string &text)
+{
+    std::istringstream stream(text);
+    stream.imbue(std::locale::classic());
+    return readModel(stream, *this);
+}
+
+struct rpCAModelCache::Entries {
+    mutable std::mutex mutex;
+    std::map<std::pair<std::string, long>, rpCAModel> models;
+};
+
+rpCAModelCache::rpCAModelCache() :
+    entries(new Entries)
+{
+}
+
+rpCAModelCache::~rpCAModelCache()
+{
+    delete entries;
+}
+
+void rpCAModelCache::insert(const std::string &lens, double focalLength, const rpCAModel &model)
+{
+    std::lock_guard<std::mutex> lock(entries->mutex);
+    entries->models[cacheKey(lens, focalLength)] = model;
+}
+
+bool rpCAModelCache::find(const std::string &lens, double focalLength, rpCAModel &model) const
+{
+    std::lock_guard<std::mutex> lock(entries->mutex);
+    const auto entry = entries->models.find(cacheKey(lens, focalLength));
+    if (entry == entries->models.end()) {
+        return false;
+    }
+    model = entry->second;
+    return true;
+}
+
+void rpCAModelCache::clear()
+{
+    std::lock_guard<std::mutex> lock(entries->mutex);
+    entries->models.clear();
+}
+
+std::size_t rpCAModelCache::size() const
+{
+    std::lock_guard<std::mutex> lock(entries->mutex);
+    return entries->models.size();
+}
+
+// one line per entry: focal length in 0.1 mm, the model and the lens name, which is last because it may contain spaces
+std::string rpCAModelCache::serialize() const
+{
+    std::lock_guard<std::mutex> lock(entries->mutex);
+    std::ostringstream stream;
+    stream.imbue(std::locale::classic());
+    for (const auto &entry : entries->models) {
+        stream << entry.first.second << ' ';
+        writeModel(stream, entry.second);
+        stream << ' ' << entry.first.first << '\n';
+    }
+    return stream.str();
+}
+
+bool rpCAModelCache::deserialize(const std::string &text)
+{
+    std::istringstream lines(text);
+    lines.imbue(std::locale::classic());
+    std::string line;
+    bool ok = true;
+    while (std::getline(lines, line)) {
+        if (line.empty()) {
+            continue;
+        }
+        std::istringstream stream(line);
+        stream.imbue(std::locale::classic());
+        long focalLength;
+        rpCAModel model;
+        std::string lens;
+        if (!(stream >> focalLength) || !readModel(stream, model)) {
+            ok = false;
+            continue;
+        }
+        stream.get(); // the separating space
+        std::getline(stream, lens);
+        std::lock_guard<std::mutex> lock(entries->mutex);
+        entries->models[{lens, focalLength}] = model;
+    }
+    return ok;
+}